@@ -0,0 +1,454 @@
+// zpBench.cpp : benchmark of zpack core, linux only
+//
+#include "zpack.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+//same data for every run, so results of different versions can be compared
+const unsigned int DATA_SEED = 12345;
+const zp::u32 RANDOM_READ_SIZE = 0x1000;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct BenchConfig
+{
+	zp::u32	fileCount;
+	zp::u32	fileSize;
+};
+
+//total size of each config is about 64MB at scale 1
+const BenchConfig CONFIGS[] =
+{
+	{16384, 0x1000},
+	{1024, 0x10000},
+	{64, 0x100000},
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct BenchResult
+{
+	string		name;
+	zp::u32		fileCount;
+	zp::u32		fileSize;
+	bool		compress;
+	double		seconds;
+	zp::u64		operations;
+	zp::u64		bytes;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+double now()
+{
+	timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class Benchmark
+{
+public:
+	Benchmark(const string& workDir, double scale, zp::u32 repeat);
+
+	void run(const BenchConfig& config, bool compress);
+
+	bool writeJson(FILE* file) const;
+
+private:
+	void makeSourceFiles(const BenchConfig& config, bool compress);
+	void removeSourceFiles();
+
+	bool benchImport(const BenchConfig& config, bool compress);
+	void benchOpen(const BenchConfig& config, bool compress);
+	void benchLookup(const BenchConfig& config, bool compress);
+	void benchSequentialRead(const BenchConfig& config, bool compress);
+	void benchRandomRead(const BenchConfig& config, bool compress);
+	void benchExtract(const BenchConfig& config, bool compress);
+	void benchDefrag(const BenchConfig& config, bool compress);
+
+	void addResult(const char* name, const BenchConfig& config, bool compress, double seconds,
+					zp::u64 operations, zp::u64 bytes);
+
+	string getFilename(zp::u32 index) const;
+
+private:
+	string					m_workDir;
+	string					m_packagePath;
+	string					m_sourcePath;
+	double					m_scale;
+	zp::u32					m_repeat;
+	vector<string>			m_filenames;
+	vector<BenchResult>		m_results;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+Benchmark::Benchmark(const string& workDir, double scale, zp::u32 repeat)
+	: m_workDir(workDir)
+	, m_scale(scale)
+	, m_repeat(repeat)
+{
+	mkdir(m_workDir.c_str(), 0755);
+	m_packagePath = m_workDir + "/bench.zpk";
+	m_sourcePath = m_workDir + "/source";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Benchmark::run(const BenchConfig& config, bool compress)
+{
+	BenchConfig scaled = config;
+	scaled.fileCount = (zp::u32)(config.fileCount * m_scale);
+	if (scaled.fileCount == 0)
+	{
+		scaled.fileCount = 1;
+	}
+	fprintf(stderr, "%lu files of %lu bytes, %s\n", scaled.fileCount, scaled.fileSize,
+			compress ? "compressed" : "raw");
+	makeSourceFiles(scaled, compress);
+	if (benchImport(scaled, compress))
+	{
+		benchOpen(scaled, compress);
+		benchLookup(scaled, compress);
+		benchSequentialRead(scaled, compress);
+		benchRandomRead(scaled, compress);
+		benchExtract(scaled, compress);
+		benchDefrag(scaled, compress);
+	}
+	removeSourceFiles();
+	remove(m_packagePath.c_str());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Benchmark::makeSourceFiles(const BenchConfig& config, bool compress)
+{
+	static const char WORDS[] = "the quick brown fox jumps over lazy dog zpack package file chunk ";
+
+	mkdir(m_sourcePath.c_str(), 0755);
+	srand(DATA_SEED);
+	m_filenames.resize(config.fileCount);
+	vector<char> data(config.fileSize);
+	for (zp::u32 i = 0; i < config.fileCount; ++i)
+	{
+		m_filenames[i] = getFilename(i);
+		for (zp::u32 pos = 0; pos < config.fileSize; ++pos)
+		{
+			//text compresses to about 1/3, random bytes don't compress
+			data[pos] = compress ? WORDS[rand() % (sizeof(WORDS) - 1)] : (char)rand();
+		}
+		string path = m_sourcePath + "/" + m_filenames[i];
+		FILE* file = fopen(path.c_str(), "wb");
+		if (file != NULL)
+		{
+			fwrite(&data[0], config.fileSize, 1, file);
+			fclose(file);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Benchmark::removeSourceFiles()
+{
+	for (zp::u32 i = 0; i < m_filenames.size(); ++i)
+	{
+		remove((m_sourcePath + "/" + m_filenames[i]).c_str());
+	}
+	rmdir(m_sourcePath.c_str());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Benchmark::benchImport(const BenchConfig& config, bool compress)
+{
+	remove(m_packagePath.c_str());
+	double start = now();
+	zp::IPackage* pack = zp::create(m_packagePath.c_str());
+	if (pack == NULL)
+	{
+		fprintf(stderr, "can't create %s\n", m_packagePath.c_str());
+		return false;
+	}
+	zp::u32 flag = compress ? zp::FILE_COMPRESS : 0;
+	for (zp::u32 i = 0; i < config.fileCount; ++i)
+	{
+		string path = m_sourcePath + "/" + m_filenames[i];
+		pack->addFile(m_filenames[i].c_str(), path.c_str(), config.fileSize, flag);
+	}
+	double added = now();
+	pack->flush();
+	double flushed = now();
+	zp::close(pack);
+
+	zp::u64 totalSize = (zp::u64)config.fileCount * config.fileSize;
+	addResult("addFile", config, compress, added - start, config.fileCount, totalSize);
+	addResult("flush", config, compress, flushed - added, 1, 0);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Benchmark::benchOpen(const BenchConfig& config, bool compress)
+{
+	double start = now();
+	for (zp::u32 i = 0; i < m_repeat; ++i)
+	{
+		zp::IPackage* pack = zp::open(m_packagePath.c_str(), zp::OPEN_READONLY);
+		zp::close(pack);
+	}
+	addResult("open", config, compress, now() - start, m_repeat, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Benchmark::benchLookup(const BenchConfig& config, bool compress)
+{
+	zp::IPackage* pack = zp::open(m_packagePath.c_str(), zp::OPEN_READONLY);
+	const zp::u32 LOOKUP_COUNT = 1000000;
+	//half of names don't exist
+	vector<string> names(config.fileCount * 2);
+	for (zp::u32 i = 0; i < names.size(); ++i)
+	{
+		names[i] = (i < config.fileCount) ? m_filenames[i] : m_filenames[i - config.fileCount] + "_";
+	}
+	zp::u32 found = 0;
+	double start = now();
+	for (zp::u32 i = 0; i < LOOKUP_COUNT; ++i)
+	{
+		if (pack->hasFile(names[i % names.size()].c_str()))
+		{
+			++found;
+		}
+	}
+	addResult("hasFile", config, compress, now() - start, LOOKUP_COUNT, 0);
+	zp::close(pack);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Benchmark::benchSequentialRead(const BenchConfig& config, bool compress)
+{
+	zp::IPackage* pack = zp::open(m_packagePath.c_str(), zp::OPEN_READONLY);
+	vector<zp::u8> buffer(config.fileSize);
+	zp::u64 totalRead = 0;
+	double start = now();
+	for (zp::u32 i = 0; i < config.fileCount; ++i)
+	{
+		zp::IReadFile* file = pack->openFile(m_filenames[i].c_str());
+		if (file != NULL)
+		{
+			totalRead += file->read(&buffer[0], config.fileSize);
+			pack->closeFile(file);
+		}
+	}
+	addResult("sequentialRead", config, compress, now() - start, config.fileCount, totalRead);
+	zp::close(pack);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Benchmark::benchRandomRead(const BenchConfig& config, bool compress)
+{
+	zp::IPackage* pack = zp::open(m_packagePath.c_str(), zp::OPEN_READONLY);
+	zp::u32 readSize = (config.fileSize < RANDOM_READ_SIZE) ? config.fileSize : RANDOM_READ_SIZE;
+	zp::u32 readCount = config.fileCount * 4;
+	vector<zp::u8> buffer(readSize);
+	zp::u64 totalRead = 0;
+	srand(DATA_SEED);
+	double start = now();
+	for (zp::u32 i = 0; i < readCount; ++i)
+	{
+		zp::IReadFile* file = pack->openFile(m_filenames[rand() % config.fileCount].c_str());
+		if (file == NULL)
+		{
+			continue;
+		}
+		file->seek((zp::u32)(rand() % (config.fileSize - readSize + 1)));
+		totalRead += file->read(&buffer[0], readSize);
+		pack->closeFile(file);
+	}
+	addResult("randomRead", config, compress, now() - start, readCount, totalRead);
+	zp::close(pack);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Benchmark::benchExtract(const BenchConfig& config, bool compress)
+{
+	zp::IPackage* pack = zp::open(m_packagePath.c_str(), zp::OPEN_READONLY);
+	if (pack == NULL)
+	{
+		return;
+	}
+	pack->setThreadCount(0);
+	string extractPath = m_workDir + "/extract";
+	mkdir(extractPath.c_str(), 0755);
+	vector<string> externalNames(config.fileCount);
+	vector<zp::ExtractFileParam> params(config.fileCount);
+	for (zp::u32 i = 0; i < config.fileCount; ++i)
+	{
+		externalNames[i] = extractPath + "/" + m_filenames[i];
+		params[i].filename = m_filenames[i].c_str();
+		params[i].externalFilename = externalNames[i].c_str();
+	}
+	double start = now();
+	zp::u32 extracted = pack->extractFiles(&params[0], config.fileCount);
+	addResult("extractFiles", config, compress, now() - start, extracted, (zp::u64)extracted * config.fileSize);
+	zp::close(pack);
+	for (zp::u32 i = 0; i < config.fileCount; ++i)
+	{
+		remove(externalNames[i].c_str());
+	}
+	rmdir(extractPath.c_str());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Benchmark::benchDefrag(const BenchConfig& config, bool compress)
+{
+	zp::IPackage* pack = zp::open(m_packagePath.c_str(), 0);
+	if (pack == NULL)
+	{
+		return;
+	}
+	//remove half of files to make fragments
+	for (zp::u32 i = 0; i < config.fileCount; i += 2)
+	{
+		pack->removeFile(m_filenames[i].c_str());
+	}
+	pack->flush();
+	zp::u32 fileCount = pack->getFileCount();
+	zp::u64 totalSize = 0;
+	for (zp::u32 i = 0; i < fileCount; ++i)
+	{
+		zp::u32 packSize = 0;
+		pack->getFileInfo(i, NULL, 0, NULL, &packSize);
+		totalSize += packSize;
+	}
+	double start = now();
+	pack->defrag(NULL, NULL);
+	addResult("defrag", config, compress, now() - start, fileCount, totalSize);
+	zp::close(pack);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Benchmark::addResult(const char* name, const BenchConfig& config, bool compress, double seconds,
+							zp::u64 operations, zp::u64 bytes)
+{
+	BenchResult result;
+	result.name = name;
+	result.fileCount = config.fileCount;
+	result.fileSize = config.fileSize;
+	result.compress = compress;
+	result.seconds = seconds;
+	result.operations = operations;
+	result.bytes = bytes;
+	m_results.push_back(result);
+	fprintf(stderr, "  %-16s %10.3f ms", name, seconds * 1000);
+	if (seconds > 0 && operations > 1)
+	{
+		fprintf(stderr, " %12.0f ops/s", operations / seconds);
+	}
+	if (seconds > 0 && bytes > 0)
+	{
+		fprintf(stderr, " %10.1f MB/s", bytes / seconds / 0x100000);
+	}
+	fprintf(stderr, "\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Benchmark::writeJson(FILE* file) const
+{
+	fprintf(file, "{\n\t\"benchmark\": \"zpack\",\n\t\"scale\": %g,\n\t\"results\": [\n", m_scale);
+	for (zp::u32 i = 0; i < m_results.size(); ++i)
+	{
+		const BenchResult& result = m_results[i];
+		double opsPerSecond = (result.seconds > 0) ? result.operations / result.seconds : 0;
+		double mbPerSecond = (result.seconds > 0) ? result.bytes / result.seconds / 0x100000 : 0;
+		fprintf(file, "\t\t{\"name\": \"%s\", \"fileCount\": %lu, \"fileSize\": %lu, \"compress\": %s, "
+				"\"seconds\": %.6f, \"operations\": %llu, \"bytes\": %llu, \"opsPerSecond\": %.1f, "
+				"\"mbPerSecond\": %.2f}%s\n",
+				result.name.c_str(), result.fileCount, result.fileSize, result.compress ? "true" : "false",
+				result.seconds, result.operations, result.bytes, opsPerSecond, mbPerSecond,
+				(i + 1 < m_results.size()) ? "," : "");
+	}
+	fprintf(file, "\t]\n}\n");
+	return (ferror(file) == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+string Benchmark::getFilename(zp::u32 index) const
+{
+	char name[32];
+	sprintf(name, "file%06lu.dat", index);
+	return name;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void printUsage()
+{
+	fprintf(stderr, "usage: zpBench [-o result.json] [-d work dir] [-s scale] [-r repeat]\n");
+	fprintf(stderr, "    -o    write json result to file instead of stdout\n");
+	fprintf(stderr, "    -d    directory for temporary files, default /tmp/zpbench\n");
+	fprintf(stderr, "    -s    multiply file counts, default 1 (about 64MB per test)\n");
+	fprintf(stderr, "    -r    times to open package in open test, default 100\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+	string outputPath;
+	string workDir = "/tmp/zpbench";
+	double scale = 1;
+	zp::u32 repeat = 100;
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			printUsage();
+			return 1;
+		}
+		if (arg == "-o")
+		{
+			outputPath = argv[++i];
+		}
+		else if (arg == "-d")
+		{
+			workDir = argv[++i];
+		}
+		else if (arg == "-s")
+		{
+			scale = atof(argv[++i]);
+		}
+		else if (arg == "-r")
+		{
+			repeat = atoi(argv[++i]);
+		}
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	Benchmark benchmark(workDir, scale, repeat);
+	for (zp::u32 i = 0; i < sizeof(CONFIGS) / sizeof(CONFIGS[0]); ++i)
+	{
+		benchmark.run(CONFIGS[i], false);
+		benchmark.run(CONFIGS[i], true);
+	}
+
+	//output may be in work dir, which is then kept
+	FILE* output = outputPath.empty() ? stdout : fopen(outputPath.c_str(), "w");
+	if (output == NULL)
+	{
+		fprintf(stderr, "can't write %s\n", outputPath.c_str());
+		rmdir(workDir.c_str());
+		return 1;
+	}
+	bool succeeded = benchmark.writeJson(output);
+	if (output != stdout)
+	{
+		fclose(output);
+	}
+	rmdir(workDir.c_str());
+	return succeeded ? 0 : 1;
+}
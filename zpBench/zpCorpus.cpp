@@ -0,0 +1,409 @@
+#include "zpCorpus.h"
+#include "zlib.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <sys/stat.h>
+
+using namespace std;
+
+//pseudo words of text content, more frequent at front
+const zp::u32 WORD_COUNT = 1024;
+const zp::u32 BLOCK_SIZE = 0x100000;
+const zp::u32 PACKAGE_CHUNK_SIZE = 0x40000;
+const double PI = 3.14159265358979323846;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CorpusConfig::CorpusConfig()
+	: seed(1)
+	, fileCount(1000)
+	, medianSize(16384)
+	, sizeSigma(1.5)
+	, tailRatio(0.005)
+	, tailMinSize(0x1000000)
+	, tailMaxSize(0x10000000)
+	, maxDepth(4)
+	, filesPerDir(20)
+	, duplicateRatio(0.05)
+{
+	typeRatio[CONTENT_TEXT] = 0.4;
+	typeRatio[CONTENT_BINARY] = 0.3;
+	typeRatio[CONTENT_RANDOM] = 0.3;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+Random::Random(zp::u64 seed)
+	: m_state(seed * 0x9E3779B97F4A7C15ULL + 1)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+zp::u64 Random::next()
+{
+	m_state ^= m_state >> 12;
+	m_state ^= m_state << 25;
+	m_state ^= m_state >> 27;
+	return m_state * 0x2545F4914F6CDD1DULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+zp::u32 Random::nextInt(zp::u32 range)
+{
+	return (range == 0) ? 0 : (zp::u32)(next() % range);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+double Random::nextDouble()
+{
+	return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+double Random::nextNormal()
+{
+	//box-muller
+	double u1 = 1.0 - nextDouble();
+	double u2 = nextDouble();
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * PI * u2);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static const vector<string>& getWords()
+{
+	static vector<string> words;
+	if (words.empty())
+	{
+		//fixed seed, words are the same for all files
+		Random random(0x574F5244);
+		words.resize(WORD_COUNT);
+		for (zp::u32 i = 0; i < WORD_COUNT; ++i)
+		{
+			zp::u32 length = 2 + random.nextInt(9);
+			for (zp::u32 c = 0; c < length; ++c)
+			{
+				words[i] += (char)('a' + random.nextInt(26));
+			}
+		}
+	}
+	return words;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+ContentStream::ContentStream(const CorpusFile& file)
+	: m_random(file.contentSeed)
+	, m_type(file.type)
+	, m_recordPos(0)
+{
+	for (zp::u32 i = 0; i < sizeof(m_record); ++i)
+	{
+		m_record[i] = (zp::u8)m_random.next();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void ContentStream::read(zp::u8* buffer, zp::u32 size)
+{
+	if (m_type == CONTENT_TEXT)
+	{
+		readText(buffer, size);
+	}
+	else if (m_type == CONTENT_BINARY)
+	{
+		readBinary(buffer, size);
+	}
+	else
+	{
+		for (zp::u32 i = 0; i < size; ++i)
+		{
+			buffer[i] = (zp::u8)(m_random.next() >> 56);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void ContentStream::readText(zp::u8* buffer, zp::u32 size)
+{
+	const vector<string>& words = getWords();
+	zp::u32 pos = 0;
+	while (pos < size)
+	{
+		if (m_pending.empty())
+		{
+			//square of uniform value, a few words are used much more than others
+			double value = m_random.nextDouble();
+			m_pending = words[(zp::u32)(value * value * WORD_COUNT)];
+			m_pending += (m_random.nextInt(12) == 0) ? '\n' : ' ';
+		}
+		zp::u32 copySize = (zp::u32)m_pending.size();
+		if (copySize > size - pos)
+		{
+			copySize = size - pos;
+		}
+		memcpy(buffer + pos, m_pending.c_str(), copySize);
+		m_pending.erase(0, copySize);
+		pos += copySize;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void ContentStream::readBinary(zp::u8* buffer, zp::u32 size)
+{
+	for (zp::u32 i = 0; i < size; ++i)
+	{
+		if (m_recordPos == sizeof(m_record))
+		{
+			//next record: counter increases, a few fields change
+			m_recordPos = 0;
+			++m_record[0];
+			for (zp::u32 change = m_random.nextInt(4); change > 0; --change)
+			{
+				m_record[4 + m_random.nextInt(sizeof(m_record) - 4)] = (zp::u8)m_random.next();
+			}
+		}
+		buffer[i] = m_record[m_recordPos++];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+Corpus::Corpus(const CorpusConfig& config)
+	: m_config(config)
+{
+	generate();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const vector<CorpusFile>& Corpus::files() const
+{
+	return m_files;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+zp::u64 Corpus::totalSize() const
+{
+	zp::u64 total = 0;
+	for (zp::u32 i = 0; i < m_files.size(); ++i)
+	{
+		total += m_files[i].size;
+	}
+	return total;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Corpus::generate()
+{
+	Random random(m_config.seed);
+
+	//directory tree, each directory is under a random one of lower depth
+	vector<string> dirs(1, "");
+	vector<zp::u32> depths(1, 0);
+	zp::u32 dirCount = m_config.fileCount / (m_config.filesPerDir > 0 ? m_config.filesPerDir : 1) + 1;
+	for (zp::u32 i = 1; i < dirCount && m_config.maxDepth > 0; ++i)
+	{
+		zp::u32 parent = random.nextInt((zp::u32)dirs.size());
+		while (depths[parent] >= m_config.maxDepth)
+		{
+			parent = random.nextInt((zp::u32)dirs.size());
+		}
+		char name[32];
+		sprintf(name, "dir%04lu/", i);
+		dirs.push_back(dirs[parent] + name);
+		depths.push_back(depths[parent] + 1);
+	}
+
+	double typeTotal = 0;
+	for (zp::u32 i = 0; i < CONTENT_TYPE_COUNT; ++i)
+	{
+		typeTotal += m_config.typeRatio[i];
+	}
+	m_files.resize(m_config.fileCount);
+	for (zp::u32 i = 0; i < m_config.fileCount; ++i)
+	{
+		CorpusFile& file = m_files[i];
+		if (i > 0 && random.nextDouble() < m_config.duplicateRatio)
+		{
+			const CorpusFile& source = m_files[random.nextInt(i)];
+			file.size = source.size;
+			file.type = source.type;
+			file.contentSeed = source.contentSeed;
+		}
+		else
+		{
+			double size = 0;
+			if (random.nextDouble() < m_config.tailRatio)
+			{
+				//pareto, alpha = 1.2
+				size = m_config.tailMinSize / pow(1.0 - random.nextDouble(), 1.0 / 1.2);
+				if (size > m_config.tailMaxSize)
+				{
+					size = m_config.tailMaxSize;
+				}
+			}
+			else
+			{
+				size = m_config.medianSize * exp(m_config.sizeSigma * random.nextNormal());
+			}
+			file.size = (size < 1) ? 1 : (size > 0xFFFFFFFF ? 0xFFFFFFFF : (zp::u32)size);
+
+			double typeValue = random.nextDouble() * typeTotal;
+			file.type = 0;
+			while (file.type + 1 < CONTENT_TYPE_COUNT && typeValue >= m_config.typeRatio[file.type])
+			{
+				typeValue -= m_config.typeRatio[file.type];
+				++file.type;
+			}
+			file.contentSeed = random.next();
+		}
+		char name[32];
+		sprintf(name, "file%06lu", i);
+		file.path = dirs[random.nextInt((zp::u32)dirs.size())] + name + getExtension(file.type);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+string Corpus::getExtension(zp::u32 type) const
+{
+	static const char* const EXTENSIONS[CONTENT_TYPE_COUNT] = {".txt", ".bin", ".dat"};
+	return EXTENSIONS[type];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Corpus::writeDirectory(const string& root) const
+{
+	set<string> createdDirs;
+	mkdir(root.c_str(), 0755);
+	for (zp::u32 i = 0; i < m_files.size(); ++i)
+	{
+		const string& path = m_files[i].path;
+		for (size_t pos = path.find('/'); pos != string::npos; pos = path.find('/', pos + 1))
+		{
+			string dir = root + "/" + path.substr(0, pos);
+			if (createdDirs.insert(dir).second)
+			{
+				mkdir(dir.c_str(), 0755);
+			}
+		}
+		if (!writeFile(m_files[i], root + "/" + path))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Corpus::writeFile(const CorpusFile& file, const string& path) const
+{
+	FILE* stream = fopen(path.c_str(), "wb");
+	if (stream == NULL)
+	{
+		fprintf(stderr, "can't write %s\n", path.c_str());
+		return false;
+	}
+	ContentStream content(file);
+	vector<zp::u8> buffer(file.size < BLOCK_SIZE ? file.size : BLOCK_SIZE);
+	for (zp::u32 written = 0; written < file.size;)
+	{
+		zp::u32 blockSize = (file.size - written < BLOCK_SIZE) ? file.size - written : BLOCK_SIZE;
+		content.read(&buffer[0], blockSize);
+		fwrite(&buffer[0], blockSize, 1, stream);
+		written += blockSize;
+	}
+	bool succeeded = (ferror(stream) == 0);
+	fclose(stream);
+	return succeeded;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Corpus::writePackage(const string& packagePath, bool compress, const string& tempPath) const
+{
+	zp::IPackage* pack = zp::create(packagePath.c_str(), PACKAGE_CHUNK_SIZE);
+	if (pack == NULL)
+	{
+		return false;
+	}
+	bool succeeded = true;
+	for (zp::u32 i = 0; i < m_files.size() && succeeded; ++i)
+	{
+		const CorpusFile& file = m_files[i];
+		succeeded = writeFile(file, tempPath)
+					&& pack->addFile(file.path.c_str(), tempPath.c_str(), file.size, compress ? zp::FILE_COMPRESS : 0);
+	}
+	remove(tempPath.c_str());
+	zp::close(pack);
+	return succeeded;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Corpus::writePackageFast(const string& packagePath, bool compress) const
+{
+	zp::IPackage* pack = zp::create(packagePath.c_str(), PACKAGE_CHUNK_SIZE);
+	if (pack == NULL)
+	{
+		return false;
+	}
+	bool succeeded = true;
+	vector<zp::u8> data;
+	vector<zp::u8> packData;
+	for (zp::u32 i = 0; i < m_files.size() && succeeded; ++i)
+	{
+		const CorpusFile& file = m_files[i];
+		data.resize(file.size);
+		ContentStream content(file);
+		content.read(&data[0], file.size);
+		zp::u32 flag = 0;
+		const vector<zp::u8>* writeData = &data;
+		if (compress)
+		{
+			compressData(data, PACKAGE_CHUNK_SIZE, packData);
+			//file of one chunk is not compressed if it doesn't get smaller
+			if (file.size > PACKAGE_CHUNK_SIZE || packData.size() < file.size)
+			{
+				flag = zp::FILE_COMPRESS;
+				writeData = &packData;
+			}
+		}
+		zp::u32 packSize = (zp::u32)writeData->size();
+		zp::IWriteFile* writeFile = pack->createFile(file.path.c_str(), file.size, packSize, PACKAGE_CHUNK_SIZE, flag);
+		if (writeFile == NULL)
+		{
+			succeeded = false;
+			break;
+		}
+		succeeded = (writeFile->write(&(*writeData)[0], packSize) == packSize);
+		pack->closeFile(writeFile);
+	}
+	zp::close(pack);
+	return succeeded;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Corpus::compressData(const vector<zp::u8>& src, zp::u32 chunkSize, vector<zp::u8>& dst) const
+{
+	zp::u32 srcSize = (zp::u32)src.size();
+	zp::u32 chunkCount = (srcSize + chunkSize - 1) / chunkSize;
+	zp::u32 tableSize = (chunkCount > 1) ? chunkCount * sizeof(zp::u32) : 0;
+	vector<zp::u8> compressBuffer(chunkSize);
+	dst.resize(tableSize);
+	for (zp::u32 i = 0; i < chunkCount; ++i)
+	{
+		zp::u32 chunkPos = (zp::u32)dst.size();
+		if (chunkCount > 1)
+		{
+			memcpy(&dst[i * sizeof(zp::u32)], &chunkPos, sizeof(zp::u32));
+		}
+		zp::u32 curChunkSize = (i + 1 < chunkCount) ? chunkSize : srcSize - i * chunkSize;
+		const zp::u8* chunkData = &src[i * chunkSize];
+		uLongf dstSize = chunkSize;
+		//chunk is stored as it is if it doesn't get smaller
+		if (compress2(&compressBuffer[0], &dstSize, chunkData, curChunkSize, Z_DEFAULT_COMPRESSION) == Z_OK
+			&& dstSize < curChunkSize)
+		{
+			dst.insert(dst.end(), compressBuffer.begin(), compressBuffer.begin() + dstSize);
+		}
+		else
+		{
+			dst.insert(dst.end(), chunkData, chunkData + curChunkSize);
+		}
+	}
+}
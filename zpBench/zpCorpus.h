@@ -0,0 +1,110 @@
+#ifndef __ZP_CORPUS_H__
+#define __ZP_CORPUS_H__
+
+#include "zpack.h"
+#include <string>
+#include <vector>
+
+//content types, decide how well a file compresses
+const zp::u32 CONTENT_TEXT = 0;		//words, about 1/2 after zlib
+const zp::u32 CONTENT_BINARY = 1;	//records with small changes, about 1/5 after zlib
+const zp::u32 CONTENT_RANDOM = 2;	//not compressible
+const zp::u32 CONTENT_TYPE_COUNT = 3;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//same config and seed always generate the same files
+struct CorpusConfig
+{
+	zp::u64		seed;
+	zp::u32		fileCount;
+	double		medianSize;			//log-normal size of normal files
+	double		sizeSigma;
+	double		tailRatio;			//files with huge size (pareto distribution)
+	zp::u32		tailMinSize;
+	zp::u32		tailMaxSize;
+	double		typeRatio[CONTENT_TYPE_COUNT];
+	zp::u32		maxDepth;			//depth of directories
+	zp::u32		filesPerDir;		//average
+	double		duplicateRatio;		//files with same content as an earlier file
+
+	CorpusConfig();
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct CorpusFile
+{
+	std::string	path;			//relative, '/' separated
+	zp::u32		size;
+	zp::u32		type;
+	zp::u64		contentSeed;	//same seed and size means same content
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//xorshift64*, same sequence on every platform
+class Random
+{
+public:
+	Random(zp::u64 seed);
+
+	zp::u64 next();
+	zp::u32 nextInt(zp::u32 range);
+	double nextDouble();	//[0, 1)
+	double nextNormal();
+
+private:
+	zp::u64	m_state;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//content of a file, generated block by block
+class ContentStream
+{
+public:
+	ContentStream(const CorpusFile& file);
+
+	void read(zp::u8* buffer, zp::u32 size);
+
+private:
+	void readText(zp::u8* buffer, zp::u32 size);
+	void readBinary(zp::u8* buffer, zp::u32 size);
+
+private:
+	Random		m_random;
+	zp::u32		m_type;
+	std::string	m_pending;		//text of last word not returned yet
+	zp::u8		m_record[32];	//current record of binary content
+	zp::u32		m_recordPos;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class Corpus
+{
+public:
+	Corpus(const CorpusConfig& config);
+
+	const std::vector<CorpusFile>& files() const;
+	zp::u64 totalSize() const;
+
+	//directory tree on disk
+	bool writeDirectory(const std::string& root) const;
+
+	//package built by zp::create() and addFile(), through a temp file for each file
+	bool writePackage(const std::string& packagePath, bool compress, const std::string& tempPath) const;
+
+	//package written by createFile() from memory, compressed here, much faster than addFile()
+	bool writePackageFast(const std::string& packagePath, bool compress) const;
+
+private:
+	void generate();
+	std::string getExtension(zp::u32 type) const;
+	bool writeFile(const CorpusFile& file, const std::string& path) const;
+
+	//same layout as Package writes, chunk position array followed by chunks
+	void compressData(const std::vector<zp::u8>& src, zp::u32 chunkSize, std::vector<zp::u8>& dst) const;
+
+private:
+	CorpusConfig			m_config;
+	std::vector<CorpusFile>	m_files;
+};
+
+#endif
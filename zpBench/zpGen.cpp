@@ -0,0 +1,158 @@
+// zpGen.cpp : generate synthetic corpus for benchmark, linux only
+//
+#include "zpCorpus.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void printUsage()
+{
+	fprintf(stderr, "usage: zpGen [options] <dir|package|fast> <output>\n");
+	fprintf(stderr, "    dir       write files into output directory\n");
+	fprintf(stderr, "    package   build package by addFile()\n");
+	fprintf(stderr, "    fast      build package by createFile(), compressed in memory\n");
+	fprintf(stderr, "options:\n");
+	fprintf(stderr, "    -seed n       random seed, default 1\n");
+	fprintf(stderr, "    -count n      file count, default 1000\n");
+	fprintf(stderr, "    -median n     median file size, default 16384\n");
+	fprintf(stderr, "    -sigma x      sigma of log-normal size, default 1.5\n");
+	fprintf(stderr, "    -tail x       ratio of huge files, default 0.005\n");
+	fprintf(stderr, "    -tailmin n    min size of huge files, default 16MB\n");
+	fprintf(stderr, "    -tailmax n    max size of huge files, default 256MB\n");
+	fprintf(stderr, "    -types t,b,r  ratio of text, binary and random files, default 0.4,0.3,0.3\n");
+	fprintf(stderr, "    -depth n      max directory depth, default 4\n");
+	fprintf(stderr, "    -perdir n     average files per directory, default 20\n");
+	fprintf(stderr, "    -dup x        ratio of duplicated files, default 0.05\n");
+	fprintf(stderr, "    -nocompress   don't compress files in package\n");
+	fprintf(stderr, "    -list         print generated files\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+	CorpusConfig config;
+	bool compress = true;
+	bool list = false;
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; ++i)
+	{
+		string arg = argv[i];
+		if (arg == "-nocompress")
+		{
+			compress = false;
+			continue;
+		}
+		else if (arg == "-list")
+		{
+			list = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			printUsage();
+			return 1;
+		}
+		const char* value = argv[++i];
+		if (arg == "-seed")
+		{
+			config.seed = strtoull(value, NULL, 0);
+		}
+		else if (arg == "-count")
+		{
+			config.fileCount = strtoul(value, NULL, 0);
+		}
+		else if (arg == "-median")
+		{
+			config.medianSize = atof(value);
+		}
+		else if (arg == "-sigma")
+		{
+			config.sizeSigma = atof(value);
+		}
+		else if (arg == "-tail")
+		{
+			config.tailRatio = atof(value);
+		}
+		else if (arg == "-tailmin")
+		{
+			config.tailMinSize = strtoul(value, NULL, 0);
+		}
+		else if (arg == "-tailmax")
+		{
+			config.tailMaxSize = strtoul(value, NULL, 0);
+		}
+		else if (arg == "-types")
+		{
+			if (sscanf(value, "%lf,%lf,%lf", &config.typeRatio[CONTENT_TEXT],
+				&config.typeRatio[CONTENT_BINARY], &config.typeRatio[CONTENT_RANDOM]) != 3)
+			{
+				printUsage();
+				return 1;
+			}
+		}
+		else if (arg == "-depth")
+		{
+			config.maxDepth = strtoul(value, NULL, 0);
+		}
+		else if (arg == "-perdir")
+		{
+			config.filesPerDir = strtoul(value, NULL, 0);
+		}
+		else if (arg == "-dup")
+		{
+			config.duplicateRatio = atof(value);
+		}
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+	if (i + 2 != argc)
+	{
+		printUsage();
+		return 1;
+	}
+	string mode = argv[i];
+	string output = argv[i + 1];
+
+	Corpus corpus(config);
+	const vector<CorpusFile>& files = corpus.files();
+	if (list)
+	{
+		for (zp::u32 f = 0; f < files.size(); ++f)
+		{
+			printf("%s %lu\n", files[f].path.c_str(), files[f].size);
+		}
+	}
+	fprintf(stderr, "%lu files, %llu bytes\n", (zp::u32)files.size(), corpus.totalSize());
+
+	bool succeeded = false;
+	if (mode == "dir")
+	{
+		succeeded = corpus.writeDirectory(output);
+	}
+	else if (mode == "package")
+	{
+		succeeded = corpus.writePackage(output, compress, output + ".tmp");
+	}
+	else if (mode == "fast")
+	{
+		succeeded = corpus.writePackageFast(output, compress);
+	}
+	else
+	{
+		printUsage();
+		return 1;
+	}
+	if (!succeeded)
+	{
+		fprintf(stderr, "failed to write %s\n", output.c_str());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,482 @@
+// zpReplay.cpp : replay access trace recorded by IPackage::startTrace(), linux only
+//
+#include "zpack.h"
+#include "zpPlatform.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+//operations measured by replay
+const zp::u32 REPLAY_OPEN = 0;
+const zp::u32 REPLAY_READ = 1;
+const zp::u32 REPLAY_CLOSE = 2;
+const zp::u32 REPLAY_OP_COUNT = 3;
+
+const char* const REPLAY_OP_NAMES[REPLAY_OP_COUNT] = {"open", "read", "close"};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct ReplayOp
+{
+	zp::u64	time;		//microseconds since trace started
+	zp::u32	type;		//REPLAY_XXX
+	zp::u32	fileIndex;	//index of filename
+	zp::u32	offset;
+	zp::u32	size;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//operations of one recorded thread, replayed in order by one thread
+struct ReplayStream
+{
+	vector<ReplayOp>	ops;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct ReplayResult
+{
+	zp::LatencyHistogram	histograms[REPLAY_OP_COUNT];
+	zp::u64					readSize;
+	zp::u64					failedCount;	//file not found or read returned less than recorded
+
+	ReplayResult();
+	void merge(const ReplayResult& other);
+};
+
+class Replay;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct ReplayWorker
+{
+	Replay*			replay;
+	zp::IPackage*	package;
+	ReplayResult	result;
+	zp::Thread		thread;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class Replay
+{
+public:
+	Replay();
+
+	bool load(const string& tracePath);
+	//package is opened with OPEN_WARM_UP if warmUp is true
+	bool run(const string& packagePath, zp::u32 threadCount, double speed, bool coldCache, bool warmUp);
+	void printResult() const;
+
+	zp::u32 streamCount() const;
+	zp::u32 opCount() const;
+
+private:
+	static bool onTraceEvent(const zp::TraceEvent& event, const zp::Char* filename, void* param);
+	static void workerEntry(void* param);
+
+	void replayStream(zp::IPackage* package, const ReplayStream& stream, ReplayResult& result,
+					vector<zp::u8>& buffer);
+	void waitUntil(zp::u64 traceTime) const;
+	bool dropCache(const string& packagePath) const;
+
+private:
+	vector<string>			m_filenames;
+	map<zp::u64, zp::u32>	m_fileIndices;		//name hash to index of filename
+	vector<ReplayStream>	m_streams;
+	map<zp::u32, zp::u32>	m_streamIndices;	//recorded thread id to stream
+	zp::u32					m_opCount;
+	zp::u32					m_maxReadSize;
+	zp::u64					m_firstTime;
+
+	//state of current run
+	double					m_speed;			//0 for no waiting
+	zp::u64					m_startTime;
+	volatile zp::u64		m_nextStream;
+	zp::u64					m_elapsed;
+	ReplayResult			m_result;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+ReplayResult::ReplayResult()
+	: readSize(0)
+	, failedCount(0)
+{
+	memset(histograms, 0, sizeof(histograms));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void ReplayResult::merge(const ReplayResult& other)
+{
+	for (zp::u32 op = 0; op < REPLAY_OP_COUNT; ++op)
+	{
+		histograms[op].count += other.histograms[op].count;
+		histograms[op].totalTime += other.histograms[op].totalTime;
+		for (zp::u32 i = 0; i < zp::HISTOGRAM_BUCKET_COUNT; ++i)
+		{
+			histograms[op].buckets[i] += other.histograms[op].buckets[i];
+		}
+	}
+	readSize += other.readSize;
+	failedCount += other.failedCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+Replay::Replay()
+	: m_opCount(0)
+	, m_maxReadSize(0)
+	, m_firstTime(0)
+	, m_speed(0)
+	, m_startTime(0)
+	, m_nextStream(0)
+	, m_elapsed(0)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Replay::load(const string& tracePath)
+{
+	if (!zp::readTrace(tracePath.c_str(), onTraceEvent, this))
+	{
+		return false;
+	}
+	return !m_streams.empty();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Replay::onTraceEvent(const zp::TraceEvent& event, const zp::Char* filename, void* param)
+{
+	Replay* replay = (Replay*)param;
+	ReplayOp op;
+	if (event.type == zp::TRACE_OPEN)
+	{
+		op.type = REPLAY_OPEN;
+	}
+	else if (event.type == zp::TRACE_READ)
+	{
+		op.type = REPLAY_READ;
+	}
+	else if (event.type == zp::TRACE_CLOSE)
+	{
+		op.type = REPLAY_CLOSE;
+	}
+	else
+	{
+		//cache events are results of reading, timing events are measured again
+		return true;
+	}
+	if (filename == NULL)
+	{
+		//file opened before trace started, can't be replayed
+		return true;
+	}
+	map<zp::u64, zp::u32>::iterator found = replay->m_fileIndices.find(event.nameHash);
+	if (found == replay->m_fileIndices.end())
+	{
+		found = replay->m_fileIndices.insert(make_pair(event.nameHash, (zp::u32)replay->m_filenames.size())).first;
+		replay->m_filenames.push_back(filename);
+	}
+	map<zp::u32, zp::u32>::iterator stream = replay->m_streamIndices.find(event.threadId);
+	if (stream == replay->m_streamIndices.end())
+	{
+		stream = replay->m_streamIndices.insert(make_pair(event.threadId, (zp::u32)replay->m_streams.size())).first;
+		replay->m_streams.push_back(ReplayStream());
+	}
+	if (replay->m_opCount++ == 0)
+	{
+		replay->m_firstTime = event.time;
+	}
+	op.time = event.time;
+	op.fileIndex = found->second;
+	op.offset = event.offset;
+	op.size = event.size;
+	replay->m_streams[stream->second].ops.push_back(op);
+	if (op.type == REPLAY_READ && op.size > replay->m_maxReadSize)
+	{
+		replay->m_maxReadSize = op.size;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+zp::u32 Replay::streamCount() const
+{
+	return (zp::u32)m_streams.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+zp::u32 Replay::opCount() const
+{
+	return m_opCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Replay::dropCache(const string& packagePath) const
+{
+	int fd = open(packagePath.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	//dirty pages are not dropped, package is expected to be flushed already
+	fdatasync(fd);
+	bool succeeded = (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+	close(fd);
+	return succeeded;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Replay::run(const string& packagePath, zp::u32 threadCount, double speed, bool coldCache, bool warmUp)
+{
+	if (coldCache && !dropCache(packagePath))
+	{
+		fprintf(stderr, "can't drop page cache of %s\n", packagePath.c_str());
+		return false;
+	}
+	m_speed = speed;
+	m_nextStream = 0;
+	m_result = ReplayResult();
+
+	//thread can't be copied, so no vector here
+	ReplayWorker* workers = new ReplayWorker[threadCount];
+	//package is only thread safe with _ZP_WIN32_THREAD_SAFE, each thread opens its own
+	bool succeeded = true;
+	for (zp::u32 i = 0; i < threadCount; ++i)
+	{
+		workers[i].replay = this;
+		workers[i].package = zp::open(packagePath.c_str(), zp::OPEN_READONLY | (warmUp ? zp::OPEN_WARM_UP : 0));
+		if (workers[i].package == NULL)
+		{
+			fprintf(stderr, "can't open %s\n", packagePath.c_str());
+			succeeded = false;
+		}
+	}
+	if (succeeded)
+	{
+		m_startTime = zp::getMicroseconds();
+		for (zp::u32 i = 0; i < threadCount; ++i)
+		{
+			workers[i].thread.start(workerEntry, &workers[i]);
+		}
+		for (zp::u32 i = 0; i < threadCount; ++i)
+		{
+			workers[i].thread.join();
+			m_result.merge(workers[i].result);
+		}
+		m_elapsed = zp::getMicroseconds() - m_startTime;
+	}
+	for (zp::u32 i = 0; i < threadCount; ++i)
+	{
+		if (workers[i].package != NULL)
+		{
+			zp::close(workers[i].package);
+		}
+	}
+	delete[] workers;
+	return succeeded;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Replay::workerEntry(void* param)
+{
+	ReplayWorker* worker = (ReplayWorker*)param;
+	Replay* replay = worker->replay;
+	vector<zp::u8> buffer(replay->m_maxReadSize > 0 ? replay->m_maxReadSize : 1);
+	while (true)
+	{
+		//streams are taken one by one, so threads stay busy when streams have different length
+		zp::u64 index = zp::atomicAdd(&replay->m_nextStream, 1) - 1;
+		if (index >= replay->m_streams.size())
+		{
+			break;
+		}
+		replay->replayStream(worker->package, replay->m_streams[(size_t)index], worker->result, buffer);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Replay::replayStream(zp::IPackage* package, const ReplayStream& stream, ReplayResult& result,
+							vector<zp::u8>& buffer)
+{
+	//a file may be opened again before closed, recorded events refer to the last one
+	map<zp::u32, vector<zp::IReadFile*> > openedFiles;
+	for (zp::u32 i = 0; i < stream.ops.size(); ++i)
+	{
+		const ReplayOp& op = stream.ops[i];
+		if (m_speed > 0)
+		{
+			waitUntil(op.time);
+		}
+		vector<zp::IReadFile*>& files = openedFiles[op.fileIndex];
+		if (op.type != REPLAY_OPEN && files.empty())
+		{
+			//open failed when replaying
+			continue;
+		}
+		zp::u64 startTime = zp::getMicroseconds();
+		if (op.type == REPLAY_OPEN)
+		{
+			zp::IReadFile* file = package->openFile(m_filenames[op.fileIndex].c_str());
+			if (file == NULL)
+			{
+				++result.failedCount;
+				continue;
+			}
+			files.push_back(file);
+		}
+		else if (op.type == REPLAY_READ)
+		{
+			zp::IReadFile* file = files.back();
+			file->seek(op.offset);
+			zp::u32 readSize = file->read(&buffer[0], op.size);
+			result.readSize += readSize;
+			if (readSize != op.size)
+			{
+				++result.failedCount;
+			}
+		}
+		else
+		{
+			package->closeFile(files.back());
+			files.pop_back();
+		}
+		zp::u64 time = zp::getMicroseconds() - startTime;
+		zp::LatencyHistogram& histogram = result.histograms[op.type];
+		++histogram.count;
+		histogram.totalTime += time;
+		++histogram.buckets[zp::getHistogramBucket(time)];
+	}
+	//trace stopped before these were closed
+	for (map<zp::u32, vector<zp::IReadFile*> >::iterator iter = openedFiles.begin(); iter != openedFiles.end(); ++iter)
+	{
+		for (zp::u32 i = 0; i < iter->second.size(); ++i)
+		{
+			package->closeFile(iter->second[i]);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Replay::waitUntil(zp::u64 traceTime) const
+{
+	zp::u64 target = m_startTime + (zp::u64)((traceTime - m_firstTime) / m_speed);
+	zp::u64 now = zp::getMicroseconds();
+	if (target > now)
+	{
+		usleep((useconds_t)(target - now));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Replay::printResult() const
+{
+	double seconds = m_elapsed / 1000000.0;
+	zp::u64 opTotal = 0;
+	for (zp::u32 op = 0; op < REPLAY_OP_COUNT; ++op)
+	{
+		opTotal += m_result.histograms[op].count;
+	}
+	printf("  elapsed %.3f ms, %.0f ops/s, %.1f MB/s, %llu failed\n", seconds * 1000,
+		seconds > 0 ? opTotal / seconds : 0, seconds > 0 ? m_result.readSize / seconds / 0x100000 : 0,
+		m_result.failedCount);
+	printf("  %-6s %10s %10s %10s %10s %10s %10s\n", "op", "count", "avg(us)", "p50", "p90", "p99", "p99.9");
+	for (zp::u32 op = 0; op < REPLAY_OP_COUNT; ++op)
+	{
+		const zp::LatencyHistogram& histogram = m_result.histograms[op];
+		if (histogram.count == 0)
+		{
+			continue;
+		}
+		printf("  %-6s %10llu %10.1f %10llu %10llu %10llu %10llu\n", REPLAY_OP_NAMES[op], histogram.count,
+			(double)histogram.totalTime / histogram.count,
+			zp::getHistogramPercentile(histogram, 50), zp::getHistogramPercentile(histogram, 90),
+			zp::getHistogramPercentile(histogram, 99), zp::getHistogramPercentile(histogram, 99.9));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void printUsage()
+{
+	fprintf(stderr, "usage: zpReplay [-t threads] [-s speed] [-r repeat] [-c] [-w] <trace file> <package>\n");
+	fprintf(stderr, "    -t    replay threads, default 1, recorded threads are shared among them\n");
+	fprintf(stderr, "    -s    follow recorded timing at this speed (2 is twice as fast), default 0 for no waiting\n");
+	fprintf(stderr, "    -r    times to replay, default 1\n");
+	fprintf(stderr, "    -c    drop page cache of package before each replay (posix_fadvise)\n");
+	fprintf(stderr, "    -w    warm up warm set of package when it's opened, replay starts right after\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+	zp::u32 threadCount = 1;
+	double speed = 0;
+	zp::u32 repeat = 1;
+	bool coldCache = false;
+	bool warmUp = false;
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; ++i)
+	{
+		string arg = argv[i];
+		if (arg == "-c")
+		{
+			coldCache = true;
+			continue;
+		}
+		if (arg == "-w")
+		{
+			warmUp = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			printUsage();
+			return 1;
+		}
+		if (arg == "-t")
+		{
+			threadCount = atoi(argv[++i]);
+		}
+		else if (arg == "-s")
+		{
+			speed = atof(argv[++i]);
+		}
+		else if (arg == "-r")
+		{
+			repeat = atoi(argv[++i]);
+		}
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+	if (i + 2 != argc || threadCount == 0)
+	{
+		printUsage();
+		return 1;
+	}
+	string tracePath = argv[i];
+	string packagePath = argv[i + 1];
+
+	Replay replay;
+	if (!replay.load(tracePath))
+	{
+		fprintf(stderr, "can't read trace %s\n", tracePath.c_str());
+		return 1;
+	}
+	fprintf(stderr, "%lu operations of %lu recorded threads, %lu replay threads, %s cache\n",
+		replay.opCount(), replay.streamCount(), threadCount, coldCache ? "cold" : "warm");
+	for (zp::u32 r = 0; r < repeat; ++r)
+	{
+		if (!replay.run(packagePath, threadCount, speed, coldCache, warmUp))
+		{
+			return 1;
+		}
+		printf("run %lu\n", r + 1);
+		replay.printResult();
+	}
+	return 0;
+}
@@ -0,0 +1,613 @@
+// zpTest.cpp : regression tests of package, linux only
+//
+#include "zpack.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//content of file is decided by its index and size
+void makeContent(zp::u32 index, zp::u32 size, vector<zp::u8>& content)
+{
+	content.resize(size);
+	for (zp::u32 i = 0; i < size; ++i)
+	{
+		content[i] = (zp::u8)(index * 31 + i * 7);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool writeExternalFile(const string& path, const vector<zp::u8>& content)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == NULL)
+	{
+		return false;
+	}
+	bool ok = content.empty() || fwrite(&content[0], content.size(), 1, file) == 1;
+	fclose(file);
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool checkFile(zp::IPackage* pack, const string& filename, const vector<zp::u8>& content)
+{
+	zp::IReadFile* file = pack->openFile(filename.c_str());
+	if (file == NULL)
+	{
+		fprintf(stderr, "  %s not found\n", filename.c_str());
+		return false;
+	}
+	vector<zp::u8> data(file->size() + 1);
+	zp::u32 readSize = file->read(&data[0], data.size());
+	pack->closeFile(file);
+	if (readSize != content.size() || (readSize > 0 && memcmp(&data[0], &content[0], readSize) != 0))
+	{
+		fprintf(stderr, "  %s content is wrong\n", filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool addContent(zp::IPackage* pack, const string& filename, const vector<zp::u8>& content,
+				const string& externalPath, zp::u32 flag)
+{
+	if (!writeExternalFile(externalPath, content))
+	{
+		return false;
+	}
+	if (!pack->addFile(filename.c_str(), externalPath.c_str(), content.size(), flag))
+	{
+		fprintf(stderr, "  failed to add %s\n", filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool checkFiles(zp::IPackage* pack, const vector<string>& filenames, const vector<vector<zp::u8> >& contents)
+{
+	bool ok = true;
+	for (zp::u32 i = 0; i < filenames.size(); ++i)
+	{
+		ok = checkFile(pack, filenames[i], contents[i]) && ok;
+	}
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//copies of one file are added while hash table grows, discarded data leaves entries of the same name
+bool testDuplicateAtTableGrowth(const string& workDir)
+{
+	const zp::u32 FILE_COUNT = 150;
+	string packagePath = workDir + "/dup.zpk";
+	string externalPath = workDir + "/external";
+	zp::IPackage* pack = zp::create(packagePath.c_str());
+	if (pack == NULL)
+	{
+		return false;
+	}
+	vector<string> filenames;
+	vector<vector<zp::u8> > contents;
+	bool ok = true;
+	for (zp::u32 i = 0; i < FILE_COUNT && ok; ++i)
+	{
+		char filename[64];
+		sprintf(filename, "unique/%03u.bin", (unsigned)i);
+		filenames.push_back(filename);
+		contents.push_back(vector<zp::u8>());
+		makeContent(i, 1000 + i, contents.back());
+		ok = addContent(pack, filenames.back(), contents.back(), externalPath, (i % 2 == 0) ? zp::FILE_COMPRESS : 0);
+
+		sprintf(filename, "copy/%03u.bin", (unsigned)i);
+		filenames.push_back(filename);
+		contents.push_back(contents[0]);
+		ok = ok && addContent(pack, filenames.back(), contents.back(), externalPath, zp::FILE_COMPRESS);
+		if (i % 50 == 49)
+		{
+			pack->flush();
+		}
+	}
+	unlink(externalPath.c_str());
+	ok = ok && checkFiles(pack, filenames, contents);
+	zp::close(pack);
+
+	pack = zp::open(packagePath.c_str(), zp::OPEN_READONLY);
+	ok = ok && pack != NULL && checkFiles(pack, filenames, contents);
+	zp::close(pack);
+	unlink(packagePath.c_str());
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//existing files are replaced by content of another one while hash table grows
+bool testReplaceWithDuplicate(const string& workDir)
+{
+	const zp::u32 FILE_COUNT = 150;
+	string packagePath = workDir + "/replace.zpk";
+	string externalPath = workDir + "/external";
+	zp::IPackage* pack = zp::create(packagePath.c_str());
+	if (pack == NULL)
+	{
+		return false;
+	}
+	vector<string> filenames;
+	vector<vector<zp::u8> > contents;
+	bool ok = true;
+	for (zp::u32 i = 0; i < FILE_COUNT && ok; ++i)
+	{
+		char filename[64];
+		sprintf(filename, "file/%03u.bin", (unsigned)i);
+		filenames.push_back(filename);
+		contents.push_back(vector<zp::u8>());
+		makeContent(i, 1000 + i, contents.back());
+		ok = addContent(pack, filenames.back(), contents.back(), externalPath, (i % 2 == 0) ? zp::FILE_COMPRESS : 0);
+
+		//replaced by content of the first file, which may be the file itself
+		zp::u32 replaced = i / 2;
+		contents[replaced] = contents[0];
+		ok = ok && addContent(pack, filenames[replaced], contents[replaced], externalPath, zp::FILE_COMPRESS);
+		if (i % 50 == 49)
+		{
+			pack->flush();
+		}
+	}
+	unlink(externalPath.c_str());
+	ok = ok && checkFiles(pack, filenames, contents);
+	zp::close(pack);
+
+	pack = zp::open(packagePath.c_str(), zp::OPEN_READONLY);
+	ok = ok && pack != NULL && checkFiles(pack, filenames, contents);
+	zp::close(pack);
+	unlink(packagePath.c_str());
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//package in memory, a copy of it is opened and checked after each write as if writing stopped there
+class SnapshotStorage : public zp::IStorage
+{
+public:
+	SnapshotStorage()
+		: m_storage(zp::createMemoryStorage(NULL, 0, false))
+		, m_filenames(NULL)
+		, m_contents(NULL)
+		, m_badCount(0)
+		, m_writtenSize(0)
+	{
+	}
+	virtual ~SnapshotStorage()
+	{
+		zp::destroyStorage(m_storage);
+	}
+
+	//files to check, NULL to stop checking
+	void check(const vector<string>* filenames, const vector<vector<zp::u8> >* contents)
+	{
+		m_filenames = filenames;
+		m_contents = contents;
+	}
+	zp::u32 badCount() const {return m_badCount;}
+	zp::u64 writtenSize() const {return m_writtenSize;}
+
+	virtual bool readonly() const {return false;}
+	virtual zp::u64 size() const {return m_storage->size();}
+	virtual zp::u32 read(zp::u64 offset, void* buffer, zp::u32 size) {return m_storage->read(offset, buffer, size);}
+	virtual zp::u32 write(zp::u64 offset, const void* buffer, zp::u32 size)
+	{
+		zp::u32 written = m_storage->write(offset, buffer, size);
+		m_writtenSize += written;
+		checkSnapshot();
+		return written;
+	}
+	virtual bool setSize(zp::u64 size)
+	{
+		bool ret = m_storage->setSize(size);
+		checkSnapshot();
+		return ret;
+	}
+	virtual bool sync() {return true;}
+	virtual const zp::u8* map() {return NULL;}
+
+private:
+	void checkSnapshot()
+	{
+		if (m_filenames == NULL)
+		{
+			return;
+		}
+		vector<zp::u8> data((size_t)m_storage->size());
+		if (!data.empty())
+		{
+			m_storage->read(0, &data[0], data.size());
+		}
+		zp::IStorage* snapshot = zp::createMemoryStorage(data.empty() ? NULL : &data[0], data.size(), true);
+		zp::IPackage* pack = zp::open(snapshot, zp::OPEN_READONLY);
+		if (pack == NULL || !checkFiles(pack, *m_filenames, *m_contents))
+		{
+			++m_badCount;
+		}
+		zp::close(pack);
+		zp::destroyStorage(snapshot);
+	}
+
+private:
+	zp::IStorage*						m_storage;
+	const vector<string>*				m_filenames;
+	const vector<vector<zp::u8> >*		m_contents;
+	zp::u32								m_badCount;
+	zp::u64								m_writtenSize;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//package must stay valid during compact(), tables are appended as log or pages
+bool testInterruptedCompact(const string& workDir, bool pagedTables)
+{
+	const zp::u32 FILE_COUNT = 80;
+	string externalPath = workDir + "/external";
+	SnapshotStorage storage;
+	zp::IPackage* pack = zp::create(&storage);
+	if (pack == NULL)
+	{
+		return false;
+	}
+	if (pagedTables)
+	{
+		pack->enablePagedTables(true);
+	}
+	else
+	{
+		pack->enableTableLog(true);
+	}
+	vector<string> filenames;
+	vector<vector<zp::u8> > contents;
+	bool ok = true;
+	for (zp::u32 i = 0; i < FILE_COUNT && ok; ++i)
+	{
+		char filename[64];
+		sprintf(filename, "file/%03u.bin", (unsigned)i);
+		filenames.push_back(filename);
+		contents.push_back(vector<zp::u8>());
+		makeContent(i, 500 + (i * 7919) % 20000, contents.back());
+		ok = addContent(pack, filenames.back(), contents.back(), externalPath, (i % 3 == 0) ? zp::FILE_COMPRESS : 0);
+		pack->flush();
+	}
+	unlink(externalPath.c_str());
+	//gaps to fill, each removal is a small flush
+	for (zp::u32 i = 0; i < filenames.size() && ok; i += 2)
+	{
+		ok = pack->removeFile(filenames[i].c_str());
+		filenames.erase(filenames.begin() + i);
+		contents.erase(contents.begin() + i);
+		pack->flush();
+	}
+	storage.check(&filenames, &contents);
+	bool finished = false;
+	for (zp::u32 i = 0; i < 1000 && ok && !finished; ++i)
+	{
+		ok = pack->compact(16384, &finished);
+	}
+	storage.check(NULL, NULL);
+	if (storage.badCount() > 0)
+	{
+		fprintf(stderr, "  %u bad snapshots\n", (unsigned)storage.badCount());
+	}
+	ok = ok && finished && storage.badCount() == 0 && checkFiles(pack, filenames, contents);
+	zp::close(pack);
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool testInterruptedCompactLog(const string& workDir)
+{
+	return testInterruptedCompact(workDir, false);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool testInterruptedCompactPaged(const string& workDir)
+{
+	return testInterruptedCompact(workDir, true);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//identical file shares data without being written
+bool testDuplicateNotWritten(const string& workDir)
+{
+	const zp::u32 FILE_SIZE = 1000000;
+	string externalPath = workDir + "/external";
+	SnapshotStorage storage;
+	zp::IPackage* pack = zp::create(&storage);
+	if (pack == NULL)
+	{
+		return false;
+	}
+	const char* filenames[] = {"raw/a.bin", "raw/b.bin", "compressed/a.bin", "compressed/b.bin"};
+	const zp::u32 flags[] = {0, 0, zp::FILE_COMPRESS, zp::FILE_COMPRESS};
+	vector<zp::u8> content;
+	bool ok = true;
+	for (zp::u32 i = 0; i < 2 && ok; ++i)
+	{
+		makeContent(i, FILE_SIZE, content);
+		ok = addContent(pack, filenames[i * 2], content, externalPath, flags[i * 2]);
+		zp::u64 writtenSize = storage.writtenSize();
+		ok = ok && addContent(pack, filenames[i * 2 + 1], content, externalPath, flags[i * 2 + 1]);
+		if (ok && storage.writtenSize() != writtenSize)
+		{
+			fprintf(stderr, "  %llu bytes written for duplicate %s\n",
+					(unsigned long long)(storage.writtenSize() - writtenSize), filenames[i * 2 + 1]);
+			ok = false;
+		}
+		pack->flush();
+		ok = ok && checkFile(pack, filenames[i * 2], content) && checkFile(pack, filenames[i * 2 + 1], content);
+	}
+	unlink(externalPath.c_str());
+	zp::close(pack);
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//raw file copied by kernel is hashed when a file of the same size is added
+bool testRawDuplicateHashedLater(const string& workDir)
+{
+	const zp::u32 FILE_SIZE = 1000000;
+	string packagePath = workDir + "/raw.zpk";
+	string externalPath = workDir + "/external";
+	zp::IPackage* pack = zp::create(packagePath.c_str());
+	if (pack == NULL)
+	{
+		return false;
+	}
+	vector<string> filenames;
+	vector<vector<zp::u8> > contents(3);
+	makeContent(0, FILE_SIZE, contents[0]);
+	contents[1] = contents[0];
+	contents[2] = contents[0];
+	contents[2][FILE_SIZE / 2] ^= 0xFF;
+	filenames.push_back("a.bin");
+	filenames.push_back("same.bin");
+	filenames.push_back("different.bin");
+	bool ok = true;
+	for (zp::u32 i = 0; i < filenames.size() && ok; ++i)
+	{
+		ok = addContent(pack, filenames[i], contents[i], externalPath, 0);
+		pack->flush();
+	}
+	unlink(externalPath.c_str());
+	zp::u64 hashes[3] = {0};
+	for (zp::u32 i = 0; i < filenames.size() && ok; ++i)
+	{
+		ok = pack->getFileInfo(filenames[i].c_str(), 0, 0, 0, 0, &hashes[i]);
+	}
+	if (ok && (hashes[0] == 0 || hashes[0] != hashes[1] || hashes[0] == hashes[2]))
+	{
+		fprintf(stderr, "  wrong content hash %llx %llx %llx\n", (unsigned long long)hashes[0],
+				(unsigned long long)hashes[1], (unsigned long long)hashes[2]);
+		ok = false;
+	}
+	ok = ok && checkFiles(pack, filenames, contents);
+	zp::close(pack);
+	pack = zp::open(packagePath.c_str(), zp::OPEN_READONLY);
+	ok = ok && pack != NULL && checkFiles(pack, filenames, contents);
+	zp::close(pack);
+	unlink(packagePath.c_str());
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//files changed by delta are stored as in new package, raw or compressed with its chunk size
+bool testPatchKeepsStorage(const string& workDir)
+{
+	string oldPath = workDir + "/old.zpk";
+	string newPath = workDir + "/new.zpk";
+	string patchPath = workDir + "/patch.zpk";
+	string externalPath = workDir + "/external";
+	const char* filenames[] = {"raw.bin", "compressed.bin", "chunk64k.bin"};
+	const zp::u32 flags[] = {0, zp::FILE_COMPRESS, zp::FILE_COMPRESS};
+	const zp::u32 chunkSizes[] = {0, 0, 0x10000};
+	const zp::u32 FILE_COUNT = sizeof(filenames) / sizeof(filenames[0]);
+
+	zp::IPackage* oldPack = zp::create(oldPath.c_str());
+	zp::IPackage* newPack = zp::create(newPath.c_str());
+	bool ok = (oldPack != NULL && newPack != NULL);
+	vector<vector<zp::u8> > contents(FILE_COUNT);
+	for (zp::u32 i = 0; i < FILE_COUNT && ok; ++i)
+	{
+		//compressible, new version differs in a few bytes
+		contents[i].resize(200000);
+		for (zp::u32 j = 0; j < contents[i].size(); ++j)
+		{
+			contents[i][j] = (zp::u8)((j / 100) * 13 + i);
+		}
+		ok = writeExternalFile(externalPath, contents[i])
+			&& oldPack->addFile(filenames[i], externalPath.c_str(), contents[i].size(), flags[i], 0, 0, chunkSizes[i]);
+		contents[i][1000] ^= 0xFF;
+		contents[i][150000] ^= 0xFF;
+		ok = ok && writeExternalFile(externalPath, contents[i])
+			&& newPack->addFile(filenames[i], externalPath.c_str(), contents[i].size(), flags[i], 0, 0, chunkSizes[i]);
+	}
+	unlink(externalPath.c_str());
+	if (oldPack != NULL)
+	{
+		oldPack->flush();
+	}
+	if (newPack != NULL)
+	{
+		newPack->flush();
+	}
+	ok = ok && zp::createPatch(oldPack, newPack, patchPath.c_str(), zp::PATCH_DELTA);
+	zp::close(oldPack);
+	oldPack = NULL;
+	if (ok)
+	{
+		oldPack = zp::open(oldPath.c_str(), 0);
+		ok = (oldPack != NULL && zp::applyPatch(oldPack, patchPath.c_str()));
+	}
+	for (zp::u32 i = 0; i < FILE_COUNT && ok; ++i)
+	{
+		zp::u32 patchedPackSize = 0;
+		zp::u32 patchedFlag = 0;
+		zp::u32 packSize = 0;
+		zp::u32 flag = 0;
+		ok = oldPack->getFileInfo(filenames[i], 0, &patchedPackSize, &patchedFlag)
+			&& newPack->getFileInfo(filenames[i], 0, &packSize, &flag)
+			&& checkFile(oldPack, filenames[i], contents[i]);
+		if (ok && (((patchedFlag ^ flag) & zp::FILE_COMPRESS) != 0 || patchedPackSize != packSize))
+		{
+			fprintf(stderr, "  %s is stored differently, flag %x size %u, expected flag %x size %u\n", filenames[i],
+					(unsigned)patchedFlag, (unsigned)patchedPackSize, (unsigned)flag, (unsigned)packSize);
+			ok = false;
+		}
+	}
+	zp::close(oldPack);
+	zp::close(newPack);
+	unlink(oldPath.c_str());
+	unlink(newPath.c_str());
+	unlink(patchPath.c_str());
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//files of size 0 and 1 share offsets, each added by its own flush of table log
+bool testTableLogOrder(const string& workDir)
+{
+	const zp::u32 FILE_COUNT = 48;
+	string packagePath = workDir + "/log.zpk";
+	string externalPath = workDir + "/external";
+	zp::IPackage* pack = zp::create(packagePath.c_str());
+	if (pack == NULL)
+	{
+		return false;
+	}
+	pack->enableTableLog(true);
+	pack->flush();
+	zp::close(pack);
+
+	vector<string> filenames;
+	vector<vector<zp::u8> > contents(FILE_COUNT);
+	bool ok = true;
+	for (zp::u32 i = 0; i < FILE_COUNT && ok; ++i)
+	{
+		char filename[64];
+		sprintf(filename, "d%u/f%02u.bin", (unsigned)(i % 3), (unsigned)i);
+		filenames.push_back(filename);
+		zp::u32 size = (i % 4 == 3) ? 100 + i : (i % 2);
+		makeContent(i, size, contents[i]);
+
+		if (!writeExternalFile(externalPath, contents[i]))
+		{
+			ok = false;
+			break;
+		}
+		pack = zp::open(packagePath.c_str(), 0);
+		if (pack == NULL)
+		{
+			ok = false;
+			break;
+		}
+		pack->enableTableLog(true);
+		ok = pack->addFile(filename, externalPath.c_str(), size, 0);
+		pack->flush();
+		zp::close(pack);
+	}
+	unlink(externalPath.c_str());
+	if (!ok)
+	{
+		fprintf(stderr, "  failed to add file\n");
+		return false;
+	}
+	pack = zp::open(packagePath.c_str(), zp::OPEN_READONLY);
+	if (pack == NULL)
+	{
+		fprintf(stderr, "  failed to open package\n");
+		return false;
+	}
+	for (zp::u32 i = 0; i < FILE_COUNT; ++i)
+	{
+		ok = checkFile(pack, filenames[i], contents[i]) && ok;
+	}
+	zp::close(pack);
+	unlink(packagePath.c_str());
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//chunks of a compressed file lie one after another, reading it through needs only the first seek
+bool testSeekCount(const string& workDir)
+{
+	const zp::u32 FILE_SIZE = 0x200000;
+	string packagePath = workDir + "/seek.zpk";
+	string externalPath = workDir + "/external";
+	vector<zp::u8> content;
+	makeContent(0, FILE_SIZE, content);
+	zp::IPackage* pack = zp::create(packagePath.c_str());
+	if (pack == NULL)
+	{
+		return false;
+	}
+	bool ok = addContent(pack, "compressed.bin", content, externalPath, zp::FILE_COMPRESS);
+	zp::close(pack);
+	unlink(externalPath.c_str());
+
+	pack = ok ? zp::open(packagePath.c_str()) : NULL;
+	if (pack != NULL)
+	{
+		zp::PackageStatistics statistics;
+		pack->resetStatistics();
+		ok = checkFile(pack, "compressed.bin", content);
+		pack->getStatistics(statistics);
+		if (ok && statistics.seekCount != 1)
+		{
+			fprintf(stderr, "  %llu seeks to read one file\n", (unsigned long long)statistics.seekCount);
+			ok = false;
+		}
+		zp::close(pack);
+	}
+	unlink(packagePath.c_str());
+	return ok && pack != NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int main()
+{
+	char workDir[] = "/tmp/zpTestXXXXXX";
+	if (mkdtemp(workDir) == NULL)
+	{
+		fprintf(stderr, "failed to create work dir\n");
+		return 1;
+	}
+	struct Test
+	{
+		const char*	name;
+		bool		(*run)(const string& workDir);
+	};
+	const Test tests[] =
+	{
+		{"tableLogOrder", testTableLogOrder},
+		{"duplicateAtTableGrowth", testDuplicateAtTableGrowth},
+		{"replaceWithDuplicate", testReplaceWithDuplicate},
+		{"interruptedCompactLog", testInterruptedCompactLog},
+		{"interruptedCompactPaged", testInterruptedCompactPaged},
+		{"duplicateNotWritten", testDuplicateNotWritten},
+		{"rawDuplicateHashedLater", testRawDuplicateHashedLater},
+		{"patchKeepsStorage", testPatchKeepsStorage},
+		{"seekCount", testSeekCount},
+	};
+	int failed = 0;
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i)
+	{
+		bool ok = tests[i].run(workDir);
+		printf("%s %s\n", ok ? "pass" : "FAIL", tests[i].name);
+		if (!ok)
+		{
+			++failed;
+		}
+	}
+	rmdir(workDir);
+	return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,238 @@
+#include "Stdafx.h"
+#include "compressPolicy.h"
+#include <fstream>
+#include <sstream>
+#include "zpExplorer.h"
+
+using namespace std;
+
+typedef basic_ifstream<zp::Char> IFileStream;
+typedef basic_istringstream<zp::Char> IStrStream;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool parseSize(const zp::String& str, zp::u32& size)
+{
+	if (str.empty() || str[0] < _T('0') || str[0] > _T('9'))
+	{
+		return false;
+	}
+	size = 0;
+	size_t i = 0;
+	for (; i < str.length() && str[i] >= _T('0') && str[i] <= _T('9'); ++i)
+	{
+		size = size * 10 + (str[i] - _T('0'));
+	}
+	if (i == str.length())
+	{
+		return true;
+	}
+	if (i + 1 != str.length())
+	{
+		return false;
+	}
+	if (str[i] == _T('k') || str[i] == _T('K'))
+	{
+		size <<= 10;
+		return true;
+	}
+	if (str[i] == _T('m') || str[i] == _T('M'))
+	{
+		size <<= 20;
+		return true;
+	}
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool wildcardMatch(const zp::Char* pattern, const zp::Char* str)
+{
+	//position to retry from when last '*' need to match more characters
+	const zp::Char* starPattern = NULL;
+	const zp::Char* starStr = NULL;
+	while (*str != 0)
+	{
+		if (*pattern == _T('*'))
+		{
+			starPattern = ++pattern;
+			starStr = str;
+		}
+		else if (*pattern == _T('?') || *pattern == *str)
+		{
+			++pattern;
+			++str;
+		}
+		else if (starPattern != NULL)
+		{
+			pattern = starPattern;
+			str = ++starStr;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	while (*pattern == _T('*'))
+	{
+		++pattern;
+	}
+	return (*pattern == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CompressPolicy::clear()
+{
+	m_rules.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CompressPolicy::addRule(const Rule& rule)
+{
+	m_rules.push_back(rule);
+	Rule& added = m_rules.back();
+#if !(ZP_CASE_SENSITIVE)
+	stringToLower(added.pattern, rule.pattern);
+#endif
+	for (size_t i = 0; i < added.pattern.length(); ++i)
+	{
+		if (added.pattern[i] == _T('/') || added.pattern[i] == _T('\\'))
+		{
+			added.pattern[i] = DIR_CHAR;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CompressPolicy::load(const zp::String& filename)
+{
+	IFileStream stream(filename.c_str());
+	if (!stream.is_open())
+	{
+		return false;
+	}
+	zp::String line;
+	while (getline(stream, line))
+	{
+		Rule rule;
+		if (parseRule(line, rule))
+		{
+			addRule(rule);
+		}
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CompressPolicy::parseRule(const zp::String& line, Rule& rule)
+{
+	IStrStream iss(line);
+	if (!(iss >> rule.pattern) || rule.pattern[0] == _T('#'))
+	{
+		return false;
+	}
+	rule.minSize = 0;
+	rule.maxSize = 0;
+	rule.compress = true;
+	rule.chunked = false;
+	rule.level = 0;
+	rule.chunkSize = 0;
+
+	const zp::String chunkKey = _T("chunk=");
+	zp::String token;
+	while (iss >> token)
+	{
+		if (token[0] == _T('>'))
+		{
+			parseSize(token.substr(1), rule.minSize);
+		}
+		else if (token[0] == _T('<'))
+		{
+			parseSize(token.substr(1), rule.maxSize);
+		}
+		else if (token.compare(0, chunkKey.length(), chunkKey) == 0)
+		{
+			parseSize(token.substr(chunkKey.length()), rule.chunkSize);
+		}
+		else if (token == _T("chunked"))
+		{
+			rule.chunked = true;
+		}
+		else if (token == _T("store"))
+		{
+			rule.compress = false;
+		}
+		else if (token == _T("fast"))
+		{
+			rule.level = 1;
+		}
+		else if (token == _T("best"))
+		{
+			rule.level = 9;
+		}
+		else if (token == _T("default"))
+		{
+			rule.level = 0;
+		}
+		else if (token.length() == 1 && token[0] >= _T('1') && token[0] <= _T('9'))
+		{
+			rule.level = token[0] - _T('0');
+		}
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CompressPolicy::empty() const
+{
+	return m_rules.empty();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CompressPolicy::apply(const zp::String& filename, zp::u32 fileSize, zp::u32& flag, zp::u32& level,
+							zp::u32& chunkSize) const
+{
+	if (m_rules.empty())
+	{
+		return;
+	}
+#if ZP_CASE_SENSITIVE
+	const zp::String& path = filename;
+#else
+	zp::String path;
+	stringToLower(path, filename);
+#endif
+	zp::String::size_type pos = path.find_last_of(DIR_CHAR);
+	const zp::Char* name = (pos == zp::String::npos) ? path.c_str() : path.c_str() + pos + 1;
+
+	for (size_t i = 0; i < m_rules.size(); ++i)
+	{
+		const Rule& rule = m_rules[i];
+		if (fileSize < rule.minSize || (rule.maxSize != 0 && fileSize >= rule.maxSize))
+		{
+			continue;
+		}
+		bool hasDir = (rule.pattern.find(DIR_CHAR) != zp::String::npos);
+		if (!wildcardMatch(rule.pattern.c_str(), hasDir ? path.c_str() : name))
+		{
+			continue;
+		}
+		if (rule.compress)
+		{
+			flag |= zp::FILE_COMPRESS;
+		}
+		else
+		{
+			flag &= (~zp::FILE_COMPRESS);
+		}
+		if (rule.chunked)
+		{
+			flag |= zp::FILE_CHUNKED;
+		}
+		else
+		{
+			flag &= (~zp::FILE_CHUNKED);
+		}
+		level = rule.level;
+		chunkSize = rule.chunkSize;
+		return;
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef __COMPRESS_POLICY_H__
+#define __COMPRESS_POLICY_H__
+
+#include <string>
+#include <vector>
+#include "zpack.h"
+
+//choose how each file is added to package by its name and size
+//rules are checked in order, the first matched one is used
+class CompressPolicy
+{
+public:
+	struct Rule
+	{
+		zp::String	pattern;	//wildcard (* and ?), matches file name only if it contains no directory
+		zp::u32		minSize;
+		zp::u32		maxSize;	//0 means no limit
+		bool		compress;	//false means store raw
+		bool		chunked;	//split into chunks shared with other files, see zp::FILE_CHUNKED
+		zp::u32		level;		//1 (fastest) to 9 (smallest), 0 means default
+		zp::u32		chunkSize;	//0 means chunk size of package
+	};
+
+	void clear();
+
+	void addRule(const Rule& rule);
+
+	//one rule per line: pattern [>size] [<size] store|fast|best|default|1-9 [chunked] [chunk=size]
+	//size can end with k or m, lines beginning with '#' are comments
+	//rules of file are appended to current ones
+	bool load(const zp::String& filename);
+
+	bool empty() const;
+
+	//flag, level and chunkSize are not changed if no rule matches
+	void apply(const zp::String& filename, zp::u32 fileSize, zp::u32& flag, zp::u32& level,
+				zp::u32& chunkSize) const;
+
+private:
+	bool parseRule(const zp::String& line, Rule& rule);
+
+private:
+	std::vector<Rule>	m_rules;
+};
+
+bool wildcardMatch(const zp::Char* pattern, const zp::Char* str);
+
+#endif
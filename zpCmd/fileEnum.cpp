@@ -62,6 +62,17 @@ bool addPackFile(const zp::String& filename, zp::u32 fileSize, void* param)
 	return explorer->addFile(filename, relativePath, fileSize);
 }
 
+bool collectPackFile(const zp::String& filename, zp::u32 fileSize, void* param)
+{
+	ZpExplorer* explorer = reinterpret_cast<ZpExplorer*>(param);
+	ZpExplorer::PendingFile file;
+	file.externalPath = filename;
+	file.relativePath = filename.substr(explorer->m_basePath.length(), filename.length() - explorer->m_basePath.length());
+	file.fileSize = fileSize;
+	explorer->m_pendingFiles.push_back(file);
+	return true;
+}
+
 bool countFile(const zp::String& filename, zp::u32 fileSize, void* param)
 {
 	ZpExplorer* explorer = reinterpret_cast<ZpExplorer*>(param);
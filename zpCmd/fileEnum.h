@@ -10,6 +10,8 @@ bool enumFile(const zp::String& searchPath, EnumCallback callback, void* param);
 
 bool addPackFile(const zp::String& filename, zp::u32 fileSize, void* param);
 
+bool collectPackFile(const zp::String& filename, zp::u32 fileSize, void* param);
+
 bool countFile(const zp::String& filename, zp::u32 fileSize, void* param);
 
 #endif
@@ -48,9 +48,21 @@ CMD_PROC(open)
 	return g_explorer.open(param0, false) || g_explorer.open(param0, true);
 }
 
+void printSkippedCompress(zp::u64 prevSkippedSize)
+{
+	zp::IPackage* pack = g_explorer.getPack();
+	if (pack != NULL && pack->getSkippedCompressSize() > prevSkippedSize)
+	{
+		COUT << _T("stored without compression: ") << pack->getSkippedCompressSize() - prevSkippedSize
+			<< _T(" bytes (already compressed)") << endl;
+	}
+}
+
 CMD_PROC(create)
 {
-	return g_explorer.create(param0, param1);
+	bool ret = g_explorer.create(param0, param1);
+	printSkippedCompress(0);
+	return ret;
 }
 
 CMD_PROC(close)
@@ -85,7 +97,11 @@ CMD_PROC(cd)
 
 CMD_PROC(add)
 {
-	return g_explorer.add(param0, param1);
+	zp::IPackage* pack = g_explorer.getPack();
+	zp::u64 prevSkippedSize = (pack != NULL) ? pack->getSkippedCompressSize() : 0;
+	bool ret = g_explorer.add(param0, param1);
+	printSkippedCompress(prevSkippedSize);
+	return ret;
 }
 
 CMD_PROC(del)
@@ -120,6 +136,217 @@ CMD_PROC(defrag)
 	return (pack != NULL && pack->defrag(NULL, NULL));
 }
 
+CMD_PROC(compact)
+{
+	IStringStream iss(param0, IStringStream::in);
+	zp::u64 maxMoveSize = 0;
+	iss >> maxMoveSize;
+	bool finished = false;
+	if (!g_explorer.compact(maxMoveSize * 0x100000, &finished))
+	{
+		return false;
+	}
+	if (!finished)
+	{
+		COUT << _T("not finished, run again to continue") << endl;
+	}
+	return true;
+}
+
+CMD_PROC(layout)
+{
+	return g_explorer.optimizeLayout(param0);
+}
+
+CMD_PROC(warmset)
+{
+	return g_explorer.setWarmSet(param0);
+}
+
+CMD_PROC(trace)
+{
+	return g_explorer.startTrace(param0);
+}
+
+const zp::Char* operationName(zp::u32 operation)
+{
+	const zp::Char* names[zp::OP_COUNT] =
+	{
+		_T("openFile"), _T("read"), _T("inflate"), _T("flush"), _T("defrag"), _T("compact")
+	};
+	return (operation < zp::OP_COUNT) ? names[operation] : _T("?");
+}
+
+const zp::Char* traceEventName(zp::u32 type)
+{
+	switch (type)
+	{
+	case zp::TRACE_OPEN:		return _T("open");
+	case zp::TRACE_READ:		return _T("read");
+	case zp::TRACE_CACHE_HIT:	return _T("hit");
+	case zp::TRACE_CACHE_MISS:	return _T("miss");
+	case zp::TRACE_CLOSE:		return _T("close");
+	case zp::TRACE_TIMING:		return _T("timing");
+	default:					return _T("?");
+	}
+}
+
+bool printTraceEvent(const zp::TraceEvent& event, const zp::Char* filename, void* param)
+{
+	COUT << event.time << _T(" [") << event.threadId << _T("] ") << traceEventName(event.type) << _T(" ");
+	if (filename != NULL)
+	{
+		COUT << filename;
+	}
+	else
+	{
+		COUT << hex << event.nameHash << dec;
+	}
+	if (event.type == zp::TRACE_OPEN)
+	{
+		COUT << _T(" size:") << event.size;
+	}
+	else if (event.type == zp::TRACE_CLOSE)
+	{
+		COUT << _T(" pos:") << event.offset;
+	}
+	else if (event.type == zp::TRACE_TIMING)
+	{
+		COUT << _T(" ") << operationName(event.offset) << _T(" ") << event.size << _T("us");
+	}
+	else
+	{
+		COUT << _T(" ") << event.offset << _T("+") << event.size;
+	}
+	COUT << endl;
+	return true;
+}
+
+CMD_PROC(dumptrace)
+{
+	return zp::readTrace(param0.c_str(), printTraceEvent, NULL);
+}
+
+CMD_PROC(stats)
+{
+	zp::IPackage* pack = g_explorer.getPack();
+	if (pack == NULL)
+	{
+		return false;
+	}
+	if (param0 == _T("reset"))
+	{
+		pack->resetStatistics();
+		return true;
+	}
+	zp::PackageStatistics stats;
+	pack->getStatistics(stats);
+	COUT << _T("lookup: ") << stats.lookupCount << _T(" (miss ") << stats.lookupMissCount << _T(")") << endl;
+	COUT << _T("open: ") << stats.openCount << endl;
+	COUT << _T("read: ") << stats.rawReadSize << _T(" bytes, compressed ") << stats.compressedReadSize
+		<< _T(" bytes") << endl;
+	COUT << _T("inflate: ") << stats.inflatedSize << _T(" bytes, ") << stats.inflateTime << _T(" us") << endl;
+	COUT << _T("seek: ") << stats.seekCount << endl;
+	COUT << _T("cache hit: ") << stats.cacheHitCount << endl;
+	COUT << _T("flush: ") << stats.flushWriteSize << _T(" bytes") << endl;
+	return true;
+}
+
+CMD_PROC(chrometrace)
+{
+	return zp::exportChromeTrace(param0.c_str(), param1.c_str());
+}
+
+CMD_PROC(timing)
+{
+	zp::IPackage* pack = g_explorer.getPack();
+	if (pack == NULL)
+	{
+		return false;
+	}
+	if (param0 == _T("on") || param0 == _T("off"))
+	{
+		pack->enableTiming(param0 == _T("on"));
+		return true;
+	}
+	zp::LatencyHistogram histogram;
+	for (zp::u32 i = 0; i < zp::OP_COUNT; ++i)
+	{
+		if (!pack->getLatencyHistogram(i, histogram) || histogram.count == 0)
+		{
+			continue;
+		}
+		COUT << operationName(i) << _T(": ") << histogram.count << _T(" times, avg ")
+			<< histogram.totalTime / histogram.count << _T("us, p50 ") << zp::getHistogramPercentile(histogram, 50)
+			<< _T("us, p99 ") << zp::getHistogramPercentile(histogram, 99) << _T("us, max ")
+			<< zp::getHistogramPercentile(histogram, 100) << _T("us") << endl;
+	}
+	return true;
+}
+
+CMD_PROC(tablelog)
+{
+	zp::IPackage* pack = g_explorer.getPack();
+	if (pack == NULL || (param0 != _T("on") && param0 != _T("off")))
+	{
+		return false;
+	}
+	pack->enableTableLog(param0 == _T("on"));
+	return true;
+}
+
+CMD_PROC(pagedtables)
+{
+	zp::IPackage* pack = g_explorer.getPack();
+	if (pack == NULL || (param0 != _T("on") && param0 != _T("off")))
+	{
+		return false;
+	}
+	pack->enablePagedTables(param0 == _T("on"));
+	return true;
+}
+
+CMD_PROC(directio)
+{
+	zp::IPackage* pack = g_explorer.getPack();
+	if (pack == NULL || (param0 != _T("on") && param0 != _T("off")))
+	{
+		return false;
+	}
+	pack->enableDirectIO(param0 == _T("on"));
+	return true;
+}
+
+CMD_PROC(diff)
+{
+	return g_explorer.createPatch(param0, param1);
+}
+
+CMD_PROC(patch)
+{
+	return g_explorer.applyPatch(param0);
+}
+
+CMD_PROC(threads)
+{
+	IStringStream iss(param0, IStringStream::in);
+	zp::u32 count = 0;
+	iss >> count;
+	g_explorer.setThreadCount(count);
+	return true;
+}
+
+CMD_PROC(policy)
+{
+	CompressPolicy& policy = g_explorer.compressPolicy();
+	policy.clear();
+	if (param0.empty())
+	{
+		return true;
+	}
+	return policy.load(param0);
+}
+
 CMD_PROC(help)
 {
 #define HELP_ITEM(cmd, explain) COUT << cmd << endl << "    "explain << endl;
@@ -133,6 +360,23 @@ CMD_PROC(help)
 	HELP_ITEM("extract [source path] [dest path]", "extrace file or directories to disk");
 	//HELP_ITEM("fragment", "calculate fragment bytes and how many bytes to move to defrag");
 	HELP_ITEM("defrag", "compact file, remove all fragments");
+	HELP_ITEM("compact [max MB]", "move files in place to remove fragments, at most max MB at a time, empty means all");
+	HELP_ITEM("layout [trace file]", "rewrite package with files in order of trace file, or list file with one filename per line");
+	HELP_ITEM("warmset [trace file]", "store files of trace (or list) file in package to be prefetched by warm up, empty to remove");
+	HELP_ITEM("trace [trace file]", "record file access of current package to trace file, empty means stop");
+	HELP_ITEM("stats [reset]", "show read, decompress and flush counters of current package, or reset them");
+	HELP_ITEM("timing [on|off]", "measure latency of package operations, empty means show percentiles");
+	HELP_ITEM("tablelog <on|off>", "append changed entries to a log on flush instead of rewriting all tables");
+	HELP_ITEM("pagedtables <on|off>", "store tables as separately compressed pages, flush rewrites changed pages only");
+	HELP_ITEM("directio <on|off>", "add, extract and defrag bypass system cache, for data much larger than memory");
+	HELP_ITEM("chrometrace [trace file] [json file]", "convert trace file to json of chrome://tracing");
+	HELP_ITEM("dumptrace [trace file]", "print events of a trace file: microseconds [thread] event file offset+size");
+	HELP_ITEM("diff [new package path] [patch path]", "create a patch package from current package to the new one");
+	HELP_ITEM("patch [patch path]", "update current package with a patch package");
+	HELP_ITEM("threads [count]", "set compress and extract thread count, 0 or empty means one per cpu core");
+	HELP_ITEM("policy [rule file]", "load compress rules for files added later, empty means compress all files");
+	COUT << "    one rule per line: pattern [>size] [<size] store|fast|best|default|1-9 [chunked] [chunk=size]" << endl;
+	COUT << "    e.g. \"*.ogg store\", \"*.json best\", \"*.exe >16m fast chunked\", first matched rule is used" << endl;
 	HELP_ITEM("exit", "exit program");
 	return true;
 }
@@ -174,6 +418,7 @@ bool processCmdLine(int argc, _TCHAR* argv[])
 int _tmain(int argc, _TCHAR* argv[])
 {
 	g_explorer.setCallback(zpcallback, NULL);
+	g_explorer.setThreadCount(0);
 
 	if (processCmdLine(argc, argv))
 	{
@@ -190,6 +435,21 @@ int _tmain(int argc, _TCHAR* argv[])
 	REGISTER_CMD(cd);
 	//REGISTER_CMD(fragment);
 	REGISTER_CMD(defrag);
+	REGISTER_CMD(compact);
+	REGISTER_CMD(layout);
+	REGISTER_CMD(warmset);
+	REGISTER_CMD(trace);
+	REGISTER_CMD(dumptrace);
+	REGISTER_CMD(stats);
+	REGISTER_CMD(timing);
+	REGISTER_CMD(tablelog);
+	REGISTER_CMD(pagedtables);
+	REGISTER_CMD(directio);
+	REGISTER_CMD(chrometrace);
+	REGISTER_CMD(diff);
+	REGISTER_CMD(patch);
+	REGISTER_CMD(threads);
+	REGISTER_CMD(policy);
 	REGISTER_CMD(help);
 
 	while (true)
@@ -11,6 +11,12 @@
 
 using namespace std;
 
+//files are extracted through a buffer of this size, a multiple of usual chunk sizes
+//so compressed chunks are decompressed directly into it
+const zp::u32 EXTRACT_BUFFER_SIZE = 0x100000;
+//unbuffered writes must be aligned to sector size
+const zp::u32 EXTRACT_WRITE_ALIGN = 0x1000;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ZpExplorer::ZpExplorer()
 	: m_pack(NULL)
@@ -18,6 +24,7 @@ ZpExplorer::ZpExplorer()
 	//, m_fileCount(0)
 	, m_totalFileSize(0)
 	, m_callbackParam(NULL)
+	, m_threadCount(1)
 {
 	m_root.isDirectory = true;
 	m_root.parent = NULL;
@@ -40,6 +47,22 @@ void ZpExplorer::setCallback(zp::Callback callback, void* param)
 	m_callbackParam = param;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void ZpExplorer::setThreadCount(zp::u32 count)
+{
+	m_threadCount = count;
+	if (m_pack != NULL)
+	{
+		m_pack->setThreadCount(count);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CompressPolicy& ZpExplorer::compressPolicy()
+{
+	return m_compressPolicy;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 bool ZpExplorer::open(const zp::String& path, bool readonly)
 {
@@ -50,6 +73,7 @@ bool ZpExplorer::open(const zp::String& path, bool readonly)
 	{
 		return false;
 	}
+	m_pack->setThreadCount(m_threadCount);
 	build();
 	//END_PERF
 	return true;
@@ -68,6 +92,7 @@ bool ZpExplorer::create(const zp::String& path, const zp::String& inputPath)
 	{
 		return false;
 	}
+	m_pack->setThreadCount(m_threadCount);
 	if (inputPath.empty())
 	{
 		return true;
@@ -77,7 +102,15 @@ bool ZpExplorer::create(const zp::String& path, const zp::String& inputPath)
 	{
 		m_basePath += DIR_STR;
 	}
-	enumFile(m_basePath, addPackFile, this);
+	if (m_threadCount != 1)
+	{
+		enumFile(m_basePath, collectPackFile, this);
+		addPendingFiles();
+	}
+	else
+	{
+		enumFile(m_basePath, addPackFile, this);
+	}
 	return true;
 }
 
@@ -103,6 +136,163 @@ bool ZpExplorer::defrag()
 	return m_pack->defrag(m_callback, m_callbackParam);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZpExplorer::compact(zp::u64 maxMoveSize, bool* finished)
+{
+	if (m_pack == NULL)
+	{
+		return false;
+	}
+	if (maxMoveSize != 0)
+	{
+		return m_pack->compact(maxMoveSize, finished);
+	}
+	bool done = false;
+	while (!done)
+	{
+		if (!m_pack->compact((zp::u64)-1, &done))
+		{
+			return false;
+		}
+	}
+	if (finished != NULL)
+	{
+		*finished = true;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static bool collectTraceFile(const zp::TraceEvent& event, const zp::Char* filename, void* param)
+{
+	if (event.type == zp::TRACE_OPEN && filename != NULL)
+	{
+		reinterpret_cast<vector<zp::String>*>(param)->push_back(filename);
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZpExplorer::optimizeLayout(const zp::String& traceFilename)
+{
+	if (m_pack == NULL)
+	{
+		return false;
+	}
+	vector<zp::String> filenames;
+	if (!readAccessList(traceFilename, filenames))
+	{
+		return false;
+	}
+	vector<const zp::Char*> names(filenames.size());
+	for (size_t i = 0; i < filenames.size(); ++i)
+	{
+		names[i] = filenames[i].c_str();
+	}
+	return m_pack->optimizeLayout(names.empty() ? NULL : &names[0], (zp::u32)names.size(),
+									m_callback, m_callbackParam);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZpExplorer::setWarmSet(const zp::String& traceFilename)
+{
+	if (m_pack == NULL)
+	{
+		return false;
+	}
+	vector<zp::String> filenames;
+	if (!traceFilename.empty() && !readAccessList(traceFilename, filenames))
+	{
+		return false;
+	}
+	vector<const zp::Char*> names(filenames.size());
+	for (size_t i = 0; i < filenames.size(); ++i)
+	{
+		names[i] = filenames[i].c_str();
+	}
+	if (!m_pack->setWarmSet(names.empty() ? NULL : &names[0], (zp::u32)names.size()))
+	{
+		return false;
+	}
+	m_pack->flush();
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZpExplorer::readAccessList(const zp::String& filename, vector<zp::String>& filenames)
+{
+	return zp::readTrace(filename.c_str(), collectTraceFile, &filenames) || readFileList(filename, filenames);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZpExplorer::readFileList(const zp::String& listFilename, vector<zp::String>& filenames)
+{
+	basic_ifstream<zp::Char> stream(listFilename.c_str());
+	if (!stream.is_open())
+	{
+		return false;
+	}
+	zp::String line;
+	while (getline(stream, line))
+	{
+		if (!line.empty() && line[line.length() - 1] == _T('\r'))
+		{
+			line.erase(line.length() - 1);
+		}
+		if (!line.empty())
+		{
+			filenames.push_back(line);
+		}
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZpExplorer::startTrace(const zp::String& traceFilename)
+{
+	if (m_pack == NULL)
+	{
+		return false;
+	}
+	if (traceFilename.empty())
+	{
+		m_pack->stopTrace();
+		return true;
+	}
+	return m_pack->startTrace(traceFilename.c_str());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZpExplorer::createPatch(const zp::String& newPackagePath, const zp::String& patchPath)
+{
+	if (m_pack == NULL || newPackagePath.empty() || patchPath.empty())
+	{
+		return false;
+	}
+	zp::IPackage* newPack = zp::open(newPackagePath.c_str(), zp::OPEN_READONLY);
+	if (newPack == NULL)
+	{
+		return false;
+	}
+	bool ret = zp::createPatch(m_pack, newPack, patchPath.c_str());
+	zp::close(newPack);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZpExplorer::applyPatch(const zp::String& patchPath)
+{
+	if (m_pack == NULL || patchPath.empty())
+	{
+		return false;
+	}
+	bool ret = zp::applyPatch(m_pack, patchPath.c_str(), m_callback, m_callbackParam);
+	//files may be changed in any directory
+	zp::String packagePath = m_pack->packageFilename();
+	open(packagePath);
+	return ret;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 zp::IPackage* ZpExplorer::getPack() const
 {
@@ -200,7 +390,15 @@ bool ZpExplorer::add(const zp::String& srcPath, const zp::String& dstPath, bool
 	{
 		searchDirectory += DIR_STR;
 	}
-	bool ret = enumFile(searchDirectory, addPackFile, this);
+	bool ret = false;
+	if (m_threadCount != 1)
+	{
+		ret = enumFile(searchDirectory, collectPackFile, this) && addPendingFiles();
+	}
+	else
+	{
+		ret = enumFile(searchDirectory, addPackFile, this);
+	}
 	
 	::FindClose(findFile);
 
@@ -298,7 +496,13 @@ bool ZpExplorer::extract(const zp::String& srcPath, const zp::String& dstPath)
 	{
 		internalPath.resize(internalPath.size() - 1);
 	}
-	return extractRecursively(child, externalPath, internalPath);
+	m_pendingFiles.clear();
+	if (!extractRecursively(child, externalPath, internalPath))
+	{
+		m_pendingFiles.clear();
+		return false;
+	}
+	return extractPendingFiles();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -345,6 +549,11 @@ void ZpExplorer::build()
 		zp::Char buffer[256];
 		zp::u32 fileSize, compressSize, flag;
 		m_pack->getFileInfo(i, buffer, sizeof(buffer)/sizeof(zp::Char), &fileSize, &compressSize, &flag);
+		if ((flag & zp::FILE_INTERNAL) != 0)
+		{
+			//shared chunks etc.
+			continue;
+		}
 		zp::String filename = buffer;
 		for (zp::u32 i = 0; i < filename.length(); ++i)
 		{
@@ -363,9 +572,13 @@ void ZpExplorer::build()
 bool ZpExplorer::addFile(const zp::String& filename, const zp::String& relativePath, zp::u32 fileSize)
 {
 	zp::String internalName = m_workingPath + relativePath;
+	zp::u32 flag = zp::FILE_COMPRESS;
+	zp::u32 level = 0;
+	zp::u32 chunkSize = 0;
+	m_compressPolicy.apply(internalName, fileSize, flag, level, chunkSize);
+
 	zp::u32 compressSize = 0;
-	zp::u32 flag = 0;
-	if (!m_pack->addFile(internalName.c_str(), filename.c_str(), fileSize, zp::FILE_COMPRESS, &compressSize, &flag))
+	if (!m_pack->addFile(internalName.c_str(), filename.c_str(), fileSize, flag, &compressSize, &flag, chunkSize, level))
 	{
 		return false;
 	}
@@ -378,6 +591,40 @@ bool ZpExplorer::addFile(const zp::String& filename, const zp::String& relativeP
 	return true;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZpExplorer::addPendingFiles()
+{
+	zp::u32 fileCount = (zp::u32)m_pendingFiles.size();
+	vector<zp::String> internalNames(fileCount);
+	vector<zp::AddFileParam> params(fileCount);
+	for (zp::u32 i = 0; i < fileCount; ++i)
+	{
+		const PendingFile& file = m_pendingFiles[i];
+		internalNames[i] = m_workingPath + file.relativePath;
+		zp::AddFileParam& param = params[i];
+		param.filename = internalNames[i].c_str();
+		param.externalFilename = file.externalPath.c_str();
+		param.fileSize = file.fileSize;
+		param.flag = zp::FILE_COMPRESS;
+		param.chunkSize = 0;
+		param.compressLevel = 0;
+		m_compressPolicy.apply(internalNames[i], file.fileSize, param.flag, param.compressLevel, param.chunkSize);
+		param.outPackSize = 0;
+		param.outFlag = 0;
+	}
+	zp::u32 addedCount = 0;
+	if (fileCount > 0)
+	{
+		addedCount = m_pack->addFiles(&params[0], fileCount, m_callback, m_callbackParam);
+	}
+	for (zp::u32 i = 0; i < addedCount; ++i)
+	{
+		insertFileToTree(internalNames[i], params[i].fileSize, params[i].outPackSize, params[i].outFlag, true);
+	}
+	m_pendingFiles.clear();
+	return (addedCount == fileCount);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 bool ZpExplorer::extractFile(const zp::String& externalPath, const zp::String& internalPath)
 {
@@ -387,21 +634,69 @@ bool ZpExplorer::extractFile(const zp::String& externalPath, const zp::String& i
 	{
 		return false;
 	}
-	fstream stream;
-	locale loc = locale::global(locale(""));
-	stream.open(externalPath.c_str(), ios_base::out | ios_base::trunc | ios_base::binary);
-	locale::global(loc);
-	if (!stream.is_open())
+	//bypass system cache, large files would push everything else out of it
+	HANDLE dstFile = ::CreateFile(externalPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+									FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (dstFile == INVALID_HANDLE_VALUE)
 	{
+		m_pack->closeFile(file);
 		return false;
 	}
-	char* buffer = new char[file->size()];
-	zp::u32 readSize = file->read((zp::u8*)buffer, file->size());
-	stream.write(buffer, readSize);
-	stream.close();
+	//page aligned
+	zp::u8* buffer = (zp::u8*)::VirtualAlloc(NULL, EXTRACT_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	zp::u32 fileSize = file->size();
+	zp::u32 extractedSize = 0;
+	bool succeeded = (buffer != NULL);
+	while (succeeded && extractedSize < fileSize)
+	{
+		zp::u32 readSize = min(EXTRACT_BUFFER_SIZE, fileSize - extractedSize);
+		if (file->read(buffer, readSize) != readSize)
+		{
+			succeeded = false;
+			break;
+		}
+		//padding of last block is cut off below
+		DWORD writeSize = (readSize + EXTRACT_WRITE_ALIGN - 1) & ~(EXTRACT_WRITE_ALIGN - 1);
+		DWORD writtenSize = 0;
+		if (!::WriteFile(dstFile, buffer, writeSize, &writtenSize, NULL) || writtenSize != writeSize)
+		{
+			succeeded = false;
+			break;
+		}
+		extractedSize += readSize;
+	}
+	if (succeeded && fileSize % EXTRACT_WRITE_ALIGN != 0)
+	{
+		LARGE_INTEGER fileEnd;
+		fileEnd.QuadPart = fileSize;
+		succeeded = (::SetFilePointerEx(dstFile, fileEnd, NULL, FILE_BEGIN) && ::SetEndOfFile(dstFile));
+	}
+	::CloseHandle(dstFile);
+	if (buffer != NULL)
+	{
+		::VirtualFree(buffer, 0, MEM_RELEASE);
+	}
 	m_pack->closeFile(file);
-	delete [] buffer;
-	return true;
+	return succeeded;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZpExplorer::extractPendingFiles()
+{
+	zp::u32 fileCount = (zp::u32)m_pendingFiles.size();
+	vector<zp::ExtractFileParam> params(fileCount);
+	for (zp::u32 i = 0; i < fileCount; ++i)
+	{
+		params[i].filename = m_pendingFiles[i].relativePath.c_str();
+		params[i].externalFilename = m_pendingFiles[i].externalPath.c_str();
+	}
+	zp::u32 extractedCount = 0;
+	if (fileCount > 0)
+	{
+		extractedCount = m_pack->extractFiles(&params[0], fileCount, m_callback, m_callbackParam);
+	}
+	m_pendingFiles.clear();
+	return (extractedCount == fileCount);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -484,6 +779,16 @@ bool ZpExplorer::extractRecursively(ZpNode* node, zp::String externalPath, zp::S
 	externalPath += node->name;
 	if (!node->isDirectory)
 	{
+		if (m_threadCount != 1)
+		{
+			//extracted later in order of position in package
+			PendingFile file;
+			file.externalPath = externalPath;
+			file.relativePath = internalPath;
+			file.fileSize = (zp::u32)node->fileSize;
+			m_pendingFiles.push_back(file);
+			return true;
+		}
 		if (m_callback != NULL && !m_callback(internalPath.c_str(), (zp::u32)node->fileSize, m_callbackParam))
 		{
 			return false;
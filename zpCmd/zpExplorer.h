@@ -3,7 +3,9 @@
 
 #include <list>
 #include <string>
+#include <vector>
 #include "zpack.h"
+#include "compressPolicy.h"
 
 namespace zp
 {
@@ -35,6 +37,7 @@ class ZpExplorer
 {
 	friend bool addPackFile(const zp::String& filename, zp::u32 fileSize, void* param);
 	friend bool countFile(const zp::String& filename, zp::u32 fileSize, void* param);
+	friend bool collectPackFile(const zp::String& filename, zp::u32 fileSize, void* param);
 
 public:
 	ZpExplorer();
@@ -42,12 +45,34 @@ public:
 
 	void setCallback(zp::Callback callback, void* param);
 
+	//compress and decompress threads of package, 0 means one thread per cpu core
+	//if it's not 1, directories are added and extracted in parallel
+	void setThreadCount(zp::u32 count);
+
+	//decide compression of files added later, compress all files with default level if empty
+	CompressPolicy& compressPolicy();
+
 	bool open(const zp::String& path, bool readonly = false);
 	bool create(const zp::String& path, const zp::String& inputPath);
 	void close();
 	bool isOpen() const;
 
 	bool defrag();
+	//move at most maxMoveSize bytes in place, 0 means until finished
+	bool compact(zp::u64 maxMoveSize, bool* finished);
+	//rewrite package with files in order of opening in a trace file
+	//trace file is written by IPackage::startTrace(), or a text file with one filename per line
+	bool optimizeLayout(const zp::String& traceFilename);
+	//store files opened in a trace file (or listed in a text file) as warm set of package, and flush
+	//empty filename removes warm set
+	bool setWarmSet(const zp::String& traceFilename);
+	//record file access of current package, empty filename means stop
+	bool startTrace(const zp::String& traceFilename);
+
+	//write difference from current package to newPackagePath into a patch package
+	bool createPatch(const zp::String& newPackagePath, const zp::String& patchPath);
+	//update current package with a patch package, then reload it
+	bool applyPatch(const zp::String& patchPath);
 
 	zp::IPackage* getPack() const;
 
@@ -83,7 +108,14 @@ private:
 	void build();
 
 	bool addFile(const zp::String& externalPath, const zp::String& internalPath, zp::u32 fileSize);
+	bool addPendingFiles();
 	bool extractFile(const zp::String& externalPath, const zp::String& internalPath);
+	bool extractPendingFiles();
+
+	//text file, one filename per line
+	bool readFileList(const zp::String& listFilename, std::vector<zp::String>& filenames);
+	//files opened in trace file, or listed in text file
+	bool readAccessList(const zp::String& filename, std::vector<zp::String>& filenames);
 
 	void countChildRecursively(const ZpNode* node);
 
@@ -109,6 +141,13 @@ private:
 	void minusAncesterSize(ZpNode* node);
 
 private:
+	struct PendingFile
+	{
+		zp::String	externalPath;
+		zp::String	relativePath;
+		zp::u32		fileSize;
+	};
+
 	zp::IPackage*	m_pack;
 	ZpNode			m_root;
 	ZpNode*			m_currentNode;
@@ -117,6 +156,9 @@ private:
 	zp::String		m_basePath;		//base path of external path (of file system)
 	zp::Callback	m_callback;
 	void*			m_callbackParam;
+	zp::u32			m_threadCount;
+	CompressPolicy	m_compressPolicy;
+	std::vector<PendingFile>	m_pendingFiles;	//files to be added or extracted in parallel
 	//zp::u32			m_fileCount;
 	zp::u64			m_totalFileSize;
 };
@@ -1,17 +1,167 @@
 #include "zpack.h"
 #include "WriteCompressFile.h"
+#include "zpPlatform.h"
+#include "zpContentHash.h"
 #include "zlib.h"
+#include <cstring>
+#include <cmath>
 
 namespace zp
 {
 
+//bytes sampled to estimate entropy of a chunk, smaller chunks are always compressed
+const u32 ENTROPY_SAMPLE_SIZE = 0x1000;
+const u32 ENTROPY_SAMPLE_RUN = 0x100;
+//bits per byte, sampled random data is about 7.95
+const double MAX_COMPRESSIBLE_ENTROPY = 7.9;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-//also needed by hasher, make it global
-u32 writeCompressFile(FILE* dstFile, u64 offset, FILE* srcFile, u32 srcFileSize, u32 chunkSize, u32& flag,
-						std::vector<u8>& chunkData,	std::vector<u8>& compressBuffer, std::vector<u32>& chunkPosBuffer)
+bool isCompressedFormat(const u8* data, u32 size)
+{
+	struct FormatSign
+	{
+		u32			offset;
+		u32			length;
+		const char*	sign;
+	};
+	static const FormatSign signs[] =
+	{
+		{0, 4, "\x89PNG"},
+		{0, 3, "\xFF\xD8\xFF"},			//jpeg
+		{0, 4, "GIF8"},
+		{0, 4, "OggS"},
+		{0, 4, "fLaC"},
+		{0, 3, "ID3"},					//mp3
+		{4, 4, "ftyp"},					//mp4, mov, m4a
+		{0, 4, "\x1A\x45\xDF\xA3"},		//webm, mkv
+		{8, 4, "WEBP"},
+		{0, 4, "PK\x03\x04"},			//zip, jar, apk, docx
+		{0, 2, "\x1F\x8B"},				//gzip
+		{0, 6, "7z\xBC\xAF\x27\x1C"},
+		{0, 4, "Rar!"},
+		{0, 3, "BZh"},
+		{0, 6, "\xFD" "7zXZ\0"},
+		{0, 4, "\x28\xB5\x2F\xFD"},		//zstd
+		{0, 4, "ZPAK"},					//another zpack package
+	};
+	for (u32 i = 0; i < sizeof(signs) / sizeof(signs[0]); ++i)
+	{
+		const FormatSign& sign = signs[i];
+		if (size >= sign.offset + sign.length
+			&& memcmp(data + sign.offset, sign.sign, sign.length) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool isHighEntropy(const u8* data, u32 size)
+{
+	if (size < ENTROPY_SAMPLE_SIZE)
+	{
+		return false;
+	}
+	//several runs spread over the data, not only the beginning
+	u8 sample[ENTROPY_SAMPLE_SIZE];
+	u32 count[256] = {0};
+	u32 runCount = ENTROPY_SAMPLE_SIZE / ENTROPY_SAMPLE_RUN;
+	u32 runStride = (size - ENTROPY_SAMPLE_RUN) / (runCount - 1);
+	for (u32 run = 0; run < runCount; ++run)
+	{
+		const u8* runData = data + run * runStride;
+		memcpy(sample + run * ENTROPY_SAMPLE_RUN, runData, ENTROPY_SAMPLE_RUN);
+		for (u32 i = 0; i < ENTROPY_SAMPLE_RUN; ++i)
+		{
+			++count[runData[i]];
+		}
+	}
+	double entropy = 0;
+	for (u32 i = 0; i < 256; ++i)
+	{
+		if (count[i] != 0)
+		{
+			double p = (double)count[i] / ENTROPY_SAMPLE_SIZE;
+			entropy -= p * log(p);
+		}
+	}
+	entropy /= log(2.0);
+	if (entropy <= MAX_COMPRESSIBLE_ENTROPY)
+	{
+		return false;
+	}
+	//flat histogram may still have structure (counters, periodic tables), confirm by compressing the sample
+	u8 packed[ENTROPY_SAMPLE_SIZE];
+	u32 packedSize = ENTROPY_SAMPLE_SIZE - 1;
+	return (compress2(packed, &packedSize, sample, ENTROPY_SAMPLE_SIZE, 1) != Z_OK);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 compressChunk(u8* dstBuffer, u32 dstBufferSize, const u8* srcBuffer, u32 srcSize, u32 level, u32& skippedSize)
+{
+	if (isHighEntropy(srcBuffer, srcSize))
+	{
+		skippedSize += srcSize;
+		return srcSize;
+	}
+	u32 dstSize = dstBufferSize;
+	int zlibLevel = (level == 0) ? Z_DEFAULT_COMPRESSION : (level > Z_BEST_COMPRESSION ? Z_BEST_COMPRESSION : (int)level);
+	int ret = compress2(dstBuffer, &dstSize, srcBuffer, srcSize, zlibLevel);
+	if (ret != Z_OK	|| dstSize >= srcSize)
+	{
+		//compress failed or compressed size greater than origin, write raw data
+		return srcSize;
+	}
+	return dstSize;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 compressFileData(const u8* srcData, u32 srcSize, u32 chunkSize, u32 level, u32& flag, std::vector<u8>& dstData,
+						u32& skippedSize)
 {
-	_fseeki64(dstFile, offset, SEEK_SET);
+	u32 chunkCount = (srcSize + chunkSize - 1) / chunkSize;
+	u32 tableSize = (chunkCount > 1) ? chunkCount * sizeof(u32) : 0;
 
+	std::vector<u8> compressBuffer(chunkSize);
+	dstData.resize(tableSize);
+	for (u32 i = 0; i < chunkCount; ++i)
+	{
+		u32 chunkPos = dstData.size();
+		if (chunkCount > 1)
+		{
+			memcpy(&dstData[i * sizeof(u32)], &chunkPos, sizeof(u32));
+		}
+		u32 curChunkSize = chunkSize;
+		if (i == chunkCount - 1 && srcSize % chunkSize != 0)
+		{
+			curChunkSize = srcSize % chunkSize;
+		}
+		const u8* chunkData = srcData + i * chunkSize;
+		u32 dstSize = compressChunk(&compressBuffer[0], chunkSize, chunkData, curChunkSize, level, skippedSize);
+		if (dstSize == curChunkSize)
+		{
+			dstData.insert(dstData.end(), chunkData, chunkData + curChunkSize);
+		}
+		else
+		{
+			dstData.insert(dstData.end(), compressBuffer.begin(), compressBuffer.begin() + dstSize);
+		}
+	}
+	if (chunkCount == 1 && dstData.size() == srcSize)
+	{
+		flag &= (~FILE_COMPRESS);
+	}
+	return dstData.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//also needed by hasher, make it global
+u32 writeCompressFile(IStorage* dst, u64 offset, FILE* srcFile, u32 srcFileSize, u32 chunkSize, u32 level, u32& flag,
+						std::vector<u8>& chunkData,	std::vector<u8>& compressBuffer, std::vector<u32>& chunkPosBuffer,
+						u32& skippedSize, ContentHash& hash)
+{
+	u64 writePos = offset;
 	u32 chunkCount = (srcFileSize + chunkSize - 1) / chunkSize;
 	chunkPosBuffer.resize(chunkCount);
 
@@ -19,7 +169,7 @@ u32 writeCompressFile(FILE* dstFile, u64 offset, FILE* srcFile, u32 srcFileSize,
 	if (chunkCount > 1)
 	{
 		chunkPosBuffer[0] = chunkCount * sizeof(u32);
-		fwrite(&chunkPosBuffer[0], chunkCount * sizeof(u32), 1, dstFile);
+		writePos += dst->write(writePos, &chunkPosBuffer[0], chunkCount * sizeof(u32));
 	}
 
 	//BEGIN_PERF("compress");
@@ -33,19 +183,16 @@ u32 writeCompressFile(FILE* dstFile, u64 offset, FILE* srcFile, u32 srcFileSize,
 			curChunkSize = srcFileSize % chunkSize;
 		}
 		fread(&chunkData[0], curChunkSize, 1, srcFile);
+		hash.update(&chunkData[0], curChunkSize);
 
-		u32 dstSize = chunkSize;
-		int ret = compress(dstBuffer, &dstSize, &chunkData[0], curChunkSize);
-
-		if (ret != Z_OK	|| dstSize >= curChunkSize)
+		u32 dstSize = compressChunk(dstBuffer, chunkSize, &chunkData[0], curChunkSize, level, skippedSize);
+		if (dstSize == curChunkSize)
 		{
-			//compress failed or compressed size greater than origin, write raw data
-			fwrite(&chunkData[0], curChunkSize, 1, dstFile);
-			dstSize = curChunkSize;
+			writePos += dst->write(writePos, &chunkData[0], curChunkSize);
 		}
 		else
 		{
-			fwrite(dstBuffer, dstSize, 1, dstFile);
+			writePos += dst->write(writePos, dstBuffer, dstSize);
 		}
 		if (i + 1 < chunkCount)
 		{
@@ -59,8 +206,7 @@ u32 writeCompressFile(FILE* dstFile, u64 offset, FILE* srcFile, u32 srcFileSize,
 	if (chunkCount > 1)
 	{
 		packSize += chunkCount * sizeof(u32);
-		_fseeki64(dstFile, offset, SEEK_SET);
-		fwrite(&chunkPosBuffer[0], chunkCount * sizeof(u32), 1, dstFile);
+		dst->write(offset, &chunkPosBuffer[0], chunkCount * sizeof(u32));
 	}
 	else if (packSize == srcFileSize)
 	{
@@ -70,4 +216,222 @@ u32 writeCompressFile(FILE* dstFile, u64 offset, FILE* srcFile, u32 srcFileSize,
 	return packSize;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//parallel version, 1 reader thread, several compressor threads, caller thread writes chunks in order
+namespace
+{
+
+enum SlotState
+{
+	SLOT_FREE = 0,
+	SLOT_READ,
+	SLOT_COMPRESSING,
+	SLOT_COMPRESSED
+};
+
+struct CompressSlot
+{
+	std::vector<u8>	srcData;
+	std::vector<u8>	dstData;
+	u32				srcSize;
+	u32				dstSize;
+	u32				skippedSize;
+	SlotState		state;
+};
+
+struct CompressPipeline
+{
+	Mutex						mutex;
+	Condition					cond;
+	std::vector<CompressSlot>	slots;
+	FILE*						srcFile;
+	ContentHash*				hash;			//updated by reader thread, chunks are read in order
+	u32							srcFileSize;
+	u32							chunkSize;
+	u32							level;
+	u32							chunkCount;
+	u32							nextCompress;	//next chunk to be picked by compressor threads
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void readerProc(void* param)
+{
+	CompressPipeline* pipeline = reinterpret_cast<CompressPipeline*>(param);
+	u32 slotCount = pipeline->slots.size();
+	for (u32 i = 0; i < pipeline->chunkCount; ++i)
+	{
+		CompressSlot& slot = pipeline->slots[i % slotCount];
+		{
+			MutexLock lock(pipeline->mutex);
+			while (slot.state != SLOT_FREE)
+			{
+				pipeline->cond.wait(pipeline->mutex);
+			}
+		}
+		//slot is owned by reader until it's marked as read
+		u32 curChunkSize = pipeline->chunkSize;
+		if (i == pipeline->chunkCount - 1 && pipeline->srcFileSize % pipeline->chunkSize != 0)
+		{
+			curChunkSize = pipeline->srcFileSize % pipeline->chunkSize;
+		}
+		fread(&slot.srcData[0], curChunkSize, 1, pipeline->srcFile);
+		pipeline->hash->update(&slot.srcData[0], curChunkSize);
+		slot.srcSize = curChunkSize;
+
+		MutexLock lock(pipeline->mutex);
+		slot.state = SLOT_READ;
+		pipeline->cond.broadcast();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void compressorProc(void* param)
+{
+	CompressPipeline* pipeline = reinterpret_cast<CompressPipeline*>(param);
+	u32 slotCount = pipeline->slots.size();
+	while (true)
+	{
+		CompressSlot* slot = NULL;
+		{
+			MutexLock lock(pipeline->mutex);
+			while (pipeline->nextCompress < pipeline->chunkCount
+				&& pipeline->slots[pipeline->nextCompress % slotCount].state != SLOT_READ)
+			{
+				pipeline->cond.wait(pipeline->mutex);
+			}
+			if (pipeline->nextCompress >= pipeline->chunkCount)
+			{
+				return;
+			}
+			slot = &pipeline->slots[pipeline->nextCompress % slotCount];
+			slot->state = SLOT_COMPRESSING;
+			++pipeline->nextCompress;
+			//other compressors may be waiting for next slot
+			pipeline->cond.broadcast();
+		}
+		slot->skippedSize = 0;
+		slot->dstSize = compressChunk(&slot->dstData[0], pipeline->chunkSize, &slot->srcData[0], slot->srcSize,
+										pipeline->level, slot->skippedSize);
+
+		MutexLock lock(pipeline->mutex);
+		slot->state = SLOT_COMPRESSED;
+		pipeline->cond.broadcast();
+	}
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 writeCompressFileParallel(IStorage* dst, u64 offset, FILE* srcFile, u32 srcFileSize, u32 chunkSize, u32 level,
+								u32& flag, std::vector<u32>& chunkPosBuffer, u32 threadCount, u32& skippedSize,
+								ContentHash& hash)
+{
+	u64 writePos = offset;
+	u32 chunkCount = (srcFileSize + chunkSize - 1) / chunkSize;
+	chunkPosBuffer.resize(chunkCount);
+
+	u32 packSize = 0;
+	if (chunkCount > 1)
+	{
+		chunkPosBuffer[0] = chunkCount * sizeof(u32);
+		writePos += dst->write(writePos, &chunkPosBuffer[0], chunkCount * sizeof(u32));
+	}
+
+	CompressPipeline pipeline;
+	pipeline.srcFile = srcFile;
+	pipeline.hash = &hash;
+	pipeline.srcFileSize = srcFileSize;
+	pipeline.chunkSize = chunkSize;
+	pipeline.level = level;
+	pipeline.chunkCount = chunkCount;
+	pipeline.nextCompress = 0;
+	//2 slots for each compressor, so reader and writer always have something to do
+	pipeline.slots.resize(threadCount * 2);
+	for (u32 i = 0; i < pipeline.slots.size(); ++i)
+	{
+		CompressSlot& slot = pipeline.slots[i];
+		slot.srcData.resize(chunkSize);
+		slot.dstData.resize(chunkSize);
+		slot.srcSize = 0;
+		slot.dstSize = 0;
+		slot.skippedSize = 0;
+		slot.state = SLOT_FREE;
+	}
+
+	Thread reader;
+	Thread* compressors = new Thread[threadCount];
+	u32 startedCount = 0;
+	for (u32 i = 0; i < threadCount; ++i)
+	{
+		if (compressors[i].start(compressorProc, &pipeline))
+		{
+			++startedCount;
+		}
+	}
+	if (startedCount == 0 || !reader.start(readerProc, &pipeline))
+	{
+		//can't create threads, stop those started and do it in this thread
+		{
+			MutexLock lock(pipeline.mutex);
+			pipeline.nextCompress = chunkCount;
+			pipeline.cond.broadcast();
+		}
+		delete[] compressors;
+		std::vector<u8> chunkData(chunkSize);
+		std::vector<u8> compressBuffer(chunkSize);
+		return writeCompressFile(dst, offset, srcFile, srcFileSize, chunkSize, level, flag,
+								chunkData, compressBuffer, chunkPosBuffer, skippedSize, hash);
+	}
+
+	u32 slotCount = pipeline.slots.size();
+	for (u32 i = 0; i < chunkCount; ++i)
+	{
+		CompressSlot& slot = pipeline.slots[i % slotCount];
+		{
+			MutexLock lock(pipeline.mutex);
+			while (slot.state != SLOT_COMPRESSED)
+			{
+				pipeline.cond.wait(pipeline.mutex);
+			}
+		}
+		u32 dstSize = slot.dstSize;
+		if (dstSize == slot.srcSize)
+		{
+			writePos += dst->write(writePos, &slot.srcData[0], dstSize);
+		}
+		else
+		{
+			writePos += dst->write(writePos, &slot.dstData[0], dstSize);
+		}
+		if (i + 1 < chunkCount)
+		{
+			chunkPosBuffer[i + 1] = chunkPosBuffer[i] + dstSize;
+		}
+		packSize += dstSize;
+		skippedSize += slot.skippedSize;
+
+		MutexLock lock(pipeline.mutex);
+		slot.state = SLOT_FREE;
+		pipeline.cond.broadcast();
+	}
+
+	reader.join();
+	for (u32 i = 0; i < threadCount; ++i)
+	{
+		compressors[i].join();
+	}
+	delete[] compressors;
+
+	if (chunkCount > 1)
+	{
+		packSize += chunkCount * sizeof(u32);
+		dst->write(offset, &chunkPosBuffer[0], chunkCount * sizeof(u32));
+	}
+	else if (packSize == srcFileSize)
+	{
+		flag &= (~FILE_COMPRESS);
+	}
+	return packSize;
+}
+
 }
@@ -2,12 +2,41 @@
 #define __ZP_WRITE_COMPRESS_FILE_H__
 
 #include <vector>
+#include "stdio.h"
 
 namespace zp
 {
 
-u32 writeCompressFile(FILE* dstFile, u64 offset, FILE* srcFile, u32 srcFileSize, u32 chunkSize, u32& flag,
-						std::vector<u8>& chunkData,	std::vector<u8>& compressBuffer, std::vector<u32>& chunkPosBuffer);
+class ContentHash;
+
+//minimum data size to check file format
+const u32 FORMAT_SIGN_SIZE = 16;
+
+//file begins with signature of an already compressed format (png, ogg, mp4, zip...)
+bool isCompressedFormat(const u8* data, u32 size);
+
+//sample bytes of data, return true if they are close to random and a fast compression of them doesn't shrink
+//no need to compress then
+bool isHighEntropy(const u8* data, u32 size);
+
+//return compressed size, or srcSize if chunk should be stored without compression
+//level is zlib compression level, 0 means default level
+//skippedSize is increased by srcSize if compression is not even tried
+u32 compressChunk(u8* dstBuffer, u32 dstBufferSize, const u8* srcBuffer, u32 srcSize, u32 level, u32& skippedSize);
+
+//compress data in memory, output has the same layout as writeCompressFile
+u32 compressFileData(const u8* srcData, u32 srcSize, u32 chunkSize, u32 level, u32& flag, std::vector<u8>& dstData,
+						u32& skippedSize);
+
+//chunks are written to dst at offset, hash is updated with source data as it's read
+u32 writeCompressFile(IStorage* dst, u64 offset, FILE* srcFile, u32 srcFileSize, u32 chunkSize, u32 level, u32& flag,
+						std::vector<u8>& chunkData,	std::vector<u8>& compressBuffer, std::vector<u32>& chunkPosBuffer,
+						u32& skippedSize, ContentHash& hash);
+
+//same output as writeCompressFile, chunks are compressed by threadCount threads
+u32 writeCompressFileParallel(IStorage* dst, u64 offset, FILE* srcFile, u32 srcFileSize, u32 chunkSize, u32 level,
+								u32& flag, std::vector<u32>& chunkPosBuffer, u32 threadCount, u32& skippedSize,
+								ContentHash& hash);
 
 }
 
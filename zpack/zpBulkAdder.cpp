@@ -0,0 +1,249 @@
+#include "zpBulkAdder.h"
+#include "zpPackage.h"
+#include "WriteCompressFile.h"
+#include "zpContentHash.h"
+#include <cassert>
+
+namespace zp
+{
+
+//larger files are compressed chunk by chunk by Package::addFile
+//uncompressed files are always added by Package::addFile, which copies them inside kernel
+//so are chunked files, chunks must be looked up and stored one by one
+const u32 MAX_BULK_FILE_SIZE = 0x1000000;
+//memory limit of files read but not written yet
+const u64 BULK_MEMORY_LIMIT = 0x10000000;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+BulkAdder::BulkAdder(Package* package, AddFileParam* files, u32 fileCount, u32 threadCount)
+	: m_package(package)
+	, m_files(files)
+	, m_fileCount(fileCount)
+	, m_threadCount(threadCount)
+	, m_nextJob(0)
+	, m_memoryInUse(0)
+	, m_stop(false)
+{
+	assert(package != NULL);
+	assert(threadCount > 0);
+
+	m_jobs.resize(fileCount);
+	for (u32 i = 0; i < fileCount; ++i)
+	{
+		Job& job = m_jobs[i];
+		job.flag = m_files[i].flag;
+		job.contentHash = 0;
+		job.skippedSize = 0;
+		job.reservedSize = 0;
+		bool direct = (m_files[i].fileSize > MAX_BULK_FILE_SIZE || (m_files[i].flag & FILE_COMPRESS) == 0
+						|| (m_files[i].flag & FILE_CHUNKED) != 0);
+		job.state = direct ? JOB_DIRECT : JOB_PENDING;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+BulkAdder::~BulkAdder()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 BulkAdder::run(Callback callback, void* callbackParam)
+{
+	Thread* workers = new Thread[m_threadCount];
+	u32 startedCount = 0;
+	for (u32 i = 0; i < m_threadCount; ++i)
+	{
+		if (workers[i].start(workerProc, this))
+		{
+			++startedCount;
+		}
+	}
+	if (startedCount == 0)
+	{
+		//can't create threads, add all files one by one in this thread
+		for (u32 i = 0; i < m_fileCount; ++i)
+		{
+			m_jobs[i].state = JOB_DIRECT;
+		}
+	}
+
+	u32 addedCount = 0;
+	for (u32 i = 0; i < m_fileCount; ++i)
+	{
+		Job& job = m_jobs[i];
+		{
+			MutexLock lock(m_mutex);
+			while (job.state == JOB_PENDING || job.state == JOB_WORKING)
+			{
+				m_cond.wait(m_mutex);
+			}
+		}
+		bool succeeded = (job.state != JOB_FAILED && commit(m_files[i], job));
+		{
+			MutexLock lock(m_mutex);
+			m_memoryInUse -= job.reservedSize;
+			job.reservedSize = 0;
+			std::vector<u8>().swap(job.data);
+			m_cond.broadcast();
+		}
+		if (!succeeded)
+		{
+			break;
+		}
+		++addedCount;
+		if (callback != NULL && !callback(m_files[i].filename, m_files[i].fileSize, callbackParam))
+		{
+			break;
+		}
+	}
+
+	{
+		MutexLock lock(m_mutex);
+		m_stop = true;
+		m_cond.broadcast();
+	}
+	for (u32 i = 0; i < m_threadCount; ++i)
+	{
+		workers[i].join();
+	}
+	delete[] workers;
+	return addedCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BulkAdder::workerProc(void* param)
+{
+	reinterpret_cast<BulkAdder*>(param)->work();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BulkAdder::work()
+{
+	//files are small here, reading ahead in background is not worth a thread
+	DirectReader directReader(false);
+	DirectReader* reader = m_package->m_directIO ? &directReader : NULL;
+	while (true)
+	{
+		u32 jobIndex = 0;
+		{
+			MutexLock lock(m_mutex);
+			while (true)
+			{
+				while (m_nextJob < m_fileCount && m_jobs[m_nextJob].state == JOB_DIRECT)
+				{
+					++m_nextJob;
+				}
+				if (m_stop || m_nextJob >= m_fileCount)
+				{
+					return;
+				}
+				//source data and compressed data
+				u64 requireSize = (u64)m_files[m_nextJob].fileSize * 2;
+				if (m_memoryInUse == 0 || m_memoryInUse + requireSize <= BULK_MEMORY_LIMIT)
+				{
+					break;
+				}
+				m_cond.wait(m_mutex);
+			}
+			jobIndex = m_nextJob++;
+			Job& job = m_jobs[jobIndex];
+			job.state = JOB_WORKING;
+			job.reservedSize = m_files[jobIndex].fileSize * 2;
+			m_memoryInUse += job.reservedSize;
+		}
+		Job& job = m_jobs[jobIndex];
+		bool succeeded = prepare(m_files[jobIndex], job, reader);
+
+		MutexLock lock(m_mutex);
+		job.state = succeeded ? JOB_READY : JOB_FAILED;
+		m_cond.broadcast();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool BulkAdder::prepare(const AddFileParam& file, Job& job, DirectReader* reader)
+{
+	std::vector<u8> srcData(file.fileSize);
+	if (reader != NULL)
+	{
+		bool succeeded = reader->open(file.externalFilename)
+						&& (file.fileSize == 0 || reader->read(0, &srcData[0], file.fileSize));
+		reader->close();
+		if (!succeeded)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		FILE* stream = Fopen(file.externalFilename, _T("rb"));
+		if (stream == NULL)
+		{
+			return false;
+		}
+		if (file.fileSize > 0 && fread(&srcData[0], file.fileSize, 1, stream) != 1)
+		{
+			fclose(stream);
+			return false;
+		}
+		fclose(stream);
+	}
+
+	job.contentHash = (file.fileSize == 0) ? 0 : contentHash(&srcData[0], file.fileSize);
+	if (file.fileSize == 0)
+	{
+		job.flag &= (~FILE_COMPRESS);
+	}
+	else if ((job.flag & FILE_COMPRESS) != 0 && isCompressedFormat(&srcData[0], file.fileSize))
+	{
+		job.flag &= (~FILE_COMPRESS);
+		job.skippedSize = file.fileSize;
+	}
+	if ((job.flag & FILE_COMPRESS) == 0)
+	{
+		job.data.swap(srcData);
+		return true;
+	}
+	u32 chunkSize = (file.chunkSize == 0) ? m_package->m_header.chunkSize : file.chunkSize;
+	compressFileData(&srcData[0], file.fileSize, chunkSize, file.compressLevel, job.flag, job.data, job.skippedSize);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool BulkAdder::commit(AddFileParam& file, Job& job)
+{
+	if (job.state == JOB_DIRECT)
+	{
+		return m_package->addFile(file.filename, file.externalFilename, file.fileSize, file.flag,
+									&file.outPackSize, &file.outFlag, file.chunkSize, file.compressLevel);
+	}
+	u32 chunkSize = (file.chunkSize == 0) ? m_package->m_header.chunkSize : file.chunkSize;
+	const u8* data = job.data.empty() ? NULL : &job.data[0];
+	int sameIndex = m_package->findSameContent(job.contentHash, file.fileSize);
+	if (sameIndex >= 0)
+	{
+		//identical file may be added after job is prepared, source is read again only if hash is the same
+		FILE* stream = Fopen(file.externalFilename, _T("rb"));
+		bool same = (stream != NULL && m_package->isSameContent(sameIndex, stream, NULL));
+		if (stream != NULL)
+		{
+			fclose(stream);
+		}
+		if (same)
+		{
+			return m_package->addSharedFile(file.filename, file.flag, sameIndex, &file.outPackSize, &file.outFlag);
+		}
+	}
+	job.flag |= FILE_HASHED;
+	if (!m_package->writeFileData(file.filename, file.fileSize, job.flag, chunkSize, data, job.data.size(),
+									job.contentHash))
+	{
+		return false;
+	}
+	file.outPackSize = job.data.size();
+	file.outFlag = job.flag;
+	m_package->m_skippedCompressSize += job.skippedSize;
+	return true;
+}
+
+}
@@ -0,0 +1,68 @@
+#ifndef __ZP_BULK_ADDER_H__
+#define __ZP_BULK_ADDER_H__
+
+#include "zpack.h"
+#include "zpPlatform.h"
+#include "zpDirectIO.h"
+#include <vector>
+
+namespace zp
+{
+
+class Package;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//worker threads read and compress files, caller thread writes them to package in array order
+class BulkAdder
+{
+public:
+	BulkAdder(Package* package, AddFileParam* files, u32 fileCount, u32 threadCount);
+	~BulkAdder();
+
+	u32 run(Callback callback, void* callbackParam);
+
+private:
+	enum JobState
+	{
+		JOB_PENDING = 0,
+		JOB_WORKING,
+		JOB_READY,
+		JOB_FAILED,
+		JOB_DIRECT		//large or uncompressed file, written by Package::addFile
+	};
+
+	struct Job
+	{
+		std::vector<u8>	data;
+		u32				flag;
+		u64				contentHash;
+		u32				skippedSize;	//bytes not compressed because they seem incompressible
+		u32				reservedSize;
+		JobState		state;
+	};
+
+	static void workerProc(void* param);
+
+	void work();
+
+	//reader is NULL if direct I/O is not enabled
+	bool prepare(const AddFileParam& file, Job& job, DirectReader* reader);
+
+	bool commit(AddFileParam& file, Job& job);
+
+private:
+	Package*			m_package;
+	AddFileParam*		m_files;
+	u32					m_fileCount;
+	u32					m_threadCount;
+	std::vector<Job>	m_jobs;
+	Mutex				m_mutex;
+	Condition			m_cond;
+	u32					m_nextJob;		//next job to be picked by worker threads
+	u64					m_memoryInUse;	//bytes held by jobs not written yet
+	bool				m_stop;
+};
+
+}
+
+#endif
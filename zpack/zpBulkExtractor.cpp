@@ -0,0 +1,460 @@
+#include "zpBulkExtractor.h"
+#include "zlib.h"
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+namespace zp
+{
+
+//larger files are read and decompressed chunk by chunk by caller thread, so are chunked files
+const u32 MAX_EXTRACT_FILE_SIZE = 0x1000000;
+//memory limit of packed data read but not written yet
+const u64 EXTRACT_MEMORY_LIMIT = 0x10000000;
+//buffer of files extracted by caller thread, a multiple of usual chunk sizes
+const u32 DIRECT_BUFFER_SIZE = 0x100000;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//extracted file written through stdio or DirectWriter
+class ExtractedFile
+{
+public:
+	ExtractedFile(DirectWriter* writer) : m_writer(writer), m_file(NULL){}
+	~ExtractedFile(){close();}
+
+	bool open(const Char* filename)
+	{
+		if (m_writer != NULL)
+		{
+			return m_writer->open(filename);
+		}
+		m_file = Fopen(filename, _T("wb"));
+		return (m_file != NULL);
+	}
+
+	bool write(const void* data, u32 size)
+	{
+		if (m_writer != NULL)
+		{
+			return m_writer->write(data, size);
+		}
+		return (size == 0 || fwrite(data, size, 1, m_file) == 1);
+	}
+
+	bool close()
+	{
+		if (m_writer != NULL)
+		{
+			return m_writer->close();
+		}
+		bool succeeded = (m_file == NULL || fclose(m_file) == 0);
+		m_file = NULL;
+		return succeeded;
+	}
+
+	//NULL if written through DirectWriter
+	FILE* getStream()
+	{
+		return m_file;
+	}
+
+private:
+	DirectWriter*	m_writer;
+	FILE*			m_file;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+BulkExtractor::BulkExtractor(Package* package, const ExtractFileParam* files, u32 fileCount, u32 threadCount)
+	: m_package(package)
+	, m_threadCount(threadCount)
+	, m_nextJob(0)
+	, m_reportedCount(0)
+	, m_memoryInUse(0)
+	, m_directIO(package->m_directIO)
+	, m_stop(false)
+{
+	assert(package != NULL);
+	assert(threadCount > 0);
+
+	m_jobs.resize(fileCount);
+	for (u32 i = 0; i < fileCount; ++i)
+	{
+		Job& job = m_jobs[i];
+		job.file = &files[i];
+		job.entryIndex = m_package->getFileIndex(files[i].filename);
+		if (job.entryIndex >= 0)
+		{
+			job.entry = m_package->getFileEntry(job.entryIndex);
+		}
+		else
+		{
+			memset(&job.entry, 0, sizeof(job.entry));
+		}
+		job.reservedSize = 0;
+		job.direct = (job.entry.originSize > MAX_EXTRACT_FILE_SIZE || (job.entry.flag & FILE_CHUNKED) != 0);
+		job.state = JOB_PENDING;
+	}
+	//read package from beginning to end
+	std::stable_sort(m_jobs.begin(), m_jobs.end(), compareOffset);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+BulkExtractor::~BulkExtractor()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool BulkExtractor::compareOffset(const Job& left, const Job& right)
+{
+	return left.entry.byteOffset < right.entry.byteOffset;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 BulkExtractor::run(Callback callback, void* callbackParam)
+{
+	if (m_directIO)
+	{
+		//package not in a file is read through its storage
+		m_package->m_storage->sync();
+		m_directIO = (m_package->m_fileStorage != NULL && m_reader.open(m_package->m_packageFilename.c_str()));
+	}
+	if (!m_directIO)
+	{
+		m_package->adviseStorage(0, 0, ADVISE_SEQUENTIAL);
+	}
+	Thread* workers = new Thread[m_threadCount];
+	u32 startedCount = 0;
+	for (u32 i = 0; i < m_threadCount; ++i)
+	{
+		if (workers[i].start(workerProc, this))
+		{
+			++startedCount;
+		}
+	}
+	if (startedCount == 0)
+	{
+		//can't create threads, extract all files one by one in this thread
+		for (u32 i = 0; i < m_jobs.size(); ++i)
+		{
+			m_jobs[i].direct = true;
+		}
+	}
+
+	u32 jobCount = (u32)m_jobs.size();
+	u32 readCount = 0;
+	bool stopped = false;
+	for (; readCount < jobCount; ++readCount)
+	{
+		if (!reportJobs(readCount, false, callback, callbackParam))
+		{
+			stopped = true;
+			break;
+		}
+		Job& job = m_jobs[readCount];
+		bool succeeded = false;
+		if (job.entryIndex < 0 || job.entry.availableSize < job.entry.packSize)
+		{
+			//not found or still being written
+			succeeded = false;
+		}
+		else if (job.direct)
+		{
+			succeeded = extractDirect(job);
+		}
+		else
+		{
+			u32 requireSize = job.entry.packSize;
+			if ((job.entry.flag & FILE_COMPRESS) != 0)
+			{
+				//decompress buffer of one chunk
+				u32 chunkSize = (job.entry.chunkSize == 0) ? m_package->m_header.chunkSize : job.entry.chunkSize;
+				requireSize += std::min(job.entry.originSize, chunkSize);
+			}
+			{
+				MutexLock lock(m_mutex);
+				while (m_memoryInUse != 0 && m_memoryInUse + requireSize > EXTRACT_MEMORY_LIMIT)
+				{
+					m_cond.wait(m_mutex);
+				}
+				job.reservedSize = requireSize;
+				m_memoryInUse += requireSize;
+			}
+			succeeded = readPackedData(job);
+		}
+
+		MutexLock lock(m_mutex);
+		if (succeeded)
+		{
+			job.state = job.direct ? JOB_DONE : JOB_READY;
+		}
+		else
+		{
+			job.state = JOB_FAILED;
+			m_memoryInUse -= job.reservedSize;
+			job.reservedSize = 0;
+			std::vector<u8>().swap(job.data);
+		}
+		m_cond.broadcast();
+		if (!succeeded)
+		{
+			++readCount;
+			break;
+		}
+	}
+	if (!stopped)
+	{
+		reportJobs(readCount, true, callback, callbackParam);
+	}
+
+	{
+		MutexLock lock(m_mutex);
+		m_stop = true;
+		m_cond.broadcast();
+	}
+	for (u32 i = 0; i < m_threadCount; ++i)
+	{
+		workers[i].join();
+	}
+	delete[] workers;
+	if (m_directIO)
+	{
+		m_reader.close();
+	}
+	else
+	{
+		m_package->adviseStorage(0, 0, ADVISE_NORMAL);
+	}
+	return m_reportedCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool BulkExtractor::reportJobs(u32 endJob, bool wait, Callback callback, void* callbackParam)
+{
+	while (m_reportedCount < endJob)
+	{
+		Job& job = m_jobs[m_reportedCount];
+		{
+			MutexLock lock(m_mutex);
+			while (wait && (job.state == JOB_READY || job.state == JOB_WORKING))
+			{
+				m_cond.wait(m_mutex);
+			}
+			if (job.state != JOB_DONE)
+			{
+				return (job.state != JOB_FAILED);
+			}
+		}
+		++m_reportedCount;
+		if (callback != NULL && !callback(job.file->filename, job.entry.originSize, callbackParam))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool BulkExtractor::readPackedData(Job& job)
+{
+	const FileEntry& entry = job.entry;
+	job.data.resize(entry.packSize);
+	if (m_directIO)
+	{
+		if (entry.packSize > 0 && !m_reader.read(entry.byteOffset, &job.data[0], entry.packSize))
+		{
+			return false;
+		}
+		m_package->addStatistic(m_package->m_statistics.rawReadSize, entry.packSize);
+		return true;
+	}
+	if (entry.packSize > 0 && !m_package->readStorage(entry.byteOffset, &job.data[0], entry.packSize))
+	{
+		return false;
+	}
+	m_package->addStatistic(m_package->m_statistics.rawReadSize, entry.packSize);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool BulkExtractor::extractDirect(Job& job)
+{
+	DirectWriter writer;
+	ExtractedFile dstFile(m_directIO ? &writer : NULL);
+	if (!dstFile.open(job.file->externalFilename))
+	{
+		return false;
+	}
+	u32 fileSize = job.entry.originSize;
+	u32 extractedSize = 0;
+	bool raw = ((job.entry.flag & (FILE_COMPRESS | FILE_CHUNKED)) == 0);
+	if (raw && !m_directIO && m_package->m_fileStorage != NULL)
+	{
+		//let kernel move the bytes if possible
+		extractedSize = (u32)copyFileRange(dstFile.getStream(), 0, m_package->m_fileStorage->getStream(),
+											job.entry.byteOffset, fileSize);
+		_fseeki64(dstFile.getStream(), extractedSize, SEEK_SET);
+	}
+	std::vector<u8> buffer;
+	bool succeeded = true;
+	if (raw && m_directIO)
+	{
+		buffer.resize(DIRECT_BUFFER_SIZE);
+		while (extractedSize < fileSize)
+		{
+			u32 readSize = std::min(DIRECT_BUFFER_SIZE, fileSize - extractedSize);
+			if (!m_reader.read(job.entry.byteOffset + extractedSize, &buffer[0], readSize)
+				|| !dstFile.write(&buffer[0], readSize))
+			{
+				succeeded = false;
+				break;
+			}
+			extractedSize += readSize;
+		}
+		m_package->addStatistic(m_package->m_statistics.rawReadSize, extractedSize);
+	}
+	IReadFile* file = NULL;
+	if (succeeded && extractedSize < fileSize)
+	{
+		file = m_package->openFileEntry(job.entryIndex);
+		succeeded = (file != NULL);
+	}
+	if (file != NULL)
+	{
+		buffer.resize(DIRECT_BUFFER_SIZE);
+		file->seek(extractedSize);
+		while (extractedSize < fileSize)
+		{
+			u32 readSize = std::min(DIRECT_BUFFER_SIZE, fileSize - extractedSize);
+			if (file->read(&buffer[0], readSize) != readSize || !dstFile.write(&buffer[0], readSize))
+			{
+				succeeded = false;
+				break;
+			}
+			extractedSize += readSize;
+		}
+		m_package->closeFile(file);
+		if (m_directIO)
+		{
+			//compressed data is read through package stream, don't keep it in cache
+			m_package->adviseStorage(job.entry.byteOffset, job.entry.packSize, ADVISE_DONTNEED);
+		}
+	}
+	if (!dstFile.close())
+	{
+		succeeded = false;
+	}
+	return succeeded;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BulkExtractor::workerProc(void* param)
+{
+	reinterpret_cast<BulkExtractor*>(param)->work();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BulkExtractor::work()
+{
+	std::vector<u8> chunkBuffer;
+	//files are small here, writing in background is not worth a thread
+	DirectWriter directWriter(false);
+	DirectWriter* writer = m_directIO ? &directWriter : NULL;
+	u32 jobCount = (u32)m_jobs.size();
+	while (true)
+	{
+		u32 jobIndex = 0;
+		{
+			MutexLock lock(m_mutex);
+			while (true)
+			{
+				//direct and failed jobs are finished by caller thread
+				while (m_nextJob < jobCount
+					&& (m_jobs[m_nextJob].state == JOB_DONE || m_jobs[m_nextJob].state == JOB_FAILED))
+				{
+					++m_nextJob;
+				}
+				if (m_stop || m_nextJob >= jobCount)
+				{
+					return;
+				}
+				if (m_jobs[m_nextJob].state == JOB_READY)
+				{
+					break;
+				}
+				m_cond.wait(m_mutex);
+			}
+			jobIndex = m_nextJob++;
+			m_jobs[jobIndex].state = JOB_WORKING;
+		}
+		Job& job = m_jobs[jobIndex];
+		bool succeeded = writeFile(job, chunkBuffer, writer);
+
+		MutexLock lock(m_mutex);
+		job.state = succeeded ? JOB_DONE : JOB_FAILED;
+		m_memoryInUse -= job.reservedSize;
+		job.reservedSize = 0;
+		std::vector<u8>().swap(job.data);
+		m_cond.broadcast();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool BulkExtractor::writeFile(Job& job, std::vector<u8>& chunkBuffer, DirectWriter* writer)
+{
+	const FileEntry& entry = job.entry;
+	ExtractedFile dstFile(writer);
+	if (!dstFile.open(job.file->externalFilename))
+	{
+		return false;
+	}
+	const u8* data = job.data.empty() ? NULL : &job.data[0];
+	u32 chunkSize = (entry.chunkSize == 0) ? m_package->m_header.chunkSize : entry.chunkSize;
+	u32 chunkCount = (entry.originSize + chunkSize - 1) / chunkSize;
+	bool succeeded = true;
+	if ((entry.flag & FILE_COMPRESS) == 0 || entry.packSize == entry.originSize)
+	{
+		succeeded = dstFile.write(data, entry.packSize);
+	}
+	else if (chunkCount <= 1)
+	{
+		chunkBuffer.resize(chunkSize);
+		u32 dstSize = entry.originSize;
+		succeeded = (m_package->uncompressData(&chunkBuffer[0], &dstSize, data, entry.packSize, entry.nameHash) == Z_OK
+					&& dstSize == entry.originSize && dstFile.write(&chunkBuffer[0], dstSize));
+	}
+	else
+	{
+		//raw data position of each chunk, followed by chunks
+		const u32* chunkPos = reinterpret_cast<const u32*>(data);
+		succeeded = (entry.packSize >= chunkCount * sizeof(u32) && chunkPos[0] == chunkCount * sizeof(u32));
+		chunkBuffer.resize(chunkSize);
+		for (u32 i = 0; succeeded && i < chunkCount; ++i)
+		{
+			u32 chunkEnd = (i + 1 < chunkCount) ? chunkPos[i + 1] : entry.packSize;
+			if (chunkEnd <= chunkPos[i] || chunkEnd > entry.packSize)
+			{
+				succeeded = false;
+				break;
+			}
+			u32 packedChunkSize = chunkEnd - chunkPos[i];
+			u32 originChunkSize = (i + 1 < chunkCount) ? chunkSize : entry.originSize - i * chunkSize;
+			if (packedChunkSize == originChunkSize)
+			{
+				//this chunk was not compressed at all
+				succeeded = dstFile.write(data + chunkPos[i], originChunkSize);
+				continue;
+			}
+			u32 dstSize = originChunkSize;
+			succeeded = (m_package->uncompressData(&chunkBuffer[0], &dstSize, data + chunkPos[i], packedChunkSize,
+													entry.nameHash) == Z_OK
+						&& dstSize == originChunkSize && dstFile.write(&chunkBuffer[0], dstSize));
+		}
+	}
+	if (!dstFile.close())
+	{
+		succeeded = false;
+	}
+	return succeeded;
+}
+
+}
@@ -0,0 +1,76 @@
+#ifndef __ZP_BULK_EXTRACTOR_H__
+#define __ZP_BULK_EXTRACTOR_H__
+
+#include "zpack.h"
+#include "zpPackage.h"
+#include "zpPlatform.h"
+#include "zpDirectIO.h"
+#include <vector>
+
+namespace zp
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//caller thread reads packed data in order of position in package, worker threads decompress and write files
+class BulkExtractor
+{
+public:
+	BulkExtractor(Package* package, const ExtractFileParam* files, u32 fileCount, u32 threadCount);
+	~BulkExtractor();
+
+	u32 run(Callback callback, void* callbackParam);
+
+private:
+	enum JobState
+	{
+		JOB_PENDING = 0,
+		JOB_READY,		//packed data is in memory
+		JOB_WORKING,
+		JOB_DONE,
+		JOB_FAILED
+	};
+
+	struct Job
+	{
+		const ExtractFileParam*	file;
+		int				entryIndex;		//-1 if file is not found
+		FileEntry		entry;
+		std::vector<u8>	data;
+		u32				reservedSize;
+		bool			direct;			//large or chunked file, extracted by caller thread through IReadFile
+		JobState		state;
+	};
+
+	static bool compareOffset(const Job& left, const Job& right);
+
+	static void workerProc(void* param);
+
+	void work();
+
+	//caller thread
+	bool readPackedData(Job& job);
+	bool extractDirect(Job& job);
+	//call callback for finished jobs before endJob in order, wait for them if wait is true
+	//return false if a job failed or callback wants to stop
+	bool reportJobs(u32 endJob, bool wait, Callback callback, void* callbackParam);
+
+	//worker threads, writer is NULL if direct I/O is not enabled
+	bool writeFile(Job& job, std::vector<u8>& chunkBuffer, DirectWriter* writer);
+
+private:
+	Package*			m_package;
+	u32					m_threadCount;
+	std::vector<Job>	m_jobs;
+	Mutex				m_mutex;
+	Condition			m_cond;
+	u32					m_nextJob;		//next job to be picked by worker threads
+	u32					m_reportedCount;
+	u64					m_memoryInUse;	//bytes held by jobs not written yet
+	DirectReader		m_reader;		//used instead of package stream if direct I/O is enabled
+	bool				m_directIO;
+	bool				m_stop;
+};
+
+}
+
+#endif
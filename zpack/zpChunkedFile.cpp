@@ -0,0 +1,280 @@
+#include "zpChunkedFile.h"
+#include "zpPackage.h"
+#include <cassert>
+#include <cstring>
+#include "zlib.h"
+
+namespace zp
+{
+
+//cut when top bits of rolling hash are all 0, average chunk size is about 64k beyond minimum
+const u64 CDC_MASK = 0xFFFF000000000000ULL;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//random value of each byte for gear hash, same on every machine
+class GearTable
+{
+public:
+	GearTable()
+	{
+		u64 seed = 0x5A504B43444347ULL;
+		for (u32 i = 0; i < 256; ++i)
+		{
+			//splitmix64
+			seed += 0x9E3779B97F4A7C15ULL;
+			u64 value = seed;
+			value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+			m_values[i] = value ^ (value >> 31);
+		}
+	}
+	u64 operator[](u8 index) const {return m_values[index];}
+
+private:
+	u64	m_values[256];
+};
+
+static const GearTable s_gear;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 findChunkEnd(const u8* data, u32 size)
+{
+	if (size <= MIN_CDC_CHUNK_SIZE)
+	{
+		return size;
+	}
+	u32 end = (size < MAX_CDC_CHUNK_SIZE) ? size : MAX_CDC_CHUNK_SIZE;
+	//each byte shifts out after 64 steps, so only the last 64 bytes decide a cut point
+	u64 hash = 0;
+	for (u32 i = MIN_CDC_CHUNK_SIZE - 64; i < MIN_CDC_CHUNK_SIZE; ++i)
+	{
+		hash = (hash << 1) + s_gear[data[i]];
+	}
+	for (u32 i = MIN_CDC_CHUNK_SIZE; i < end; ++i)
+	{
+		hash = (hash << 1) + s_gear[data[i]];
+		if ((hash & CDC_MASK) == 0)
+		{
+			return i + 1;
+		}
+	}
+	return end;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 gearHash(u64 hash, u8 value)
+{
+	return (hash << 1) + s_gear[value];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+String getChunkName(u64 contentHash, u32 size)
+{
+	const Char* HEX_DIGITS = _T("0123456789abcdef");
+	String name = _T("$chunk/");
+	for (int bit = 60; bit >= 0; bit -= 4)
+	{
+		name += HEX_DIGITS[(contentHash >> bit) & 0xF];
+	}
+	name += _T('_');
+	for (int bit = 28; bit >= 0; bit -= 4)
+	{
+		name += HEX_DIGITS[(size >> bit) & 0xF];
+	}
+	return name;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+ChunkedFile::ChunkedFile(const Package* package, u64 offset, u32 listSize, u32 originSize, u32 flag, u64 nameHash)
+	: m_offset(offset)
+	, m_nameHash(nameHash)
+	, m_package(package)
+	, m_flag(flag)
+	, m_originSize(originSize)
+	, m_readPos(0)
+	, m_cachedChunk((u32)-1)
+{
+	assert(package != NULL);
+	assert(package->m_storage != NULL);
+
+	u32 chunkCount = listSize / sizeof(ChunkRef);
+	if (chunkCount == 0)
+	{
+		m_originSize = 0;
+		return;
+	}
+	m_chunks.resize(chunkCount);
+	m_package->readStorage(m_offset, &m_chunks[0], chunkCount * sizeof(ChunkRef));
+	m_package->addStatistic(m_package->m_statistics.rawReadSize, chunkCount * sizeof(ChunkRef));
+
+	m_chunkStart.resize(chunkCount);
+	u32 pos = 0;
+	for (u32 i = 0; i < chunkCount; ++i)
+	{
+		m_chunkStart[i] = pos;
+		pos += m_chunks[i].size;
+	}
+	if (pos != m_originSize)
+	{
+		//let package delete me
+		m_flag |= FILE_DELETE;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+ChunkedFile::~ChunkedFile()
+{
+	//file failed to open is not traced
+	if (m_package->m_trace != NULL && (m_flag & FILE_DELETE) == 0)
+	{
+		m_package->m_trace->record(TRACE_CLOSE, m_nameHash, m_readPos, 0);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+u32 ChunkedFile::size() const
+{
+	return m_originSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+u32 ChunkedFile::availableSize() const
+{
+	//chunked files are always complete
+	return m_originSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+u32 ChunkedFile::flag() const
+{
+	return m_flag;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void ChunkedFile::seek(u32 pos)
+{
+	if (pos > m_originSize)
+	{
+		m_readPos = m_originSize;
+	}
+	else
+	{
+		m_readPos = pos;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+u32 ChunkedFile::tell() const
+{
+	return m_readPos;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+u32 ChunkedFile::read(u8* buffer, u32 size)
+{
+	PACKAGE_LOCK;
+	OperationTimer timer(m_package, OP_READ, m_nameHash);
+
+	if (m_readPos + size > m_originSize)
+	{
+		size = m_originSize - m_readPos;
+	}
+	if (size == 0)
+	{
+		return 0;
+	}
+	//last chunk starting before read position
+	u32 low = 0;
+	u32 high = m_chunks.size();
+	while (high - low > 1)
+	{
+		u32 middle = (low + high) / 2;
+		if (m_chunkStart[middle] <= m_readPos)
+		{
+			low = middle;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	u32 dstOffset = 0;
+	for (u32 chunkIndex = low; dstOffset < size; ++chunkIndex)
+	{
+		if (!loadChunk(chunkIndex))
+		{
+			return 0;
+		}
+		u32 readOffset = m_readPos + dstOffset - m_chunkStart[chunkIndex];
+		u32 readSize = m_chunks[chunkIndex].size - readOffset;
+		if (readSize > size - dstOffset)
+		{
+			readSize = size - dstOffset;
+		}
+		memcpy(buffer + dstOffset, &m_chunkData[readOffset], readSize);
+		dstOffset += readSize;
+	}
+	if (m_package->m_trace != NULL)
+	{
+		m_package->m_trace->record(TRACE_READ, m_nameHash, m_readPos, size);
+	}
+	m_readPos += size;
+	return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ChunkedFile::loadChunk(u32 chunkIndex)
+{
+	if (chunkIndex == m_cachedChunk)
+	{
+		if (m_package->m_trace != NULL)
+		{
+			m_package->m_trace->record(TRACE_CACHE_HIT, m_nameHash, m_chunkStart[chunkIndex], m_chunks[chunkIndex].size);
+		}
+		m_package->addStatistic(m_package->m_statistics.cacheHitCount, 1);
+		return true;
+	}
+	if (m_package->m_trace != NULL)
+	{
+		m_package->m_trace->record(TRACE_CACHE_MISS, m_nameHash, m_chunkStart[chunkIndex], m_chunks[chunkIndex].size);
+	}
+	int fileIndex = m_package->getFileIndex(m_chunks[chunkIndex].nameHash);
+	if (fileIndex < 0)
+	{
+		return false;
+	}
+	const FileEntry& entry = m_package->getFileEntry(fileIndex);
+	u32 chunkSize = m_chunks[chunkIndex].size;
+	if (entry.originSize != chunkSize)
+	{
+		return false;
+	}
+	m_chunkData.resize(chunkSize);
+	m_package->addStatistic(m_package->m_statistics.rawReadSize, entry.packSize);
+	if ((entry.flag & FILE_COMPRESS) == 0)
+	{
+		m_package->readStorage(entry.byteOffset, &m_chunkData[0], chunkSize);
+	}
+	else
+	{
+		//chunk is compressed as a whole, in place if storage is mapped
+		const u8* packData = m_package->mapStorage(entry.byteOffset, entry.packSize);
+		if (packData == NULL)
+		{
+			m_packBuffer.resize(entry.packSize);
+			m_package->readStorage(entry.byteOffset, &m_packBuffer[0], entry.packSize);
+			packData = &m_packBuffer[0];
+		}
+		u32 dstSize = chunkSize;
+		if (m_package->uncompressData(&m_chunkData[0], &dstSize, packData, entry.packSize, m_nameHash) != Z_OK
+			|| dstSize != chunkSize)
+		{
+			m_cachedChunk = (u32)-1;
+			return false;
+		}
+	}
+	m_cachedChunk = chunkIndex;
+	return true;
+}
+
+}
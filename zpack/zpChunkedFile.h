@@ -0,0 +1,74 @@
+#ifndef __ZP_CHUNKED_FILE_H__
+#define __ZP_CHUNKED_FILE_H__
+
+#include "zpack.h"
+#include <vector>
+
+namespace zp
+{
+
+class Package;
+
+//content defined chunking, chunk size is between MIN_CDC_CHUNK_SIZE and MAX_CDC_CHUNK_SIZE
+const u32 MIN_CDC_CHUNK_SIZE = 0x4000;
+const u32 MAX_CDC_CHUNK_SIZE = 0x40000;
+
+//data of a FILE_CHUNKED file is an array of ChunkRef
+//each chunk is stored as an internal file named by its content, shared by all files containing it
+struct ChunkRef
+{
+	u64	nameHash;	//name hash of internal file of chunk
+	u32	size;
+	u32	reserved;
+};
+
+//return size of first chunk in data, cut points depend on content only (gear rolling hash)
+//so data inserted or removed in a file only changes chunks around it
+u32 findChunkEnd(const u8* data, u32 size);
+
+//roll one byte into gear hash, only the last 64 bytes affect the result
+u64 gearHash(u64 hash, u8 value);
+
+//name of internal file to store a chunk
+String getChunkName(u64 contentHash, u32 size);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class ChunkedFile : public IReadFile
+{
+public:
+	ChunkedFile(const Package* package, u64 offset, u32 listSize, u32 originSize, u32 flag, u64 nameHash);
+	virtual ~ChunkedFile();
+
+	virtual u32 size() const;
+
+	virtual u32 availableSize() const;
+
+	virtual u32 flag() const;
+
+	virtual void seek(u32 pos);
+
+	virtual u32 tell() const;
+
+	virtual u32 read(u8* buffer, u32 size);
+
+private:
+	bool loadChunk(u32 chunkIndex);
+
+private:
+	u64						m_offset;
+	u64						m_nameHash;
+	const Package*			m_package;
+	u32						m_flag;
+	u32						m_originSize;
+	u32						m_readPos;
+
+	std::vector<ChunkRef>	m_chunks;
+	std::vector<u32>		m_chunkStart;	//position of each chunk in file
+	u32						m_cachedChunk;	//index of chunk in m_chunkData
+	std::vector<u8>			m_chunkData;
+	std::vector<u8>			m_packBuffer;
+};
+
+}
+
+#endif
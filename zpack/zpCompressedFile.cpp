@@ -1,6 +1,7 @@
 #include "zpCompressedFile.h"
 #include "zpPackage.h"
 #include <cassert>
+#include <cstring>
 #include "zlib.h"
 //#include "PerfUtil.h"
 
@@ -21,9 +22,10 @@ CompressedFile::CompressedFile(const Package* package, u64 offset, u32 compresse
 	, m_chunkPos(NULL)
 	, m_fileData(NULL)
 	, m_chunkData(NULL)
+	, m_cachedChunk((u32)-1)
 {
 	assert(package != NULL);
-	assert(package->m_stream != NULL);
+	assert(package->m_storage != NULL);
 
 	if (compressedSize <= 0)
 	{
@@ -31,8 +33,13 @@ CompressedFile::CompressedFile(const Package* package, u64 offset, u32 compresse
 	}
 	assert(m_chunkSize != 0);
 	m_chunkCount = (m_originSize + m_chunkSize - 1) / m_chunkSize;
+	if (m_package->m_preloader != NULL && m_originSize > 0)
+	{
+		//decompressed by IPackage::warmUp()
+		m_fileData = m_package->m_preloader->take(offset, compressedSize, originSize);
+	}
 	//no chunk size array for files have only 1 chunk
-	if (m_chunkCount <= 1)
+	if (m_chunkCount <= 1 || m_fileData != NULL)
 	{
 		return;
 	}
@@ -49,8 +56,8 @@ CompressedFile::CompressedFile(const Package* package, u64 offset, u32 compresse
 	
 	//raw data position of each chunk
 	m_chunkPos = new u32[m_chunkCount];
-	seekInPackage(0);
-	fread((char*)m_chunkPos, m_chunkCount * sizeof(u32), 1, m_package->m_stream);
+	m_package->readStorage(m_offset, m_chunkPos, m_chunkCount * sizeof(u32));
+	m_package->addStatistic(m_package->m_statistics.rawReadSize, m_chunkCount * sizeof(u32));
 	if (!checkChunkPos())
 	{
 		//let package delete me
@@ -61,6 +68,11 @@ CompressedFile::CompressedFile(const Package* package, u64 offset, u32 compresse
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 CompressedFile::~CompressedFile()
 {
+	//file failed to open is not traced
+	if (m_package->m_trace != NULL && (m_flag & FILE_DELETE) == 0)
+	{
+		m_package->m_trace->record(TRACE_CLOSE, m_nameHash, m_readPos, 0);
+	}
 	if (m_chunkPos != NULL)
 	{
 		delete[] m_chunkPos;
@@ -83,10 +95,6 @@ CompressedFile::~CompressedFile()
 		delete[] m_fileData;
 		m_fileData = NULL;
 	}
-	if (m_package->m_lastSeekFile == this)
-	{
-		m_package->m_lastSeekFile = NULL;
-	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -154,6 +162,7 @@ u32 CompressedFile::tell() const
 u32 CompressedFile::read(u8* buffer, u32 size)
 {
 	PACKAGE_LOCK;
+	OperationTimer timer(m_package, OP_READ, m_nameHash);
 
 	//BEGIN_PERF("read")
 
@@ -169,6 +178,16 @@ u32 CompressedFile::read(u8* buffer, u32 size)
 	{
 		size = oneChunkRead(buffer, size);
 	}
+	else if (m_fileData != NULL)
+	{
+		//whole file is decompressed by warm up
+		if (m_package->m_trace != NULL)
+		{
+			m_package->m_trace->record(TRACE_CACHE_HIT, m_nameHash, 0, m_originSize);
+		}
+		m_package->addStatistic(m_package->m_statistics.cacheHitCount, 1);
+		memcpy(buffer, m_fileData + m_readPos, size);
+	}
 	else
 	{
 		//let's do something real!
@@ -188,6 +207,7 @@ u32 CompressedFile::read(u8* buffer, u32 size)
 				//last chunk
 				readSize = (m_readPos + size) - chunkIndex * m_chunkSize;
 			}
+			readSize -= readOffset;
 			if (!readChunk(chunkIndex, readOffset, readSize, buffer + dstOffset))
 			{
 				return 0;
@@ -195,6 +215,10 @@ u32 CompressedFile::read(u8* buffer, u32 size)
 			dstOffset += readSize;
 		}
 	}
+	if (m_package->m_trace != NULL && size > 0)
+	{
+		m_package->m_trace->record(TRACE_READ, m_nameHash, m_readPos, size);
+	}
 	m_readPos += size;
 
 	//END_PERF
@@ -234,11 +258,18 @@ u32 CompressedFile::oneChunkRead(u8* buffer, u32 size)
 	//cached
 	if (m_fileData != NULL)
 	{
+		if (m_package->m_trace != NULL)
+		{
+			m_package->m_trace->record(TRACE_CACHE_HIT, m_nameHash, 0, m_originSize);
+		}
+		m_package->addStatistic(m_package->m_statistics.cacheHitCount, 1);
 		memcpy(buffer, m_fileData + m_readPos, size);
 		return size;
 	}
-
-	seekInPackage(0);
+	if (m_package->m_trace != NULL)
+	{
+		m_package->m_trace->record(TRACE_CACHE_MISS, m_nameHash, 0, m_originSize);
+	}
 
 	u8* dstBuffer = NULL;
 	if (m_readPos == 0 && size == m_originSize)
@@ -252,11 +283,19 @@ u32 CompressedFile::oneChunkRead(u8* buffer, u32 size)
 		dstBuffer = m_fileData;
 	}
 
-	u8* compressed = new u8[m_compressedSize];
-	fread((char*)compressed, m_compressedSize, 1, m_package->m_stream);
+	//mapped storage is decompressed in place
+	const u8* compressed = m_package->mapStorage(m_offset, m_compressedSize);
+	u8* compressBuffer = NULL;
+	if (compressed == NULL)
+	{
+		compressBuffer = new u8[m_compressedSize];
+		m_package->readStorage(m_offset, compressBuffer, m_compressedSize);
+		compressed = compressBuffer;
+	}
+	m_package->addStatistic(m_package->m_statistics.rawReadSize, m_compressedSize);
 
 	u32 dstSize = m_originSize;	//don't want m_originSize to be changed
-	if (uncompress(dstBuffer, &dstSize, compressed, m_compressedSize) != Z_OK)
+	if (m_package->uncompressData(dstBuffer, &dstSize, compressed, m_compressedSize, m_nameHash) != Z_OK)
 	{
 		size = 0;
 	}
@@ -264,7 +303,7 @@ u32 CompressedFile::oneChunkRead(u8* buffer, u32 size)
 	{
 		memcpy(buffer, m_fileData + m_readPos, size);
 	}
-	delete[] compressed;
+	delete[] compressBuffer;
 	return size;
 }
 
@@ -276,12 +315,19 @@ bool CompressedFile::readChunk(u32 chunkIndex, u32 offset, u32 readSize, u8* buf
 	if (m_chunkData[chunkIndex] != NULL)
 	{
 		//cached
+		if (m_package->m_trace != NULL)
+		{
+			u32 chunkStart = chunkIndex * m_chunkSize;
+			u32 chunkSize = (chunkIndex + 1 < m_chunkCount) ? m_chunkSize : m_originSize - chunkStart;
+			m_package->m_trace->record(TRACE_CACHE_HIT, m_nameHash, chunkStart, chunkSize);
+		}
+		m_package->addStatistic(m_package->m_statistics.cacheHitCount, 1);
 		memcpy(buffer, m_chunkData[chunkIndex] + offset, readSize);
 		return true;
 	}
 
 	assert(m_chunkPos != NULL);
-	seekInPackage(m_chunkPos[chunkIndex]);
+	u64 chunkOffset = m_offset + m_chunkPos[chunkIndex];
 
 	u32 compressedChunkSize = 0;
 	u32 originChunkSize = 0;
@@ -294,7 +340,11 @@ bool CompressedFile::readChunk(u32 chunkIndex, u32 offset, u32 readSize, u8* buf
 	{
 		//last chunk
 		compressedChunkSize = m_compressedSize - m_chunkPos[m_chunkCount - 1];
-		originChunkSize = m_originSize % m_chunkSize;
+		originChunkSize = m_originSize - chunkIndex * m_chunkSize;
+	}
+	if (m_package->m_trace != NULL)
+	{
+		m_package->m_trace->record(TRACE_CACHE_MISS, m_nameHash, chunkIndex * m_chunkSize, originChunkSize);
 	}
 
 	u8* dstBuffer = NULL;
@@ -305,24 +355,50 @@ bool CompressedFile::readChunk(u32 chunkIndex, u32 offset, u32 readSize, u8* buf
 	}
 	else
 	{
-		m_chunkData[chunkIndex] = new u8[originChunkSize];
+		//only one chunk is cached, memory doesn't grow with file size when reading sequentially
+		if (m_cachedChunk < m_chunkCount)
+		{
+			m_chunkData[chunkIndex] = m_chunkData[m_cachedChunk];
+			m_chunkData[m_cachedChunk] = NULL;
+		}
+		else
+		{
+			m_chunkData[chunkIndex] = new u8[m_chunkSize];
+		}
+		m_cachedChunk = chunkIndex;
 		dstBuffer = m_chunkData[chunkIndex];
 	}
 
 	if (compressedChunkSize == originChunkSize)
 	{
 		//this chunk was not compressed at all, read directly to the dstBuffer
-		fread((char*)dstBuffer, originChunkSize, 1, m_package->m_stream);
+		m_package->readStorage(chunkOffset, dstBuffer, originChunkSize);
+		m_package->addStatistic(m_package->m_statistics.rawReadSize, originChunkSize);
 	}
 	else
 	{
-		u8* compressed = new u8[compressedChunkSize];
-		fread((char*)compressed, compressedChunkSize, 1, m_package->m_stream);
+		//mapped storage is decompressed in place
+		const u8* compressed = m_package->mapStorage(chunkOffset, compressedChunkSize);
+		u8* compressBuffer = NULL;
+		if (compressed == NULL)
+		{
+			compressBuffer = new u8[compressedChunkSize];
+			m_package->readStorage(chunkOffset, compressBuffer, compressedChunkSize);
+			compressed = compressBuffer;
+		}
+		m_package->addStatistic(m_package->m_statistics.rawReadSize, compressedChunkSize);
 
-		int ret = uncompress(dstBuffer, &originChunkSize, compressed, compressedChunkSize);
-		delete[] compressed;
+		int ret = m_package->uncompressData(dstBuffer, &originChunkSize, compressed, compressedChunkSize, m_nameHash);
+		delete[] compressBuffer;
 		if (ret != Z_OK)
 		{
+			if (m_chunkData[chunkIndex] != NULL)
+			{
+				//don't keep broken data
+				delete[] m_chunkData[chunkIndex];
+				m_chunkData[chunkIndex] = NULL;
+				m_cachedChunk = (u32)-1;
+			}
 			return false;
 		}
 	}
@@ -333,11 +409,4 @@ bool CompressedFile::readChunk(u32 chunkIndex, u32 offset, u32 readSize, u8* buf
 	return true;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////
-void CompressedFile::seekInPackage(u32 offset)
-{
-	_fseeki64(m_package->m_stream, m_offset + offset, SEEK_SET);
-	m_package->m_lastSeekFile = this;
-}
-
 }
@@ -31,8 +31,6 @@ public:
 private:
 	bool checkChunkPos() const;
 
-	void seekInPackage(u32 offset);
-
 	u32 oneChunkRead(u8* buffer, u32 size);
 
 	bool readChunk(u32 chunkIndex, u32 offset, u32 readSize, u8* buffer);
@@ -49,8 +47,9 @@ private:
 	u32				m_readPos;
 	u32				m_chunkCount;
 	u32*			m_chunkPos;
-	u8*				m_fileData;		//available when there's only 1 chunk
+	u8*				m_fileData;		//available when there's only 1 chunk, or decompressed by warm up
 	u8**			m_chunkData;	//available when there's more than 1 chunk
+	u32				m_cachedChunk;	//index of the only chunk in m_chunkData
 };
 
 }
@@ -0,0 +1,150 @@
+#include "zpContentHash.h"
+#include <cstring>
+
+namespace zp
+{
+
+const u64 PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const u64 PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const u64 PRIME64_3 = 0x165667B19E3779F9ULL;
+const u64 PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const u64 PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline u64 rotateLeft(u64 value, u32 bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline u64 readU64(const u8* data)
+{
+	//package format is little endian
+	u64 value;
+	memcpy(&value, data, sizeof(u64));
+	return value;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline u32 readU32(const u8* data)
+{
+	unsigned int value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline u64 hashRound(u64 acc, u64 input)
+{
+	acc += input * PRIME64_2;
+	acc = rotateLeft(acc, 31);
+	return acc * PRIME64_1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline u64 mergeRound(u64 acc, u64 value)
+{
+	acc ^= hashRound(0, value);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ContentHash::ContentHash()
+	: m_bufferSize(0)
+	, m_totalSize(0)
+{
+	m_acc[0] = PRIME64_1 + PRIME64_2;
+	m_acc[1] = PRIME64_2;
+	m_acc[2] = 0;
+	m_acc[3] = 0 - PRIME64_1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ContentHash::update(const u8* data, u32 size)
+{
+	m_totalSize += size;
+	if (m_bufferSize + size < sizeof(m_buffer))
+	{
+		memcpy(m_buffer + m_bufferSize, data, size);
+		m_bufferSize += size;
+		return;
+	}
+	if (m_bufferSize > 0)
+	{
+		u32 fillSize = sizeof(m_buffer) - m_bufferSize;
+		memcpy(m_buffer + m_bufferSize, data, fillSize);
+		data += fillSize;
+		size -= fillSize;
+		for (u32 i = 0; i < 4; ++i)
+		{
+			m_acc[i] = hashRound(m_acc[i], readU64(m_buffer + i * 8));
+		}
+		m_bufferSize = 0;
+	}
+	const u8* end = data + size;
+	while (data + sizeof(m_buffer) <= end)
+	{
+		for (u32 i = 0; i < 4; ++i)
+		{
+			m_acc[i] = hashRound(m_acc[i], readU64(data + i * 8));
+		}
+		data += sizeof(m_buffer);
+	}
+	m_bufferSize = (u32)(end - data);
+	memcpy(m_buffer, data, m_bufferSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 ContentHash::digest() const
+{
+	u64 hash;
+	if (m_totalSize >= sizeof(m_buffer))
+	{
+		hash = rotateLeft(m_acc[0], 1) + rotateLeft(m_acc[1], 7) + rotateLeft(m_acc[2], 12) + rotateLeft(m_acc[3], 18);
+		for (u32 i = 0; i < 4; ++i)
+		{
+			hash = mergeRound(hash, m_acc[i]);
+		}
+	}
+	else
+	{
+		hash = m_acc[2] + PRIME64_5;
+	}
+	hash += m_totalSize;
+
+	const u8* data = m_buffer;
+	const u8* end = m_buffer + m_bufferSize;
+	for (; data + 8 <= end; data += 8)
+	{
+		hash ^= hashRound(0, readU64(data));
+		hash = rotateLeft(hash, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if (data + 4 <= end)
+	{
+		hash ^= (u64)readU32(data) * PRIME64_1;
+		hash = rotateLeft(hash, 23) * PRIME64_2 + PRIME64_3;
+		data += 4;
+	}
+	for (; data < end; ++data)
+	{
+		hash ^= (*data) * PRIME64_5;
+		hash = rotateLeft(hash, 11) * PRIME64_1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PRIME64_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 contentHash(const u8* data, u32 size)
+{
+	ContentHash hash;
+	hash.update(data, size);
+	return hash.digest();
+}
+
+}
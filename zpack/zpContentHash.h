@@ -0,0 +1,31 @@
+#ifndef __ZP_CONTENT_HASH_H__
+#define __ZP_CONTENT_HASH_H__
+
+#include "zpack.h"
+
+namespace zp
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//64 bit hash of file content (xxHash64), data can be fed piece by piece
+class ContentHash
+{
+public:
+	ContentHash();
+
+	void update(const u8* data, u32 size);
+
+	u64 digest() const;
+
+private:
+	u64	m_acc[4];
+	u8	m_buffer[32];
+	u32	m_bufferSize;
+	u64	m_totalSize;
+};
+
+u64 contentHash(const u8* data, u32 size);
+
+}
+
+#endif
@@ -0,0 +1,371 @@
+#include "zpDirectIO.h"
+#include <cassert>
+#include <cstring>
+
+namespace zp
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DirectReader::DirectReader(bool background)
+	: m_background(background)
+	, m_stop(false)
+{
+	for (u32 i = 0; i < 2; ++i)
+	{
+		m_blocks[i].data = NULL;
+		m_blocks[i].offset = (u64)-1;
+		m_blocks[i].size = 0;
+		m_blocks[i].loading = false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DirectReader::~DirectReader()
+{
+	close();
+	for (u32 i = 0; i < 2; ++i)
+	{
+		freeAligned(m_blocks[i].data);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DirectReader::open(const Char* filename)
+{
+	close();
+	for (u32 i = 0; i < 2; ++i)
+	{
+		if (m_blocks[i].data == NULL)
+		{
+			m_blocks[i].data = (u8*)allocAligned(DIRECT_BLOCK_SIZE);
+		}
+		if (m_blocks[i].data == NULL)
+		{
+			return false;
+		}
+	}
+	if (!m_file.open(filename, false))
+	{
+		return false;
+	}
+	m_stop = false;
+	if (m_background && !m_thread.start(threadProc, this))
+	{
+		m_background = false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DirectReader::close()
+{
+	{
+		MutexLock lock(m_mutex);
+		m_stop = true;
+		m_cond.broadcast();
+	}
+	m_thread.join();
+	m_file.close();
+	for (u32 i = 0; i < 2; ++i)
+	{
+		m_blocks[i].offset = (u64)-1;
+		m_blocks[i].size = 0;
+		m_blocks[i].loading = false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DirectReader::read(u64 offset, void* buffer, u32 size)
+{
+	u8* dst = (u8*)buffer;
+	while (size > 0)
+	{
+		const Block* block = getBlock(offset);
+		if (block == NULL)
+		{
+			return false;
+		}
+		u32 start = (u32)(offset - block->offset);
+		u32 copySize = (size < block->size - start) ? size : block->size - start;
+		memcpy(dst, block->data + start, copySize);
+		dst += copySize;
+		offset += copySize;
+		size -= copySize;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const DirectReader::Block* DirectReader::getBlock(u64 offset)
+{
+	assert(m_file.isOpen());
+	u64 blockOffset = offset - offset % DIRECT_BLOCK_SIZE;
+	MutexLock lock(m_mutex);
+	Block* block = NULL;
+	for (u32 i = 0; i < 2; ++i)
+	{
+		if (m_blocks[i].offset == blockOffset)
+		{
+			block = &m_blocks[i];
+		}
+	}
+	if (block == NULL)
+	{
+		//jumped to somewhere else, read ahead block is useless
+		while (m_blocks[0].loading || m_blocks[1].loading)
+		{
+			m_cond.wait(m_mutex);
+		}
+		block = &m_blocks[0];
+		block->offset = blockOffset;
+		block->size = 0;
+		block->loading = true;
+		if (m_background)
+		{
+			m_cond.broadcast();
+		}
+		else
+		{
+			block->size = m_file.read(blockOffset, block->data, DIRECT_BLOCK_SIZE);
+			block->loading = false;
+		}
+	}
+	while (block->loading)
+	{
+		m_cond.wait(m_mutex);
+	}
+	if (block->size <= offset - blockOffset)
+	{
+		return NULL;
+	}
+	Block& other = (block == &m_blocks[0]) ? m_blocks[1] : m_blocks[0];
+	u64 nextOffset = blockOffset + DIRECT_BLOCK_SIZE;
+	if (m_background && block->size == DIRECT_BLOCK_SIZE && other.offset != nextOffset && !other.loading)
+	{
+		other.offset = nextOffset;
+		other.size = 0;
+		other.loading = true;
+		m_cond.broadcast();
+	}
+	return block;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DirectReader::threadProc(void* param)
+{
+	reinterpret_cast<DirectReader*>(param)->loadBlocks();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DirectReader::loadBlocks()
+{
+	while (true)
+	{
+		Block* block = NULL;
+		{
+			MutexLock lock(m_mutex);
+			while (!m_stop && !m_blocks[0].loading && !m_blocks[1].loading)
+			{
+				m_cond.wait(m_mutex);
+			}
+			if (m_stop)
+			{
+				return;
+			}
+			block = m_blocks[0].loading ? &m_blocks[0] : &m_blocks[1];
+		}
+		//offset is not changed by caller while loading
+		u32 size = m_file.read(block->offset, block->data, DIRECT_BLOCK_SIZE);
+
+		MutexLock lock(m_mutex);
+		block->size = size;
+		block->loading = false;
+		m_cond.broadcast();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DirectWriter::DirectWriter(bool background)
+	: m_currentBlock(0)
+	, m_usedSize(0)
+	, m_fileSize(0)
+	, m_background(background)
+	, m_stop(false)
+	, m_failed(false)
+{
+	for (u32 i = 0; i < 2; ++i)
+	{
+		m_blocks[i].data = NULL;
+		m_blocks[i].offset = 0;
+		m_blocks[i].size = 0;
+		m_blocks[i].writing = false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DirectWriter::~DirectWriter()
+{
+	close();
+	for (u32 i = 0; i < 2; ++i)
+	{
+		freeAligned(m_blocks[i].data);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DirectWriter::open(const Char* filename)
+{
+	close();
+	for (u32 i = 0; i < 2; ++i)
+	{
+		if (m_blocks[i].data == NULL)
+		{
+			m_blocks[i].data = (u8*)allocAligned(DIRECT_BLOCK_SIZE);
+		}
+		if (m_blocks[i].data == NULL)
+		{
+			return false;
+		}
+	}
+	if (!m_file.open(filename, true))
+	{
+		return false;
+	}
+	m_currentBlock = 0;
+	m_usedSize = 0;
+	m_fileSize = 0;
+	m_stop = false;
+	m_failed = false;
+	if (m_background && !m_thread.start(threadProc, this))
+	{
+		m_background = false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DirectWriter::write(const void* data, u32 size)
+{
+	assert(m_file.isOpen());
+	const u8* src = (const u8*)data;
+	while (size > 0)
+	{
+		Block& block = m_blocks[m_currentBlock];
+		u32 copySize = DIRECT_BLOCK_SIZE - m_usedSize;
+		if (copySize > size)
+		{
+			copySize = size;
+		}
+		memcpy(block.data + m_usedSize, src, copySize);
+		m_usedSize += copySize;
+		m_fileSize += copySize;
+		src += copySize;
+		size -= copySize;
+		if (m_usedSize == DIRECT_BLOCK_SIZE)
+		{
+			submitBlock();
+		}
+	}
+	return !m_failed;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 DirectWriter::tell() const
+{
+	return m_fileSize;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DirectWriter::close()
+{
+	if (!m_file.isOpen())
+	{
+		return !m_failed;
+	}
+	if (m_usedSize > 0)
+	{
+		submitBlock();
+	}
+	{
+		MutexLock lock(m_mutex);
+		while (m_blocks[0].writing || m_blocks[1].writing)
+		{
+			m_cond.wait(m_mutex);
+		}
+		m_stop = true;
+		m_cond.broadcast();
+	}
+	m_thread.join();
+	if (m_fileSize % DIRECT_IO_ALIGN != 0 && !m_file.setSize(m_fileSize))
+	{
+		m_failed = true;
+	}
+	m_file.close();
+	return !m_failed;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DirectWriter::submitBlock()
+{
+	Block& block = m_blocks[m_currentBlock];
+	//pad to alignment, cut by close()
+	u32 size = (m_usedSize + DIRECT_IO_ALIGN - 1) & ~(DIRECT_IO_ALIGN - 1);
+	memset(block.data + m_usedSize, 0, size - m_usedSize);
+	block.offset = m_fileSize - m_usedSize;
+	block.size = size;
+	m_usedSize = 0;
+	m_currentBlock = 1 - m_currentBlock;
+
+	MutexLock lock(m_mutex);
+	if (m_background)
+	{
+		block.writing = true;
+		m_cond.broadcast();
+	}
+	else if (!m_file.write(block.offset, block.data, block.size))
+	{
+		m_failed = true;
+	}
+	while (m_blocks[m_currentBlock].writing)
+	{
+		m_cond.wait(m_mutex);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DirectWriter::threadProc(void* param)
+{
+	reinterpret_cast<DirectWriter*>(param)->writeBlocks();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DirectWriter::writeBlocks()
+{
+	while (true)
+	{
+		Block* block = NULL;
+		{
+			MutexLock lock(m_mutex);
+			while (!m_stop && !m_blocks[0].writing && !m_blocks[1].writing)
+			{
+				m_cond.wait(m_mutex);
+			}
+			if (m_stop)
+			{
+				return;
+			}
+			block = m_blocks[0].writing ? &m_blocks[0] : &m_blocks[1];
+		}
+		bool succeeded = m_file.write(block->offset, block->data, block->size);
+
+		MutexLock lock(m_mutex);
+		if (!succeeded)
+		{
+			m_failed = true;
+		}
+		block->writing = false;
+		m_cond.broadcast();
+	}
+}
+
+}
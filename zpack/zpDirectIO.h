@@ -0,0 +1,107 @@
+#ifndef __ZP_DIRECT_IO_H__
+#define __ZP_DIRECT_IO_H__
+
+#include "zpack.h"
+#include "zpPlatform.h"
+
+namespace zp
+{
+
+//unit of reading and writing, two of them are used by each reader or writer
+const u32 DIRECT_BLOCK_SIZE = 0x100000;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//reading through DirectFile for bulk operations, see IPackage::enableDirectIO()
+//with background thread, block after the one being used is read ahead while caller copies data
+class DirectReader
+{
+public:
+	DirectReader(bool background = true);
+	~DirectReader();
+
+	bool open(const Char* filename);
+	void close();
+
+	//any offset and size, reading on from end of last read is fastest
+	//return false if file is shorter
+	bool read(u64 offset, void* buffer, u32 size);
+
+private:
+	struct Block
+	{
+		u8*		data;
+		u64		offset;		//-1 if empty
+		u32		size;		//less than DIRECT_BLOCK_SIZE at end of file
+		bool	loading;
+	};
+
+	static void threadProc(void* param);
+
+	void loadBlocks();
+
+	//load block containing offset if not loaded yet, NULL if offset is beyond end of file
+	const Block* getBlock(u64 offset);
+
+private:
+	DirectFile	m_file;
+	Block		m_blocks[2];
+	Thread		m_thread;
+	Mutex		m_mutex;
+	Condition	m_cond;
+	bool		m_background;
+	bool		m_stop;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//writing a new file sequentially through DirectFile for bulk operations
+//with background thread, a full block is written while caller fills the other one
+class DirectWriter
+{
+public:
+	DirectWriter(bool background = true);
+	~DirectWriter();
+
+	bool open(const Char* filename);
+
+	//append
+	bool write(const void* data, u32 size);
+
+	//bytes written
+	u64 tell() const;
+
+	//write last block and cut its padding, return false if any writing failed
+	bool close();
+
+private:
+	struct Block
+	{
+		u8*		data;
+		u64		offset;
+		u32		size;		//padded to DIRECT_IO_ALIGN
+		bool	writing;
+	};
+
+	static void threadProc(void* param);
+
+	void writeBlocks();
+
+	//hand current block to background thread (or write it), then switch to the other one
+	void submitBlock();
+
+private:
+	DirectFile	m_file;
+	Block		m_blocks[2];
+	u32			m_currentBlock;
+	u32			m_usedSize;		//of current block
+	u64			m_fileSize;
+	Thread		m_thread;
+	Mutex		m_mutex;
+	Condition	m_cond;
+	bool		m_background;
+	bool		m_stop;
+	bool		m_failed;
+};
+
+}
+
+#endif
@@ -15,15 +15,15 @@ File::File(const Package* package, u64 offset, u32 size, u32 flag, u64 nameHash)
 	, m_readPos(0)
 {
 	assert(package != NULL);
-	assert(package->m_stream != NULL);
+	assert(package->m_storage != NULL);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 File::~File()
 {
-	if (m_package->m_lastSeekFile == this)
+	if (m_package->m_trace != NULL)
 	{
-		m_package->m_lastSeekFile = NULL;
+		m_package->m_trace->record(TRACE_CLOSE, m_nameHash, m_readPos, 0);
 	}
 }
 
@@ -70,6 +70,7 @@ u32 File::tell() const
 u32 File::read(u8* buffer, u32 size)
 {
 	PACKAGE_LOCK;
+	OperationTimer timer(m_package, OP_READ, m_nameHash);
 
 	//not preventing user from reading over available size here
 	if (m_readPos + size > m_size)
@@ -80,20 +81,14 @@ u32 File::read(u8* buffer, u32 size)
 	{
 		return 0;
 	}
-	if (m_package->m_lastSeekFile != this)
+	m_package->readStorage(m_offset + m_readPos, buffer, size);
+	m_package->addStatistic(m_package->m_statistics.rawReadSize, size);
+	if (m_package->m_trace != NULL)
 	{
-		seekInPackage();
+		m_package->m_trace->record(TRACE_READ, m_nameHash, m_readPos, size);
 	}
-	fread(buffer, size, 1, m_package->m_stream);
 	m_readPos += size;
 	return size;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////
-void File::seekInPackage()
-{
-	_fseeki64(m_package->m_stream, m_offset + m_readPos, SEEK_SET);
-	m_package->m_lastSeekFile = this;
-}
-
 }
@@ -26,9 +26,6 @@ public:
 
 	virtual u32 read(u8* buffer, u32 size);
 
-private:
-	void seekInPackage();
-
 private:
 	u64				m_offset;
 	u64				m_nameHash;
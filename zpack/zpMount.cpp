@@ -0,0 +1,225 @@
+#include "zpMount.h"
+#include "zpPackage.h"
+#include <cassert>
+
+namespace zp
+{
+
+const u32 EMPTY_SLOT = (u32)-1;
+const u32 MIN_INDEX_SIZE = 256;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Mount::Mount()
+	: m_indexMask(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Mount::~Mount()
+{
+	assert(m_openFiles.empty());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Mount::mount(IPackage* package, int priority)
+{
+	if (package == NULL)
+	{
+		return false;
+	}
+	MutexLock lock(m_mutex);
+
+	u32 insertPos = 0;
+	for (u32 i = 0; i < m_layers.size(); ++i)
+	{
+		if (m_layers[i].package == package)
+		{
+			return false;
+		}
+		if (m_layers[i].priority > priority)
+		{
+			insertPos = i + 1;
+		}
+	}
+	Layer layer;
+	layer.package = static_cast<Package*>(package);
+	layer.priority = priority;
+	m_layers.insert(m_layers.begin() + insertPos, layer);
+	buildIndex();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Mount::unmount(IPackage* package)
+{
+	MutexLock lock(m_mutex);
+
+	for (std::map<IReadFile*, Package*>::const_iterator iter = m_openFiles.begin(); iter != m_openFiles.end(); ++iter)
+	{
+		if (iter->second == package)
+		{
+			return false;
+		}
+	}
+	for (u32 i = 0; i < m_layers.size(); ++i)
+	{
+		if (m_layers[i].package == package)
+		{
+			m_layers.erase(m_layers.begin() + i);
+			buildIndex();
+			return true;
+		}
+	}
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Mount::refresh()
+{
+	MutexLock lock(m_mutex);
+	buildIndex();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 Mount::getPackageCount() const
+{
+	MutexLock lock(m_mutex);
+	return m_layers.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IPackage* Mount::getPackage(u32 index) const
+{
+	MutexLock lock(m_mutex);
+	if (index >= m_layers.size())
+	{
+		return NULL;
+	}
+	return m_layers[index].package;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Mount::hasFile(const Char* filename) const
+{
+	MutexLock lock(m_mutex);
+	return (findFile(filename) != NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IPackage* Mount::findPackage(const Char* filename) const
+{
+	MutexLock lock(m_mutex);
+	const MountedFile* file = findFile(filename);
+	if (file == NULL)
+	{
+		return NULL;
+	}
+	return m_layers[file->layer].package;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IReadFile* Mount::openFile(const Char* filename)
+{
+	//held until the file is recorded, so its package can't be unmounted meanwhile
+	MutexLock lock(m_mutex);
+
+	const MountedFile* mounted = findFile(filename);
+	if (mounted == NULL)
+	{
+		return NULL;
+	}
+	Package* package = m_layers[mounted->layer].package;
+	IReadFile* file = package->openFileEntry(mounted->entryIndex);
+	if (file != NULL)
+	{
+		m_openFiles[file] = package;
+	}
+	return file;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Mount::closeFile(IReadFile* file)
+{
+	Package* package = NULL;
+	{
+		MutexLock lock(m_mutex);
+		std::map<IReadFile*, Package*>::iterator iter = m_openFiles.find(file);
+		if (iter == m_openFiles.end())
+		{
+			assert(false);
+			return;
+		}
+		package = iter->second;
+		m_openFiles.erase(iter);
+	}
+	package->closeFile(file);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Mount::buildIndex()
+{
+	u32 fileCount = 0;
+	for (u32 i = 0; i < m_layers.size(); ++i)
+	{
+		fileCount += m_layers[i].package->getFileCount();
+	}
+	u32 indexSize = MIN_INDEX_SIZE;
+	while (indexSize < fileCount * 2)
+	{
+		indexSize *= 2;
+	}
+	m_indexMask = indexSize - 1;
+	MountedFile emptySlot;
+	emptySlot.nameHash = 0;
+	emptySlot.layer = EMPTY_SLOT;
+	emptySlot.entryIndex = 0;
+	m_index.clear();
+	m_index.resize(indexSize, emptySlot);
+
+	//from the lowest layer, entries of higher layers replace lower ones
+	for (u32 layer = m_layers.size(); layer > 0; --layer)
+	{
+		const Package* package = m_layers[layer - 1].package;
+		u32 entryCount = package->getFileCount();
+		for (u32 i = 0; i < entryCount; ++i)
+		{
+			const FileEntry& entry = package->getFileEntry(i);
+			if ((entry.flag & (FILE_DELETE | FILE_INTERNAL)) != 0)
+			{
+				continue;
+			}
+			u32 slot = (u32)(entry.nameHash & m_indexMask);
+			while (m_index[slot].layer != EMPTY_SLOT && m_index[slot].nameHash != entry.nameHash)
+			{
+				slot = (slot + 1) & m_indexMask;
+			}
+			m_index[slot].nameHash = entry.nameHash;
+			m_index[slot].layer = layer - 1;
+			m_index[slot].entryIndex = i;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const Mount::MountedFile* Mount::findFile(const Char* filename) const
+{
+	if (m_layers.empty())
+	{
+		return NULL;
+	}
+	u64 nameHash = m_layers[0].package->stringHash(filename, HASH_SEED);
+	u32 slot = (u32)(nameHash & m_indexMask);
+	while (m_index[slot].layer != EMPTY_SLOT)
+	{
+		const MountedFile& file = m_index[slot];
+		if (file.nameHash == nameHash)
+		{
+			const FileEntry& entry = m_layers[file.layer].package->getFileEntry(file.entryIndex);
+			return ((entry.flag & FILE_WHITEOUT) != 0) ? NULL : &file;
+		}
+		slot = (slot + 1) & m_indexMask;
+	}
+	return NULL;
+}
+
+}
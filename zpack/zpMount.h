@@ -0,0 +1,65 @@
+#ifndef __ZP_MOUNT_H__
+#define __ZP_MOUNT_H__
+
+#include "zpack.h"
+#include "zpPlatform.h"
+#include <vector>
+#include <map>
+
+namespace zp
+{
+
+class Package;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class Mount : public IMount
+{
+public:
+	Mount();
+	virtual ~Mount();
+
+	virtual bool mount(IPackage* package, int priority);
+	virtual bool unmount(IPackage* package);
+	virtual void refresh();
+
+	virtual u32 getPackageCount() const;
+	virtual IPackage* getPackage(u32 index) const;
+
+	virtual bool hasFile(const Char* filename) const;
+	virtual IPackage* findPackage(const Char* filename) const;
+
+	virtual IReadFile* openFile(const Char* filename);
+	virtual void closeFile(IReadFile* file);
+
+private:
+	struct Layer
+	{
+		Package*	package;
+		int			priority;
+	};
+
+	//slot of merged hash index, the visible entry of a name (may be a whiteout)
+	struct MountedFile
+	{
+		u64	nameHash;
+		u32	layer;		//index in m_layers, EMPTY_SLOT if not used
+		u32	entryIndex;
+	};
+
+	//m_mutex must be locked by caller
+	void buildIndex();
+
+	//NULL if not found or removed by whiteout, m_mutex must be locked by caller
+	const MountedFile* findFile(const Char* filename) const;
+
+private:
+	std::vector<Layer>				m_layers;		//highest priority first
+	std::vector<MountedFile>		m_index;
+	u32								m_indexMask;
+	std::map<IReadFile*, Package*>	m_openFiles;	//to close file by the package opening it
+	mutable Mutex					m_mutex;		//files may be opened by several threads, guards all members
+};
+
+}
+
+#endif
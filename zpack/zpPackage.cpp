@@ -1,11 +1,19 @@
 #include "zpPackage.h"
 #include "zpFile.h"
 #include "zpCompressedFile.h"
+#include "zpChunkedFile.h"
 #include "zpWriteFile.h"
+#include "zpStreamWriteFile.h"
 #include "WriteCompressFile.h"
+#include "zpBulkAdder.h"
+#include "zpBulkExtractor.h"
+#include "zpPlatform.h"
+#include "zpContentHash.h"
 #include "zlib.h"
 #include <cassert>
+#include <cstring>
 #include <sstream>
+#include <algorithm>
 
 //#include "PerfUtil.h"
 //#include "windows.h"
@@ -22,55 +30,103 @@ const u32 MIN_HASH_BITS = 8;
 const u32 MIN_HASH_TABLE_SIZE = (1<<MIN_HASH_BITS);
 const u32 MAX_HASH_TABLE_SIZE = 0x100000;
 const u32 MIN_CHUNK_SIZE = 0x1000;
-
-const u32 HASH_SEED = 131;
+//compact() makes a gap at least this large (or several times of tables) before moving files into it
+//otherwise tables have to be written after almost every file
+const u64 MIN_COMPACT_GAP = 0x100000;
+const u32 COMPACT_GAP_SCALE = 4;
+//space reserved for table log, at least this or a part of tables
+const u32 MIN_TABLE_LOG_CAPACITY = 0x10000;
+const u32 TABLE_LOG_CAPACITY_SCALE = 4;
+//tables are written again after this many records, or when more than 1/TABLE_LOG_CHANGE_SCALE of files changed
+const u32 MAX_TABLE_LOG_COUNT = 256;
+const u32 TABLE_LOG_CHANGE_SCALE = 8;
+//more changed names than this are not recorded, tables will be written
+const u32 MAX_CHANGED_NAMES = 0x10000;
+//entries of each page of paged tables
+const u32 TABLE_PAGE_ENTRY_COUNT = 256;
 
 using namespace std;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-Package::Package(const Char* filename, bool readonly, bool readFilename)
-	: m_stream(NULL)
+//compressed if smaller, return size appended
+static u32 appendPackedData(const u8* src, u32 srcSize, vector<u8>& dst)
+{
+	size_t pos = dst.size();
+	u32 dstSize = srcSize;
+	dst.resize(pos + srcSize);
+	if (srcSize == 0)
+	{
+		return 0;
+	}
+	int ret = compress(&dst[pos], &dstSize, src, srcSize);
+	if (ret != Z_OK || dstSize >= srcSize)
+	{
+		memcpy(&dst[pos], src, srcSize);
+		return srcSize;
+	}
+	dst.resize(pos + dstSize);
+	return dstSize;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Package::Package(IStorage* storage, bool ownStorage, bool readonly, bool readFilename)
+	: m_storage(storage)
+	, m_fileStorage(dynamic_cast<FileStorage*>(storage))
+	, m_ownStorage(ownStorage)
 	, m_hashBits(MIN_HASH_BITS)
 	, m_packageEnd(0)
 	, m_hashMask(0)
+	, m_skippedCompressSize(0)
+	, m_contentIndexReady(false)
+	, m_threadCount(1)
+	, m_directIO(false)
+	, m_trace(NULL)
+	, m_preloader(NULL)
+	, m_timingEnabled(false)
+	, m_changedNamesOverflow(false)
+	, m_tableLogEnabled(false)
+	, m_firstMovedPage((u32)-1)
+	, m_pagedTables(false)
 	, m_readonly(readonly)
-	, m_lastSeekFile(NULL)
 	, m_dirty(false)
 {
 #ifdef _ZP_WIN32_THREAD_SAFE
 	::InitializeCriticalSection(&m_cs);
 #endif
+	memset(&m_statistics, 0, sizeof(m_statistics));
+	memset(m_histograms, 0, sizeof(m_histograms));
 
 	//require filename to modify package
-	if (!readFilename && !readonly)
-	{
-		return;
-	}
-	if (readonly)
+	if ((!readFilename || storage->readonly()) && !readonly)
 	{
-		m_stream = Fopen(filename, _T("rb"));
+		goto Error;
 	}
-	else
+	if (!readHeader() || !readFileEntries())
 	{
-		m_stream = Fopen(filename, _T("r+b"));
+		goto Error;
 	}
-	if (m_stream == NULL)
+	if (readFilename && !readFilenames())
 	{
-		return;
+		goto Error;
 	}
-	if (!readHeader() || !readFileEntries())
+	if (!readTableLog(readFilename))
 	{
 		goto Error;
 	}
-	if (readFilename && !readFilenames())
+	if (m_header.tableLogSize > 0)
 	{
-		goto Error;
+		updatePackageEnd();
 	}
+	m_pagedTables = (m_header.tablePageEntryCount > 0);
 	if (!buildHashTable())
 	{
 		goto Error;
 	}
-	m_packageFilename = filename;
+	if (m_fileStorage != NULL)
+	{
+		m_packageFilename = m_fileStorage->filename();
+		m_fileStorage->countSeeks(&m_statistics.seekCount);
+	}
 	if (!readonly)
 	{
 		//for compress output
@@ -79,22 +135,33 @@ Package::Package(const Char* filename, bool readonly, bool readFilename)
 	}
 	return;
 Error:
-	if (m_stream != NULL)
+	if (m_ownStorage)
 	{
-		fclose(m_stream);
-		m_stream = NULL;
+		delete m_storage;
 	}
+	m_storage = NULL;
+	m_fileStorage = NULL;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 Package::~Package()
 {
-	if (m_stream != NULL)
+	releaseWarmUp();
+	if (m_storage != NULL)
 	{
 		removeDeletedEntries();
 		flush();
-		fclose(m_stream);
+		if (m_fileStorage != NULL)
+		{
+			//storage given by user lives longer
+			m_fileStorage->countSeeks(NULL);
+		}
+		if (m_ownStorage)
+		{
+			delete m_storage;
+		}
 	}
+	stopTrace();
 #ifdef _ZP_WIN32_THREAD_SAFE
 	::DeleteCriticalSection(&m_cs);
 #endif
@@ -103,7 +170,7 @@ Package::~Package()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool Package::valid() const
 {
-	return (m_stream != NULL);
+	return (m_storage != NULL);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -136,18 +203,49 @@ IReadFile* Package::openFile(const Char* filename)
 	{
 		return NULL;
 	}
-	FileEntry& entry = getFileEntry(fileIndex);
-	if ((entry.flag & FILE_COMPRESS) == 0)
+	return openFileEntry(fileIndex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IReadFile* Package::openFileEntry(u32 index)
+{
+	SCOPE_LOCK;
+
+	FileEntry& entry = getFileEntry(index);
+	OperationTimer timer(this, OP_OPEN_FILE, entry.nameHash);
+	IReadFile* file = NULL;
+	if ((entry.flag & FILE_CHUNKED) != 0)
+	{
+		ChunkedFile* chunkedFile = new ChunkedFile(this, entry.byteOffset, entry.packSize, entry.originSize,
+													entry.flag, entry.nameHash);
+		if ((chunkedFile->flag() & FILE_DELETE) != 0)
+		{
+			delete chunkedFile;
+			return NULL;
+		}
+		file = chunkedFile;
+	}
+	else if ((entry.flag & FILE_COMPRESS) == 0)
+	{
+		file = new File(this, entry.byteOffset, entry.packSize, entry.flag, entry.nameHash);
+	}
+	else
 	{
-		return new File(this, entry.byteOffset, entry.packSize, entry.flag, entry.nameHash);
+		u32 chunkSize = entry.chunkSize == 0 ? m_header.chunkSize : entry.chunkSize;
+		CompressedFile* compressedFile = new CompressedFile(this, entry.byteOffset, entry.packSize, entry.originSize,
+															chunkSize, entry.flag, entry.nameHash);
+		if ((compressedFile->flag() & FILE_DELETE) != 0)
+		{
+			delete compressedFile;
+			return NULL;
+		}
+		file = compressedFile;
 	}
-	u32 chunkSize = entry.chunkSize == 0 ? m_header.chunkSize : entry.chunkSize;
-	CompressedFile* file = new CompressedFile(this, entry.byteOffset, entry.packSize, entry.originSize,
-												chunkSize, entry.flag, entry.nameHash);
-	if ((file->flag() & FILE_DELETE) != 0)
+	addStatistic(m_statistics.openCount, 1);
+	if (m_trace != NULL)
 	{
-		delete file;
-		file = NULL;
+		const Char* filename = (index < m_filenames.size()) ? getFilename(index).c_str() : NULL;
+		m_trace->record(TRACE_OPEN, entry.nameHash, 0, entry.originSize, filename);
 	}
 	return file;
 }
@@ -157,7 +255,11 @@ void Package::closeFile(IReadFile* file)
 {
 	SCOPE_LOCK;
 
-	if ((file->flag() & FILE_COMPRESS) == 0)
+	if ((file->flag() & FILE_CHUNKED) != 0)
+	{
+		delete static_cast<ChunkedFile*>(file);
+	}
+	else if ((file->flag() & FILE_COMPRESS) == 0)
 	{
 		delete static_cast<File*>(file);
 	}
@@ -172,7 +274,16 @@ void Package::closeFile(IWriteFile* file)
 {
 	SCOPE_LOCK;
 
-	delete static_cast<WriteFile*>(file);
+	if ((file->flag() & FILE_WRITING) != 0)
+	{
+		StreamWriteFile* streamFile = static_cast<StreamWriteFile*>(file);
+		streamFile->finish();
+		delete streamFile;
+	}
+	else
+	{
+		delete static_cast<WriteFile*>(file);
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -187,7 +298,7 @@ bool Package::getFileInfo(u32 index, Char* filenameBuffer, u32 filenameBufferSiz
 	}
 	if (filenameBuffer != NULL)
 	{
-        snprintf(filenameBuffer, filenameBufferSize, "%s", m_filenames[index].c_str());
+        snprintf(filenameBuffer, filenameBufferSize, "%s", getFilename(index).c_str());
 		filenameBuffer[filenameBufferSize - 1] = 0;
 	}
 	const FileEntry& entry = getFileEntry(index);
@@ -249,9 +360,18 @@ bool Package::getFileInfo(const Char* filename, u32* fileSize, u32* packSize, u3
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 Package::extractFiles(const ExtractFileParam* files, u32 fileCount, Callback callback, void* callbackParam)
+{
+	SCOPE_LOCK;
+
+	BulkExtractor extractor(this, files, fileCount, m_threadCount);
+	return extractor.run(callback, callbackParam);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool Package::addFile(const Char* filename, const Char* externalFilename, u32 fileSize, u32 flag,
-						u32* outPackSize, u32* outFlag, u32 chunkSize)
+						u32* outPackSize, u32* outFlag, u32 chunkSize, u32 compressLevel)
 {
 	SCOPE_LOCK;
 
@@ -268,35 +388,73 @@ bool Package::addFile(const Char* filename, const Char* externalFilename, u32 fi
 	{
 		return false;
 	}
+	adviseFile(file, 0, 0, ADVISE_SEQUENTIAL);
+	if ((flag & FILE_CHUNKED) != 0)
+	{
+		bool ret = addChunkedFile(filename, file, fileSize, flag, compressLevel, outPackSize, outFlag);
+		fclose(file);
+		return ret;
+	}
+	//identical file is only possible if one of the same size exists, data is shared then and never written
+	//source is read once more for this, raw file copied by kernel is not read to user space otherwise
+	u64 contentHash = 0;
+	bool hashed = false;
+	if (hasSameSize(fileSize))
+	{
+		ContentHash hash;
+		m_chunkData.resize(m_header.chunkSize);
+		for (u32 pos = 0; pos < fileSize;)
+		{
+			u32 size = (fileSize - pos < m_header.chunkSize) ? fileSize - pos : m_header.chunkSize;
+			if (fread(&m_chunkData[0], size, 1, file) != 1)
+			{
+				break;
+			}
+			hash.update(&m_chunkData[0], size);
+			pos += size;
+		}
+		contentHash = hash.digest();
+		hashed = true;
+		int sameIndex = findSameContent(contentHash, fileSize);
+		if (sameIndex >= 0 && isSameContent(sameIndex, file, NULL))
+		{
+			fclose(file);
+			return addSharedFile(filename, flag, sameIndex, outPackSize, outFlag);
+		}
+		_fseeki64(file, 0, SEEK_SET);
+	}
+	if ((flag & FILE_COMPRESS) != 0 && fileSize >= FORMAT_SIGN_SIZE)
+	{
+		u8 sign[FORMAT_SIGN_SIZE];
+		fread(sign, FORMAT_SIGN_SIZE, 1, file);
+		_fseeki64(file, 0, SEEK_SET);
+		if (isCompressedFormat(sign, FORMAT_SIGN_SIZE))
+		{
+			flag &= (~FILE_COMPRESS);
+			m_skippedCompressSize += fileSize;
+		}
+	}
 
 	m_dirty = true;
 
-	int fileIndex = getFileIndex(filename);
-	if (fileIndex >= 0)
-	{
-		//file exist
-		getFileEntry(fileIndex).flag |= FILE_DELETE;
-	}
 	FileEntry entry;
 	entry.nameHash = stringHash(filename, HASH_SEED);
 	entry.packSize = fileSize;
 	entry.originSize = fileSize;
-	entry.flag = flag;
+	entry.flag = flag | FILE_HASHED;
 	entry.chunkSize = chunkSize;
 	entry.contentHash = 0;
 	entry.availableSize = fileSize;
 	entry.reserved = 0;
 	//memset(entry.reserved, 0, sizeof(entry.reserved));
 
+	//new entry is not in hash table until data is written
+	u64 oldPackageEnd = m_packageEnd;
 	u32 insertedIndex = insertFileEntry(entry, filename);
 
-	if (!insertFileHash(entry.nameHash, insertedIndex))
-	{
-		//may be hash confliction
-		getFileEntry(insertedIndex).flag |= FILE_DELETE;
-		return false;
-	}
-
+	//hash is computed while file is written, so source is read only once
+	ContentHash hash;
+	bool hashComplete = true;
 	if (fileSize == 0)
 	{
 		entry.flag &= (~FILE_COMPRESS);
@@ -305,23 +463,71 @@ bool Package::addFile(const Char* filename, const Char* externalFilename, u32 fi
 	{
 		if ((entry.flag & FILE_COMPRESS) == 0)
 		{
-			writeRawFile(getFileEntry(insertedIndex), file);
+			hashComplete = writeRawFile(getFileEntry(insertedIndex), file, hash);
 		}
 		else
 		{
-			m_chunkData.resize(chunkSize);
-			m_compressBuffer.resize(chunkSize);
 			FileEntry& dstEntry = getFileEntry(insertedIndex);
-			dstEntry.packSize = writeCompressFile(m_stream, entry.byteOffset, file, dstEntry.originSize, chunkSize, dstEntry.flag,
-												m_chunkData, m_compressBuffer, m_chunkPosBuffer);
+			u32 skippedSize = 0;
+			if (m_threadCount > 1 && dstEntry.originSize > chunkSize)
+			{
+				dstEntry.packSize = writeCompressFileParallel(m_storage, entry.byteOffset, file, dstEntry.originSize, chunkSize,
+															compressLevel, dstEntry.flag, m_chunkPosBuffer, m_threadCount, skippedSize,
+															hash);
+			}
+			else
+			{
+				m_chunkData.resize(chunkSize);
+				m_compressBuffer.resize(chunkSize);
+				dstEntry.packSize = writeCompressFile(m_storage, entry.byteOffset, file, dstEntry.originSize, chunkSize,
+													compressLevel, dstEntry.flag, m_chunkData, m_compressBuffer, m_chunkPosBuffer, skippedSize,
+													hash);
+			}
+			m_skippedCompressSize += skippedSize;
+			dstEntry.availableSize = dstEntry.packSize;
 			//temp
 			if (m_packageEnd == dstEntry.byteOffset + dstEntry.originSize)
 			{
 				m_packageEnd = dstEntry.byteOffset + dstEntry.packSize;
 			}
 		}
+		if (m_directIO)
+		{
+			//source is read only once
+			adviseFile(file, 0, 0, ADVISE_DONTNEED);
+			dropWrittenData(getFileEntry(insertedIndex).byteOffset, getFileEntry(insertedIndex).packSize);
+		}
 	}
 	fclose(file);
+	if (!hashed)
+	{
+		//0 if not known yet, see hashSameSizeFiles()
+		contentHash = (fileSize == 0 || !hashComplete) ? 0 : hash.digest();
+	}
+
+	//existing file is only hidden from insertFileHash, it's kept if new entry can't be inserted
+	int fileIndex = getFileIndex(filename);
+	if (fileIndex >= 0)
+	{
+		getFileEntry(fileIndex).flag |= FILE_DELETE;
+	}
+	if (!insertFileHash(entry.nameHash, insertedIndex))
+	{
+		//may be hash confliction
+		if (fileIndex >= 0)
+		{
+			getFileEntry(fileIndex).flag &= (~FILE_DELETE);
+		}
+		discardFileData(insertedIndex, oldPackageEnd);
+		return false;
+	}
+	if (fileIndex >= 0)
+	{
+		//file exist
+		deleteFileEntry(fileIndex);
+	}
+	getFileEntry(insertedIndex).contentHash = contentHash;
+	addContentIndex(insertedIndex);
 
 	if (outPackSize != NULL)
 	{
@@ -334,6 +540,41 @@ bool Package::addFile(const Char* filename, const Char* externalFilename, u32 fi
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::setThreadCount(u32 count)
+{
+	SCOPE_LOCK;
+
+	m_threadCount = (count == 0) ? getCpuCount() : count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 Package::addFiles(AddFileParam* files, u32 fileCount, Callback callback, void* callbackParam)
+{
+	SCOPE_LOCK;
+
+	if (m_readonly)
+	{
+		return 0;
+	}
+	BulkAdder adder(this, files, fileCount, m_threadCount);
+	return adder.run(callback, callbackParam);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::enableDirectIO(bool enable)
+{
+	SCOPE_LOCK;
+
+	m_directIO = enable;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 Package::getSkippedCompressSize() const
+{
+	return m_skippedCompressSize;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 IWriteFile* Package::createFile(const Char* filename, u32 fileSize, u32 packSize, u32 chunkSize,
 								u32 flag, u64 contentHash)
@@ -350,12 +591,13 @@ IWriteFile* Package::createFile(const Char* filename, u32 fileSize, u32 packSize
 	if (fileIndex >= 0)
 	{
 		//file exist
-		getFileEntry(fileIndex).flag |= FILE_DELETE;
+		deleteFileEntry(fileIndex);
 	}
 
 	FileEntry entry;
 	entry.nameHash = stringHash(filename, HASH_SEED);
-	entry.flag = flag;
+	//hash is not computed by package, see FILE_HASHED
+	entry.flag = flag & (~FILE_HASHED);
 	entry.packSize = packSize;
 	entry.originSize = fileSize;
 	entry.contentHash = contentHash;
@@ -395,13 +637,44 @@ IWriteFile* Package::openFileToWrite(const Char* filename)
 		return NULL;
 	}
 	FileEntry& entry = getFileEntry(fileIndex);
-	if ((entry.flag & FILE_DELETE) != 0)
+	if ((entry.flag & (FILE_DELETE | FILE_CHUNKED | FILE_INTERNAL)) != 0 || isDataShared(fileIndex))
 	{
+		//writing would change content of other files too
 		return NULL;
 	}
+	if ((entry.flag & FILE_HASHED) != 0 || entry.contentHash != 0)
+	{
+		//content is going to change, files added later must not share it
+		std::map<u64, u64>::iterator iter = m_contentIndex.find(entry.contentHash);
+		if (iter != m_contentIndex.end() && iter->second == entry.byteOffset)
+		{
+			m_contentIndex.erase(iter);
+		}
+		entry.contentHash = 0;
+		entry.flag &= (~FILE_HASHED);
+		m_dirty = true;
+		markEntryChanged(fileIndex);
+	}
+	releaseWarmUp();
 	return new WriteFile(this, entry.byteOffset, entry.packSize, entry.flag, entry.nameHash);
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IWriteFile* Package::createStreamFile(const Char* filename, u32 flag, u32 chunkSize, u32 compressLevel)
+{
+	SCOPE_LOCK;
+
+	if (m_readonly || (flag & (FILE_CHUNKED | FILE_INTERNAL | FILE_DELETE)) != 0)
+	{
+		return NULL;
+	}
+	if (chunkSize == 0)
+	{
+		chunkSize = m_header.chunkSize;
+	}
+	return new StreamWriteFile(this, filename, flag, chunkSize, compressLevel);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool Package::removeFile(const Char* filename)
 {
@@ -416,8 +689,12 @@ bool Package::removeFile(const Char* filename)
 	{
 		return false;
 	}
-	//hash table doesn't change until flushso we shouldn't remove entry here
-	getFileEntry(fileIndex).flag |= FILE_DELETE;
+	if ((getFileEntry(fileIndex).flag & FILE_INTERNAL) != 0)
+	{
+		return false;
+	}
+	//hash table doesn't change until flush��so we shouldn't remove entry here
+	deleteFileEntry(fileIndex);
 	m_dirty = true;
 	return true;
 }
@@ -437,25 +714,58 @@ void Package::flush()
 	{
 		return;
 	}
-	m_lastSeekFile = NULL;
-
-	writeTables(true);
+	OperationTimer timer(this, OP_FLUSH);
 
-	//header
-	_fseeki64(m_stream, 0, SEEK_SET);
-	fwrite(&m_header, sizeof(m_header), 1, m_stream);
-
-	fflush(m_stream);
+	u64 writeSize = sizeof(m_header);
+	u32 oldLogSize = m_header.tableLogSize;
+	bool appended = m_pagedTables ? appendTablePages() : (m_tableLogEnabled && appendTableLog());
+	if (appended)
+	{
+		writeSize += m_header.tableLogSize - oldLogSize;
+	}
+	else
+	{
+		writeTables(true);
+		writeSize += m_header.allFileEntrySize + m_header.allFilenameSize;
+	}
+	writeHeader();
+	addStatistic(m_statistics.flushWriteSize, writeSize);
 
 	buildHashTable();
 
-	if (m_header.filenameOffset + m_header.allFilenameSize > m_packageEnd)
+	if (getTablesEnd() > m_packageEnd)
 	{
-		m_packageEnd = m_header.filenameOffset + m_header.allFilenameSize;
+		m_packageEnd = getTablesEnd();
 	}
 	m_dirty = false;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::enableTableLog(bool enable)
+{
+	SCOPE_LOCK;
+
+	if (enable && !m_tableLogEnabled && m_dirty)
+	{
+		//changes before were not recorded
+		m_changedNamesOverflow = true;
+	}
+	m_tableLogEnabled = enable;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::enablePagedTables(bool enable)
+{
+	SCOPE_LOCK;
+
+	if (enable != m_pagedTables && !m_readonly)
+	{
+		//tables are converted by next flush()
+		m_pagedTables = enable;
+		m_dirty = true;
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool Package::defrag(Callback callback, void* callbackParam)
 {
@@ -465,16 +775,40 @@ bool Package::defrag(Callback callback, void* callbackParam)
 	{
 		return false;
 	}
-	m_lastSeekFile = NULL;
+	OperationTimer timer(this, OP_DEFRAG);
+	releaseWarmUp();
 
+	//package not in a file is rebuilt in memory and copied back
 	String tempFilename = m_packageFilename + _T("_");
-	FILE* tempFile;
-	tempFile = Fopen(tempFilename.c_str(), _T("wb"));
-	if (tempFile == NULL)
+	IStorage* tempStorage = NULL;
+	DirectReader reader;
+	DirectWriter writer;
+	if (m_fileStorage == NULL)
 	{
-		return false;
+		tempStorage = new MemoryStorage(NULL, 0, false);
+	}
+	else if (m_directIO)
+	{
+		m_storage->sync();
+		if (!reader.open(m_packageFilename.c_str()) || !writer.open(tempFilename.c_str()))
+		{
+			return false;
+		}
+		//header is written at last
+		vector<char> emptyHeader(sizeof(m_header), 0);
+		writer.write(&emptyHeader[0], sizeof(m_header));
+	}
+	else
+	{
+		FileStorage* tempFile = new FileStorage;
+		if (!tempFile->open(tempFilename.c_str(), false, true))
+		{
+			delete tempFile;
+			return false;
+		}
+		tempStorage = tempFile;
+		adviseStorage(0, 0, ADVISE_SEQUENTIAL);
 	}
-	_fseeki64(tempFile, sizeof(m_header), SEEK_SET);
 
 	vector<char> tempBuffer;
 	u64 nextPos = m_header.headerSize;
@@ -483,6 +817,9 @@ bool Package::defrag(Callback callback, void* callbackParam)
 	u64 currentChunkPos = nextPos;
 	u64 fragmentSize = 0;
 	u32 currentChunkSize = 0;
+	//files sharing data are adjacent, data is copied only once
+	u64 lastOffset = 0;
+	u64 lastNewOffset = 0;
 	u32 fileCount = getFileCount();
 	for (u32 i = 0; i < fileCount; ++i)
 	{
@@ -490,8 +827,12 @@ bool Package::defrag(Callback callback, void* callbackParam)
 		if (callback != NULL && !callback(m_filenames[i].c_str(), entry.originSize, callbackParam))
 		{
 			//stop
-			fclose(tempFile);
-			Remove(tempFilename.c_str());
+			delete tempStorage;
+			writer.close();
+			if (m_fileStorage != NULL)
+			{
+				Remove(tempFilename.c_str());
+			}
 			return false;
 		}
 		if (entry.packSize == 0)
@@ -499,15 +840,20 @@ bool Package::defrag(Callback callback, void* callbackParam)
 			entry.byteOffset = nextPos;
 			continue;
 		}
+		if (entry.byteOffset == lastOffset)
+		{
+			entry.byteOffset = lastNewOffset;
+			continue;
+		}
+		lastOffset = entry.byteOffset;
+		lastNewOffset = nextPos;
 		if (entry.byteOffset != fragmentSize + nextPos	//new fragment encountered
 			|| currentChunkSize > MIN_CHUNK_SIZE)
 		{
 			if (currentChunkSize > 0)
 			{
-				tempBuffer.resize(currentChunkSize);
-				_fseeki64(m_stream, currentChunkPos, SEEK_SET);
-				fread(&tempBuffer[0], currentChunkSize, 1, m_stream);
-				fwrite(&tempBuffer[0], currentChunkSize, 1, tempFile);
+				copyToTemp(currentChunkPos, nextPos - currentChunkSize, currentChunkSize, tempStorage, reader, writer,
+							tempBuffer);
 			}
 			fragmentSize = entry.byteOffset - nextPos;
 			currentChunkPos = entry.byteOffset;
@@ -520,515 +866,2265 @@ bool Package::defrag(Callback callback, void* callbackParam)
 	//one chunk may be left
 	if (currentChunkSize > 0)
 	{
-		tempBuffer.resize(currentChunkSize);
-		_fseeki64(m_stream, currentChunkPos, SEEK_SET);
-		fread(&tempBuffer[0], currentChunkSize, 1, m_stream);
-		fwrite(&tempBuffer[0], currentChunkSize, 1, tempFile);
+		copyToTemp(currentChunkPos, nextPos - currentChunkSize, currentChunkSize, tempStorage, reader, writer,
+					tempBuffer);
 	}
+	reader.close();
+	writer.close();
 
-	fclose(m_stream);
-	fclose(tempFile);
-
-	m_stream = Fopen(tempFilename.c_str(), _T("r+b"));//ios_base::in | ios_base::out | ios_base::binary);	//only for flush()
-	assert(m_stream != NULL);
+	if (m_fileStorage != NULL)
+	{
+		m_fileStorage->close();
+		if (tempStorage == NULL)
+		{
+			//written by direct writer, only for flush()
+			FileStorage* tempFile = new FileStorage;
+			tempFile->open(tempFilename.c_str(), false);
+			tempStorage = tempFile;
+		}
+	}
 
-	//write file entries, filenames and header
+	//write file entries, filenames and header to temp storage
+	IStorage* packageStorage = m_storage;
+	m_storage = tempStorage;
 	writeTables(false);
-	_fseeki64(m_stream, 0, SEEK_SET);
-	fwrite(&m_header, sizeof(m_header), 1, m_stream);
-	fflush(m_stream);
+	writeHeader();
+	m_storage = packageStorage;
 
-	fclose(m_stream);
+	bool succeeded = true;
+	if (m_fileStorage != NULL)
+	{
+		delete tempStorage;
+		Remove(m_packageFilename.c_str());
+		Rename(tempFilename.c_str(), m_packageFilename.c_str());
+		succeeded = m_fileStorage->open(m_packageFilename.c_str(), false);
+		assert(succeeded);
+	}
+	else
+	{
+		succeeded = copyFromTemp(tempStorage);
+		delete tempStorage;
+	}
 
-	Remove(m_packageFilename.c_str());
-	Rename(tempFilename.c_str(), m_packageFilename.c_str());
-	m_stream = Fopen(m_packageFilename.c_str(), _T("r+b"));//ios_base::in | ios_base::out | ios_base::binary);
-	assert(m_stream != NULL);
-	return true;
+	//offsets changed
+	m_contentIndex.clear();
+	m_sizeIndex.clear();
+	m_contentIndexReady = false;
+	return succeeded;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-u32 Package::getFileUserDataSize() const
+void Package::copyToTemp(u64 offset, u64 dstOffset, u64 size, IStorage* tempStorage, DirectReader& reader,
+						DirectWriter& writer, vector<char>& buffer)
 {
-	assert(m_header.fileEntrySize >= sizeof(FileEntry));
-	return m_header.fileEntrySize - sizeof(FileEntry);
+	//large file is copied piece by piece
+	buffer.resize((size < DIRECT_BLOCK_SIZE) ? (u32)size : DIRECT_BLOCK_SIZE);
+	for (u64 copied = 0; copied < size; )
+	{
+		u32 copySize = (size - copied < buffer.size()) ? (u32)(size - copied) : (u32)buffer.size();
+		if (tempStorage == NULL)
+		{
+			reader.read(offset + copied, &buffer[0], copySize);
+			writer.write(&buffer[0], copySize);
+		}
+		else
+		{
+			readStorage(offset + copied, &buffer[0], copySize);
+			tempStorage->write(dstOffset + copied, &buffer[0], copySize);
+		}
+		copied += copySize;
+	}
+	if (tempStorage != NULL)
+	{
+		//old package file is replaced by temp file
+		adviseStorage(offset, size, ADVISE_DONTNEED);
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool Package::writeFileUserData(const Char* filename, const u8* data, u32 dataLen)
+bool Package::copyFromTemp(IStorage* tempStorage)
 {
-	SCOPE_LOCK;
-
-	if (dataLen > getFileUserDataSize())
-	{
-		return false;
-	}
-	int fileIndex = getFileIndex(filename);
-	if (fileIndex < 0)
+	const u8* data = tempStorage->map();
+	u64 size = tempStorage->size();
+	assert(data != NULL);
+	for (u64 copied = 0; copied < size; )
 	{
-		return false;
+		u32 copySize = (size - copied < DIRECT_BLOCK_SIZE) ? (u32)(size - copied) : DIRECT_BLOCK_SIZE;
+		if (!writeStorage(copied, data + copied, copySize))
+		{
+			return false;
+		}
+		copied += copySize;
 	}
-	FileEntry& entry = getFileEntry(fileIndex);
-	memcpy(&entry + 1, data, dataLen);
-	return true;
+	return (m_storage->setSize(size) && m_storage->sync());
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool Package::readFileUserData(const Char* filename, u8* data, u32 dataLen)
+bool Package::optimizeLayout(const Char* const* filenames, u32 count, Callback callback, void* callbackParam)
 {
 	SCOPE_LOCK;
 
-	if (dataLen > getFileUserDataSize())
+	if (m_readonly || m_dirty)
 	{
 		return false;
 	}
-	int fileIndex = getFileIndex(filename);
-	if (fileIndex < 0)
+	u32 fileCount = getFileCount();
+	vector<u32> order;
+	order.reserve(fileCount);
+	vector<bool> placed(fileCount, false);
+	for (u32 i = 0; i < count; ++i)
 	{
-		return false;
+		int fileIndex = getFileIndex(filenames[i]);
+		if (fileIndex >= 0)
+		{
+			placeFileEntry(fileIndex, order, placed, true);
+		}
 	}
-	FileEntry& entry = getFileEntry(fileIndex);
-	memcpy(data, &entry + 1, dataLen);
-	return true;
-}
+	for (u32 i = 0; i < fileCount; ++i)
+	{
+		placeFileEntry(i, order, placed, false);
+	}
+	assert(order.size() == fileCount);
+
+	//reorder tables, defrag() writes data in entry order
+	vector<u8> oldEntries(m_fileEntries);
+	vector<String> oldFilenames(m_filenames);
+	u32 entrySize = m_header.fileEntrySize;
+	for (u32 i = 0; i < fileCount; ++i)
+	{
+		memcpy(&m_fileEntries[i * entrySize], &oldEntries[order[i] * entrySize], entrySize);
+		m_filenames[i] = oldFilenames[order[i]];
+	}
+	buildHashTable();
+	if (!defrag(callback, callbackParam))
+	{
+		//package file is not changed
+		m_fileEntries.swap(oldEntries);
+		m_filenames.swap(oldFilenames);
+		buildHashTable();
+		return false;
+	}
+	return true;
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool Package::readHeader()
+void Package::placeFileEntry(u32 index, vector<u32>& order, vector<bool>& placed, bool withChunks)
+{
+	if (placed[index])
+	{
+		return;
+	}
+	const FileEntry& entry = getFileEntry(index);
+	//entries sharing data are adjacent, keep them together so data is copied only once
+	u32 first = index;
+	u32 last = index;
+	if (entry.packSize > 0)
+	{
+		while (first > 0 && getFileEntry(first - 1).byteOffset == entry.byteOffset
+			&& getFileEntry(first - 1).packSize > 0)
+		{
+			--first;
+		}
+		while (last + 1 < getFileCount() && getFileEntry(last + 1).byteOffset == entry.byteOffset
+			&& getFileEntry(last + 1).packSize > 0)
+		{
+			++last;
+		}
+	}
+	for (u32 i = first; i <= last; ++i)
+	{
+		if (!placed[i])
+		{
+			placed[i] = true;
+			order.push_back(i);
+		}
+	}
+	if (!withChunks || (entry.flag & FILE_CHUNKED) == 0 || entry.packSize < sizeof(ChunkRef))
+	{
+		return;
+	}
+	vector<ChunkRef> chunks(entry.packSize / sizeof(ChunkRef));
+	if (!readStorage(entry.byteOffset, &chunks[0], chunks.size() * sizeof(ChunkRef)))
+	{
+		return;
+	}
+	for (u32 i = 0; i < chunks.size(); ++i)
+	{
+		int chunkIndex = getFileIndex(chunks[i].nameHash);
+		if (chunkIndex >= 0)
+		{
+			placeFileEntry(chunkIndex, order, placed, false);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::compact(u64 maxMoveSize, bool* finished)
 {
-	_fseeki64(m_stream, 0, SEEK_END);
-	u64 packageSize = _ftelli64(m_stream);
-	if (packageSize < sizeof(PackageHeader))
+	SCOPE_LOCK;
+
+	if (finished != NULL)
+	{
+		*finished = false;
+	}
+	if (m_readonly || m_dirty)
 	{
 		return false;
 	}
-	_fseeki64(m_stream, 0, SEEK_SET);
-	fread(&m_header, sizeof(PackageHeader), 1, m_stream);
-	if (m_header.sign != PACKAGE_FILE_SIGN
-		|| m_header.headerSize != sizeof(PackageHeader)
-		|| m_header.fileEntryOffset < m_header.headerSize
-		|| m_header.fileEntryOffset + m_header.allFileEntrySize > packageSize
-		|| m_header.filenameOffset < m_header.fileEntryOffset + m_header.allFileEntrySize
-		|| m_header.filenameOffset + m_header.allFilenameSize > packageSize
-		|| m_header.chunkSize < MIN_CHUNK_SIZE)
+	OperationTimer timer(this, OP_COMPACT);
+
+	if (m_header.tableLogSize > 0)
+	{
+		//files added since tables were written may be after log, tables must be after all files
+		writeTables(true);
+		writeHeader();
+		//files moved to the end must not overwrite tables
+		if (getTablesEnd() > m_packageEnd)
+		{
+			m_packageEnd = getTablesEnd();
+		}
+	}
+	//tables will be written anyway
+	removeDeletedEntries();
+	//offsets will change
+	m_contentIndex.clear();
+	m_sizeIndex.clear();
+	m_contentIndexReady = false;
+
+	u64 minGap = ((u64)m_header.allFileEntrySize + m_header.allFilenameSize) * COMPACT_GAP_SCALE;
+	if (minGap < MIN_COMPACT_GAP)
+	{
+		minGap = MIN_COMPACT_GAP;
+	}
+	//data moved away is still referred by tables in package file, until tables are written again
+	u64 oldDataStart = (u64)-1;
+	u64 oldDataEnd = 0;
+	u64 movedSize = 0;
+	u64 nextPos = m_header.headerSize;
+	bool done = true;
+	u32 fileCount = getFileCount();
+	u32 i = 0;
+	while (i < fileCount)
+	{
+		//files sharing data are adjacent, move them together
+		u64 offset = getFileEntry(i).byteOffset;
+		u32 packSize = 0;
+		u32 groupEnd = i;
+		for (; groupEnd < fileCount && getFileEntry(groupEnd).byteOffset == offset; ++groupEnd)
+		{
+			if (getFileEntry(groupEnd).packSize > packSize)
+			{
+				packSize = getFileEntry(groupEnd).packSize;
+			}
+		}
+		if (packSize == 0 || offset == nextPos)
+		{
+			for (u32 j = i; j < groupEnd; ++j)
+			{
+				getFileEntry(j).byteOffset = nextPos;
+			}
+			m_dirty = m_dirty || (offset != nextPos);
+			nextPos += packSize;
+			i = groupEnd;
+			continue;
+		}
+		assert(offset > nextPos);
+		if (movedSize > 0 && movedSize + packSize > maxMoveSize)
+		{
+			done = false;
+			break;
+		}
+		u64 gap = offset - nextPos;
+		bool lastGroup = (groupEnd == fileCount);
+		//small gap is enlarged first, unless there's not much left to move
+		u64 requiredGap = (m_packageEnd - nextPos) / 2;
+		if (requiredGap > minGap)
+		{
+			requiredGap = minGap;
+		}
+		if (gap >= packSize && (gap >= requiredGap || lastGroup))
+		{
+			//slide toward the beginning
+			if (nextPos + packSize > oldDataStart)
+			{
+				writeTables(true, oldDataEnd);
+				writeHeader();
+				if (getTablesEnd() > m_packageEnd)
+				{
+					m_packageEnd = getTablesEnd();
+				}
+				oldDataStart = (u64)-1;
+				oldDataEnd = 0;
+			}
+			moveFileData(offset, nextPos, packSize);
+			for (u32 j = i; j < groupEnd; ++j)
+			{
+				getFileEntry(j).byteOffset = nextPos;
+			}
+			nextPos += packSize;
+			i = groupEnd;
+		}
+		else if (!lastGroup)
+		{
+			//move to the end to make the gap larger, nothing is overwritten
+			u64 newOffset = m_packageEnd;
+			moveFileData(offset, newOffset, packSize);
+			m_packageEnd += packSize;
+			for (u32 j = i; j < groupEnd; ++j)
+			{
+				getFileEntry(j).byteOffset = newOffset;
+			}
+			u32 entrySize = m_header.fileEntrySize;
+			std::rotate(m_fileEntries.begin() + i * entrySize, m_fileEntries.begin() + groupEnd * entrySize,
+						m_fileEntries.end());
+			std::rotate(m_filenames.begin() + i, m_filenames.begin() + groupEnd, m_filenames.end());
+		}
+		else
+		{
+			//last file can't be moved without overwriting itself, leave the gap
+			break;
+		}
+		if (offset < oldDataStart)
+		{
+			oldDataStart = offset;
+		}
+		if (offset + packSize > oldDataEnd)
+		{
+			oldDataEnd = offset + packSize;
+		}
+		movedSize += packSize;
+		m_dirty = true;
+	}
+
+	if (m_dirty)
+	{
+		writeTables(true, oldDataEnd);
+		writeHeader();
+		buildHashTable();
+		m_dirty = false;
+	}
+	u64 tableSize = (u64)m_header.allFileEntrySize + m_header.allFilenameSize + m_header.tableLogCapacity;
+	u64 dataEnd = 0;
+	if (fileCount > 0)
+	{
+		const FileEntry& lastEntry = getFileEntry(fileCount - 1);
+		dataEnd = lastEntry.byteOffset + lastEntry.packSize;
+	}
+	if (done && fileCount > 0 && dataEnd + tableSize <= m_header.fileEntryOffset)
+	{
+		//tables were written after old data of last file
+		writeTables(true);
+		writeHeader();
+	}
+	m_packageEnd = getTablesEnd();
+	if (done)
+	{
+		m_storage->setSize(m_packageEnd);
+	}
+	if (finished != NULL)
+	{
+		*finished = done;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 Package::getFileUserDataSize() const
+{
+	assert(m_header.fileEntrySize >= sizeof(FileEntry));
+	return m_header.fileEntrySize - sizeof(FileEntry);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::writeFileUserData(const Char* filename, const u8* data, u32 dataLen)
+{
+	SCOPE_LOCK;
+
+	if (dataLen > getFileUserDataSize())
 	{
 		return false;
 	}
-	if (m_header.version != CURRENT_VERSION && !m_readonly)
+	int fileIndex = getFileIndex(filename);
+	if (fileIndex < 0)
 	{
 		return false;
 	}
-	if (m_header.fileEntrySize == 0)
+	FileEntry& entry = getFileEntry(fileIndex);
+	memcpy(&entry + 1, data, dataLen);
+	markEntryChanged(fileIndex);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::readFileUserData(const Char* filename, u8* data, u32 dataLen)
+{
+	SCOPE_LOCK;
+
+	if (dataLen > getFileUserDataSize())
 	{
-		m_header.fileEntrySize = sizeof(FileEntry);
+		return false;
 	}
-	if (m_header.fileEntrySize < sizeof(FileEntry))
+	int fileIndex = getFileIndex(filename);
+	if (fileIndex < 0)
 	{
 		return false;
 	}
-	m_packageEnd = m_header.filenameOffset + m_header.allFilenameSize;
+	FileEntry& entry = getFileEntry(fileIndex);
+	memcpy(data, &entry + 1, dataLen);
 	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool Package::readFileEntries()
+bool Package::setWarmSet(const Char* const* filenames, u32 count)
 {
-	m_fileEntries.resize(m_header.fileCount * m_header.fileEntrySize);
-	if (m_header.fileCount == 0)
+	SCOPE_LOCK;
+
+	if (m_readonly)
 	{
-		return true;
+		return false;
 	}
-	_fseeki64(m_stream, m_header.fileEntryOffset, SEEK_SET);
-	if (m_header.allFileEntrySize == m_header.fileCount * m_header.fileEntrySize)
+	vector<u64> nameHashes;
+	set<u64> added;
+	for (u32 i = 0; i < count; ++i)
 	{
-		//not compressed
-		fread(&m_fileEntries[0], m_header.allFileEntrySize, 1, m_stream);
+		u64 nameHash = stringHash(filenames[i], HASH_SEED);
+		if (getFileIndex(nameHash) >= 0 && added.insert(nameHash).second)
+		{
+			nameHashes.push_back(nameHash);
+		}
 	}
-	else
+	int fileIndex = getFileIndex(WARM_SET_NAME);
+	if (nameHashes.empty())
 	{
-		vector<u8> srcBuffer(m_header.allFileEntrySize);
-		fread(&srcBuffer[0], m_header.allFileEntrySize, 1, m_stream);
-		u32 dstBufferSize = m_header.fileCount * m_header.fileEntrySize;
-		int ret = uncompress(&m_fileEntries[0], &dstBufferSize, &srcBuffer[0], m_header.allFileEntrySize);
-		if (ret != Z_OK || dstBufferSize != m_header.fileCount * m_header.fileEntrySize)
+		if (fileIndex >= 0)
 		{
-			return false;
+			deleteFileEntry(fileIndex);
+			m_dirty = true;
 		}
+		return true;
 	}
-	return true;
+	u32 size = nameHashes.size() * sizeof(u64);
+	//content hash 0, so no file will share data with it
+	return writeFileData(WARM_SET_NAME, size, FILE_INTERNAL, 0, (const u8*)&nameHashes[0], size, 0);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool Package::readFilenames()
+u32 Package::warmUp()
 {
-	if (m_fileEntries.empty())
+	SCOPE_LOCK;
+
+	releaseWarmUp();
+	int fileIndex = getFileIndex(WARM_SET_NAME);
+	if (m_dirty || fileIndex < 0)
 	{
-		return true;
+		return 0;
 	}
-	if (m_header.allFilenameSize == 0)
+	const FileEntry& listEntry = getFileEntry(fileIndex);
+	vector<u64> nameHashes(listEntry.packSize / sizeof(u64));
+	if (!nameHashes.empty())
 	{
-		return false;
+		readStorage(listEntry.byteOffset, &nameHashes[0], nameHashes.size() * sizeof(u64));
 	}
-	_fseeki64(m_stream, m_header.filenameOffset, SEEK_SET);
-	vector<u8> dstBuffer(m_header.originFilenamesSize);
-	if (m_header.allFilenameSize == m_header.originFilenamesSize)
+	//files of a chunked file are its chunks
+	u32 count = 0;
+	vector<u32> indices;
+	set<u32> listed;
+	vector<ChunkRef> chunks;
+	for (u32 i = 0; i < nameHashes.size(); ++i)
 	{
-		//not compressed
-		fread(&dstBuffer[0], m_header.allFilenameSize, 1, m_stream);
+		fileIndex = getFileIndex(nameHashes[i]);
+		if (fileIndex < 0 || !listed.insert(fileIndex).second)
+		{
+			//removed after warm set was written
+			continue;
+		}
+		const FileEntry& entry = getFileEntry(fileIndex);
+		indices.push_back(fileIndex);
+		++count;
+		if ((entry.flag & FILE_CHUNKED) == 0 || entry.packSize < sizeof(ChunkRef))
+		{
+			continue;
+		}
+		chunks.resize(entry.packSize / sizeof(ChunkRef));
+		readStorage(entry.byteOffset, &chunks[0], chunks.size() * sizeof(ChunkRef));
+		for (u32 j = 0; j < chunks.size(); ++j)
+		{
+			int chunkIndex = getFileIndex(chunks[j].nameHash);
+			if (chunkIndex >= 0 && listed.insert(chunkIndex).second)
+			{
+				indices.push_back(chunkIndex);
+			}
+		}
 	}
-	else
+
+	//compressed files are decompressed in background, shared chunks are only read into system cache
+	//since a chunked file doesn't keep them
+	vector<FileEntry> preloadEntries;
+	set<u64> preloaded;
+	u64 preloadSize = 0;
+	u64 adviseOffset = 0;
+	u64 adviseEnd = 0;
+	for (u32 i = 0; i < indices.size(); ++i)
 	{
-		vector<u8> tempBuffer(m_header.allFilenameSize);
-		fread(&tempBuffer[0], m_header.allFilenameSize, 1, m_stream);
-		u32 originSize = m_header.originFilenamesSize;
-		int ret = uncompress(&dstBuffer[0], &originSize, &tempBuffer[0], m_header.allFilenameSize);
-		if (ret != Z_OK || originSize != m_header.originFilenamesSize)
+		FileEntry entry = getFileEntry(indices[i]);
+		if ((entry.flag & FILE_DELETE) != 0 || entry.availableSize < entry.packSize || entry.packSize == 0)
 		{
-			return false;
+			continue;
+		}
+		bool compressed = ((entry.flag & (FILE_COMPRESS | FILE_CHUNKED | FILE_INTERNAL)) == FILE_COMPRESS
+							&& entry.packSize != entry.originSize);
+		if (compressed && preloadSize + entry.originSize <= PRELOAD_MEMORY_LIMIT)
+		{
+			if (preloaded.insert(entry.byteOffset).second)
+			{
+				if (entry.chunkSize == 0)
+				{
+					entry.chunkSize = m_header.chunkSize;
+				}
+				preloadEntries.push_back(entry);
+				preloadSize += entry.originSize;
+			}
+			continue;
+		}
+		//adjacent files are advised together
+		if (entry.byteOffset != adviseEnd)
+		{
+			if (adviseEnd > adviseOffset)
+			{
+				adviseStorage(adviseOffset, adviseEnd - adviseOffset, ADVISE_WILLNEED);
+			}
+			adviseOffset = entry.byteOffset;
 		}
+		adviseEnd = entry.byteOffset + entry.packSize;
 	}
+	if (adviseEnd > adviseOffset)
+	{
+		adviseStorage(adviseOffset, adviseEnd - adviseOffset, ADVISE_WILLNEED);
+	}
+	if (!preloadEntries.empty())
+	{
+		m_preloader = new Preloader(this);
+		m_preloader->start(m_storage, m_packageFilename.c_str(), preloadEntries);
+	}
+	return count;
+}
 
-	String names;
-	names.assign((Char*)&dstBuffer[0], m_header.originFilenamesSize / sizeof(Char));
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::releaseWarmUp()
+{
+	SCOPE_LOCK;
 
-	u32 fileCount = getFileCount();
-	m_filenames.resize(fileCount);
+	if (m_preloader != NULL)
+	{
+		delete m_preloader;
+		m_preloader = NULL;
+	}
+}
 
-	IStringStream iss(names, IStringStream::in);
-	for (u32 i = 0; i < fileCount; ++i)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::startTrace(const Char* traceFilename)
+{
+	SCOPE_LOCK;
+
+	stopTrace();
+	m_trace = new TraceRecorder;
+	if (!m_trace->open(traceFilename))
+	{
+		delete m_trace;
+		m_trace = NULL;
+		return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::stopTrace()
+{
+	SCOPE_LOCK;
+
+	if (m_trace != NULL)
+	{
+		delete m_trace;
+		m_trace = NULL;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int Package::uncompressData(u8* dst, u32* dstSize, const u8* src, u32 srcSize, u64 nameHash) const
+{
+	u64 startTime = getMicroseconds();
+	int ret = uncompress(dst, dstSize, src, srcSize);
+	u64 duration = getMicroseconds() - startTime;
+	addStatistic(m_statistics.inflateTime, duration);
+	addTiming(OP_INFLATE, nameHash, startTime, duration);
+	addStatistic(m_statistics.compressedReadSize, srcSize);
+	if (ret == Z_OK)
+	{
+		addStatistic(m_statistics.inflatedSize, *dstSize);
+	}
+	return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::addTiming(u32 operation, u64 nameHash, u64 startTime, u64 duration) const
+{
+	if (!m_timingEnabled)
+	{
+		return;
+	}
+	LatencyHistogram& histogram = m_histograms[operation];
+	atomicAdd(&histogram.count, 1);
+	atomicAdd(&histogram.totalTime, duration);
+	atomicAdd(&histogram.buckets[getHistogramBucket(duration)], 1);
+	if (m_trace != NULL)
+	{
+		m_trace->recordTiming(operation, nameHash, startTime, duration);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::getStatistics(PackageStatistics& statistics) const
+{
+	//all members are u64 counters
+	const u64* src = (const u64*)&m_statistics;
+	u64* dst = (u64*)&statistics;
+	for (u32 i = 0; i < sizeof(PackageStatistics) / sizeof(u64); ++i)
+	{
+		dst[i] = atomicAdd(const_cast<u64*>(src + i), 0);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::resetStatistics()
+{
+	u64* counters = (u64*)&m_statistics;
+	for (u32 i = 0; i < sizeof(PackageStatistics) / sizeof(u64); ++i)
+	{
+		atomicExchange(counters + i, 0);
+	}
+	counters = (u64*)m_histograms;
+	for (u32 i = 0; i < OP_COUNT * sizeof(LatencyHistogram) / sizeof(u64); ++i)
+	{
+		atomicExchange(counters + i, 0);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::enableTiming(bool enable)
+{
+	m_timingEnabled = enable;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::getLatencyHistogram(u32 operation, LatencyHistogram& histogram) const
+{
+	if (operation >= OP_COUNT)
+	{
+		return false;
+	}
+	//all members are u64 counters
+	const u64* src = (const u64*)&m_histograms[operation];
+	u64* dst = (u64*)&histogram;
+	for (u32 i = 0; i < sizeof(LatencyHistogram) / sizeof(u64); ++i)
+	{
+		dst[i] = atomicAdd(const_cast<u64*>(src + i), 0);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::readHeader()
+{
+	u64 packageSize = m_storage->size();
+	if (packageSize < sizeof(PackageHeader) || !readStorage(0, &m_header, sizeof(PackageHeader)))
+	{
+		return false;
+	}
+	if (m_header.sign != PACKAGE_FILE_SIGN
+		|| m_header.headerSize != sizeof(PackageHeader)
+		|| m_header.fileEntryOffset < m_header.headerSize
+		|| m_header.fileEntryOffset + m_header.allFileEntrySize > packageSize
+		|| m_header.filenameOffset < m_header.fileEntryOffset + m_header.allFileEntrySize
+		|| m_header.filenameOffset + m_header.allFilenameSize > packageSize
+		|| m_header.chunkSize < MIN_CHUNK_SIZE)
+	{
+		return false;
+	}
+	if (m_header.version != CURRENT_VERSION && m_header.version != TABLE_LOG_VERSION
+		&& m_header.version != TABLE_PAGE_VERSION && !m_readonly)
+	{
+		return false;
+	}
+	if (m_header.tableLogSize > m_header.tableLogCapacity
+		|| (m_header.tableLogCapacity > 0 && m_header.tableLogOffset != m_header.filenameOffset + m_header.allFilenameSize)
+		|| m_header.tableLogOffset + m_header.tableLogSize > packageSize)
+	{
+		return false;
+	}
+	if (m_header.tablePageEntryCount > 0
+		&& (m_header.tableLogCount != 0
+		|| m_header.tablePageDirectoryOffset < m_header.fileEntryOffset
+		|| m_header.tablePageDirectoryOffset + (u64)m_header.tablePageCount * sizeof(TablePage) > packageSize))
+	{
+		return false;
+	}
+	if (m_header.fileEntrySize == 0)
+	{
+		m_header.fileEntrySize = sizeof(FileEntry);
+	}
+	if (m_header.fileEntrySize < sizeof(FileEntry))
+	{
+		return false;
+	}
+	m_packageEnd = getTablesEnd();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::readFileEntries()
+{
+	if (m_header.tablePageEntryCount > 0)
+	{
+		return readTablePages();
+	}
+	m_fileEntries.resize(m_header.fileCount * m_header.fileEntrySize);
+	if (m_header.fileCount == 0)
+	{
+		return true;
+	}
+	if (m_header.allFileEntrySize == m_header.fileCount * m_header.fileEntrySize)
+	{
+		//not compressed
+		readStorage(m_header.fileEntryOffset, &m_fileEntries[0], m_header.allFileEntrySize);
+	}
+	else
+	{
+		vector<u8> srcBuffer(m_header.allFileEntrySize);
+		readStorage(m_header.fileEntryOffset, &srcBuffer[0], m_header.allFileEntrySize);
+		u32 dstBufferSize = m_header.fileCount * m_header.fileEntrySize;
+		int ret = uncompress(&m_fileEntries[0], &dstBufferSize, &srcBuffer[0], m_header.allFileEntrySize);
+		if (ret != Z_OK || dstBufferSize != m_header.fileCount * m_header.fileEntrySize)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::readFilenames()
+{
+	if (m_fileEntries.empty())
+	{
+		return true;
+	}
+	if (m_header.tablePageEntryCount > 0)
+	{
+		m_filenames.resize(getFileCount());
+		m_filenamePageRead.assign(m_tablePages.size(), false);
+		if (m_readonly)
+		{
+			return true;
+		}
+		//all filenames are required to modify package
+		for (u32 i = 0; i < m_tablePages.size(); ++i)
+		{
+			if (!readFilenamePage(i))
+			{
+				return false;
+			}
+		}
+		m_filenamePageRead.clear();
+		return true;
+	}
+	if (m_header.allFilenameSize == 0)
+	{
+		return false;
+	}
+	vector<u8> dstBuffer(m_header.originFilenamesSize);
+	if (m_header.allFilenameSize == m_header.originFilenamesSize)
+	{
+		//not compressed
+		readStorage(m_header.filenameOffset, &dstBuffer[0], m_header.allFilenameSize);
+	}
+	else
+	{
+		vector<u8> tempBuffer(m_header.allFilenameSize);
+		readStorage(m_header.filenameOffset, &tempBuffer[0], m_header.allFilenameSize);
+		u32 originSize = m_header.originFilenamesSize;
+		int ret = uncompress(&dstBuffer[0], &originSize, &tempBuffer[0], m_header.allFilenameSize);
+		if (ret != Z_OK || originSize != m_header.originFilenamesSize)
+		{
+			return false;
+		}
+	}
+
+	String names;
+	names.assign((Char*)&dstBuffer[0], m_header.originFilenamesSize / sizeof(Char));
+
+	u32 fileCount = getFileCount();
+	m_filenames.resize(fileCount);
+
+	IStringStream iss(names, IStringStream::in);
+	for (u32 i = 0; i < fileCount; ++i)
+	{
+		Char out[MAX_FILENAME_LEN];
+		iss.getline(out, MAX_FILENAME_LEN);
+		m_filenames[i] = out;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::readTableLog(bool readFilename)
+{
+	//appended pages are read by readTablePages()
+	if (m_header.tableLogSize == 0 || m_header.tablePageEntryCount > 0)
+	{
+		return true;
+	}
+	vector<u8> logData(m_header.tableLogSize);
+	if (!readStorage(m_header.tableLogOffset, &logData[0], m_header.tableLogSize))
+	{
+		return false;
+	}
+	u32 entrySize = m_header.fileEntrySize;
+	//order of entries after each record, index below old count refers to old entries
+	u32 oldCount = getFileCount();
+	vector<u32> order(oldCount);
+	for (u32 i = 0; i < oldCount; ++i)
+	{
+		order[i] = i;
+	}
+	vector<u8> newEntries;
+	vector<String> newNames;
+	vector<u8> data;
+	vector<u64> nameHashes;
+	vector<u32> merged;
+	u32 pos = 0;
+	for (u32 r = 0; r < m_header.tableLogCount; ++r)
+	{
+		TableLogRecord record;
+		if (pos + sizeof(record) > logData.size())
+		{
+			return false;
+		}
+		memcpy(&record, &logData[pos], sizeof(record));
+		pos += sizeof(record);
+		if (record.sign != TABLE_LOG_SIGN || record.packSize > logData.size() - pos
+			|| record.originSize < (u64)record.nameHashCount * sizeof(u64)
+									+ (u64)record.entryCount * (entrySize + sizeof(u32)))
+		{
+			return false;
+		}
+		data.resize(record.originSize);
+		if (record.packSize == record.originSize)
+		{
+			memcpy(&data[0], &logData[pos], record.originSize);
+		}
+		else
+		{
+			u32 originSize = record.originSize;
+			int ret = uncompress(&data[0], &originSize, &logData[pos], record.packSize);
+			if (ret != Z_OK || originSize != record.originSize)
+			{
+				return false;
+			}
+		}
+		pos += record.packSize;
+
+		const u8* cursor = &data[0];
+		nameHashes.resize(record.nameHashCount);
+		if (record.nameHashCount > 0)
+		{
+			memcpy(&nameHashes[0], cursor, record.nameHashCount * sizeof(u64));
+		}
+		std::sort(nameHashes.begin(), nameHashes.end());
+		cursor += record.nameHashCount * sizeof(u64);
+
+		//new entries are put to their recorded index
+		merged.assign(record.fileCount, (u32)-1);
+		u32 firstIndex = oldCount + newEntries.size() / entrySize;
+		newEntries.insert(newEntries.end(), cursor, cursor + record.entryCount * entrySize);
+		cursor += record.entryCount * entrySize;
+		for (u32 i = 0; i < record.entryCount; ++i)
+		{
+			u32 index;
+			memcpy(&index, cursor, sizeof(u32));
+			cursor += sizeof(u32);
+			if (index >= record.fileCount || merged[index] != (u32)-1)
+			{
+				return false;
+			}
+			merged[index] = firstIndex + i;
+		}
+		//other entries fill the rest in previous order
+		u32 slot = 0;
+		for (u32 i = 0; i < order.size(); ++i)
+		{
+			const u8* entry = (order[i] < oldCount)
+							? &m_fileEntries[order[i] * entrySize]
+							: &newEntries[(order[i] - oldCount) * entrySize];
+			if (std::binary_search(nameHashes.begin(), nameHashes.end(), ((const FileEntry*)entry)->nameHash))
+			{
+				continue;
+			}
+			while (slot < record.fileCount && merged[slot] != (u32)-1)
+			{
+				++slot;
+			}
+			if (slot == record.fileCount)
+			{
+				return false;
+			}
+			merged[slot] = order[i];
+		}
+		while (slot < record.fileCount && merged[slot] != (u32)-1)
+		{
+			++slot;
+		}
+		if (slot != record.fileCount)
+		{
+			return false;
+		}
+		order.swap(merged);
+
+		u32 namesLength = (record.originSize - (cursor - &data[0])) / sizeof(Char);
+		String names(namesLength, 0);
+		if (namesLength > 0)
+		{
+			memcpy(&names[0], cursor, namesLength * sizeof(Char));
+		}
+		size_t nameStart = 0;
+		for (u32 i = 0; i < record.entryCount; ++i)
+		{
+			size_t nameEnd = names.find(_T('\n'), nameStart);
+			if (nameEnd == String::npos)
+			{
+				return false;
+			}
+			newNames.push_back(names.substr(nameStart, nameEnd - nameStart));
+			nameStart = nameEnd + 1;
+		}
+	}
+
+	vector<u8> entries(order.size() * entrySize);
+	vector<String> filenames;
+	if (readFilename)
+	{
+		filenames.resize(order.size());
+	}
+	for (u32 i = 0; i < order.size(); ++i)
+	{
+		u32 index = order[i];
+		if (index < oldCount)
+		{
+			memcpy(&entries[i * entrySize], &m_fileEntries[index * entrySize], entrySize);
+			if (readFilename)
+			{
+				filenames[i].swap(m_filenames[index]);
+			}
+		}
+		else
+		{
+			memcpy(&entries[i * entrySize], &newEntries[(index - oldCount) * entrySize], entrySize);
+			if (readFilename)
+			{
+				filenames[i].swap(newNames[index - oldCount]);
+			}
+		}
+	}
+	m_fileEntries.swap(entries);
+	if (readFilename)
+	{
+		m_filenames.swap(filenames);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::readTablePages()
+{
+	u32 fileCount = m_header.fileCount;
+	u32 pageEntryCount = m_header.tablePageEntryCount;
+	if (m_header.tablePageCount != (fileCount + pageEntryCount - 1) / pageEntryCount)
+	{
+		return false;
+	}
+	m_fileEntries.resize(fileCount * m_header.fileEntrySize);
+	m_tablePages.resize(m_header.tablePageCount);
+	if (fileCount == 0)
+	{
+		return true;
+	}
+	if (!readStorage(m_header.tablePageDirectoryOffset, &m_tablePages[0], m_tablePages.size() * sizeof(TablePage)))
+	{
+		return false;
+	}
+	u64 tablesEnd = getTablesEnd();
+	vector<u8> srcBuffer;
+	for (u32 i = 0; i < m_tablePages.size(); ++i)
+	{
+		const TablePage& page = m_tablePages[i];
+		u32 entryCount = (i + 1 < m_tablePages.size()) ? pageEntryCount : fileCount - i * pageEntryCount;
+		u32 entriesSize = entryCount * m_header.fileEntrySize;
+		if (page.entryCount != entryCount
+			|| page.offset < m_header.fileEntryOffset
+			|| page.offset + page.entryPackSize + page.namePackSize > tablesEnd)
+		{
+			return false;
+		}
+		u8* entries = &m_fileEntries[i * pageEntryCount * m_header.fileEntrySize];
+		if (page.entryPackSize == entriesSize)
+		{
+			//not compressed
+			if (!readStorage(page.offset, entries, entriesSize))
+			{
+				return false;
+			}
+			continue;
+		}
+		srcBuffer.resize(page.entryPackSize);
+		if (page.entryPackSize == 0 || !readStorage(page.offset, &srcBuffer[0], page.entryPackSize))
+		{
+			return false;
+		}
+		u32 dstBufferSize = entriesSize;
+		int ret = uncompress(entries, &dstBufferSize, &srcBuffer[0], page.entryPackSize);
+		if (ret != Z_OK || dstBufferSize != entriesSize)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::readFilenamePage(u32 page) const
+{
+	if (!m_filenamePageRead.empty())
+	{
+		//won't try again if failed
+		m_filenamePageRead[page] = true;
+	}
+	const TablePage& tablePage = m_tablePages[page];
+	if (tablePage.nameOriginSize == 0)
+	{
+		return false;
+	}
+	u64 nameOffset = tablePage.offset + tablePage.entryPackSize;
+	vector<u8> dstBuffer(tablePage.nameOriginSize);
+	if (tablePage.namePackSize == tablePage.nameOriginSize)
+	{
+		//not compressed
+		if (!readStorage(nameOffset, &dstBuffer[0], tablePage.namePackSize))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		vector<u8> tempBuffer(tablePage.namePackSize);
+		if (tablePage.namePackSize == 0 || !readStorage(nameOffset, &tempBuffer[0], tablePage.namePackSize))
+		{
+			return false;
+		}
+		u32 originSize = tablePage.nameOriginSize;
+		int ret = uncompress(&dstBuffer[0], &originSize, &tempBuffer[0], tablePage.namePackSize);
+		if (ret != Z_OK || originSize != tablePage.nameOriginSize)
+		{
+			return false;
+		}
+	}
+	String names;
+	names.assign((const Char*)&dstBuffer[0], tablePage.nameOriginSize / sizeof(Char));
+	u32 first = page * m_header.tablePageEntryCount;
+	size_t pos = 0;
+	for (u32 i = 0; i < tablePage.entryCount; ++i)
+	{
+		size_t end = names.find(_T('\n'), pos);
+		if (end == String::npos)
+		{
+			return false;
+		}
+		m_filenames[first + i] = names.substr(pos, end - pos);
+		pos = end + 1;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::updatePackageEnd()
+{
+	u32 fileCount = getFileCount();
+	for (u32 i = 0; i < fileCount; ++i)
+	{
+		const FileEntry& entry = getFileEntry(i);
+		if (entry.byteOffset + entry.packSize > m_packageEnd)
+		{
+			m_packageEnd = entry.byteOffset + entry.packSize;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::removeDeletedEntries()
+{
+	if (m_readonly)
+	{
+		return;
+	}
+	assert(getFileCount() == m_filenames.size());
+
+	//m_header.fileCount and m_header.allFilenameSize will not change
+	vector<String>::iterator nameIter = m_filenames.begin();
+	u32 fileCount = getFileCount();
+	for (u32 i = 0; i < fileCount;)
+	{
+		FileEntry& entry = getFileEntry(i);
+		if ((entry.flag & FILE_DELETE) != 0)
+		{
+			markEntryChanged(i, true);
+			std::vector<u8>::iterator eraseBegin = m_fileEntries.begin() + i * m_header.fileEntrySize;
+			m_fileEntries.erase(eraseBegin, eraseBegin + m_header.fileEntrySize);
+			nameIter = m_filenames.erase(nameIter);
+			m_dirty = true;
+			--fileCount;
+			continue;
+		}
+		++i;
+		++nameIter;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::writeTables(bool avoidOverwrite, u64 minOffset)
+{
+	//log and pages are appended again after new tables
+	m_header.tableLogSize = 0;
+	m_header.tableLogCount = 0;
+	m_changedNames.clear();
+	m_changedNamesOverflow = false;
+	m_dirtyPages.clear();
+	m_firstMovedPage = (u32)-1;
+	m_tablePages.clear();
+	m_header.tablePageCount = 0;
+	m_header.tablePageDirectoryOffset = 0;
+	m_header.tablePageEntryCount = 0;
+	m_header.version = CURRENT_VERSION;
+
+	if (m_fileEntries.empty())
+	{
+		//nothing to write
+		m_header.fileCount = 0;
+		m_header.allFileEntrySize = 0;
+		m_header.allFilenameSize = 0;
+		m_header.fileEntryOffset = sizeof(m_header);
+		m_header.filenameOffset = m_header.fileEntryOffset;
+		m_header.originFilenamesSize = 0;
+		//no log for empty tables, first file is written right after header
+		m_header.tableLogOffset = m_header.filenameOffset;
+		m_header.tableLogCapacity = 0;
+		return;
+	}
+
+	//entries followed by filenames, or pages followed by page directory
+	vector<u8> tables;
+	u32 entryTableSize = 0;
+	u32 originFilenamesSize = 0;
+	if (m_pagedTables)
+	{
+		u32 pageCount = (getFileCount() + TABLE_PAGE_ENTRY_COUNT - 1) / TABLE_PAGE_ENTRY_COUNT;
+		m_tablePages.resize(pageCount);
+		for (u32 i = 0; i < pageCount; ++i)
+		{
+			//relative to tables now
+			m_tablePages[i].offset = tables.size();
+			packTablePage(i, m_tablePages[i], tables);
+		}
+		entryTableSize = tables.size() + pageCount * sizeof(TablePage);
+	}
+	else
+	{
+		appendPackedData(&m_fileEntries[0], m_fileEntries.size(), tables);
+		entryTableSize = tables.size();
+
+		String srcFilename;
+		for (u32 i = 0; i < m_filenames.size(); ++i)
+		{
+			srcFilename += m_filenames[i];
+			srcFilename += _T("\n");
+		}
+		originFilenamesSize = srcFilename.length() * sizeof(Char);
+		appendPackedData((const u8*)srcFilename.c_str(), originFilenamesSize, tables);
+	}
+	u32 tablesSize = m_pagedTables ? entryTableSize : tables.size();
+
+	u32 logCapacity = 0;
+	if (m_tableLogEnabled || m_pagedTables)
+	{
+		logCapacity = tablesSize / TABLE_LOG_CAPACITY_SCALE;
+		if (logCapacity < MIN_TABLE_LOG_CAPACITY)
+		{
+			logCapacity = MIN_TABLE_LOG_CAPACITY;
+		}
+	}
+
+	m_header.fileEntryOffset = getTablesPosition(tablesSize + logCapacity, avoidOverwrite, minOffset);
+	if (m_pagedTables)
+	{
+		for (u32 i = 0; i < m_tablePages.size(); ++i)
+		{
+			m_tablePages[i].offset += m_header.fileEntryOffset;
+		}
+		m_header.tablePageCount = m_tablePages.size();
+		m_header.tablePageDirectoryOffset = m_header.fileEntryOffset + tables.size();
+		m_header.tablePageEntryCount = TABLE_PAGE_ENTRY_COUNT;
+		m_header.version = TABLE_PAGE_VERSION;
+		tables.insert(tables.end(), (const u8*)&m_tablePages[0], (const u8*)&m_tablePages[0] + tablesSize - tables.size());
+	}
+
+	//write
+	writeStorage(m_header.fileEntryOffset, &tables[0], tables.size());
+
+	m_header.fileCount = getFileCount();
+	m_header.allFileEntrySize = entryTableSize;
+	m_header.filenameOffset = m_header.fileEntryOffset + m_header.allFileEntrySize;
+	m_header.allFilenameSize = tables.size() - entryTableSize;
+	m_header.originFilenamesSize = originFilenamesSize;
+
+	m_header.tableLogOffset = m_header.filenameOffset + m_header.allFilenameSize;
+	m_header.tableLogCapacity = logCapacity;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 Package::getTablesPosition(u64 tablesSize, bool avoidOverwrite, u64 minOffset) const
+{
+	u32 lastIndex = getFileCount() - 1;
+	FileEntry& last =  getFileEntry(lastIndex);
+	u64 lastFileEnd = last.byteOffset + last.packSize;
+	if (lastFileEnd < minOffset)
+	{
+		lastFileEnd = minOffset;
+	}
+	if (avoidOverwrite)
+	{
+		if ((lastFileEnd >= getTablesEnd())
+			|| (lastFileEnd + tablesSize <= m_header.fileEntryOffset))
+		{
+			return lastFileEnd;
+		}
+		return getTablesEnd();
+	}
+	return lastFileEnd;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::writeHeader()
+{
+	writeStorage(0, &m_header, sizeof(m_header));
+	m_storage->sync();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::appendTableLog()
+{
+	if (m_header.tablePageEntryCount > 0 || m_changedNamesOverflow || m_header.tableLogCapacity == 0 || m_header.tableLogCount >= MAX_TABLE_LOG_COUNT)
+	{
+		return false;
+	}
+	u32 fileCount = getFileCount();
+	if (m_changedNames.size() * TABLE_LOG_CHANGE_SCALE > fileCount)
+	{
+		return false;
+	}
+	if (m_changedNames.empty())
+	{
+		return true;
+	}
+	//all entries of changed names, deleted ones too
+	vector<u8> data;
+	for (set<u64>::const_iterator iter = m_changedNames.begin(); iter != m_changedNames.end(); ++iter)
+	{
+		data.insert(data.end(), (const u8*)&(*iter), (const u8*)&(*iter) + sizeof(u64));
+	}
+	String names;
+	vector<u32> indices;
+	for (u32 i = 0; i < fileCount; ++i)
+	{
+		const u8* entry = &m_fileEntries[i * m_header.fileEntrySize];
+		if (m_changedNames.find(((const FileEntry*)entry)->nameHash) == m_changedNames.end())
+		{
+			continue;
+		}
+		data.insert(data.end(), entry, entry + m_header.fileEntrySize);
+		names += m_filenames[i];
+		names += _T("\n");
+		indices.push_back(i);
+	}
+	//entries of the same offset are not sorted, so order is recorded
+	if (!indices.empty())
+	{
+		data.insert(data.end(), (const u8*)&indices[0], (const u8*)&indices[0] + indices.size() * sizeof(u32));
+	}
+	data.insert(data.end(), (const u8*)names.c_str(), (const u8*)names.c_str() + names.length() * sizeof(Char));
+
+	TableLogRecord record;
+	record.sign = TABLE_LOG_SIGN;
+	record.nameHashCount = m_changedNames.size();
+	record.entryCount = indices.size();
+	record.originSize = data.size();
+	record.packSize = record.originSize;
+	record.fileCount = fileCount;
+	vector<u8> packData(record.originSize);
+	int ret = compress(&packData[0], &record.packSize, &data[0], record.originSize);
+	if (ret != Z_OK || record.packSize >= record.originSize)
+	{
+		record.packSize = record.originSize;
+	}
+	u32 recordSize = sizeof(record) + record.packSize;
+	if (m_header.tableLogSize + recordSize > m_header.tableLogCapacity)
+	{
+		return false;
+	}
+	u64 recordOffset = m_header.tableLogOffset + m_header.tableLogSize;
+	writeStorage(recordOffset, &record, sizeof(record));
+	writeStorage(recordOffset + sizeof(record), record.packSize == record.originSize ? &data[0] : &packData[0],
+				record.packSize);
+
+	m_header.tableLogSize += recordSize;
+	++m_header.tableLogCount;
+	m_header.version = TABLE_LOG_VERSION;
+	m_changedNames.clear();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::appendTablePages()
+{
+	u32 fileCount = getFileCount();
+	if (m_header.tablePageEntryCount != TABLE_PAGE_ENTRY_COUNT || m_header.tableLogCapacity == 0 || fileCount == 0)
+	{
+		return false;
+	}
+	u32 pageCount = (fileCount + TABLE_PAGE_ENTRY_COUNT - 1) / TABLE_PAGE_ENTRY_COUNT;
+	u64 writeOffset = m_header.tableLogOffset + m_header.tableLogSize;
+	vector<TablePage> pages(m_tablePages);
+	pages.resize(pageCount);
+	vector<u8> data;
+	for (u32 i = 0; i < pageCount; ++i)
+	{
+		if (i < m_tablePages.size() && i < m_firstMovedPage && m_dirtyPages.find(i) == m_dirtyPages.end())
+		{
+			continue;
+		}
+		pages[i].offset = writeOffset + data.size();
+		packTablePage(i, pages[i], data);
+	}
+	u64 directoryOffset = writeOffset + data.size();
+	data.insert(data.end(), (const u8*)&pages[0], (const u8*)&pages[0] + pageCount * sizeof(TablePage));
+	if (m_header.tableLogSize + data.size() > m_header.tableLogCapacity)
+	{
+		return false;
+	}
+	writeStorage(writeOffset, &data[0], data.size());
+
+	m_header.fileCount = fileCount;
+	m_header.tableLogSize += data.size();
+	m_header.tablePageCount = pageCount;
+	m_header.tablePageDirectoryOffset = directoryOffset;
+	m_tablePages.swap(pages);
+	m_dirtyPages.clear();
+	m_firstMovedPage = (u32)-1;
+	m_changedNames.clear();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::packTablePage(u32 page, TablePage& tablePage, vector<u8>& data) const
+{
+	u32 first = page * TABLE_PAGE_ENTRY_COUNT;
+	u32 entryCount = getFileCount() - first;
+	if (entryCount > TABLE_PAGE_ENTRY_COUNT)
+	{
+		entryCount = TABLE_PAGE_ENTRY_COUNT;
+	}
+	tablePage.entryCount = entryCount;
+	tablePage.entryPackSize = appendPackedData(&m_fileEntries[first * m_header.fileEntrySize],
+												entryCount * m_header.fileEntrySize, data);
+	String names;
+	for (u32 i = first; i < first + entryCount; ++i)
+	{
+		names += m_filenames[i];
+		names += _T("\n");
+	}
+	tablePage.nameOriginSize = names.length() * sizeof(Char);
+	tablePage.namePackSize = appendPackedData((const u8*)names.c_str(), tablePage.nameOriginSize, data);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::markEntryChanged(u32 index, bool moved)
+{
+	//data decompressed by warm up may be out of date
+	releaseWarmUp();
+
+	//pages are always tracked, it's cheap
+	u32 page = index / TABLE_PAGE_ENTRY_COUNT;
+	if (moved)
+	{
+		if (page < m_firstMovedPage)
+		{
+			m_firstMovedPage = page;
+		}
+	}
+	else
+	{
+		m_dirtyPages.insert(page);
+	}
+
+	if (!m_tableLogEnabled || m_changedNamesOverflow)
+	{
+		return;
+	}
+	if (m_changedNames.size() >= MAX_CHANGED_NAMES)
+	{
+		m_changedNames.clear();
+		m_changedNamesOverflow = true;
+		return;
+	}
+	m_changedNames.insert(getFileEntry(index).nameHash);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::moveFileData(u64 srcOffset, u64 dstOffset, u64 size)
+{
+	assert(srcOffset >= dstOffset + size || dstOffset >= srcOffset + size);
+
+	releaseWarmUp();
+
+	u64 copied = 0;
+	if (m_fileStorage != NULL)
+	{
+		FILE* stream = m_fileStorage->getStream();
+		copied = copyFileRange(stream, dstOffset, stream, srcOffset, size);
+	}
+	m_chunkData.resize(m_header.chunkSize);
+	while (copied < size)
+	{
+		u32 copySize = (size - copied < m_header.chunkSize) ? (u32)(size - copied) : m_header.chunkSize;
+		readStorage(srcOffset + copied, &m_chunkData[0], copySize);
+		writeStorage(dstOffset + copied, &m_chunkData[0], copySize);
+		copied += copySize;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::buildHashTable()
+{
+	u32 requireSize = getFileCount() * HASH_TABLE_SCALE;
+	u32 tableSize = MIN_HASH_TABLE_SIZE;
+	m_hashBits = MIN_HASH_BITS;
+	while (tableSize < requireSize)
+	{
+		if (tableSize >= MAX_HASH_TABLE_SIZE)
+		{
+			return false;
+		}
+		tableSize *= 2;
+		++m_hashBits;
+	}
+	m_hashMask = (1 << m_hashBits) - 1;
+
+	bool wrong = false;
+	m_hashTable.clear();
+	m_hashTable.resize(tableSize, -1);
+	u32 fileCount = getFileCount();
+	for (u32 i = 0; i < fileCount; ++i)
+	{
+		const FileEntry& currentEntry = getFileEntry(i);
+		u32 index = (currentEntry.nameHash & m_hashMask);
+		while (m_hashTable[index] != -1)
+		{
+			const FileEntry& conflictEntry = getFileEntry(m_hashTable[index]);
+			//deleted entries may be anywhere, e.g. data discarded for a shared file
+			if (!wrong && ((conflictEntry.flag | currentEntry.flag) & FILE_DELETE) == 0
+				&& conflictEntry.nameHash == currentEntry.nameHash)
+			{
+				wrong = true;
+			}
+			if (++index >= tableSize)
+			{
+				index = 0;
+			}
+		}
+		m_hashTable[index] = i;
+	}
+	return !wrong;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int Package::getFileIndex(const Char* filename) const
+{
+	u64 nameHash = stringHash(filename, HASH_SEED);
+
+	int fileIndex = getFileIndex(nameHash);
+	addStatistic(m_statistics.lookupCount, 1);
+	if (fileIndex < 0)
+	{
+		addStatistic(m_statistics.lookupMissCount, 1);
+	}
+	return fileIndex;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int Package::getFileIndex(u64 nameHash) const
+{
+	u32 hashIndex = (nameHash & m_hashMask);
+	int fileIndex = m_hashTable[hashIndex];
+	while (fileIndex >= 0)
+	{
+		const FileEntry& entry = getFileEntry(fileIndex);
+		//a deleted file may be followed by the one replacing it
+		if (entry.nameHash == nameHash && (entry.flag & FILE_DELETE) == 0)
+		{
+			return fileIndex;
+		}
+		if (++hashIndex >= m_hashTable.size())
+		{
+			hashIndex = 0;
+		}
+		fileIndex = m_hashTable[hashIndex];
+	}
+	return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 Package::insertFileEntry(FileEntry& entry, const Char* filename)
+{
+	u32 maxIndex = getFileCount();
+	u64 lastEnd = m_header.headerSize;
+
+	//file with 0 size will alway be put to the end
+	for (u32 fileIndex = 0; fileIndex < maxIndex; ++fileIndex)
+	{
+		FileEntry& thisEntry = getFileEntry(fileIndex);
+		//avoid overwritting old file entries and filenames
+		if (thisEntry.byteOffset >= lastEnd + entry.packSize
+			&& (lastEnd + entry.packSize <= m_header.fileEntryOffset || lastEnd >= getTablesEnd()))
+		{
+			entry.byteOffset = lastEnd;
+			m_fileEntries.insert(m_fileEntries.begin() + fileIndex * m_header.fileEntrySize, m_header.fileEntrySize, 0);
+			//thisEntry may be moved by insertion
+			getFileEntry(fileIndex) = entry;
+			m_filenames.insert(m_filenames.begin() + fileIndex, filename);
+			assert(m_filenames.size() == getFileCount());
+			//user may call addFile or removeFile before calling flush, so hash table need to be fixed
+			fixHashTable(fileIndex);
+			markEntryChanged(fileIndex, true);
+			return fileIndex;
+		}
+		//file with 0 size may be put before others of the same offset
+		if (thisEntry.byteOffset + thisEntry.packSize > lastEnd)
+		{
+			lastEnd = thisEntry.byteOffset + thisEntry.packSize;
+		}
+	}
+
+	if (m_header.fileCount == 0 || m_header.fileEntryOffset > lastEnd + entry.packSize)
+	{
+		entry.byteOffset = lastEnd;
+		if (entry.byteOffset + entry.packSize > m_packageEnd)
+		{
+			m_packageEnd = entry.byteOffset + entry.packSize;
+		}
+	}
+	else
+	{
+		entry.byteOffset = m_packageEnd;
+		m_packageEnd += entry.packSize;
+	}
+	m_fileEntries.insert(m_fileEntries.end(), m_header.fileEntrySize, 0);
+	u32 newFileCount = getFileCount();
+	getFileEntry(newFileCount - 1) = entry;
+
+	m_filenames.push_back(filename);
+	assert(m_filenames.size() == newFileCount);
+	markEntryChanged(newFileCount - 1, true);
+	return m_filenames.size() - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::insertFileHash(u64 nameHash, u32 entryIndex)
+{
+	u32 requireSize = getFileCount() * HASH_TABLE_SCALE;
+	u32 tableSize = m_hashTable.size();
+	if (tableSize < requireSize)
+	{
+		//file entry hash been inserted, just rebuild hash table
+		return buildHashTable();
+	}
+	u32 index = (nameHash & m_hashMask);
+	while (m_hashTable[index] != -1)
+	{
+		const FileEntry& entry = getFileEntry(m_hashTable[index]);
+		if ((entry.flag & FILE_DELETE) == 0 && entry.nameHash == nameHash)
+		{
+			//it's possible that file is added back right after it's deleted
+			return false;
+		}
+		if (++index >= tableSize)
+		{
+			index = 0;
+		}
+	}
+	m_hashTable[index] = entryIndex;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 Package::stringHash(const Char* str, u32 seed) const
+{
+	u64 out = 0;
+	while (*str)
+	{
+		Char ch = *(str++);
+		if (ch == _T('\\'))
+		{
+			ch = _T('/');
+		}
+	#if (ZP_CASE_SENSITIVE)
+		out = out * seed + ch;
+	#else
+		#if defined ZP_USE_WCHAR
+			out = out * seed + towlower(ch);
+		#else
+			out = out * seed + tolower(ch);
+		#endif
+	#endif
+	}
+	return out;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::fixHashTable(u32 index)
+{
+	//increase file index which is greater than "index" by 1
+	for (u32 i = 0; i < m_hashTable.size(); ++i)
+	{
+		if (m_hashTable[i] >= (int)index)
+		{
+			++m_hashTable[i];
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::writeRawFile(FileEntry& entry, FILE* file, ContentHash& hash)
+{
+	u32 copied = 0;
+	if (m_fileStorage != NULL)
+	{
+		//let kernel move the bytes if possible, no copy to user space
+		copied = (u32)copyFileRange(m_fileStorage->getStream(), entry.byteOffset, file, 0, entry.originSize);
+	}
+	if (copied == entry.originSize)
+	{
+		return false;
+	}
+	m_chunkData.resize(m_header.chunkSize);
+	_fseeki64(file, copied, SEEK_SET);
+	u64 writePos = entry.byteOffset + copied;
+
+	u32 sizeLeft = entry.originSize - copied;
+	u32 chunkCount = (sizeLeft + m_header.chunkSize - 1) / m_header.chunkSize;
+	for (u32 i = 0; i < chunkCount; ++i)
+	{
+		u32 curChunkSize = m_header.chunkSize;
+		if (i == chunkCount - 1 && sizeLeft % m_header.chunkSize != 0)
+		{
+			curChunkSize = sizeLeft % m_header.chunkSize;
+		}
+		fread(&m_chunkData[0], curChunkSize, 1, file);
+		hash.update(&m_chunkData[0], curChunkSize);
+		writeStorage(writePos, &m_chunkData[0], curChunkSize);
+		writePos += curChunkSize;
+	}
+	return (copied == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::writeFileData(const Char* filename, u32 originSize, u32 flag, u32 chunkSize, const u8* data, u32 packSize,
+							u64 contentHash)
+{
+	m_dirty = true;
+
+	FileEntry entry;
+	entry.nameHash = stringHash(filename, HASH_SEED);
+	entry.packSize = packSize;
+	entry.originSize = originSize;
+	entry.flag = flag;
+	entry.chunkSize = chunkSize;
+	entry.contentHash = contentHash;
+	entry.availableSize = packSize;
+	entry.reserved = 0;
+
+	u32 insertedIndex = insertFileEntry(entry, filename);
+
+	//existing file is kept if new entry can't be inserted
+	int fileIndex = getFileIndex(filename);
+	if (fileIndex >= 0)
+	{
+		getFileEntry(fileIndex).flag |= FILE_DELETE;
+	}
+	if (!insertFileHash(entry.nameHash, insertedIndex))
+	{
+		getFileEntry(insertedIndex).flag |= FILE_DELETE;
+		if (fileIndex >= 0)
+		{
+			getFileEntry(fileIndex).flag &= (~FILE_DELETE);
+		}
+		return false;
+	}
+	if (fileIndex >= 0)
+	{
+		//file exist
+		deleteFileEntry(fileIndex);
+	}
+	addContentIndex(insertedIndex);
+	if (packSize > 0)
+	{
+		writeStorage(entry.byteOffset, data, packSize);
+		if (m_directIO)
+		{
+			dropWrittenData(entry.byteOffset, packSize);
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::readStorage(u64 offset, void* buffer, u32 size) const
+{
+	return (m_storage->read(offset, buffer, size) == size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::writeStorage(u64 offset, const void* buffer, u32 size)
+{
+	return (m_storage->write(offset, buffer, size) == size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const u8* Package::mapStorage(u64 offset, u32 size) const
+{
+	const u8* data = m_storage->map();
+	if (data == NULL || offset + size > m_storage->size())
+	{
+		return NULL;
+	}
+	return data + offset;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::adviseStorage(u64 offset, u64 size, u32 advice) const
+{
+	if (m_fileStorage != NULL)
+	{
+		adviseFile(m_fileStorage->getStream(), offset, size, advice);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::dropWrittenData(u64 offset, u64 size)
+{
+	//package stream is shared with tables and opened files, so it can't be opened for direct I/O
+	//dirty pages can't be dropped before they are written
+	if (m_fileStorage != NULL)
+	{
+		syncFileRange(m_fileStorage->getStream(), offset, size);
+		adviseStorage(offset, size, ADVISE_DONTNEED);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int Package::findSameContent(u64 contentHash, u32 originSize)
+{
+	if (contentHash == 0 || originSize == 0)
+	{
+		return -1;
+	}
+	buildContentIndex();
+	hashSameSizeFiles(originSize);
+	std::map<u64, u64>::const_iterator iter = m_contentIndex.find(contentHash);
+	if (iter == m_contentIndex.end())
+	{
+		return -1;
+	}
+	u32 fileCount = getFileCount();
+	for (u32 i = getFirstEntryAt(iter->second); i < fileCount && getFileEntry(i).byteOffset == iter->second; ++i)
+	{
+		const FileEntry& entry = getFileEntry(i);
+		//file may be removed or still being written after index is updated
+		if ((entry.flag & (FILE_DELETE | FILE_HASHED)) == FILE_HASHED && entry.contentHash == contentHash
+			&& entry.originSize == originSize && entry.packSize > 0 && entry.availableSize >= entry.packSize)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::hasSameSize(u32 originSize)
+{
+	if (originSize == 0)
+	{
+		return false;
+	}
+	buildContentIndex();
+	//index may have files removed since, it only costs a needless hashing
+	return (m_sizeIndex.find(originSize) != m_sizeIndex.end());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::hashSameSizeFiles(u32 originSize)
+{
+	typedef std::multimap<u32, u64>::const_iterator SizeIter;
+	std::pair<SizeIter, SizeIter> range = m_sizeIndex.equal_range(originSize);
+	u32 fileCount = getFileCount();
+	for (SizeIter iter = range.first; iter != range.second; ++iter)
+	{
+		//files sharing data have the same content
+		u64 contentHash = 0;
+		for (u32 i = getFirstEntryAt(iter->second); i < fileCount && getFileEntry(i).byteOffset == iter->second; ++i)
+		{
+			FileEntry& entry = getFileEntry(i);
+			if ((entry.flag & (FILE_DELETE | FILE_HASHED)) != FILE_HASHED || entry.contentHash != 0
+				|| entry.originSize != originSize || entry.packSize == 0 || entry.availableSize < entry.packSize)
+			{
+				continue;
+			}
+			if (contentHash == 0)
+			{
+				IReadFile* file = openFileEntry(i);
+				if (file == NULL)
+				{
+					continue;
+				}
+				ContentHash hash;
+				m_chunkData.resize(m_header.chunkSize);
+				for (u32 pos = 0; pos < originSize;)
+				{
+					u32 size = file->read(&m_chunkData[0], m_header.chunkSize);
+					if (size == 0)
+					{
+						break;
+					}
+					hash.update(&m_chunkData[0], size);
+					pos += size;
+				}
+				bool complete = (file->tell() == originSize);
+				closeFile(file);
+				if (!complete)
+				{
+					continue;
+				}
+				contentHash = hash.digest();
+			}
+			getFileEntry(i).contentHash = contentHash;
+			m_contentIndex[contentHash] = iter->second;
+			markEntryChanged(i);
+			m_dirty = true;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Package::buildContentIndex()
+{
+	if (m_contentIndexReady)
+	{
+		return;
+	}
+	m_contentIndexReady = true;
+	u32 fileCount = getFileCount();
+	for (u32 i = 0; i < fileCount; ++i)
+	{
+		addContentIndex(i);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 Package::getFirstEntryAt(u64 byteOffset) const
+{
+	//entries are sorted by offset
+	u32 low = 0;
+	u32 high = getFileCount();
+	while (low < high)
+	{
+		u32 middle = (low + high) / 2;
+		if (getFileEntry(middle).byteOffset < byteOffset)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return low;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::isSameContent(u32 index, FILE* file, const u8* data)
+{
+	//64 bit hash may collide, sharing data of another content would be silent corruption
+	u32 originSize = getFileEntry(index).originSize;
+	IReadFile* sameFile = openFileEntry(index);
+	if (sameFile == NULL)
+	{
+		return false;
+	}
+	if (file != NULL)
+	{
+		_fseeki64(file, 0, SEEK_SET);
+	}
+	u32 bufferSize = m_header.chunkSize;
+	vector<u8> buffer(bufferSize * 2);
+	bool same = true;
+	for (u32 pos = 0; same && pos < originSize;)
 	{
-		Char out[MAX_FILENAME_LEN];
-		iss.getline(out, MAX_FILENAME_LEN);
-		m_filenames[i] = out;
+		u32 size = (originSize - pos < bufferSize) ? originSize - pos : bufferSize;
+		if (file != NULL)
+		{
+			same = (fread(&buffer[bufferSize], size, 1, file) == 1);
+		}
+		const u8* other = (file != NULL) ? &buffer[bufferSize] : data + pos;
+		same = same && sameFile->read(&buffer[0], size) == size && memcmp(&buffer[0], other, size) == 0;
+		pos += size;
 	}
-	return true;
+	closeFile(sameFile);
+	return same;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void Package::removeDeletedEntries()
+bool Package::isSamePackData(u32 index, u32 flag, u32 chunkSize, const u8* packData, u32 packSize) const
 {
-	if (m_readonly)
+	const FileEntry& entry = getFileEntry(index);
+	const u32 storageFlag = FILE_COMPRESS | FILE_CHUNKED;
+	u32 entryChunkSize = (entry.chunkSize == 0) ? m_header.chunkSize : entry.chunkSize;
+	if ((entry.flag & storageFlag) != (flag & storageFlag) || entry.packSize != packSize
+		|| ((flag & FILE_COMPRESS) != 0 && entryChunkSize != chunkSize))
 	{
-		return;
+		//packed differently, content may still be the same but it's not worth uncompressing
+		return false;
 	}
-	assert(getFileCount() == m_filenames.size());
-
-	//m_header.fileCount and m_header.allFilenameSize will not change
-	vector<String>::iterator nameIter = m_filenames.begin();
-	u32 fileCount = getFileCount();
-	for (u32 i = 0; i < fileCount;)
+	vector<u8> buffer(m_header.chunkSize);
+	for (u32 pos = 0; pos < packSize;)
 	{
-		FileEntry& entry = getFileEntry(i);
-		if ((entry.flag & FILE_DELETE) != 0)
+		u32 size = (packSize - pos < buffer.size()) ? packSize - pos : buffer.size();
+		if (!readStorage(entry.byteOffset + pos, &buffer[0], size) || memcmp(&buffer[0], packData + pos, size) != 0)
 		{
-			std::vector<u8>::iterator eraseBegin = m_fileEntries.begin() + i * m_header.fileEntrySize;
-			m_fileEntries.erase(eraseBegin, eraseBegin + m_header.fileEntrySize);
-			nameIter = m_filenames.erase(nameIter);
-			m_dirty = true;
-			--fileCount;
-			continue;
+			return false;
 		}
-		++i;
-		++nameIter;
+		pos += size;
 	}
+	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void Package::writeTables(bool avoidOverwrite)
+void Package::discardFileData(u32 index, u64 oldPackageEnd)
 {
-	if (m_fileEntries.empty())
+	FileEntry& entry = getFileEntry(index);
+	if (entry.byteOffset >= oldPackageEnd)
 	{
-		//nothing to write
-		m_header.fileCount = 0;
-		m_header.allFileEntrySize = 0;
-		m_header.allFilenameSize = 0;
-		m_header.fileEntryOffset = sizeof(m_header);
-		m_header.filenameOffset = m_header.fileEntryOffset;
-		m_header.originFilenamesSize = 0;
-		return;
+		//appended to the end, next file will be written there
+		m_packageEnd = oldPackageEnd;
+		if (entry.packSize > 0 && m_storage->size() == entry.byteOffset + entry.packSize)
+		{
+			//storage was extended by the data
+			m_storage->setSize(entry.byteOffset);
+		}
 	}
+	//entry takes no space, so the gap can be used like one of a removed file
+	entry.packSize = 0;
+	entry.availableSize = 0;
+	entry.flag |= FILE_DELETE;
+	markEntryChanged(index);
+}
 
-	//compress file entries
-	u32 srcEntrySize = m_fileEntries.size();
-	u32 dstEntrySize = srcEntrySize;
-
-	vector<u8> dstEntryBuffer(dstEntrySize);
-	int ret = compress(&dstEntryBuffer[0], &dstEntrySize, &m_fileEntries[0], srcEntrySize);
-	if (ret != Z_OK || dstEntrySize >= srcEntrySize)
-	{
-		dstEntrySize = srcEntrySize;
-	}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Package::addSharedFile(const Char* filename, u32 flag, u32 sourceIndex, u32* outPackSize, u32* outFlag)
+{
+	m_dirty = true;
 
-	//compress filenames
-	String srcFilename;
-	for (u32 i = 0; i < m_filenames.size(); ++i)
+	//existing file may be the source itself, chunks are released after new entry refers to the same data
+	//it's only hidden from insertFileHash until then, and kept if new entry can't be inserted
+	int fileIndex = getFileIndex(filename);
+	if (fileIndex >= 0)
 	{
-		srcFilename += m_filenames[i];
-		srcFilename += _T("\n");
+		getFileEntry(fileIndex).flag |= FILE_DELETE;
 	}
-	u32 srcFilenameSize = srcFilename.length() * sizeof(Char);
-	u32 dstFilenameSize = srcFilenameSize;
+	const FileEntry& source = getFileEntry(sourceIndex);
+	FileEntry entry = source;
+	entry.nameHash = stringHash(filename, HASH_SEED);
+	//data is read the same way as source and has the same hash, user flags are kept
+	const u32 storageFlag = FILE_COMPRESS | FILE_CHUNKED | FILE_HASHED;
+	entry.flag = (flag & (~storageFlag)) | (source.flag & storageFlag);
+	entry.reserved = 0;
 
-	vector<u8> dstFilenameBuffer(dstFilenameSize);
-	ret = compress(&dstFilenameBuffer[0], &dstFilenameSize, (const u8*)srcFilename.c_str(), srcFilenameSize);
-	if (ret != Z_OK || dstFilenameSize >= srcFilenameSize)
+	//insert right after source to keep entries sorted by offset
+	u32 insertedIndex = sourceIndex + 1;
+	m_fileEntries.insert(m_fileEntries.begin() + insertedIndex * m_header.fileEntrySize, m_header.fileEntrySize, 0);
+	getFileEntry(insertedIndex) = entry;
+	m_filenames.insert(m_filenames.begin() + insertedIndex, filename);
+	assert(m_filenames.size() == getFileCount());
+	fixHashTable(insertedIndex);
+	markEntryChanged(insertedIndex, true);
+	if (fileIndex >= (int)insertedIndex)
 	{
-		dstFilenameSize = srcFilenameSize;
+		++fileIndex;
 	}
 
-	//find pos to write
-	u32 lastIndex = getFileCount() - 1;
-	FileEntry& last =  getFileEntry(lastIndex);
-	u64 lastFileEnd = last.byteOffset + last.packSize;
-	if (avoidOverwrite)
+	if (!insertFileHash(entry.nameHash, insertedIndex))
 	{
-		if ((lastFileEnd >= m_header.filenameOffset + m_header.allFilenameSize)
-			|| (lastFileEnd + dstEntrySize + dstFilenameSize <= m_header.fileEntryOffset))
-		{
-			m_header.fileEntryOffset = lastFileEnd;
-		}
-		else
+		getFileEntry(insertedIndex).flag |= FILE_DELETE;
+		if (fileIndex >= 0)
 		{
-			m_header.fileEntryOffset = m_header.filenameOffset + m_header.allFilenameSize;
+			getFileEntry(fileIndex).flag &= (~FILE_DELETE);
 		}
+		return false;
 	}
-	else
-	{
-		m_header.fileEntryOffset = lastFileEnd;
-	}
-
-	//write
-	_fseeki64(m_stream, m_header.fileEntryOffset, SEEK_SET);
-	if (dstEntrySize == srcEntrySize)
-	{
-		fwrite(&m_fileEntries[0], srcEntrySize, 1, m_stream);
-	}
-	else
+	if (fileIndex >= 0)
 	{
-		fwrite(&dstEntryBuffer[0], dstEntrySize, 1, m_stream);
+		//file exist
+		markEntryChanged(fileIndex);
+		releaseChunks(fileIndex);
 	}
-	if (dstFilenameSize == srcFilenameSize)
+	if (outPackSize != NULL)
 	{
-		fwrite(&srcFilename[0], srcFilenameSize, 1, m_stream);
+		*outPackSize = entry.packSize;
 	}
-	else
+	if (outFlag != NULL)
 	{
-		fwrite(&dstFilenameBuffer[0], dstFilenameSize, 1, m_stream);
+		*outFlag = entry.flag;
 	}
-
-	m_header.fileCount = getFileCount();
-	m_header.allFileEntrySize = dstEntrySize;
-	m_header.filenameOffset = m_header.fileEntryOffset + m_header.allFileEntrySize;
-	m_header.allFilenameSize = dstFilenameSize;
-	m_header.originFilenamesSize = srcFilenameSize;
+	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool Package::buildHashTable()
+bool Package::isDataShared(u32 index) const
 {
-	u32 requireSize = getFileCount() * HASH_TABLE_SCALE;
-	u32 tableSize = MIN_HASH_TABLE_SIZE;
-	m_hashBits = MIN_HASH_BITS;
-	while (tableSize < requireSize)
+	const FileEntry& entry = getFileEntry(index);
+	if (entry.packSize == 0)
 	{
-		if (tableSize >= MAX_HASH_TABLE_SIZE)
+		return false;
+	}
+	//files sharing data are adjacent
+	u32 fileCount = getFileCount();
+	for (u32 i = index + 1; i < fileCount && getFileEntry(i).byteOffset == entry.byteOffset; ++i)
+	{
+		if ((getFileEntry(i).flag & FILE_DELETE) == 0 && getFileEntry(i).packSize > 0)
 		{
-			return false;
+			return true;
 		}
-		tableSize *= 2;
-		++m_hashBits;
 	}
-	m_hashMask = (1 << m_hashBits) - 1;
-
-	bool wrong = false;
-	m_hashTable.clear();
-	m_hashTable.resize(tableSize, -1);
-	u32 fileCount = getFileCount();
-	for (u32 i = 0; i < fileCount; ++i)
+	for (u32 i = index; i > 0 && getFileEntry(i - 1).byteOffset == entry.byteOffset; --i)
 	{
-		const FileEntry& currentEntry = getFileEntry(i);
-		u32 index = (currentEntry.nameHash & m_hashMask);
-		while (m_hashTable[index] != -1)
+		if ((getFileEntry(i - 1).flag & FILE_DELETE) == 0 && getFileEntry(i - 1).packSize > 0)
 		{
-			const FileEntry& conflictEntry = getFileEntry(m_hashTable[index]);
-			if (!wrong && (conflictEntry.flag & FILE_DELETE) == 0
-				&& conflictEntry.nameHash == currentEntry.nameHash)
-			{
-				wrong = true;
-			}
-			if (++index >= tableSize)
-			{
-				index = 0;
-			}
+			return true;
 		}
-		m_hashTable[index] = i;
 	}
-	return !wrong;
+	return false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-int Package::getFileIndex(const Char* filename) const
+void Package::addContentIndex(u32 index)
 {
-	u64 nameHash = stringHash(filename, HASH_SEED);
-
-	return getFileIndex(nameHash);
+	if (!m_contentIndexReady)
+	{
+		//whole index will be built when it's used
+		return;
+	}
+	const FileEntry& entry = getFileEntry(index);
+	//hash given by user with createFile() may be anything
+	if ((entry.flag & (FILE_DELETE | FILE_HASHED)) != FILE_HASHED || entry.packSize == 0)
+	{
+		return;
+	}
+	m_sizeIndex.insert(std::make_pair(entry.originSize, entry.byteOffset));
+	if (entry.contentHash != 0)
+	{
+		m_contentIndex[entry.contentHash] = entry.byteOffset;
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-int Package::getFileIndex(u64 nameHash) const
+bool Package::addChunkedFile(const Char* filename, FILE* file, u32 fileSize, u32 flag, u32 compressLevel,
+							u32* outPackSize, u32* outFlag)
 {
-	u32 hashIndex = (nameHash & m_hashMask);
-	int fileIndex = m_hashTable[hashIndex];
-	while (fileIndex >= 0)
-	{
-		const FileEntry& entry = getFileEntry(fileIndex);
-		if (entry.nameHash == nameHash)
+	m_dirty = true;
+
+	bool compress = ((flag & FILE_COMPRESS) != 0);
+	vector<ChunkRef> chunks;
+	vector<u8> buffer(MAX_CDC_CHUNK_SIZE * 4);
+	ContentHash hash;
+	u32 dataSize = 0;
+	u32 sizeLeft = fileSize;
+	bool succeeded = true;
+	while (succeeded && (sizeLeft > 0 || dataSize > 0))
+	{
+		u32 readSize = buffer.size() - dataSize;
+		if (readSize > sizeLeft)
 		{
-			if ((entry.flag & FILE_DELETE) != 0)
-			{
-				return -1;
-			}
-			return fileIndex;
+			readSize = sizeLeft;
 		}
-		if (++hashIndex >= m_hashTable.size())
+		if (readSize > 0 && fread(&buffer[dataSize], readSize, 1, file) != 1)
 		{
-			hashIndex = 0;
+			succeeded = false;
+			break;
 		}
-		fileIndex = m_hashTable[hashIndex];
-	}
-	return -1;
-}
-
-///////////////////////////////////////////////////////////////////////////////////////////////////
-u32 Package::insertFileEntry(FileEntry& entry, const Char* filename)
-{
-	u32 maxIndex = getFileCount();
-	u64 lastEnd = m_header.headerSize;
+		hash.update(&buffer[dataSize], readSize);
+		dataSize += readSize;
+		sizeLeft -= readSize;
 
-	//file with 0 size will alway be put to the end
-	for (u32 fileIndex = 0; fileIndex < maxIndex; ++fileIndex)
-	{
-		FileEntry& thisEntry = getFileEntry(fileIndex);
-		//avoid overwritting old file entries and filenames
-		if (thisEntry.byteOffset >= lastEnd + entry.packSize
-			&& (lastEnd + entry.packSize <= m_header.fileEntryOffset
-				|| lastEnd >= m_header.filenameOffset + m_header.allFilenameSize))
+		//keep at least one max chunk in buffer until file ends, so cut points don't depend on buffer size
+		u32 pos = 0;
+		while (pos < dataSize && (dataSize - pos >= MAX_CDC_CHUNK_SIZE || sizeLeft == 0))
 		{
-			entry.byteOffset = lastEnd;
-			m_fileEntries.insert(m_fileEntries.begin() + fileIndex * m_header.fileEntrySize, m_header.fileEntrySize, 0);
-			thisEntry = entry;
-			m_filenames.insert(m_filenames.begin() + fileIndex, filename);
-			assert(m_filenames.size() == getFileCount());
-			//user may call addFile or removeFile before calling flush, so hash table need to be fixed
-			fixHashTable(fileIndex);
-			return fileIndex;
+			ChunkRef ref;
+			ref.size = findChunkEnd(&buffer[pos], dataSize - pos);
+			ref.reserved = 0;
+			if (!addChunk(&buffer[pos], ref.size, compress, compressLevel, ref.nameHash))
+			{
+				succeeded = false;
+				break;
+			}
+			chunks.push_back(ref);
+			pos += ref.size;
 		}
-		lastEnd = thisEntry.byteOffset + thisEntry.packSize;
+		memmove(&buffer[0], &buffer[pos], dataSize - pos);
+		dataSize -= pos;
 	}
 
-	if (m_header.fileCount == 0 || m_header.fileEntryOffset > lastEnd + entry.packSize)
+	u64 contentHash = (fileSize == 0) ? 0 : hash.digest();
+	int sameIndex = succeeded ? findSameContent(contentHash, fileSize) : -1;
+	if (sameIndex >= 0 && isSameContent(sameIndex, file, NULL))
 	{
-		entry.byteOffset = lastEnd;
-		if (entry.byteOffset + entry.packSize > m_packageEnd)
-		{
-			m_packageEnd = entry.byteOffset + entry.packSize;
-		}
+		//chunks are kept by that file, new ones are removed
+		releaseChunks(chunks);
+		return addSharedFile(filename, flag, sameIndex, outPackSize, outFlag);
 	}
-	else
+
+	//file data is the chunk list, chunks are compressed instead of list
+	u32 listFlag = (flag & (~FILE_COMPRESS)) | FILE_CHUNKED | FILE_HASHED;
+	u32 listSize = chunks.size() * sizeof(ChunkRef);
+	const u8* listData = chunks.empty() ? NULL : (const u8*)&chunks[0];
+	if (!succeeded || !writeFileData(filename, fileSize, listFlag, 0, listData, listSize, contentHash))
 	{
-		entry.byteOffset = m_packageEnd;
-		m_packageEnd += entry.packSize;
+		releaseChunks(chunks);
+		return false;
 	}
-	m_fileEntries.insert(m_fileEntries.end(), m_header.fileEntrySize, 0);
-	u32 newFileCount = getFileCount();
-	getFileEntry(newFileCount - 1) = entry;
-
-	m_filenames.push_back(filename);
-	assert(m_filenames.size() == newFileCount);
-	return m_filenames.size() - 1;
+	if (outPackSize != NULL)
+	{
+		*outPackSize = listSize;
+	}
+	if (outFlag != NULL)
+	{
+		*outFlag = listFlag;
+	}
+	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool Package::insertFileHash(u64 nameHash, u32 entryIndex)
+bool Package::addChunk(const u8* data, u32 size, bool compress, u32 compressLevel, u64& nameHash)
 {
-	u32 requireSize = getFileCount() * HASH_TABLE_SCALE;
-	u32 tableSize = m_hashTable.size();
-	if (tableSize < requireSize)
+	u64 chunkHash = contentHash(data, size);
+	String chunkName = getChunkName(chunkHash, size);
+	nameHash = stringHash(chunkName.c_str(), HASH_SEED);
+
+	int fileIndex = getFileIndex(nameHash);
+	if (fileIndex >= 0)
 	{
-		//file entry hash been inserted, just rebuild hash table
-		return buildHashTable();
+		//already in package
+		++getFileEntry(fileIndex).reserved;
+		markEntryChanged(fileIndex);
+		m_dirty = true;
+		return true;
 	}
-	u32 index = (nameHash & m_hashMask);
-	while (m_hashTable[index] != -1)
-	{
-		const FileEntry& entry = getFileEntry(m_hashTable[index]);
-		if ((entry.flag & FILE_DELETE) == 0 && entry.nameHash == nameHash)
-		{
-			//it's possible that file is added back right after it's deleted
-			return false;
-		}
-		if (++index >= tableSize)
+	const u8* packData = data;
+	u32 packSize = size;
+	//not FILE_HASHED, chunks are shared by name and never by other files
+	u32 flag = FILE_INTERNAL;
+	if (compress)
+	{
+		m_compressBuffer.resize(MAX_CDC_CHUNK_SIZE);
+		u32 skippedSize = 0;
+		u32 dstSize = compressChunk(&m_compressBuffer[0], size, data, size, compressLevel, skippedSize);
+		m_skippedCompressSize += skippedSize;
+		if (dstSize < size)
 		{
-			index = 0;
+			packData = &m_compressBuffer[0];
+			packSize = dstSize;
+			flag |= FILE_COMPRESS;
 		}
 	}
-	m_hashTable[index] = entryIndex;
+	//one compress chunk for whole chunk
+	if (!writeFileData(chunkName.c_str(), size, flag, MAX_CDC_CHUNK_SIZE, packData, packSize, chunkHash))
+	{
+		return false;
+	}
+	getFileEntry(getFileIndex(nameHash)).reserved = 1;
 	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-u64 Package::stringHash(const Char* str, u32 seed) const
+void Package::releaseChunks(u32 index)
 {
-	u64 out = 0;
-	while (*str)
+	const FileEntry& entry = getFileEntry(index);
+	//chunks are referred by list data, not by entries sharing it
+	if ((entry.flag & FILE_CHUNKED) == 0 || entry.packSize < sizeof(ChunkRef) || isDataShared(index))
 	{
-		Char ch = *(str++);
-		if (ch == _T('\\'))
-		{
-			ch = _T('/');
-		}
-	#if (ZP_CASE_SENSITIVE)
-		out = out * seed + ch;
-	#else
-		#if defined ZP_USE_WCHAR
-			out = out * seed + towlower(ch);
-		#else
-			out = out * seed + tolower(ch);
-		#endif
-	#endif
+		return;
 	}
-	return out;
+	vector<ChunkRef> chunks(entry.packSize / sizeof(ChunkRef));
+	readStorage(entry.byteOffset, &chunks[0], chunks.size() * sizeof(ChunkRef));
+	releaseChunks(chunks);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void Package::fixHashTable(u32 index)
+void Package::releaseChunks(const std::vector<ChunkRef>& chunks)
 {
-	//increase file index which is greater than "index" by 1
-	for (u32 i = 0; i < m_hashTable.size(); ++i)
+	for (u32 i = 0; i < chunks.size(); ++i)
 	{
-		if (m_hashTable[i] >= (int)index)
+		int fileIndex = getFileIndex(chunks[i].nameHash);
+		if (fileIndex < 0)
 		{
-			++m_hashTable[i];
+			continue;
+		}
+		FileEntry& chunk = getFileEntry(fileIndex);
+		if (chunk.reserved > 1)
+		{
+			--chunk.reserved;
 		}
+		else
+		{
+			//space is freed when entry is removed
+			chunk.reserved = 0;
+			chunk.flag |= FILE_DELETE;
+		}
+		markEntryChanged(fileIndex);
+		m_dirty = true;
 	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void Package::writeRawFile(FileEntry& entry, FILE* file)
+void Package::deleteFileEntry(u32 index)
 {
-	_fseeki64(m_stream, entry.byteOffset, SEEK_SET);
-
-	u32 chunkCount = (entry.originSize + m_header.chunkSize - 1) / m_header.chunkSize;
-	m_chunkData.resize(m_header.chunkSize);
-	for (u32 i = 0; i < chunkCount; ++i)
-	{
-		u32 curChunkSize = m_header.chunkSize;
-		if (i == chunkCount - 1 && entry.originSize % m_header.chunkSize != 0)
-		{
-			curChunkSize = entry.originSize % m_header.chunkSize;
-		}
-		fread(&m_chunkData[0], curChunkSize, 1, file);
-		fwrite(&m_chunkData[0], curChunkSize, 1, file);
-	}
+	getFileEntry(index).flag |= FILE_DELETE;
+	markEntryChanged(index);
+	releaseChunks(index);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1053,6 +3149,7 @@ bool Package::setFileAvailableSize(u64 nameHash, u32 size)
 	}
 	FileEntry& entry = getFileEntry(fileIndex);
 	entry.availableSize = size;
+	markEntryChanged(fileIndex);
 	m_dirty = true;
 	return true;
 }
@@ -4,7 +4,16 @@
 #include "zpack.h"
 #include <string>
 #include <vector>
+#include <map>
+#include <set>
 #include "stdio.h"
+#include "zpChunkedFile.h"
+#include "zpTrace.h"
+#include "zpPlatform.h"
+#include "zpDirectIO.h"
+#include "zpPreloader.h"
+#include "zpStorage.h"
+#include "zpContentHash.h"
 
 #ifdef _ZP_WIN32_THREAD_SAFE
 #include <windows.h>
@@ -25,6 +34,11 @@ namespace zp
 
 const u32 PACKAGE_FILE_SIGN = 'KAPZ';
 const u32 CURRENT_VERSION = '0030';
+const u32 TABLE_LOG_VERSION = '0031';	//written when table log is not empty
+const u32 TABLE_PAGE_VERSION = '0032';	//written when tables are paged
+const u32 TABLE_LOG_SIGN = 'GOLT';
+
+const u32 HASH_SEED = 131;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 struct PackageHeader
@@ -41,7 +55,40 @@ struct PackageHeader
 	u32 chunkSize;				//file compress unit
 	u32	flag;
 	u32 fileEntrySize;
-	u32 reserved[18];
+	u64 tableLogOffset;			//right after filenames
+	u32 tableLogSize;
+	u32 tableLogCapacity;		//reserved for table log, files are not written into it
+	u32 tableLogCount;
+	u32 tablePageCount;
+	u64 tablePageDirectoryOffset;	//array of TablePage
+	u32 tablePageEntryCount;		//entries of each page, 0 if tables are not paged
+	u32 reserved[9];
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//appended to table log by flush(), followed by data (may be compressed):
+//name hashes, file entries, index of each entry in tables (u32), filenames ended with '\n'
+//all entries of these names are replaced by entries in record, other entries keep their order
+struct TableLogRecord
+{
+	u32	sign;
+	u32	nameHashCount;
+	u32	entryCount;
+	u32	originSize;		//size of data
+	u32	packSize;		//size of data in package
+	u32	fileCount;		//entries in tables after flush
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//paged tables, entries and filenames of each page are compressed separately
+//pages changed by flush() and new page directory are appended to space of table log
+struct TablePage
+{
+	u64	offset;			//entries, followed by filenames ended with '\n'
+	u32	entryCount;		//only last page is not full
+	u32	entryPackSize;	//not compressed if same as size of entries
+	u32	nameOriginSize;
+	u32	namePackSize;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -55,7 +102,7 @@ struct FileEntry
 	u32 chunkSize;	//can be different with chunkSize in package header
 	u64 contentHash;
 	u32 availableSize;
-	u32 reserved;
+	u32 reserved;	//reference count of shared chunk (FILE_INTERNAL)
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -64,9 +111,18 @@ class Package : public IPackage
 	friend class File;
 	friend class CompressedFile;
 	friend class WriteFile;
+	friend class StreamWriteFile;
+	friend class ChunkedFile;
+	friend class BulkAdder;
+	friend class BulkExtractor;
+	friend class Patch;
+	friend class Mount;
+	friend class OperationTimer;
+	friend class Preloader;
 
 public:
-	Package(const Char* filename, bool readonly, bool readFilename);
+	//storage is deleted with package if ownStorage is true
+	Package(IStorage* storage, bool ownStorage, bool readonly, bool readFilename);
 	~Package();
 
 	bool valid() const;
@@ -84,37 +140,96 @@ public:
 							u32* packSize = 0, u32* flag = 0, u32* availableSize = 0, u64* contentHash = 0) const;
 	virtual bool getFileInfo(const Char* filename, u32* fileSize = 0, u32* packSize = 0,
 							u32* flag = 0, u32* availableSize = 0, u64* contentHash = 0) const;
+	virtual u32 extractFiles(const ExtractFileParam* files, u32 fileCount, Callback callback = 0,
+							void* callbackParam = 0);
 
 	virtual bool addFile(const Char* filename, const Char* exterFilename, u32 fileSize, u32 flag,
-						u32* outPackSize = 0, u32* outFlag = 0, u32 chunkSize = 0);
+						u32* outPackSize = 0, u32* outFlag = 0, u32 chunkSize = 0, u32 compressLevel = 0);
+	virtual void setThreadCount(u32 count);
+	virtual u32 addFiles(AddFileParam* files, u32 fileCount, Callback callback = 0, void* callbackParam = 0);
+	virtual void enableDirectIO(bool enable);
+	virtual u64 getSkippedCompressSize() const;
 	virtual IWriteFile* createFile(const Char* filename, u32 fileSize, u32 packSize,
 									u32 chunkSize = 0, u32 flag = 0, u64 contentHash = 0);
 	virtual IWriteFile* openFileToWrite(const Char* filename);
+	virtual IWriteFile* createStreamFile(const Char* filename, u32 flag, u32 chunkSize, u32 compressLevel);
 	virtual void closeFile(IWriteFile* file);
 
 	virtual bool removeFile(const Char* filename);
 	virtual bool dirty() const;
 	virtual void flush();
+	virtual void enableTableLog(bool enable);
+	virtual void enablePagedTables(bool enable);
 
 	virtual bool defrag(Callback callback, void* callbackParam);
+	virtual bool optimizeLayout(const Char* const* filenames, u32 count, Callback callback = 0,
+								void* callbackParam = 0);
+	virtual bool compact(u64 maxMoveSize, bool* finished = 0);
 
 	virtual u32 getFileUserDataSize() const;
 
 	virtual bool writeFileUserData(const Char* filename, const u8* data, u32 dataLen);
 	virtual bool readFileUserData(const Char* filename, u8* data, u32 dataLen);
 
+	virtual bool setWarmSet(const Char* const* filenames, u32 count);
+	virtual u32 warmUp();
+	virtual void releaseWarmUp();
+
+	virtual bool startTrace(const Char* traceFilename);
+	virtual void stopTrace();
+
+	virtual void getStatistics(PackageStatistics& statistics) const;
+	virtual void resetStatistics();
+
+	virtual void enableTiming(bool enable);
+	virtual bool getLatencyHistogram(u32 operation, LatencyHistogram& histogram) const;
+
 private:
 	bool readHeader();
 	bool readFileEntries();
 	bool readFilenames();
+	bool readTableLog(bool readFilename);
+	bool readTablePages();
+	//filenames of read only package are read when used
+	bool readFilenamePage(u32 page) const;
+	const String& getFilename(u32 index) const;
+	//files added after tables were written may be after log or appended pages
+	void updatePackageEnd();
 
 	void removeDeletedEntries();
 
-	void writeTables(bool avoidOverwrite);
+	//tables are written after all files and minOffset
+	void writeTables(bool avoidOverwrite, u64 minOffset = 0);
+	u64 getTablesPosition(u64 tablesSize, bool avoidOverwrite, u64 minOffset) const;
+	void writeHeader();
+
+	//return false if changes can't be written as a log record, tables should be written instead
+	bool appendTableLog();
+	//same for paged tables, changed pages and page directory are appended
+	bool appendTablePages();
+	void packTablePage(u32 page, TablePage& tablePage, std::vector<u8>& data) const;
+	//for table log and paged tables, called when an entry is added, removed or changed
+	//moved means entries after it are moved by insertion or removal
+	void markEntryChanged(u32 index, bool moved = false);
+	//end of tables and space reserved for table log
+	u64 getTablesEnd() const;
+
+	//for optimizeLayout(), append entry and entries sharing its data to order
+	void placeFileEntry(u32 index, std::vector<u32>& order, std::vector<bool>& placed, bool withChunks);
+
+	//for defrag(), copy data of package to dstOffset of temp storage, through reader and writer if it's NULL
+	void copyToTemp(u64 offset, u64 dstOffset, u64 size, IStorage* tempStorage, DirectReader& reader,
+					DirectWriter& writer, std::vector<char>& buffer);
+	//for defrag() of package not in a file, replace content of storage
+	bool copyFromTemp(IStorage* tempStorage);
+
+	//for compact(), source and destination can't overlap
+	void moveFileData(u64 srcOffset, u64 dstOffset, u64 size);
 
 	bool buildHashTable();
 	int getFileIndex(const Char* filename) const;
 	int getFileIndex(u64 nameHash) const;
+	IReadFile* openFileEntry(u32 index);
 	u32 insertFileEntry(FileEntry& entry, const Char* filename);
 	bool insertFileHash(u64 nameHash, u32 entryIndex);
 
@@ -122,7 +237,54 @@ private:
 
 	void fixHashTable(u32 index);
 
-	void writeRawFile(FileEntry& entry, FILE* file);
+	//return false if data is copied by kernel, it's not hashed then
+	bool writeRawFile(FileEntry& entry, FILE* file, ContentHash& hash);
+
+	//positional access of package data, return false if not all bytes are transferred
+	bool readStorage(u64 offset, void* buffer, u32 size) const;
+	bool writeStorage(u64 offset, const void* buffer, u32 size);
+	//data in place if storage is mapped, NULL otherwise
+	const u8* mapStorage(u64 offset, u32 size) const;
+	//system cache hint, only for package in a file
+	void adviseStorage(u64 offset, u64 size, u32 advice) const;
+
+	//for direct I/O, write data just added to disk and drop it from system cache
+	void dropWrittenData(u64 offset, u64 size);
+
+	//add a file whose content (compressed or not) is already in memory
+	bool writeFileData(const Char* filename, u32 originSize, u32 flag, u32 chunkSize, const u8* data, u32 packSize,
+						u64 contentHash);
+
+	//deduplication, files with identical content share the same bytes in package
+	//data is freed when the last entry referring to it is removed, since free space is not recorded
+	//candidate of same content is found by hash, bytes are compared before data is shared
+	int findSameContent(u64 contentHash, u32 originSize);
+	//file to be added is hashed before it's written only if a file of the same size exists
+	bool hasSameSize(u32 originSize);
+	//raw file copied by kernel is not hashed until a file of the same size is added, see FILE_HASHED
+	void hashSameSizeFiles(u32 originSize);
+	void buildContentIndex();
+	//first entry at this offset, or entry after it
+	u32 getFirstEntryAt(u64 byteOffset) const;
+	//compare with content of file from beginning, or with data in memory if file is NULL
+	bool isSameContent(u32 index, FILE* file, const u8* data);
+	//compare with data packed the same way, no need to uncompress
+	bool isSamePackData(u32 index, u32 flag, u32 chunkSize, const u8* packData, u32 packSize) const;
+	//for file failed to be added, data just written is given back if possible
+	void discardFileData(u32 index, u64 oldPackageEnd);
+	bool addSharedFile(const Char* filename, u32 flag, u32 sourceIndex, u32* outPackSize, u32* outFlag);
+	bool isDataShared(u32 index) const;
+	void addContentIndex(u32 index);
+
+	//chunked files, see FILE_CHUNKED
+	bool addChunkedFile(const Char* filename, FILE* file, u32 fileSize, u32 flag, u32 compressLevel,
+						u32* outPackSize, u32* outFlag);
+	bool addChunk(const u8* data, u32 size, bool compress, u32 compressLevel, u64& nameHash);
+	void releaseChunks(u32 index);
+	void releaseChunks(const std::vector<ChunkRef>& chunks);
+
+	//mark as deleted, release chunks if needed
+	void deleteFileEntry(u32 index);
 
 	//for writing file
 	u32 getFileAvailableSize(u64 nameHash) const;
@@ -130,23 +292,51 @@ private:
 
 	FileEntry& getFileEntry(u32 index) const;
 
+	//counter is a member of m_statistics, can be called by opened files
+	void addStatistic(u64& counter, u64 value) const;
+	//zlib uncompress() of data read by opened files, with statistics
+	int uncompressData(u8* dst, u32* dstSize, const u8* src, u32 srcSize, u64 nameHash) const;
+
+	//add to latency histogram, and trace if it's recording
+	void addTiming(u32 operation, u64 nameHash, u64 startTime, u64 duration) const;
+
 private:
 #ifdef _ZP_WIN32_THREAD_SAFE
 	mutable CRITICAL_SECTION	m_cs;
 #endif
-	String					m_packageFilename;
-	mutable FILE*			m_stream;
+	String					m_packageFilename;	//empty if package is not in a file
+	IStorage*				m_storage;
+	FileStorage*			m_fileStorage;		//same as m_storage if it's a file, NULL otherwise
+	bool					m_ownStorage;
 	PackageHeader			m_header;
 	u32						m_hashBits;
 	std::vector<int>		m_hashTable;
 	std::vector<u8>			m_fileEntries;
-	std::vector<String>		m_filenames;
+	mutable std::vector<String>	m_filenames;
 	u64						m_packageEnd;
 	u32						m_hashMask;
 	std::vector<u8>			m_chunkData;
 	std::vector<u8>			m_compressBuffer;
 	std::vector<u32>		m_chunkPosBuffer;
-	mutable void*			m_lastSeekFile;
+	u64						m_skippedCompressSize;
+	std::map<u64, u64>		m_contentIndex;		//content hash -> byte offset, built when first file is added
+	std::multimap<u32, u64>	m_sizeIndex;		//origin size -> byte offset, built with m_contentIndex
+	bool					m_contentIndexReady;
+	u32						m_threadCount;
+	bool					m_directIO;
+	TraceRecorder*			m_trace;			//NULL if not recording
+	Preloader*				m_preloader;		//NULL if not warming up
+	mutable PackageStatistics	m_statistics;	//update by addStatistic()
+	mutable LatencyHistogram	m_histograms[OP_COUNT];
+	bool					m_timingEnabled;
+	std::set<u64>			m_changedNames;		//since last flush, for table log
+	bool					m_changedNamesOverflow;
+	bool					m_tableLogEnabled;
+	std::vector<TablePage>	m_tablePages;		//directory of paged tables in package file
+	mutable std::vector<bool>	m_filenamePageRead;	//empty if all filenames are read
+	std::set<u32>			m_dirtyPages;		//since last flush
+	u32						m_firstMovedPage;	//this page and all after are dirty
+	bool					m_pagedTables;
 	bool					m_readonly;
 	bool					m_dirty;
 };
@@ -163,6 +353,65 @@ inline FileEntry& Package::getFileEntry(u32 index) const
 	return *((FileEntry*)&m_fileEntries[index * m_header.fileEntrySize]);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+inline const String& Package::getFilename(u32 index) const
+{
+	if (!m_filenamePageRead.empty() && !m_filenamePageRead[index / m_header.tablePageEntryCount])
+	{
+		readFilenamePage(index / m_header.tablePageEntryCount);
+	}
+	return m_filenames[index];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+inline u64 Package::getTablesEnd() const
+{
+	return m_header.filenameOffset + m_header.allFilenameSize + m_header.tableLogCapacity;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+inline void Package::addStatistic(u64& counter, u64 value) const
+{
+	atomicAdd(&counter, value);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//measure time of an operation till end of scope, if timing of package is enabled
+class OperationTimer
+{
+public:
+	OperationTimer(const Package* package, u32 operation, u64 nameHash = 0)
+		: m_package(package)
+		, m_operation(operation)
+		, m_nameHash(nameHash)
+		, m_enabled(package->m_timingEnabled)
+		, m_startTime(0)
+	{
+		if (m_enabled)
+		{
+			m_startTime = getMicroseconds();
+		}
+	}
+	~OperationTimer()
+	{
+		if (m_enabled)
+		{
+			m_package->addTiming(m_operation, m_nameHash, m_startTime, getMicroseconds() - m_startTime);
+		}
+	}
+
+private:
+	OperationTimer(const OperationTimer&);
+	OperationTimer& operator=(const OperationTimer&);
+
+private:
+	const Package*	m_package;
+	u32				m_operation;
+	u64				m_nameHash;
+	bool			m_enabled;
+	u64				m_startTime;
+};
+
 #ifdef _ZP_WIN32_THREAD_SAFE
 	////////////////////////////////////////////////////////////////////////////////////////////////////
 	class Lock
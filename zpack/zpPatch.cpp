@@ -0,0 +1,469 @@
+#include "zpPatch.h"
+#include "zpPackage.h"
+#include "zpChunkedFile.h"
+#include "zpContentHash.h"
+#include "WriteCompressFile.h"
+#include <cassert>
+#include <cstring>
+
+namespace zp
+{
+
+const u8 DELTA_COPY = 0;
+const u8 DELTA_INSERT = 1;
+
+//values in delta are little endian with fixed size, same on every platform
+static void appendValue(std::vector<u8>& data, u64 value, u32 size)
+{
+	for (u32 i = 0; i < size; ++i)
+	{
+		data.push_back((u8)(value >> (i * 8)));
+	}
+}
+
+static u64 readValue(const u8*& data, u32 size)
+{
+	u64 value = 0;
+	for (u32 i = 0; i < size; ++i)
+	{
+		value |= (u64)data[i] << (i * 8);
+	}
+	data += size;
+	return value;
+}
+
+static void appendInsert(std::vector<u8>& delta, const u8* data, u32 size)
+{
+	if (size == 0)
+	{
+		return;
+	}
+	delta.push_back(DELTA_INSERT);
+	appendValue(delta, size, 4);
+	delta.insert(delta.end(), data, data + size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void makeDelta(const u8* oldData, u32 oldSize, const u8* newData, u32 newSize, u32 newFlag, u32 newChunkSize,
+				std::vector<u8>& delta)
+{
+	delta.clear();
+	appendValue(delta, DELTA_SIGN, 4);
+	appendValue(delta, oldSize, 4);
+	appendValue(delta, (oldSize == 0) ? 0 : contentHash(oldData, oldSize), 8);
+	appendValue(delta, newSize, 4);
+	appendValue(delta, (newSize == 0) ? 0 : contentHash(newData, newSize), 8);
+	appendValue(delta, newFlag & FILE_COMPRESS, 4);
+	appendValue(delta, newChunkSize, 4);
+	assert(delta.size() == DELTA_HEADER_SIZE);
+
+	//gear hash of each aligned block of old content, low bits of gear hash depend on last few bytes only
+	u32 blockCount = oldSize / DELTA_BLOCK_SIZE;
+	u32 tableBits = 8;
+	while (tableBits < 30 && ((u32)1 << tableBits) < blockCount * 2)
+	{
+		++tableBits;
+	}
+	std::vector<u32> table((u32)1 << tableBits, 0);	//block offset + 1
+	for (u32 i = 0; i < blockCount; ++i)
+	{
+		const u8* block = oldData + i * DELTA_BLOCK_SIZE;
+		u64 hash = 0;
+		for (u32 j = 0; j < DELTA_BLOCK_SIZE; ++j)
+		{
+			hash = gearHash(hash, block[j]);
+		}
+		u32& slot = table[(u32)(hash >> (64 - tableBits))];
+		if (slot == 0)
+		{
+			slot = i * DELTA_BLOCK_SIZE + 1;
+		}
+	}
+
+	//gear hash of last DELTA_BLOCK_SIZE bytes of new content is the same as hash of the block
+	u32 literalStart = 0;
+	u32 windowStart = 0;
+	u32 pos = 0;
+	u64 hash = 0;
+	while (pos < newSize)
+	{
+		hash = gearHash(hash, newData[pos++]);
+		if (pos - windowStart < DELTA_BLOCK_SIZE)
+		{
+			continue;
+		}
+		u32 slot = table[(u32)(hash >> (64 - tableBits))];
+		if (slot == 0)
+		{
+			continue;
+		}
+		u32 oldStart = slot - 1;
+		u32 newStart = pos - DELTA_BLOCK_SIZE;
+		if (memcmp(oldData + oldStart, newData + newStart, DELTA_BLOCK_SIZE) != 0)
+		{
+			continue;
+		}
+		//extend matched range both ways
+		while (newStart > literalStart && oldStart > 0 && oldData[oldStart - 1] == newData[newStart - 1])
+		{
+			--newStart;
+			--oldStart;
+		}
+		u32 newEnd = pos;
+		u32 oldEnd = oldStart + (pos - newStart);
+		while (newEnd < newSize && oldEnd < oldSize && newData[newEnd] == oldData[oldEnd])
+		{
+			++newEnd;
+			++oldEnd;
+		}
+		appendInsert(delta, newData + literalStart, newStart - literalStart);
+		delta.push_back(DELTA_COPY);
+		appendValue(delta, oldStart, 4);
+		appendValue(delta, newEnd - newStart, 4);
+
+		literalStart = windowStart = pos = newEnd;
+		hash = 0;
+	}
+	appendInsert(delta, newData + literalStart, newSize - literalStart);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool applyDelta(const u8* oldData, u32 oldSize, const u8* delta, u32 deltaSize, std::vector<u8>& newData,
+				u32& newFlag, u32& newChunkSize)
+{
+	if (deltaSize < DELTA_HEADER_SIZE)
+	{
+		return false;
+	}
+	const u8* cur = delta;
+	const u8* end = delta + deltaSize;
+	if (readValue(cur, 4) != DELTA_SIGN)
+	{
+		return false;
+	}
+	u32 baseSize = (u32)readValue(cur, 4);
+	u64 baseHash = readValue(cur, 8);
+	u32 newSize = (u32)readValue(cur, 4);
+	u64 newHash = readValue(cur, 8);
+	newFlag = (u32)readValue(cur, 4) & FILE_COMPRESS;
+	newChunkSize = (u32)readValue(cur, 4);
+	if (baseSize != oldSize || (oldSize > 0 && contentHash(oldData, oldSize) != baseHash))
+	{
+		return false;
+	}
+	newData.clear();
+	newData.reserve(newSize);
+	while (cur < end)
+	{
+		u8 op = *cur++;
+		if (op == DELTA_COPY && end - cur >= 8)
+		{
+			u32 offset = (u32)readValue(cur, 4);
+			u32 size = (u32)readValue(cur, 4);
+			if (offset > oldSize || size > oldSize - offset)
+			{
+				return false;
+			}
+			newData.insert(newData.end(), oldData + offset, oldData + offset + size);
+		}
+		else if (op == DELTA_INSERT && end - cur >= 4)
+		{
+			u32 size = (u32)readValue(cur, 4);
+			if (size > (u32)(end - cur))
+			{
+				return false;
+			}
+			newData.insert(newData.end(), cur, cur + size);
+			cur += size;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	if (newData.size() != newSize)
+	{
+		return false;
+	}
+	return (newSize == 0 || contentHash(&newData[0], newSize) == newHash);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Patch::create(Package* oldPackage, Package* newPackage, const Char* patchFilename, u32 flag)
+{
+	if (!hasFilenames(oldPackage) || !hasFilenames(newPackage))
+	{
+		return false;
+	}
+	Package* patch = static_cast<Package*>(zp::create(patchFilename, newPackage->m_header.chunkSize));
+	if (patch == NULL)
+	{
+		return false;
+	}
+	bool succeeded = true;
+	u32 fileCount = newPackage->getFileCount();
+	for (u32 i = 0; i < fileCount && succeeded; ++i)
+	{
+		if ((newPackage->getFileEntry(i).flag & (FILE_DELETE | FILE_INTERNAL)) == 0)
+		{
+			succeeded = addChangedFile(patch, oldPackage, newPackage, i, flag);
+		}
+	}
+	fileCount = oldPackage->getFileCount();
+	for (u32 i = 0; i < fileCount && succeeded; ++i)
+	{
+		const FileEntry& entry = oldPackage->getFileEntry(i);
+		const Char* filename = oldPackage->getFilename(i).c_str();
+		if ((entry.flag & (FILE_DELETE | FILE_INTERNAL)) == 0 && newPackage->getFileIndex(filename) < 0)
+		{
+			succeeded = patch->writeFileData(filename, 0, FILE_WHITEOUT, 0, NULL, 0, 0);
+		}
+	}
+	zp::close(patch);
+	if (!succeeded)
+	{
+		Remove(patchFilename);
+	}
+	return succeeded;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Patch::apply(Package* package, Package* patch, Callback callback, void* callbackParam)
+{
+	if (package->m_readonly || !hasFilenames(package) || !hasFilenames(patch))
+	{
+		return false;
+	}
+	bool succeeded = true;
+	u32 fileCount = patch->getFileCount();
+	for (u32 i = 0; i < fileCount && succeeded; ++i)
+	{
+		const FileEntry& entry = patch->getFileEntry(i);
+		const Char* filename = patch->getFilename(i).c_str();
+		if ((entry.flag & (FILE_DELETE | FILE_INTERNAL)) != 0)
+		{
+			continue;
+		}
+		if ((entry.flag & FILE_WHITEOUT) != 0)
+		{
+			//may be removed already
+			package->removeFile(filename);
+		}
+		else if ((entry.flag & FILE_DELTA) != 0)
+		{
+			succeeded = applyDeltaFile(package, patch, i);
+		}
+		else
+		{
+			succeeded = copyFile(package, patch, i, getContentHash(patch, i));
+		}
+		if (succeeded && callback != NULL && !callback(filename, entry.originSize, callbackParam))
+		{
+			succeeded = false;
+		}
+	}
+	package->flush();
+	return succeeded;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Patch::addChangedFile(Package* patch, Package* oldPackage, Package* newPackage, u32 index, u32 flag)
+{
+	const FileEntry& entry = newPackage->getFileEntry(index);
+	const Char* filename = newPackage->getFilename(index).c_str();
+	u64 hash = getContentHash(newPackage, index);
+	int oldIndex = oldPackage->getFileIndex(filename);
+	u32 oldFlag = (oldIndex >= 0) ? oldPackage->getFileEntry(oldIndex).flag : 0;
+	if (oldIndex >= 0 && oldPackage->getFileEntry(oldIndex).originSize == entry.originSize
+		&& (oldFlag & FILE_WHITEOUT) == (entry.flag & FILE_WHITEOUT)
+		&& (hash != 0 || entry.originSize == 0) && getContentHash(oldPackage, oldIndex) == hash)
+	{
+		//not changed
+		return true;
+	}
+	bool chunked = ((entry.flag & FILE_CHUNKED) != 0);
+	std::vector<u8> content;
+	std::vector<u8> packData;
+	u32 packFlag = entry.flag;
+	if (chunked)
+	{
+		//chunks are not in patch, store content as a normal file
+		if (!readContent(newPackage, index, content))
+		{
+			return false;
+		}
+		packFlag = (entry.flag & (~FILE_CHUNKED)) | FILE_COMPRESS;
+		compressData(content, patch->m_header.chunkSize, packFlag, packData);
+	}
+	u32 packSize = chunked ? packData.size() : entry.packSize;
+
+	if ((flag & PATCH_DELTA) != 0 && oldIndex >= 0 && entry.originSize > 0
+		&& ((oldFlag | entry.flag) & FILE_WHITEOUT) == 0)
+	{
+		std::vector<u8> oldContent;
+		if ((content.empty() && !readContent(newPackage, index, content)) || !readContent(oldPackage, oldIndex, oldContent))
+		{
+			return false;
+		}
+		//chunked file is stored as a compressed one, see above
+		u32 newFlag = chunked ? FILE_COMPRESS : entry.flag;
+		u32 newChunkSize = chunked ? patch->m_header.chunkSize
+									: ((entry.chunkSize == 0) ? newPackage->m_header.chunkSize : entry.chunkSize);
+		std::vector<u8> delta;
+		makeDelta(oldContent.empty() ? NULL : &oldContent[0], oldContent.size(), &content[0], content.size(),
+					newFlag, newChunkSize, delta);
+		u32 deltaFlag = (entry.flag & (~FILE_CHUNKED)) | FILE_COMPRESS | FILE_DELTA;
+		std::vector<u8> deltaPackData;
+		compressData(delta, patch->m_header.chunkSize, deltaFlag, deltaPackData);
+		if (deltaPackData.size() < packSize)
+		{
+			return patch->writeFileData(filename, delta.size(), deltaFlag | FILE_HASHED, patch->m_header.chunkSize,
+										&deltaPackData[0], deltaPackData.size(), contentHash(&delta[0], delta.size()));
+		}
+	}
+	if (!chunked)
+	{
+		return copyFile(patch, newPackage, index, hash);
+	}
+	return patch->writeFileData(filename, entry.originSize, packFlag | FILE_HASHED, patch->m_header.chunkSize,
+								packData.empty() ? NULL : &packData[0], packData.size(), hash);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Patch::applyDeltaFile(Package* package, Package* patch, u32 index)
+{
+	const FileEntry& entry = patch->getFileEntry(index);
+	const Char* filename = patch->getFilename(index).c_str();
+	int oldIndex = package->getFileIndex(filename);
+	std::vector<u8> delta;
+	std::vector<u8> oldContent;
+	if (oldIndex < 0 || !readContent(patch, index, delta) || !readContent(package, oldIndex, oldContent))
+	{
+		return false;
+	}
+	std::vector<u8> content;
+	u32 storageFlag = 0;
+	u32 chunkSize = 0;
+	if (delta.empty() || !applyDelta(oldContent.empty() ? NULL : &oldContent[0], oldContent.size(),
+									&delta[0], delta.size(), content, storageFlag, chunkSize))
+	{
+		return false;
+	}
+	u32 originSize = content.size();
+	u64 hash = (originSize == 0) ? 0 : contentHash(&content[0], originSize);
+	//stored the same way as in new package
+	u32 flag = (entry.flag & (~(FILE_DELTA | FILE_COMPRESS))) | storageFlag;
+	if (chunkSize == 0)
+	{
+		chunkSize = package->m_header.chunkSize;
+	}
+	int sameIndex = package->findSameContent(hash, originSize);
+	if (sameIndex >= 0 && package->isSameContent(sameIndex, NULL, &content[0]))
+	{
+		return package->addSharedFile(filename, flag, sameIndex, NULL, NULL);
+	}
+	if (originSize == 0)
+	{
+		flag &= (~FILE_COMPRESS);
+	}
+	std::vector<u8> packData;
+	if ((flag & FILE_COMPRESS) != 0)
+	{
+		compressData(content, chunkSize, flag, packData);
+	}
+	else
+	{
+		packData.swap(content);
+	}
+	return package->writeFileData(filename, originSize, flag | FILE_HASHED, chunkSize,
+								packData.empty() ? NULL : &packData[0], packData.size(), hash);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Patch::copyFile(Package* dstPackage, Package* srcPackage, u32 index, u64 contentHash)
+{
+	const FileEntry& entry = srcPackage->getFileEntry(index);
+	const Char* filename = srcPackage->getFilename(index).c_str();
+	std::vector<u8> packData;
+	if (!readPackData(srcPackage, index, packData))
+	{
+		return false;
+	}
+	u32 chunkSize = (entry.chunkSize == 0) ? srcPackage->m_header.chunkSize : entry.chunkSize;
+	const u8* data = packData.empty() ? NULL : &packData[0];
+	int sameIndex = dstPackage->findSameContent(contentHash, entry.originSize);
+	if (sameIndex >= 0 && dstPackage->isSamePackData(sameIndex, entry.flag, chunkSize, data, packData.size()))
+	{
+		return dstPackage->addSharedFile(filename, entry.flag, sameIndex, NULL, NULL);
+	}
+	u32 flag = (contentHash != 0) ? (entry.flag | FILE_HASHED) : (entry.flag & (~FILE_HASHED));
+	return dstPackage->writeFileData(filename, entry.originSize, flag, chunkSize, data, packData.size(), contentHash);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Patch::readPackData(Package* package, u32 index, std::vector<u8>& data)
+{
+	const FileEntry& entry = package->getFileEntry(index);
+	data.resize(entry.packSize);
+	if (entry.packSize == 0)
+	{
+		return true;
+	}
+	return package->readStorage(entry.byteOffset, &data[0], entry.packSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Patch::readContent(Package* package, u32 index, std::vector<u8>& data)
+{
+	const FileEntry& entry = package->getFileEntry(index);
+	data.resize(entry.originSize);
+	if (entry.originSize == 0)
+	{
+		return true;
+	}
+	IReadFile* file = package->openFile(package->getFilename(index).c_str());
+	if (file == NULL)
+	{
+		return false;
+	}
+	u32 readSize = file->read(&data[0], entry.originSize);
+	package->closeFile(file);
+	return (readSize == entry.originSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Patch::compressData(const std::vector<u8>& data, u32 chunkSize, u32& flag, std::vector<u8>& packData)
+{
+	if (data.empty())
+	{
+		flag &= (~FILE_COMPRESS);
+		packData.clear();
+		return;
+	}
+	u32 skippedSize = 0;
+	compressFileData(&data[0], data.size(), chunkSize, 0, flag, packData, skippedSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 Patch::getContentHash(Package* package, u32 index)
+{
+	const FileEntry& entry = package->getFileEntry(index);
+	if (((entry.flag & FILE_HASHED) != 0 && entry.contentHash != 0) || entry.originSize == 0)
+	{
+		return entry.contentHash;
+	}
+	std::vector<u8> content;
+	if (!readContent(package, index, content))
+	{
+		return 0;
+	}
+	return contentHash(&content[0], content.size());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Patch::hasFilenames(const Package* package)
+{
+	return (package->m_filenames.size() == package->getFileCount());
+}
+
+}
@@ -0,0 +1,57 @@
+#ifndef __ZP_PATCH_H__
+#define __ZP_PATCH_H__
+
+#include "zpack.h"
+#include <vector>
+
+namespace zp
+{
+
+class Package;
+
+//data of a FILE_DELTA file, header with size and hash of old and new content,
+//and how new file is stored (FILE_COMPRESS and chunk size)
+//followed by operations: copy a range of old content, or insert new bytes
+const u32 DELTA_SIGN = 'TLDZ';
+const u32 DELTA_HEADER_SIZE = 36;
+
+//only ranges at least this long are copied from old content
+const u32 DELTA_BLOCK_SIZE = 64;
+
+void makeDelta(const u8* oldData, u32 oldSize, const u8* newData, u32 newSize, u32 newFlag, u32 newChunkSize,
+				std::vector<u8>& delta);
+
+//return false if delta is broken or not made from oldData
+bool applyDelta(const u8* oldData, u32 oldSize, const u8* delta, u32 deltaSize, std::vector<u8>& newData,
+				u32& newFlag, u32& newChunkSize);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//see createPatch() and applyPatch()
+class Patch
+{
+public:
+	static bool create(Package* oldPackage, Package* newPackage, const Char* patchFilename, u32 flag);
+
+	static bool apply(Package* package, Package* patch, Callback callback, void* callbackParam);
+
+private:
+	static bool addChangedFile(Package* patch, Package* oldPackage, Package* newPackage, u32 index, u32 flag);
+	static bool applyDeltaFile(Package* package, Package* patch, u32 index);
+
+	//copy packed data of a file, or share data of an identical file in dstPackage
+	//contentHash is computed by package (see getContentHash), 0 if unknown
+	static bool copyFile(Package* dstPackage, Package* srcPackage, u32 index, u64 contentHash);
+
+	static bool readPackData(Package* package, u32 index, std::vector<u8>& data);
+	static bool readContent(Package* package, u32 index, std::vector<u8>& data);
+	static void compressData(const std::vector<u8>& data, u32 chunkSize, u32& flag, std::vector<u8>& packData);
+
+	//file needs to be read if hash is not recorded or is given by user (no FILE_HASHED)
+	static u64 getContentHash(Package* package, u32 index);
+
+	static bool hasFilenames(const Package* package);
+};
+
+}
+
+#endif
@@ -0,0 +1,703 @@
+#include "zpPlatform.h"
+#include <cassert>
+
+#if defined (_WIN32)
+	#include <io.h>
+#else
+	#include <unistd.h>
+	#include <time.h>
+	#include <fcntl.h>
+	#include <stdlib.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+#if defined (__linux__)
+	#include <sys/syscall.h>
+	#include <sys/sendfile.h>
+#endif
+
+namespace zp
+{
+
+#if defined (_WIN32)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Mutex::Mutex()
+{
+	::InitializeCriticalSection(&m_cs);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Mutex::~Mutex()
+{
+	::DeleteCriticalSection(&m_cs);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Mutex::lock()
+{
+	::EnterCriticalSection(&m_cs);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Mutex::unlock()
+{
+	::LeaveCriticalSection(&m_cs);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Condition::Condition()
+{
+	::InitializeConditionVariable(&m_cond);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Condition::~Condition()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Condition::wait(Mutex& mutex)
+{
+	::SleepConditionVariableCS(&m_cond, &mutex.m_cs, INFINITE);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Condition::signal()
+{
+	::WakeConditionVariable(&m_cond);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Condition::broadcast()
+{
+	::WakeAllConditionVariable(&m_cond);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static DWORD WINAPI threadEntry(LPVOID param)
+{
+	Thread* thread = reinterpret_cast<Thread*>(param);
+	thread->run();
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 getCpuCount()
+{
+	SYSTEM_INFO info;
+	::GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 getThreadId()
+{
+	return ::GetCurrentThreadId();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 getMicroseconds()
+{
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	::QueryPerformanceFrequency(&frequency);
+	::QueryPerformanceCounter(&counter);
+	//avoid overflow of counter * 1000000
+	u64 seconds = counter.QuadPart / frequency.QuadPart;
+	u64 remainder = counter.QuadPart % frequency.QuadPart;
+	return seconds * 1000000 + remainder * 1000000 / frequency.QuadPart;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 atomicAdd(volatile u64* value, u64 delta)
+{
+	return ::InterlockedExchangeAdd64((volatile LONGLONG*)value, delta) + delta;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 atomicExchange(volatile u64* value, u64 newValue)
+{
+	return ::InterlockedExchange64((volatile LONGLONG*)value, newValue);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 copyFileRange(FILE* dstFile, u64 dstOffset, FILE* srcFile, u64 srcOffset, u64 size)
+{
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool truncateFile(FILE* file, u64 size)
+{
+	fflush(file);
+	return (_chsize_s(_fileno(file), size) == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void adviseFile(FILE* file, u64 offset, u64 size, u32 advice)
+{
+	//no such hint for opened files, FILE_FLAG_SEQUENTIAL_SCAN can only be given when opening
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void syncFileRange(FILE* file, u64 offset, u64 size)
+{
+	fflush(file);
+	::FlushFileBuffers((HANDLE)_get_osfhandle(_fileno(file)));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void* allocAligned(u32 size)
+{
+	//page aligned
+	return ::VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void freeAligned(void* buffer)
+{
+	if (buffer != NULL)
+	{
+		::VirtualFree(buffer, 0, MEM_RELEASE);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DirectFile::DirectFile()
+	: m_handle(INVALID_HANDLE_VALUE)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DirectFile::open(const Char* filename, bool write)
+{
+	close();
+	m_handle = ::CreateFile(filename, write ? GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+							write ? CREATE_ALWAYS : OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	return (m_handle != INVALID_HANDLE_VALUE);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DirectFile::close()
+{
+	if (m_handle != INVALID_HANDLE_VALUE)
+	{
+		::CloseHandle(m_handle);
+		m_handle = INVALID_HANDLE_VALUE;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DirectFile::isOpen() const
+{
+	return (m_handle != INVALID_HANDLE_VALUE);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 DirectFile::read(u64 offset, void* buffer, u32 size)
+{
+	OVERLAPPED overlapped = {0};
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD readSize = 0;
+	if (!::ReadFile(m_handle, buffer, size, &readSize, &overlapped))
+	{
+		return 0;
+	}
+	return readSize;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DirectFile::write(u64 offset, const void* buffer, u32 size)
+{
+	OVERLAPPED overlapped = {0};
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD writtenSize = 0;
+	return (::WriteFile(m_handle, buffer, size, &writtenSize, &overlapped) && writtenSize == size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DirectFile::setSize(u64 size)
+{
+	LARGE_INTEGER fileEnd;
+	fileEnd.QuadPart = size;
+	return (::SetFilePointerEx(m_handle, fileEnd, NULL, FILE_BEGIN) && ::SetEndOfFile(m_handle));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+FileMapping::FileMapping()
+	: m_data(NULL)
+	, m_size(0)
+	, m_file(INVALID_HANDLE_VALUE)
+	, m_mapping(NULL)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool FileMapping::open(const Char* filename)
+{
+	close();
+	m_file = ::CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	LARGE_INTEGER fileSize;
+	if (m_file == INVALID_HANDLE_VALUE || !::GetFileSizeEx(m_file, &fileSize))
+	{
+		close();
+		return false;
+	}
+	m_size = fileSize.QuadPart;
+	if (m_size == 0)
+	{
+		//empty file can't be mapped
+		return true;
+	}
+	m_mapping = ::CreateFileMapping(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping != NULL)
+	{
+		m_data = (const u8*)::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (m_data == NULL)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FileMapping::close()
+{
+	if (m_data != NULL)
+	{
+		::UnmapViewOfFile(m_data);
+		m_data = NULL;
+	}
+	if (m_mapping != NULL)
+	{
+		::CloseHandle(m_mapping);
+		m_mapping = NULL;
+	}
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		::CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+	m_size = 0;
+}
+
+#else
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Mutex::Mutex()
+{
+	pthread_mutex_init(&m_mutex, NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Mutex::~Mutex()
+{
+	pthread_mutex_destroy(&m_mutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Mutex::lock()
+{
+	pthread_mutex_lock(&m_mutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Mutex::unlock()
+{
+	pthread_mutex_unlock(&m_mutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Condition::Condition()
+{
+	pthread_cond_init(&m_cond, NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Condition::~Condition()
+{
+	pthread_cond_destroy(&m_cond);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Condition::wait(Mutex& mutex)
+{
+	pthread_cond_wait(&m_cond, &mutex.m_mutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Condition::signal()
+{
+	pthread_cond_signal(&m_cond);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Condition::broadcast()
+{
+	pthread_cond_broadcast(&m_cond);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void* threadEntry(void* param)
+{
+	Thread* thread = reinterpret_cast<Thread*>(param);
+	thread->run();
+	return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 getCpuCount()
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (u32)count : 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 getThreadId()
+{
+#if defined (__linux__)
+	return (u32)syscall(SYS_gettid);
+#else
+	return (u32)(size_t)pthread_self();
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 getMicroseconds()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 atomicAdd(volatile u64* value, u64 delta)
+{
+	return __sync_add_and_fetch(value, delta);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 atomicExchange(volatile u64* value, u64 newValue)
+{
+	//__sync_lock_test_and_set is only an acquire barrier
+	__sync_synchronize();
+	return __sync_lock_test_and_set(value, newValue);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 copyFileRange(FILE* dstFile, u64 dstOffset, FILE* srcFile, u64 srcOffset, u64 size)
+{
+	//max bytes of one system call
+	const u64 MAX_COPY_SIZE = 0x40000000;
+
+	u64 copied = 0;
+#if defined (__linux__)
+	//data buffered by stdio must reach the file first
+	fflush(dstFile);
+	int dstFd = fileno(dstFile);
+	int srcFd = fileno(srcFile);
+
+	#if defined (__NR_copy_file_range)
+	loff_t srcPos = srcOffset;
+	loff_t dstPos = dstOffset;
+	while (copied < size)
+	{
+		u64 copySize = (size - copied < MAX_COPY_SIZE) ? size - copied : MAX_COPY_SIZE;
+		long ret = syscall(__NR_copy_file_range, srcFd, &srcPos, dstFd, &dstPos, (size_t)copySize, 0);
+		if (ret <= 0)
+		{
+			break;
+		}
+		copied += ret;
+	}
+	#endif
+	if (copied < size && lseek(dstFd, dstOffset + copied, SEEK_SET) >= 0)
+	{
+		//copy_file_range not available or failed (e.g. cross file system on old kernel)
+		off_t srcPos = srcOffset + copied;
+		while (copied < size)
+		{
+			u64 copySize = (size - copied < MAX_COPY_SIZE) ? size - copied : MAX_COPY_SIZE;
+			ssize_t ret = sendfile(dstFd, srcFd, &srcPos, (size_t)copySize);
+			if (ret <= 0)
+			{
+				break;
+			}
+			copied += ret;
+		}
+	}
+#endif
+	return copied;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool truncateFile(FILE* file, u64 size)
+{
+	fflush(file);
+	return (ftruncate(fileno(file), size) == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void adviseFile(FILE* file, u64 offset, u64 size, u32 advice)
+{
+#if defined (POSIX_FADV_SEQUENTIAL)
+	int hint = POSIX_FADV_NORMAL;
+	switch (advice)
+	{
+	case ADVISE_SEQUENTIAL:
+		hint = POSIX_FADV_SEQUENTIAL;
+		break;
+	case ADVISE_WILLNEED:
+		hint = POSIX_FADV_WILLNEED;
+		break;
+	case ADVISE_DONTNEED:
+		hint = POSIX_FADV_DONTNEED;
+		break;
+	}
+	posix_fadvise(fileno(file), offset, size, hint);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void syncFileRange(FILE* file, u64 offset, u64 size)
+{
+	fflush(file);
+#if defined (__linux__)
+	sync_file_range(fileno(file), offset, size,
+					SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+	fsync(fileno(file));
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void* allocAligned(u32 size)
+{
+	void* buffer = NULL;
+	if (posix_memalign(&buffer, DIRECT_IO_ALIGN, size) != 0)
+	{
+		return NULL;
+	}
+	return buffer;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void freeAligned(void* buffer)
+{
+	free(buffer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DirectFile::DirectFile()
+	: m_fd(-1)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DirectFile::open(const Char* filename, bool write)
+{
+	close();
+	int flags = write ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY;
+#if defined (O_DIRECT)
+	m_fd = ::open(filename, flags | O_DIRECT, 0644);
+	if (m_fd >= 0)
+	{
+		return true;
+	}
+#endif
+	m_fd = ::open(filename, flags, 0644);
+#if defined (F_NOCACHE)
+	if (m_fd >= 0)
+	{
+		fcntl(m_fd, F_NOCACHE, 1);
+	}
+#endif
+	return (m_fd >= 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DirectFile::close()
+{
+	if (m_fd >= 0)
+	{
+		::close(m_fd);
+		m_fd = -1;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DirectFile::isOpen() const
+{
+	return (m_fd >= 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 DirectFile::read(u64 offset, void* buffer, u32 size)
+{
+	u32 readSize = 0;
+	while (readSize < size)
+	{
+		ssize_t ret = pread(m_fd, (u8*)buffer + readSize, size - readSize, offset + readSize);
+		if (ret <= 0)
+		{
+			break;
+		}
+		readSize += ret;
+	}
+	return readSize;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DirectFile::write(u64 offset, const void* buffer, u32 size)
+{
+	u32 writtenSize = 0;
+	while (writtenSize < size)
+	{
+		ssize_t ret = pwrite(m_fd, (const u8*)buffer + writtenSize, size - writtenSize, offset + writtenSize);
+		if (ret <= 0)
+		{
+			return false;
+		}
+		writtenSize += ret;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DirectFile::setSize(u64 size)
+{
+	return (ftruncate(m_fd, size) == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+FileMapping::FileMapping()
+	: m_data(NULL)
+	, m_size(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool FileMapping::open(const Char* filename)
+{
+	close();
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+	m_size = fileStat.st_size;
+	if (m_size > 0)
+	{
+		//mapping stays valid after file is closed
+		void* data = mmap(NULL, (size_t)m_size, PROT_READ, MAP_SHARED, fd, 0);
+		m_data = (data != MAP_FAILED) ? (const u8*)data : NULL;
+	}
+	::close(fd);
+	if (m_size > 0 && m_data == NULL)
+	{
+		m_size = 0;
+		return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FileMapping::close()
+{
+	if (m_data != NULL)
+	{
+		munmap(const_cast<u8*>(m_data), (size_t)m_size);
+		m_data = NULL;
+	}
+	m_size = 0;
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Thread::Thread()
+	: m_proc(NULL)
+	, m_param(NULL)
+	, m_running(false)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Thread::~Thread()
+{
+	join();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Thread::start(ThreadProc proc, void* param)
+{
+	assert(!m_running);
+	m_proc = proc;
+	m_param = param;
+#if defined (_WIN32)
+	m_handle = ::CreateThread(NULL, 0, threadEntry, this, 0, NULL);
+	m_running = (m_handle != NULL);
+#else
+	m_running = (pthread_create(&m_handle, NULL, threadEntry, this) == 0);
+#endif
+	return m_running;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Thread::join()
+{
+	if (!m_running)
+	{
+		return;
+	}
+#if defined (_WIN32)
+	::WaitForSingleObject(m_handle, INFINITE);
+	::CloseHandle(m_handle);
+#else
+	pthread_join(m_handle, NULL);
+#endif
+	m_running = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Thread::run()
+{
+	m_proc(m_param);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DirectFile::~DirectFile()
+{
+	close();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+FileMapping::~FileMapping()
+{
+	close();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const u8* FileMapping::data() const
+{
+	return m_data;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 FileMapping::size() const
+{
+	return m_size;
+}
+
+}
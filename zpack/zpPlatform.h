@@ -0,0 +1,211 @@
+#ifndef __ZP_PLATFORM_H__
+#define __ZP_PLATFORM_H__
+
+#include "zpack.h"
+#include "stdio.h"
+
+#if defined (_WIN32)
+	#include <windows.h>
+#else
+	#include <pthread.h>
+#endif
+
+namespace zp
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class Mutex
+{
+	friend class Condition;
+
+public:
+	Mutex();
+	~Mutex();
+
+	void lock();
+	void unlock();
+
+private:
+	Mutex(const Mutex&);
+	Mutex& operator=(const Mutex&);
+
+private:
+#if defined (_WIN32)
+	CRITICAL_SECTION	m_cs;
+#else
+	pthread_mutex_t		m_mutex;
+#endif
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class MutexLock
+{
+public:
+	MutexLock(Mutex& mutex) : m_mutex(mutex){m_mutex.lock();}
+	~MutexLock(){m_mutex.unlock();}
+
+private:
+	MutexLock& operator=(const MutexLock&);
+
+private:
+	Mutex&	m_mutex;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//condition variable, windows version requires vista or later
+class Condition
+{
+public:
+	Condition();
+	~Condition();
+
+	//mutex must be locked by caller
+	void wait(Mutex& mutex);
+	void signal();
+	void broadcast();
+
+private:
+	Condition(const Condition&);
+	Condition& operator=(const Condition&);
+
+private:
+#if defined (_WIN32)
+	CONDITION_VARIABLE	m_cond;
+#else
+	pthread_cond_t		m_cond;
+#endif
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+typedef void (*ThreadProc)(void* param);
+
+class Thread
+{
+public:
+	Thread();
+	~Thread();	//join if still running
+
+	bool start(ThreadProc proc, void* param);
+	void join();
+
+	//called in new thread
+	void run();
+
+private:
+	Thread(const Thread&);
+	Thread& operator=(const Thread&);
+
+private:
+	ThreadProc	m_proc;
+	void*		m_param;
+	bool		m_running;
+#if defined (_WIN32)
+	HANDLE		m_handle;
+#else
+	pthread_t	m_handle;
+#endif
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 getCpuCount();
+
+//id of calling thread
+u32 getThreadId();
+
+//monotonic clock, start point is undefined
+u64 getMicroseconds();
+
+//return new value
+u64 atomicAdd(volatile u64* value, u64 delta);
+//return old value
+u64 atomicExchange(volatile u64* value, u64 newValue);
+
+//copy bytes between files inside kernel (copy_file_range, or sendfile as fallback)
+//return bytes copied, may be less than size (0 if not supported), caller should copy the rest
+//file position of dstFile is undefined after calling
+u64 copyFileRange(FILE* dstFile, u64 dstOffset, FILE* srcFile, u64 srcOffset, u64 size);
+
+//cut file to size, buffered data is written first
+bool truncateFile(FILE* file, u64 size);
+
+//access hints of file range for system cache (posix_fadvise), size 0 means to end of file
+//ignored where not supported
+const u32 ADVISE_NORMAL = 0;
+const u32 ADVISE_SEQUENTIAL = 1;	//read ahead more aggressively
+const u32 ADVISE_WILLNEED = 2;		//start reading into cache now
+const u32 ADVISE_DONTNEED = 3;		//drop from cache, dirty pages are kept, see syncFileRange()
+void adviseFile(FILE* file, u64 offset, u64 size, u32 advice);
+
+//write dirty pages of file range to disk and wait, data buffered by stdio is written first
+void syncFileRange(FILE* file, u64 offset, u64 size);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//offset, size and buffer address of every DirectFile access must be multiple of this
+const u32 DIRECT_IO_ALIGN = 0x1000;
+
+void* allocAligned(u32 size);
+void freeAligned(void* buffer);
+
+//file bypassing system cache (O_DIRECT, FILE_FLAG_NO_BUFFERING)
+//opened normally if file system doesn't support it, so aligned access always works
+class DirectFile
+{
+public:
+	DirectFile();
+	~DirectFile();
+
+	//file is created or truncated if write is true
+	bool open(const Char* filename, bool write);
+	void close();
+	bool isOpen() const;
+
+	//return bytes read, less than size only at end of file
+	u32 read(u64 offset, void* buffer, u32 size);
+	bool write(u64 offset, const void* buffer, u32 size);
+
+	//cut padding of last block
+	bool setSize(u64 size);
+
+private:
+	DirectFile(const DirectFile&);
+	DirectFile& operator=(const DirectFile&);
+
+private:
+#if defined (_WIN32)
+	HANDLE	m_handle;
+#else
+	int		m_fd;
+#endif
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//whole file mapped into memory readonly (mmap, MapViewOfFile)
+class FileMapping
+{
+public:
+	FileMapping();
+	~FileMapping();
+
+	bool open(const Char* filename);
+	void close();
+
+	//NULL if not opened or file is empty
+	const u8* data() const;
+	u64 size() const;
+
+private:
+	FileMapping(const FileMapping&);
+	FileMapping& operator=(const FileMapping&);
+
+private:
+	const u8*	m_data;
+	u64			m_size;
+#if defined (_WIN32)
+	HANDLE		m_file;
+	HANDLE		m_mapping;
+#endif
+};
+
+}
+
+#endif
@@ -0,0 +1,224 @@
+#include "zpPreloader.h"
+#include "zpPackage.h"
+#include "zlib.h"
+#include <cassert>
+#include <cstring>
+
+namespace zp
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Preloader::Preloader(const Package* package)
+	: m_package(package)
+	, m_stream(NULL)
+	, m_mappedData(NULL)
+	, m_mappedSize(0)
+	, m_stop(false)
+{
+	assert(package != NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Preloader::~Preloader()
+{
+	stop();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Preloader::start(IStorage* storage, const Char* packageFilename, const std::vector<FileEntry>& entries)
+{
+	stop();
+	if (entries.empty())
+	{
+		return false;
+	}
+	if (packageFilename[0] != 0)
+	{
+		//package stream is used by opened files meanwhile
+		m_stream = Fopen(packageFilename, _T("rb"));
+	}
+	else
+	{
+		//mapped data can be read by several threads
+		m_mappedData = storage->map();
+		m_mappedSize = storage->size();
+	}
+	if (m_stream == NULL && m_mappedData == NULL)
+	{
+		return false;
+	}
+	m_jobs.resize(entries.size());
+	for (u32 i = 0; i < entries.size(); ++i)
+	{
+		const FileEntry& entry = entries[i];
+		Job& job = m_jobs[i];
+		job.offset = entry.byteOffset;
+		job.nameHash = entry.nameHash;
+		job.packSize = entry.packSize;
+		job.originSize = entry.originSize;
+		job.chunkSize = entry.chunkSize;
+		job.data = NULL;
+		job.state = JOB_PENDING;
+		m_jobIndex[entry.byteOffset] = i;
+	}
+	m_stop = false;
+	if (!m_thread.start(threadProc, this))
+	{
+		stop();
+		return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Preloader::stop()
+{
+	{
+		MutexLock lock(m_mutex);
+		m_stop = true;
+		m_cond.broadcast();
+	}
+	m_thread.join();
+	for (u32 i = 0; i < m_jobs.size(); ++i)
+	{
+		delete[] m_jobs[i].data;
+	}
+	m_jobs.clear();
+	m_jobIndex.clear();
+	if (m_stream != NULL)
+	{
+		fclose(m_stream);
+		m_stream = NULL;
+	}
+	m_mappedData = NULL;
+	m_mappedSize = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u8* Preloader::take(u64 offset, u32 packSize, u32 originSize)
+{
+	MutexLock lock(m_mutex);
+	std::map<u64, u32>::const_iterator iter = m_jobIndex.find(offset);
+	if (iter == m_jobIndex.end())
+	{
+		return NULL;
+	}
+	Job& job = m_jobs[iter->second];
+	if (job.packSize != packSize || job.originSize != originSize)
+	{
+		return NULL;
+	}
+	while (job.state == JOB_LOADING)
+	{
+		m_cond.wait(m_mutex);
+	}
+	//file opened before warm up reaches it reads package itself
+	u8* data = job.data;
+	job.data = NULL;
+	job.state = JOB_DONE;
+	return data;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Preloader::threadProc(void* param)
+{
+	reinterpret_cast<Preloader*>(param)->loadFiles();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Preloader::loadFiles()
+{
+	std::vector<u8> packed;
+	for (u32 i = 0; i < m_jobs.size(); ++i)
+	{
+		Job& job = m_jobs[i];
+		{
+			MutexLock lock(m_mutex);
+			if (m_stop)
+			{
+				return;
+			}
+			if (job.state != JOB_PENDING)
+			{
+				continue;
+			}
+			job.state = JOB_LOADING;
+		}
+		const u8* packData = NULL;
+		if (m_stream != NULL)
+		{
+			packed.resize(job.packSize);
+			_fseeki64(m_stream, job.offset, SEEK_SET);
+			if (fread(&packed[0], job.packSize, 1, m_stream) == 1)
+			{
+				packData = &packed[0];
+			}
+		}
+		else if (job.offset + job.packSize <= m_mappedSize)
+		{
+			packData = m_mappedData + job.offset;
+		}
+		u8* data = new u8[job.originSize];
+		if (packData == NULL || !inflateFile(job, packData, data))
+		{
+			delete[] data;
+			data = NULL;
+		}
+		m_package->addStatistic(m_package->m_statistics.rawReadSize, job.packSize);
+
+		MutexLock lock(m_mutex);
+		job.data = data;
+		job.state = (data != NULL) ? JOB_READY : JOB_DONE;
+		m_cond.broadcast();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Preloader::inflateFile(const Job& job, const u8* packed, u8* dst)
+{
+	//not Package::uncompressData(), trace may be stopped by user meanwhile
+	u64 startTime = getMicroseconds();
+	bool succeeded = true;
+	u32 chunkCount = (job.originSize + job.chunkSize - 1) / job.chunkSize;
+	if (chunkCount <= 1)
+	{
+		uLongf dstSize = job.originSize;
+		succeeded = (uncompress(dst, &dstSize, packed, job.packSize) == Z_OK && dstSize == job.originSize);
+	}
+	else
+	{
+		//raw data position of each chunk, followed by chunks
+		const u32* chunkPos = reinterpret_cast<const u32*>(packed);
+		succeeded = (job.packSize >= chunkCount * sizeof(u32) && chunkPos[0] == chunkCount * sizeof(u32));
+		for (u32 i = 0; succeeded && i < chunkCount; ++i)
+		{
+			u32 chunkEnd = (i + 1 < chunkCount) ? chunkPos[i + 1] : job.packSize;
+			if (chunkEnd <= chunkPos[i] || chunkEnd > job.packSize)
+			{
+				succeeded = false;
+				break;
+			}
+			u32 packedChunkSize = chunkEnd - chunkPos[i];
+			u32 originChunkSize = (i + 1 < chunkCount) ? job.chunkSize : job.originSize - i * job.chunkSize;
+			u8* chunkDst = dst + i * job.chunkSize;
+			if (packedChunkSize == originChunkSize)
+			{
+				//this chunk was not compressed at all
+				memcpy(chunkDst, packed + chunkPos[i], originChunkSize);
+				continue;
+			}
+			uLongf dstSize = originChunkSize;
+			succeeded = (uncompress(chunkDst, &dstSize, packed + chunkPos[i], packedChunkSize) == Z_OK
+						&& dstSize == originChunkSize);
+		}
+	}
+	m_package->addStatistic(m_package->m_statistics.inflateTime, getMicroseconds() - startTime);
+	m_package->addStatistic(m_package->m_statistics.compressedReadSize, job.packSize);
+	if (succeeded)
+	{
+		m_package->addStatistic(m_package->m_statistics.inflatedSize, job.originSize);
+	}
+	return succeeded;
+}
+
+}
@@ -0,0 +1,88 @@
+#ifndef __ZP_PRELOADER_H__
+#define __ZP_PRELOADER_H__
+
+#include "zpack.h"
+#include "zpPlatform.h"
+#include <vector>
+#include <map>
+
+namespace zp
+{
+
+class Package;
+struct FileEntry;
+
+//name of internal file holding warm set, an array of name hashes, see IPackage::setWarmSet()
+const Char* const WARM_SET_NAME = _T("$warmset");
+
+//memory limit of files decompressed by warm up, others are only read into system cache
+const u64 PRELOAD_MEMORY_LIMIT = 0x10000000;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//background thread decompresses files of warm set, see IPackage::warmUp()
+//CompressedFile takes the data when it's opened, instead of reading package
+class Preloader
+{
+public:
+	Preloader(const Package* package);
+	~Preloader();	//stop
+
+	//package file is read through a stream of its own, files are decompressed in array order
+	//package not in a file (packageFilename is empty) is decompressed in place, only if storage is mapped
+	//chunkSize of entries is the real one (not 0)
+	bool start(IStorage* storage, const Char* packageFilename, const std::vector<FileEntry>& entries);
+
+	//wait for thread to finish current file, data not taken is released
+	void stop();
+
+	//return decompressed file at offset, allocated with new[] and owned by caller
+	//wait if it's being decompressed, NULL if it's not preloaded (it won't be decompressed later)
+	u8* take(u64 offset, u32 packSize, u32 originSize);
+
+private:
+	enum JobState
+	{
+		JOB_PENDING = 0,
+		JOB_LOADING,
+		JOB_READY,
+		JOB_DONE		//taken, skipped or failed
+	};
+
+	struct Job
+	{
+		u64			offset;
+		u64			nameHash;
+		u32			packSize;
+		u32			originSize;
+		u32			chunkSize;
+		u8*			data;
+		JobState	state;
+	};
+
+	static void threadProc(void* param);
+
+	void loadFiles();
+
+	//whole file, chunk by chunk if there's more than one
+	bool inflateFile(const Job& job, const u8* packed, u8* dst);
+
+private:
+	Preloader(const Preloader&);
+	Preloader& operator=(const Preloader&);
+
+private:
+	const Package*		m_package;
+	FILE*				m_stream;
+	const u8*			m_mappedData;	//used if m_stream is NULL
+	u64					m_mappedSize;
+	std::vector<Job>	m_jobs;
+	std::map<u64, u32>	m_jobIndex;		//offset -> index of job
+	Thread				m_thread;
+	Mutex				m_mutex;
+	Condition			m_cond;
+	bool				m_stop;
+};
+
+}
+
+#endif
@@ -0,0 +1,303 @@
+#include "zpStorage.h"
+#include <cassert>
+#include <cstring>
+
+namespace zp
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+FileStorage::FileStorage()
+	: m_stream(NULL)
+	, m_position((u64)-1)
+	, m_seekCounter(NULL)
+	, m_writing(false)
+	, m_readonly(true)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+FileStorage::~FileStorage()
+{
+	close();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool FileStorage::open(const Char* filename, bool readonly, bool create)
+{
+	close();
+	if (create)
+	{
+		m_stream = Fopen(filename, _T("w+b"));
+	}
+	else
+	{
+		m_stream = Fopen(filename, readonly ? _T("rb") : _T("r+b"));
+	}
+	if (m_stream == NULL)
+	{
+		return false;
+	}
+	m_filename = filename;
+	m_readonly = readonly && !create;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FileStorage::close()
+{
+	if (m_stream != NULL)
+	{
+		fclose(m_stream);
+		m_stream = NULL;
+	}
+	m_position = (u64)-1;
+	m_writing = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const Char* FileStorage::filename() const
+{
+	return m_filename.c_str();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+FILE* FileStorage::getStream()
+{
+	m_position = (u64)-1;
+	return m_stream;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FileStorage::countSeeks(u64* counter)
+{
+	m_seekCounter = counter;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool FileStorage::readonly() const
+{
+	return m_readonly;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 FileStorage::size() const
+{
+	m_position = (u64)-1;
+	_fseeki64(m_stream, 0, SEEK_END);
+	return _ftelli64(m_stream);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 FileStorage::read(u64 offset, void* buffer, u32 size)
+{
+	seek(offset, false);
+	u32 readSize = (u32)fread(buffer, 1, size, m_stream);
+	m_position = (readSize == size) ? offset + size : (u64)-1;
+	return readSize;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 FileStorage::write(u64 offset, const void* buffer, u32 size)
+{
+	if (m_readonly)
+	{
+		return 0;
+	}
+	seek(offset, true);
+	u32 writtenSize = (u32)fwrite(buffer, 1, size, m_stream);
+	m_position = (writtenSize == size) ? offset + size : (u64)-1;
+	return writtenSize;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool FileStorage::setSize(u64 size)
+{
+	if (m_readonly)
+	{
+		return false;
+	}
+	m_position = (u64)-1;
+	return truncateFile(m_stream, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool FileStorage::sync()
+{
+	return (fflush(m_stream) == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const u8* FileStorage::map()
+{
+	return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FileStorage::seek(u64 offset, bool writing)
+{
+	if (offset != m_position || writing != m_writing)
+	{
+		_fseeki64(m_stream, offset, SEEK_SET);
+		m_writing = writing;
+		if (m_seekCounter != NULL)
+		{
+			atomicAdd(m_seekCounter, 1);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool MapStorage::open(const Char* filename)
+{
+	return m_mapping.open(filename);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool MapStorage::readonly() const
+{
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 MapStorage::size() const
+{
+	return m_mapping.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 MapStorage::read(u64 offset, void* buffer, u32 size)
+{
+	if (offset >= m_mapping.size())
+	{
+		return 0;
+	}
+	if (offset + size > m_mapping.size())
+	{
+		size = (u32)(m_mapping.size() - offset);
+	}
+	memcpy(buffer, m_mapping.data() + offset, size);
+	return size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 MapStorage::write(u64, const void*, u32)
+{
+	//mapping is readonly
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool MapStorage::setSize(u64)
+{
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool MapStorage::sync()
+{
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const u8* MapStorage::map()
+{
+	return m_mapping.data();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+MemoryStorage::MemoryStorage(const void* data, u64 size, bool readonly)
+	: m_data((const u8*)data)
+	, m_size(size)
+	, m_readonly(readonly)
+{
+	if (!readonly)
+	{
+		if (data != NULL)
+		{
+			m_buffer.assign(m_data, m_data + size);
+		}
+		else
+		{
+			m_buffer.resize((size_t)size);
+		}
+		m_data = m_buffer.empty() ? NULL : &m_buffer[0];
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool MemoryStorage::readonly() const
+{
+	return m_readonly;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 MemoryStorage::size() const
+{
+	return m_size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 MemoryStorage::read(u64 offset, void* buffer, u32 size)
+{
+	if (offset >= m_size)
+	{
+		return 0;
+	}
+	if (offset + size > m_size)
+	{
+		size = (u32)(m_size - offset);
+	}
+	memcpy(buffer, m_data + offset, size);
+	return size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 MemoryStorage::write(u64 offset, const void* buffer, u32 size)
+{
+	if (m_readonly || size == 0)
+	{
+		return 0;
+	}
+	if (offset + size > m_size && !setSize(offset + size))
+	{
+		return 0;
+	}
+	memcpy(&m_buffer[0] + offset, buffer, size);
+	return size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool MemoryStorage::setSize(u64 size)
+{
+	if (m_readonly)
+	{
+		return false;
+	}
+	if (size > m_buffer.size())
+	{
+		//grow like a file being appended, not reallocated on each write
+		u64 capacity = m_buffer.size() * 3 / 2;
+		m_buffer.resize((size_t)(size > capacity ? size : capacity));
+	}
+	else if (size < m_size)
+	{
+		memset(&m_buffer[0] + size, 0, (size_t)(m_size - size));
+	}
+	m_size = size;
+	m_data = m_buffer.empty() ? NULL : &m_buffer[0];
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool MemoryStorage::sync()
+{
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const u8* MemoryStorage::map()
+{
+	return m_data;
+}
+
+}
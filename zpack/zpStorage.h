@@ -0,0 +1,101 @@
+#ifndef __ZP_STORAGE_H__
+#define __ZP_STORAGE_H__
+
+#include "zpack.h"
+#include "zpPlatform.h"
+#include <vector>
+
+namespace zp
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//package file accessed through stdio, see createFileStorage()
+class FileStorage : public IStorage
+{
+public:
+	FileStorage();
+	virtual ~FileStorage();
+
+	//existing file, or a new empty one if create is true
+	bool open(const Char* filename, bool readonly, bool create = false);
+	void close();
+
+	const Char* filename() const;
+
+	//for system calls on the file (copyFileRange(), adviseFile()...)
+	//file position is unknown to storage afterwards
+	FILE* getStream();
+
+	//counter is increased by each seek actually issued, NULL to stop counting
+	void countSeeks(u64* counter);
+
+	virtual bool readonly() const;
+	virtual u64 size() const;
+	virtual u32 read(u64 offset, void* buffer, u32 size);
+	virtual u32 write(u64 offset, const void* buffer, u32 size);
+	virtual bool setSize(u64 size);
+	virtual bool sync();
+	virtual const u8* map();
+
+private:
+	//seek is skipped if access continues from last one
+	void seek(u64 offset, bool writing);
+
+private:
+	FileStorage(const FileStorage&);
+	FileStorage& operator=(const FileStorage&);
+
+private:
+	FILE*		m_stream;
+	String		m_filename;
+	mutable u64	m_position;		//-1 if unknown
+	u64*		m_seekCounter;
+	bool		m_writing;		//stdio requires a seek between read and write
+	bool		m_readonly;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//readonly package file mapped into memory, see createMapStorage()
+class MapStorage : public IStorage
+{
+public:
+	bool open(const Char* filename);
+
+	virtual bool readonly() const;
+	virtual u64 size() const;
+	virtual u32 read(u64 offset, void* buffer, u32 size);
+	virtual u32 write(u64 offset, const void* buffer, u32 size);
+	virtual bool setSize(u64 size);
+	virtual bool sync();
+	virtual const u8* map();
+
+private:
+	FileMapping	m_mapping;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//package in memory, see createMemoryStorage()
+class MemoryStorage : public IStorage
+{
+public:
+	//data is copied unless readonly
+	MemoryStorage(const void* data, u64 size, bool readonly);
+
+	virtual bool readonly() const;
+	virtual u64 size() const;
+	virtual u32 read(u64 offset, void* buffer, u32 size);
+	virtual u32 write(u64 offset, const void* buffer, u32 size);
+	virtual bool setSize(u64 size);
+	virtual bool sync();
+	virtual const u8* map();
+
+private:
+	const u8*		m_data;		//user data, or m_buffer
+	u64				m_size;
+	std::vector<u8>	m_buffer;
+	bool			m_readonly;
+};
+
+}
+
+#endif
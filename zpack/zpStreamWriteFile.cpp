@@ -0,0 +1,169 @@
+#include "zpStreamWriteFile.h"
+#include "zpPackage.h"
+#include "WriteCompressFile.h"
+
+namespace zp
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+StreamWriteFile::StreamWriteFile(Package* package, const Char* filename, u32 flag, u32 chunkSize,
+								u32 compressLevel)
+	: m_package(package)
+	, m_filename(filename)
+	, m_flag(flag)
+	, m_chunkSize(chunkSize)
+	, m_compressLevel(compressLevel)
+	, m_size(0)
+	, m_skippedSize(0)
+	, m_skipCompress(false)
+{
+	m_chunkData.reserve(m_chunkSize);
+	if ((m_flag & FILE_COMPRESS) != 0)
+	{
+		m_compressBuffer.resize(m_chunkSize);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+StreamWriteFile::~StreamWriteFile()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 StreamWriteFile::size() const
+{
+	return m_size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 StreamWriteFile::flag() const
+{
+	return m_flag | FILE_WRITING;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void StreamWriteFile::seek(u32)
+{
+	//compressed stream can't be rewound, data is only appended
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+u32 StreamWriteFile::tell() const
+{
+	return m_size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 StreamWriteFile::write(const u8* buffer, u32 size)
+{
+	if (m_size + size < m_size)
+	{
+		//file size can't exceed 4G
+		size = (u32)-1 - m_size;
+	}
+	if (size == 0)
+	{
+		return 0;
+	}
+	m_hash.update(buffer, size);
+	m_size += size;
+
+	u32 left = size;
+	while (left > 0)
+	{
+		u32 copySize = m_chunkSize - m_chunkData.size();
+		if (copySize > left)
+		{
+			copySize = left;
+		}
+		m_chunkData.insert(m_chunkData.end(), buffer, buffer + copySize);
+		buffer += copySize;
+		left -= copySize;
+		if (m_chunkData.size() == m_chunkSize)
+		{
+			packChunk();
+		}
+	}
+	return size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool StreamWriteFile::finish()
+{
+	packChunk();
+
+	u32 flag = m_flag;
+	u32 chunkCount = m_chunkPos.size();
+	if (chunkCount > 1)
+	{
+		//same layout as writeCompressFile, chunk position table is before chunks
+		u32 tableSize = chunkCount * sizeof(u32);
+		for (u32 i = 0; i < chunkCount; ++i)
+		{
+			m_chunkPos[i] += tableSize;
+		}
+		m_packData.insert(m_packData.begin(), (const u8*)&m_chunkPos[0], (const u8*)&m_chunkPos[0] + tableSize);
+	}
+	else if (m_packData.size() == m_size)
+	{
+		//empty or one chunk not compressed
+		flag &= (~FILE_COMPRESS);
+	}
+
+	u64 contentHash = (m_size == 0) ? 0 : m_hash.digest();
+	const u8* data = m_packData.empty() ? NULL : &m_packData[0];
+	int sameIndex = m_package->findSameContent(contentHash, m_size);
+	//source data is gone, only packed data can be compared
+	if (sameIndex >= 0 && m_package->isSamePackData(sameIndex, flag, m_chunkSize, data, m_packData.size()))
+	{
+		return m_package->addSharedFile(m_filename.c_str(), flag, sameIndex, NULL, NULL);
+	}
+	if (!m_package->writeFileData(m_filename.c_str(), m_size, flag | FILE_HASHED, m_chunkSize, data, m_packData.size(),
+									contentHash))
+	{
+		return false;
+	}
+	m_package->m_skippedCompressSize += m_skippedSize;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void StreamWriteFile::packChunk()
+{
+	u32 chunkSize = m_chunkData.size();
+	if (chunkSize == 0)
+	{
+		return;
+	}
+	if ((m_flag & FILE_COMPRESS) != 0 && m_chunkPos.empty() && chunkSize >= FORMAT_SIGN_SIZE
+		&& isCompressedFormat(&m_chunkData[0], FORMAT_SIGN_SIZE))
+	{
+		//first chunk shows file is already compressed
+		m_flag &= (~FILE_COMPRESS);
+		m_skipCompress = true;
+	}
+	if ((m_flag & FILE_COMPRESS) == 0)
+	{
+		m_packData.insert(m_packData.end(), m_chunkData.begin(), m_chunkData.end());
+		if (m_skipCompress)
+		{
+			m_skippedSize += chunkSize;
+		}
+		m_chunkData.clear();
+		return;
+	}
+	m_chunkPos.push_back(m_packData.size());
+	u32 packSize = compressChunk(&m_compressBuffer[0], m_chunkSize, &m_chunkData[0], chunkSize, m_compressLevel,
+									m_skippedSize);
+	if (packSize == chunkSize)
+	{
+		m_packData.insert(m_packData.end(), m_chunkData.begin(), m_chunkData.end());
+	}
+	else
+	{
+		m_packData.insert(m_packData.end(), m_compressBuffer.begin(), m_compressBuffer.begin() + packSize);
+	}
+	m_chunkData.clear();
+}
+
+}
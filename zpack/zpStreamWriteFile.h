@@ -0,0 +1,56 @@
+#ifndef __ZP_STREAM_WRITE_FILE_H__
+#define __ZP_STREAM_WRITE_FILE_H__
+
+#include "zpack.h"
+#include "zpContentHash.h"
+#include <vector>
+
+namespace zp
+{
+
+class Package;
+
+//created by IPackage::createStreamFile(), file is added to package by finish()
+class StreamWriteFile : public IWriteFile
+{
+public:
+	StreamWriteFile(Package* package, const Char* filename, u32 flag, u32 chunkSize, u32 compressLevel);
+	~StreamWriteFile();
+
+	//size written so far
+	virtual u32 size() const;
+
+	virtual u32 flag() const;
+
+	//only sequential writing is supported, seek() does nothing
+	virtual void seek(u32 pos);
+
+	virtual u32 tell() const;
+
+	virtual u32 write(const u8* buffer, u32 size);
+
+	//called by Package::closeFile()
+	bool finish();
+
+private:
+	void packChunk();
+
+private:
+	Package*			m_package;
+	String				m_filename;
+	u32					m_flag;
+	u32					m_chunkSize;
+	u32					m_compressLevel;
+	u32					m_size;
+	u32					m_skippedSize;
+	bool				m_skipCompress;		//file format is already compressed
+	ContentHash			m_hash;
+	std::vector<u8>		m_chunkData;		//not compressed yet, less than a chunk
+	std::vector<u8>		m_compressBuffer;
+	std::vector<u8>		m_packData;			//compressed chunks
+	std::vector<u32>	m_chunkPos;			//relative to first chunk
+};
+
+}
+
+#endif
@@ -0,0 +1,319 @@
+#include "zpTrace.h"
+#include <vector>
+#include <map>
+#include <cmath>
+
+using namespace std;
+
+namespace zp
+{
+
+//events are buffered, trace is small compared with data read
+const u32 TRACE_BUFFER_SIZE = 0x10000;
+
+//names of OP_XXX
+static const char* const OPERATION_NAMES[OP_COUNT] = {"openFile", "read", "inflate", "flush", "defrag", "compact"};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+TraceRecorder::TraceRecorder()
+	: m_file(NULL)
+	, m_startTime(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+TraceRecorder::~TraceRecorder()
+{
+	if (m_file != NULL)
+	{
+		fclose(m_file);
+		m_file = NULL;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool TraceRecorder::open(const Char* filename)
+{
+	m_file = Fopen(filename, _T("wb"));
+	if (m_file == NULL)
+	{
+		return false;
+	}
+	setvbuf(m_file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+	TraceHeader header;
+	header.sign = TRACE_FILE_SIGN;
+	header.version = TRACE_VERSION;
+#ifdef ZP_USE_WCHAR
+	header.flag = PACK_UNICODE;
+#else
+	header.flag = 0;
+#endif
+	header.eventSize = sizeof(TraceEvent);
+	fwrite(&header, sizeof(header), 1, m_file);
+	m_startTime = getMicroseconds();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void TraceRecorder::record(u32 type, u64 nameHash, u32 offset, u32 size, const Char* filename)
+{
+	TraceEvent event;
+	event.nameHash = nameHash;
+	event.threadId = getThreadId();
+	event.type = type;
+	event.offset = offset;
+	event.size = size;
+	u32 filenameLen = 0;
+	if (type == TRACE_OPEN)
+	{
+		//length of filename instead of offset
+		filenameLen = (filename == NULL) ? 0 : (u32)String(filename).length();
+		event.offset = filenameLen;
+	}
+	MutexLock lock(m_mutex);
+	//time is taken inside lock, so events are sorted by time
+	event.time = getMicroseconds() - m_startTime;
+	fwrite(&event, sizeof(event), 1, m_file);
+	if (filenameLen > 0)
+	{
+		fwrite(filename, filenameLen * sizeof(Char), 1, m_file);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void TraceRecorder::recordTiming(u32 operation, u64 nameHash, u64 startTime, u64 duration)
+{
+	TraceEvent event;
+	event.time = (startTime > m_startTime) ? startTime - m_startTime : 0;
+	event.nameHash = nameHash;
+	event.threadId = getThreadId();
+	event.type = TRACE_TIMING;
+	event.offset = operation;
+	event.size = (duration < 0xFFFFFFFF) ? (u32)duration : 0xFFFFFFFF;
+
+	MutexLock lock(m_mutex);
+	fwrite(&event, sizeof(event), 1, m_file);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool TraceRecorder::read(const Char* filename, TraceCallback callback, void* callbackParam)
+{
+	FILE* file = Fopen(filename, _T("rb"));
+	if (file == NULL)
+	{
+		return false;
+	}
+	TraceHeader header;
+#ifdef ZP_USE_WCHAR
+	const u32 flag = PACK_UNICODE;
+#else
+	const u32 flag = 0;
+#endif
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.sign != TRACE_FILE_SIGN
+		|| header.version != TRACE_VERSION || header.flag != flag || header.eventSize != sizeof(TraceEvent))
+	{
+		fclose(file);
+		return false;
+	}
+	//filenames of opened files, later events refer to them by name hash
+	map<u64, String> filenames;
+	vector<Char> filenameBuffer;
+	TraceEvent event;
+	while (fread(&event, sizeof(event), 1, file) == 1)
+	{
+		const Char* eventFilename = NULL;
+		if (event.type == TRACE_OPEN && event.offset > 0)
+		{
+			if (event.offset >= MAX_FILENAME_LEN)
+			{
+				break;
+			}
+			filenameBuffer.resize(event.offset);
+			if (fread(&filenameBuffer[0], event.offset * sizeof(Char), 1, file) != 1)
+			{
+				break;
+			}
+			String& name = filenames[event.nameHash];
+			name.assign(&filenameBuffer[0], event.offset);
+			eventFilename = name.c_str();
+		}
+		else
+		{
+			map<u64, String>::const_iterator found = filenames.find(event.nameHash);
+			if (found != filenames.end())
+			{
+				eventFilename = found->second.c_str();
+			}
+		}
+		if (!callback(event, eventFilename, callbackParam))
+		{
+			break;
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool TraceRecorder::exportChromeTrace(const Char* traceFilename, const Char* jsonFilename)
+{
+	FILE* file = Fopen(jsonFilename, _T("wb"));
+	if (file == NULL)
+	{
+		return false;
+	}
+	fprintf(file, "{\"traceEvents\":[\n");
+	ChromeTraceWriter writer;
+	writer.file = file;
+	writer.first = true;
+	bool succeeded = read(traceFilename, writeChromeEvent, &writer);
+	fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	fclose(file);
+	return succeeded;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool TraceRecorder::writeChromeEvent(const TraceEvent& event, const Char* filename, void* param)
+{
+	static const char* const EVENT_NAMES[] = {"", "open", "read", "hit", "miss", "close"};
+
+	ChromeTraceWriter* writer = reinterpret_cast<ChromeTraceWriter*>(param);
+	FILE* file = writer->file;
+	if (event.type == TRACE_TIMING ? event.offset >= OP_COUNT : event.type > TRACE_CLOSE)
+	{
+		//unknown event
+		return true;
+	}
+	//no comma before first event
+	fprintf(file, writer->first ? "" : ",\n");
+	writer->first = false;
+	if (event.type == TRACE_TIMING)
+	{
+		fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%lu",
+				OPERATION_NAMES[event.offset], event.time, event.size);
+	}
+	else
+	{
+		fprintf(file, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%llu",
+				EVENT_NAMES[event.type], event.time);
+	}
+	fprintf(file, ",\"pid\":0,\"tid\":%lu,\"args\":{", event.threadId);
+	//name hash is 0 for operations of package, e.g. flush
+	const char* separator = "";
+	if (filename != NULL)
+	{
+		fprintf(file, "\"file\":");
+		writeJsonString(file, filename);
+		separator = ",";
+	}
+	else if (event.nameHash != 0)
+	{
+		fprintf(file, "\"hash\":\"%016llx\"", event.nameHash);
+		separator = ",";
+	}
+	if (event.type == TRACE_READ || event.type == TRACE_CACHE_HIT || event.type == TRACE_CACHE_MISS)
+	{
+		fprintf(file, "%s\"offset\":%lu,\"size\":%lu", separator, event.offset, event.size);
+	}
+	else if (event.type == TRACE_OPEN)
+	{
+		fprintf(file, "%s\"size\":%lu", separator, event.size);
+	}
+	fprintf(file, "}}");
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void TraceRecorder::writeJsonString(FILE* file, const Char* str)
+{
+	fputc('"', file);
+	for (; *str != 0; ++str)
+	{
+		//wchar_t is written as utf-8, surrogate pairs are not combined
+		u32 ch = (u32)(*str) & ((sizeof(Char) == 1) ? 0xFF : 0xFFFF);
+		if (ch == '"' || ch == '\\')
+		{
+			fputc('\\', file);
+			fputc((int)ch, file);
+		}
+		else if (ch < 0x20)
+		{
+			fprintf(file, "\\u%04lx", ch);
+		}
+		else if (ch < 0x80 || sizeof(Char) == 1)
+		{
+			//multi-byte string is written as it is
+			fputc((int)ch, file);
+		}
+		else if (ch < 0x800)
+		{
+			fputc((int)(0xC0 | (ch >> 6)), file);
+			fputc((int)(0x80 | (ch & 0x3F)), file);
+		}
+		else
+		{
+			fputc((int)(0xE0 | (ch >> 12)), file);
+			fputc((int)(0x80 | ((ch >> 6) & 0x3F)), file);
+			fputc((int)(0x80 | (ch & 0x3F)), file);
+		}
+	}
+	fputc('"', file);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u32 getHistogramBucket(u64 value)
+{
+	if (value < HISTOGRAM_SUB_BUCKETS)
+	{
+		return (u32)value;
+	}
+	u32 highBit = HISTOGRAM_SUB_BUCKET_BITS;
+	while (highBit < 63 && (value >> (highBit + 1)) != 0)
+	{
+		++highBit;
+	}
+	u32 shift = highBit - HISTOGRAM_SUB_BUCKET_BITS;
+	u32 subBucket = (u32)(value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1);
+	return (shift + 1) * HISTOGRAM_SUB_BUCKETS + subBucket;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 getHistogramBucketValue(u32 bucket)
+{
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+	{
+		return bucket;
+	}
+	u32 shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	u64 subBucket = bucket % HISTOGRAM_SUB_BUCKETS;
+	u64 lowest = (HISTOGRAM_SUB_BUCKETS + subBucket) << shift;
+	return lowest + (((u64)1 << shift) - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+u64 getHistogramPercentile(const LatencyHistogram& histogram, double percentile)
+{
+	if (histogram.count == 0)
+	{
+		return 0;
+	}
+	//samples at or below the result
+	u64 target = (u64)ceil(histogram.count * percentile / 100);
+	if (target == 0)
+	{
+		target = 1;
+	}
+	u64 counted = 0;
+	for (u32 i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+	{
+		counted += histogram.buckets[i];
+		if (counted >= target)
+		{
+			return getHistogramBucketValue(i);
+		}
+	}
+	return getHistogramBucketValue(HISTOGRAM_BUCKET_COUNT - 1);
+}
+
+}
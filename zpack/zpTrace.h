@@ -0,0 +1,62 @@
+#ifndef __ZP_TRACE_H__
+#define __ZP_TRACE_H__
+
+#include "zpack.h"
+#include "zpPlatform.h"
+#include "stdio.h"
+
+namespace zp
+{
+
+const u32 TRACE_FILE_SIGN = 'CRTZ';
+const u32 TRACE_VERSION = 1;
+
+//trace file is a header followed by TraceEvent array
+//TRACE_OPEN event is followed by its filename (without terminating 0)
+struct TraceHeader
+{
+	u32	sign;
+	u32	version;
+	u32	flag;		//PACK_UNICODE if filenames are wchar_t
+	u32	eventSize;	//sizeof(TraceEvent) of writer
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class TraceRecorder
+{
+public:
+	TraceRecorder();
+	~TraceRecorder();
+
+	bool open(const Char* filename);
+
+	//can be called by any thread
+	void record(u32 type, u64 nameHash, u32 offset, u32 size, const Char* filename = 0);
+	//TRACE_TIMING event, startTime is from getMicroseconds()
+	void recordTiming(u32 operation, u64 nameHash, u64 startTime, u64 duration);
+
+	static bool read(const Char* filename, TraceCallback callback, void* callbackParam);
+	static bool exportChromeTrace(const Char* traceFilename, const Char* jsonFilename);
+
+private:
+	struct ChromeTraceWriter
+	{
+		FILE*	file;
+		bool	first;
+	};
+	static bool writeChromeEvent(const TraceEvent& event, const Char* filename, void* param);
+	static void writeJsonString(FILE* file, const Char* str);
+
+private:
+	TraceRecorder(const TraceRecorder&);
+	TraceRecorder& operator=(const TraceRecorder&);
+
+private:
+	Mutex	m_mutex;
+	FILE*	m_file;
+	u64		m_startTime;
+};
+
+}
+
+#endif
@@ -18,10 +18,6 @@ WriteFile::WriteFile(Package* package, u64 offset, u32 size, u32 flag, u64 nameH
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 WriteFile::~WriteFile()
 {
-	if (m_package->m_lastSeekFile == this)
-	{
-		m_package->m_lastSeekFile = NULL;
-	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -68,11 +64,7 @@ u32 WriteFile::write(const u8* buffer, u32 size)
 	{
 		return 0;
 	}
-	if (m_package->m_lastSeekFile != this)
-	{
-		seekInPackage();
-	}
-	fwrite(buffer, size, 1, m_package->m_stream);
+	m_package->writeStorage(m_offset + m_writePos, buffer, size);
 	m_writePos += size;
 
 	if (!m_package->setFileAvailableSize(m_nameHash, m_writePos))
@@ -84,11 +76,4 @@ u32 WriteFile::write(const u8* buffer, u32 size)
 	return size;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////
-void WriteFile::seekInPackage()
-{
-	_fseeki64(m_package->m_stream, m_offset + m_writePos, SEEK_SET);
-	m_package->m_lastSeekFile = this;
-}
-
 }
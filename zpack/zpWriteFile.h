@@ -24,9 +24,6 @@ public:
 
 	virtual u32 write(const u8* buffer, u32 size);
 
-private:
-	void seekInPackage();
-
 private:
 	Package*	m_package;
 	u64			m_offset;
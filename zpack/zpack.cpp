@@ -1,7 +1,12 @@
 #include "zpack.h"
 #include "zpPackage.h"
 #include "zpFile.h"
+#include "zpPatch.h"
+#include "zpMount.h"
+#include "zpTrace.h"
+#include "zpStorage.h"
 #include <fstream>
+#include <cstring>
 
 using namespace std;
 
@@ -9,9 +14,10 @@ namespace zp
 {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-IPackage* open(const Char* filename, u32 flag)
+static IPackage* openPackage(IStorage* storage, bool ownStorage, u32 flag)
 {
-	Package* package = new Package(filename, 
+	Package* package = new Package(storage,
+									ownStorage,
 									(flag & OPEN_READONLY) != 0,
 									(flag & OPEN_NO_FILENAME) == 0);
 	if (!package->valid())
@@ -19,27 +25,16 @@ IPackage* open(const Char* filename, u32 flag)
 		delete package;
 		package = NULL;
 	}
+	else if ((flag & OPEN_WARM_UP) != 0)
+	{
+		package->warmUp();
+	}
 	return package;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void close(IPackage* package)
+static void initHeader(PackageHeader& header, u32 chunkSize, u32 fileUserDataSize)
 {
-	delete static_cast<Package*>(package);
-}
-
-///////////////////////////////////////////////////////////////////////////////////////////////////
-IPackage* create(const Char* filename, u32 chunkSize, u32 fileUserDataSize)
-{
-	fstream stream;
-	locale loc = locale::global(locale(""));
-	stream.open(filename, ios_base::out | ios_base::trunc | ios_base::binary);
-	locale::global(loc);
-	if (!stream.is_open())
-	{
-		return NULL;
-	}
-	PackageHeader header;
 	header.sign = PACKAGE_FILE_SIGN;
 	header.version = CURRENT_VERSION;
 	header.headerSize = sizeof(PackageHeader);
@@ -56,7 +51,57 @@ IPackage* create(const Char* filename, u32 chunkSize, u32 fileUserDataSize)
 	header.flag = 0;
 #endif
 	header.fileEntrySize = sizeof(FileEntry) + fileUserDataSize;
+	header.tableLogOffset = sizeof(PackageHeader);
+	header.tableLogSize = 0;
+	header.tableLogCapacity = 0;
+	header.tableLogCount = 0;
+	header.tablePageCount = 0;
+	header.tablePageDirectoryOffset = 0;
+	header.tablePageEntryCount = 0;
 	memset(header.reserved, 0, sizeof(header.reserved));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IPackage* open(const Char* filename, u32 flag)
+{
+	FileStorage* storage = new FileStorage;
+	if (!storage->open(filename, (flag & OPEN_READONLY) != 0))
+	{
+		delete storage;
+		return NULL;
+	}
+	return openPackage(storage, true, flag);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IPackage* open(IStorage* storage, u32 flag)
+{
+	if (storage == NULL)
+	{
+		return NULL;
+	}
+	return openPackage(storage, false, flag);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void close(IPackage* package)
+{
+	delete static_cast<Package*>(package);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IPackage* create(const Char* filename, u32 chunkSize, u32 fileUserDataSize)
+{
+	fstream stream;
+	locale loc = locale::global(locale(""));
+	stream.open(filename, ios_base::out | ios_base::trunc | ios_base::binary);
+	locale::global(loc);
+	if (!stream.is_open())
+	{
+		return NULL;
+	}
+	PackageHeader header;
+	initHeader(header, chunkSize, fileUserDataSize);
 
 	stream.write((char*)&header, sizeof(header));
 	stream.close();
@@ -64,4 +109,101 @@ IPackage* create(const Char* filename, u32 chunkSize, u32 fileUserDataSize)
 	return open(filename, 0);
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IPackage* create(IStorage* storage, u32 chunkSize, u32 fileUserDataSize)
+{
+	if (storage == NULL || storage->readonly())
+	{
+		return NULL;
+	}
+	PackageHeader header;
+	initHeader(header, chunkSize, fileUserDataSize);
+	if (!storage->setSize(0) || storage->write(0, &header, sizeof(header)) != sizeof(header))
+	{
+		return NULL;
+	}
+	storage->sync();
+
+	return open(storage, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IMount* createMount()
+{
+	return new Mount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void destroyMount(IMount* mount)
+{
+	delete static_cast<Mount*>(mount);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IStorage* createFileStorage(const Char* filename, bool readonly)
+{
+	FileStorage* storage = new FileStorage;
+	if (!storage->open(filename, readonly))
+	{
+		delete storage;
+		return NULL;
+	}
+	return storage;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IStorage* createMapStorage(const Char* filename)
+{
+	MapStorage* storage = new MapStorage;
+	if (!storage->open(filename))
+	{
+		delete storage;
+		return NULL;
+	}
+	return storage;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IStorage* createMemoryStorage(const void* data, u64 size, bool readonly)
+{
+	return new MemoryStorage(data, size, readonly);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void destroyStorage(IStorage* storage)
+{
+	delete storage;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool createPatch(IPackage* oldPackage, IPackage* newPackage, const Char* patchFilename, u32 flag)
+{
+	return Patch::create(static_cast<Package*>(oldPackage), static_cast<Package*>(newPackage), patchFilename, flag);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool applyPatch(IPackage* package, const Char* patchFilename, Callback callback, void* callbackParam)
+{
+	Package* patch = static_cast<Package*>(open(patchFilename, OPEN_READONLY));
+	if (patch == NULL)
+	{
+		return false;
+	}
+	bool succeeded = Patch::apply(static_cast<Package*>(package), patch, callback, callbackParam);
+	close(patch);
+	return succeeded;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool readTrace(const Char* traceFilename, TraceCallback callback, void* callbackParam)
+{
+	return TraceRecorder::read(traceFilename, callback, callbackParam);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool exportChromeTrace(const Char* traceFilename, const Char* jsonFilename)
+{
+	return TraceRecorder::exportChromeTrace(traceFilename, jsonFilename);
+}
+
 }
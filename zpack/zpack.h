@@ -47,21 +47,115 @@ const u32 MAX_FILENAME_LEN = 1024;
 
 const u32 OPEN_READONLY = 1;
 const u32 OPEN_NO_FILENAME = 2;
+const u32 OPEN_WARM_UP = 4;		//call IPackage::warmUp() after package is opened
 
 const u32 PACK_UNICODE = 1;
 
 const u32 FILE_DELETE = (1<<0);
 const u32 FILE_COMPRESS = (1<<1);
-//const u32 FILE_WRITING = (1<<2);
+const u32 FILE_WRITING = (1<<2);	//flag() of IWriteFile from IPackage::createStreamFile(), never stored
+const u32 FILE_CHUNKED = (1<<3);	//split by content into chunks shared by all files, see IPackage::addFile()
+const u32 FILE_INTERNAL = (1<<4);	//managed by package (e.g. shared chunk), can not be modified or removed by user
+const u32 FILE_WHITEOUT = (1<<5);	//empty entry of patch package, the file is removed by the patch
+const u32 FILE_DELTA = (1<<6);		//entry of patch package, data is difference to old content of the file
+const u32 FILE_HASHED = (1<<7);		//content hash is computed by package, only such files share data
+									//0 for raw file copied by kernel until a file of the same size is added
+
+const u32 PATCH_DELTA = 1;
 
 const u32 FILE_FLAG_USER0 = (1<<10);
 const u32 FILE_FLAG_USER1 = (1<<11);
 
 typedef bool (*Callback)(const Char* path, zp::u32 fileSize, void* param);
 
+//event types of access trace, see IPackage::startTrace()
+const u32 TRACE_OPEN = 1;		//size is file size, offset is length of filename stored after the event
+const u32 TRACE_READ = 2;		//offset and size of data read by user
+const u32 TRACE_CACHE_HIT = 3;	//decompressed chunk is in memory, offset and size of chunk in file
+const u32 TRACE_CACHE_MISS = 4;	//chunk is read from package (and decompressed), offset and size of chunk in file
+const u32 TRACE_CLOSE = 5;		//offset is read position when closed
+const u32 TRACE_TIMING = 6;		//offset is operation (OP_XXX), size is duration, time is start of operation
+								//written when operation ends, so it's not sorted by time with other events
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct TraceEvent
+{
+	u64	time;		//microseconds since trace started
+	u64	nameHash;	//identify file, filename is stored in TRACE_OPEN event
+	u32	threadId;
+	u32	type;
+	u32	offset;
+	u32	size;
+};
+
+//filename is NULL if the file was not opened with filename in trace
+typedef bool (*TraceCallback)(const TraceEvent& event, const Char* filename, void* param);
+
 class IReadFile;
 class IWriteFile;
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//runtime counters of a package, see IPackage::getStatistics()
+struct PackageStatistics
+{
+	u64	lookupCount;		//file found by filename (hasFile, openFile, getFileInfo, ...)
+	u64	lookupMissCount;	//file not found
+	u64	openCount;
+	u64	rawReadSize;		//bytes read from package file by opened files, including compressedReadSize
+	u64	compressedReadSize;	//bytes read to be decompressed
+	u64	inflatedSize;		//bytes output by decompression
+	u64	inflateTime;		//microseconds spent in decompression
+	u64	seekCount;			//seeks of package file actually issued, 0 for package not in a file
+	u64	cacheHitCount;		//decompressed chunk already in memory
+	u64	flushWriteSize;		//bytes of tables and header written by flush()
+};
+
+//operations timed by IPackage::enableTiming()
+const u32 OP_OPEN_FILE = 0;
+const u32 OP_READ = 1;			//IReadFile::read()
+const u32 OP_INFLATE = 2;		//decompress one chunk (or whole file of one chunk)
+const u32 OP_FLUSH = 3;
+const u32 OP_DEFRAG = 4;		//defrag() and optimizeLayout()
+const u32 OP_COMPACT = 5;		//one compact() call
+const u32 OP_COUNT = 6;
+
+//log-linear buckets like HdrHistogram, values below HISTOGRAM_SUB_BUCKETS have their own bucket
+//larger values are grouped by power of 2, each split into HISTOGRAM_SUB_BUCKETS (about 6% precision)
+const u32 HISTOGRAM_SUB_BUCKET_BITS = 4;
+const u32 HISTOGRAM_SUB_BUCKETS = (1<<HISTOGRAM_SUB_BUCKET_BITS);
+const u32 HISTOGRAM_BUCKET_COUNT = HISTOGRAM_SUB_BUCKETS * (64 - HISTOGRAM_SUB_BUCKET_BITS + 1);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//latency of one operation in microseconds
+struct LatencyHistogram
+{
+	u64	count;
+	u64	totalTime;
+	u64	buckets[HISTOGRAM_BUCKET_COUNT];
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//one file for IPackage::addFiles()
+struct AddFileParam
+{
+	const Char*	filename;			//name in package
+	const Char*	externalFilename;	//file on disk
+	u32			fileSize;
+	u32			flag;
+	u32			chunkSize;			//0 means chunk size of package
+	u32			compressLevel;		//1 (fastest) to 9 (smallest), 0 means default level of zlib
+	u32			outPackSize;		//size in package, filled after file is added
+	u32			outFlag;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//one file for IPackage::extractFiles()
+struct ExtractFileParam
+{
+	const Char*	filename;			//name in package
+	const Char*	externalFilename;	//file on disk, directory must exist
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 class IPackage
 {
@@ -84,18 +178,61 @@ public:
 	virtual bool getFileInfo(const Char* filename, u32* fileSize = 0, u32* packSize = 0,
 							u32* flag = 0, u32* availableSize = 0, u64* contentHash = 0) const = 0;
 
+	//write files to disk, package is read sequentially in order of file position instead of array order
+	//decompressing and writing are done by several threads (see setThreadCount), memory used is bounded
+	//callback is called after each file is written (in order of position), return false to stop
+	//return count of files extracted, stop at first failure
+	virtual u32 extractFiles(const ExtractFileParam* files, u32 fileCount, Callback callback = 0,
+							void* callbackParam = 0) = 0;
+
 	///////////////////////////////////////////////////////////////////////////////////////////////
 	//package manipulation fuctions, not available in read only mode
 
 	//do not add same file more than once between flush() call
 	//outFileSize	origin file size
 	//outPackSize	size in package
+	//compressLevel	1 (fastest) to 9 (smallest), 0 means default level of zlib, ignored without FILE_COMPRESS
+	//if a file of the same size exists, content is hashed before it's written, and if that file has identical
+	//content (same hash, size and bytes), data is shared instead of written
+	//then outPackSize and outFlag (FILE_COMPRESS) come from that file
+	//otherwise content hash is computed while file is written, see FILE_HASHED
+	//with FILE_CHUNKED, content is cut into chunks by content and only chunks not in package yet are stored
+	//(compressed if FILE_COMPRESS is also set), similar versions of a big file cost little more than one
 	virtual bool addFile(const Char* filename, const Char* externalFilename, u32 fileSize, u32 flag,
-						u32* outPackSize = 0, u32* outFlag = 0, u32 chunkSize = 0) = 0;
-
+						u32* outPackSize = 0, u32* outFlag = 0, u32 chunkSize = 0, u32 compressLevel = 0) = 0;
+
+	//threads used to compress chunks in addFile() and decompress in extractFiles(), 1 by default
+	//0 means one thread per cpu core
+	//package content is the same no matter how many threads are used
+	virtual void setThreadCount(u32 count) = 0;
+
+	//add files in array order, reading and compressing are done by several threads (see setThreadCount)
+	//the same input always results in the same package
+	//callback is called after each file is written, return false to stop
+	//return count of files added, stop at first failure
+	virtual u32 addFiles(AddFileParam* files, u32 fileCount, Callback callback = 0, void* callbackParam = 0) = 0;
+
+	//bulk operations (defrag, optimizeLayout, addFile, addFiles, extractFiles) bypass system cache, off by default
+	//so they don't push data used by other programs out of it, but they may be slower
+	//data is copied through aligned blocks, the next one is read or written by another thread meanwhile
+	//without it, files are still marked as read sequentially, and old data is dropped from cache by defrag
+	virtual void enableDirectIO(bool enable) = 0;
+
+	//bytes added without trying to compress since package was opened
+	//because file format or sampled data shows they are already compressed
+	virtual u64 getSkippedCompressSize() const = 0;
+
+	//contentHash is only stored for user, file never shares data with others
 	virtual IWriteFile* createFile(const Char* filename, u32 fileSize, u32 packSize,
 									u32 chunkSize = 0, u32 flag = 0, u64 contentHash = 0) = 0;
+	//return NULL if data of file is shared by other files
+	//content hash of file is cleared, files added later won't share its data
 	virtual IWriteFile* openFileToWrite(const Char* filename) = 0;
+	//total size is not required, data is compressed chunk by chunk while writing
+	//compressed data is kept in memory, the file is added (or replaced) by closeFile()
+	//only sequential writing, FILE_CHUNKED is not supported
+	virtual IWriteFile* createStreamFile(const Char* filename, u32 flag = FILE_COMPRESS, u32 chunkSize = 0,
+										u32 compressLevel = 0) = 0;
 	virtual void closeFile(IWriteFile* file) = 0;
 
 	//can not remove files added after last flush() call
@@ -107,13 +244,64 @@ public:
 	//package file won't change before calling this function
 	virtual void flush() = 0;
 
+	//when enabled, flush() appends entries of changed files to a log after tables instead of rewriting all tables
+	//all tables are written again when log is full, too many files changed, or log is disabled, off by default
+	//packages with log can't be modified by versions without it
+	virtual void enableTableLog(bool enable) = 0;
+
+	//store tables as separately compressed pages of entries and filenames, table log is not used then
+	//flush() writes only pages changed (usually the last one, unless files are inserted into gaps) and page directory
+	//filenames of read only package are decompressed when used
+	//on by default for packages already paged, packages with paged tables can't be opened by versions without it
+	virtual void enablePagedTables(bool enable) = 0;
+
 	virtual bool defrag(Callback callback, void* callbackParam) = 0;	//can be very slow, don't call this all the time
 
+	//rewrite package like defrag(), files are placed in the order of first appearance in filenames
+	//filenames is usually a trace of files opened while loading, so they can be read sequentially
+	//chunks of chunked files are placed after them, files not in the list follow in original order
+	virtual bool optimizeLayout(const Char* const* filenames, u32 count, Callback callback = 0,
+								void* callbackParam = 0) = 0;
+
+	//move files toward the beginning of package file in place, no temp file like defrag()
+	//stop after moving maxMoveSize bytes (at least one file is moved), call again to continue
+	//package file is valid after every file moved, so it can be stopped or interrupted any time
+	//a few files may be moved to the end first, file is truncated when finished
+	//return false if package is read only or dirty
+	virtual bool compact(u64 maxMoveSize, bool* finished = 0) = 0;
+
 	virtual u32 getFileUserDataSize() const = 0;
 
 	virtual bool writeFileUserData(const Char* filename, const u8* data, u32 dataLen) = 0;
 	virtual bool readFileUserData(const Char* filename, u8* data, u32 dataLen) = 0;
 
+	//store an ordered list of files needed at startup in package (internal file), replacing the old one
+	//filenames is usually a trace of files opened while loading, files not in package are ignored
+	//empty list removes it, takes effect after flush()
+	virtual bool setWarmSet(const Char* const* filenames, u32 count) = 0;
+
+	//prefetch files of warm set in list order, return count of files prefetched
+	//compressed files are decompressed by a background thread and taken by openFile() without reading package
+	//(up to 256MB, a file opened before its turn reads package itself), others are read ahead by system cache
+	//decompressed data not opened yet is released by releaseWarmUp() or any change of package
+	virtual u32 warmUp() = 0;
+	virtual void releaseWarmUp() = 0;
+
+	//record open, read, cache hit/miss and close of files to a binary trace file, read it with readTrace()
+	//old trace is stopped first, don't call these when a file is being read by other threads
+	virtual bool startTrace(const Char* traceFilename) = 0;
+	virtual void stopTrace() = 0;
+
+	//counters are updated atomically, they can be read by any thread
+	//resetStatistics() also clears latency histograms
+	virtual void getStatistics(PackageStatistics& statistics) const = 0;
+	virtual void resetStatistics() = 0;
+
+	//measure time of operations (OP_XXX) into latency histograms, off by default
+	//when trace is recording too, each timed operation is written as a TRACE_TIMING event
+	virtual void enableTiming(bool enable) = 0;
+	virtual bool getLatencyHistogram(u32 operation, LatencyHistogram& histogram) const = 0;
+
 protected:
 	virtual ~IPackage(){}
 };
@@ -156,11 +344,119 @@ protected:
 	virtual ~IWriteFile(){}
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//several packages stacked as layers (e.g. base, dlc, patches, mods), a file is read from the top layer having it
+//names of all layers are merged into one hash index when a package is mounted
+//all methods may be called from several threads, mount() and refresh() wait for opens in progress
+class IMount
+{
+public:
+	//package of higher priority hides files of the same name in lower ones, the later mounted wins if equal
+	//a FILE_WHITEOUT entry hides the file in lower packages (see createPatch())
+	//package is not owned by mount, call refresh() after a mounted package is modified
+	virtual bool mount(IPackage* package, int priority) = 0;
+
+	//fail if any file of the package is still open
+	virtual bool unmount(IPackage* package) = 0;
+
+	virtual void refresh() = 0;
+
+	//sorted by priority, the highest first
+	virtual u32 getPackageCount() const = 0;
+	virtual IPackage* getPackage(u32 index) const = 0;
+
+	virtual bool hasFile(const Char* filename) const = 0;
+
+	//package the visible file comes from, NULL if not found or removed by whiteout
+	virtual IPackage* findPackage(const Char* filename) const = 0;
+
+	virtual IReadFile* openFile(const Char* filename) = 0;
+	virtual void closeFile(IReadFile* file) = 0;
+
+protected:
+	virtual ~IMount(){}
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//where package data is kept, offsets are from beginning of package
+//implement it to open package from other places, or use createFileStorage() etc.
+class IStorage
+{
+public:
+	//write() and setSize() always fail
+	virtual bool readonly() const = 0;
+
+	virtual u64 size() const = 0;
+
+	//return bytes read, less than size only at end of storage
+	virtual u32 read(u64 offset, void* buffer, u32 size) = 0;
+
+	//storage grows if written beyond end, return bytes written
+	virtual u32 write(u64 offset, const void* buffer, u32 size) = 0;
+
+	//cut or extend
+	virtual bool setSize(u64 size) = 0;
+
+	//pass written data to underlying medium (e.g. flush stdio buffer of file)
+	virtual bool sync() = 0;
+
+	//whole content if it's addressable memory, package then reads (and decompresses) data in place
+	//NULL if not supported, pointer is invalid after write() or setSize()
+	virtual const u8* map() = 0;
+
+	//public since user storages are deleted by user
+	virtual ~IStorage(){}
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 IPackage* create(const Char* filename, u32 chunkSize = 0x40000, u32 fileUserDataSize = 0);
 IPackage* open(const Char* filename, u32 flag = OPEN_READONLY | OPEN_NO_FILENAME);
 void close(IPackage* package);
 
+//package in storage, storage is not owned by package and must be destroyed after package is closed
+//packageFilename() is empty unless storage is from createFileStorage()
+//same as open by filename, package can be modified only if storage is writable and OPEN_NO_FILENAME is not given
+IPackage* create(IStorage* storage, u32 chunkSize = 0x40000, u32 fileUserDataSize = 0);
+IPackage* open(IStorage* storage, u32 flag = OPEN_READONLY | OPEN_NO_FILENAME);
+
+//built-in storages, NULL if file can't be opened
+IStorage* createFileStorage(const Char* filename, bool readonly);
+//whole file is mapped into memory, always readonly
+IStorage* createMapStorage(const Char* filename);
+//readonly storage uses data in place (e.g. package embedded in executable), which must be valid until it's destroyed
+//writable storage copies data into a buffer of its own, growing with package, data can be NULL for empty storage
+IStorage* createMemoryStorage(const void* data, u64 size, bool readonly);
+//only for storages created above
+void destroyStorage(IStorage* storage);
+
+IMount* createMount();
+void destroyMount(IMount* mount);
+
+//write files added or changed in newPackage since oldPackage to a new package, which is a normal package
+//files only in oldPackage are written as FILE_WHITEOUT entries
+//with PATCH_DELTA, changed files are stored as FILE_DELTA when the difference is smaller than the file
+//both packages must be opened with filenames
+bool createPatch(IPackage* oldPackage, IPackage* newPackage, const Char* patchFilename, u32 flag = PATCH_DELTA);
+
+//update package in place to the new version, package must be the old version patch was created from
+//callback is called after each file is updated or removed, return false to stop
+//return false if patch can't be read or a delta doesn't match old content, package is flushed anyway
+bool applyPatch(IPackage* package, const Char* patchFilename, Callback callback = 0, void* callbackParam = 0);
+
+//call callback for each event of a trace file written by IPackage::startTrace(), return false to stop
+//return false if file can't be read or is not a trace file
+bool readTrace(const Char* traceFilename, TraceCallback callback, void* callbackParam);
+
+//convert a trace file to Chrome trace event json, which can be viewed in chrome://tracing or Perfetto
+//TRACE_TIMING events are shown as durations, others as instant events
+bool exportChromeTrace(const Char* traceFilename, const Char* jsonFilename);
+
+//bucket of a value in LatencyHistogram, and the largest value of a bucket
+u32 getHistogramBucket(u64 value);
+u64 getHistogramBucketValue(u32 bucket);
+//value not exceeded by percentile (0 - 100) of samples, rounded up to bucket
+u64 getHistogramPercentile(const LatencyHistogram& histogram, double percentile);
+
 }
 
 #endif